@@ -0,0 +1,131 @@
+#!/usr/bin/env python
+"""Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+"""
+
+
+"""
+Inspect or prune a cache of libraries built from CellML models (and compiled protocols), as used by FunctionalCuration --model-cache.
+
+Usage: ModelCache.py cache_folder list
+       ModelCache.py cache_folder prune [--max-size MB] [--unused-days N]
+       ModelCache.py cache_folder clear
+
+Listing shows each entry with its size, when it was last used, and the model and protocol it was built from.
+Pruning evicts least recently used entries until the cache is no bigger than the given size, and any entries
+not used for the given number of days.  It also tidies up after processes that died while changing the cache.
+Clearing evicts all entries.  It is safe to do any of these while simulations are using the cache.
+"""
+
+import argparse
+import os
+import shutil
+import sys
+import time
+import uuid
+
+# Must match ModelCache::INFO_FILE_NAME
+INFO_FILE_NAME = 'info.txt'
+
+# Temporary folders older than this (in seconds) were left by processes that died
+STALE_AGE = 24 * 60 * 60
+
+def GetEntries(cacheFolder):
+    """Return a list of (last_used, size, path, info) tuples for the complete entries in the cache, oldest first."""
+    entries = []
+    for name in os.listdir(cacheFolder):
+        path = os.path.join(cacheFolder, name)
+        info_path = os.path.join(path, INFO_FILE_NAME)
+        if '.' in name or not os.path.isfile(info_path):
+            continue
+        size = 0
+        for dirpath, dirnames, filenames in os.walk(path):
+            size += sum(os.path.getsize(os.path.join(dirpath, filename)) for filename in filenames)
+        info = {}
+        for line in open(info_path):
+            key, _, value = line.partition(':')
+            info[key.strip()] = value.strip()
+        entries.append((os.path.getmtime(info_path), size, path, info))
+    entries.sort()
+    return entries
+
+def Evict(path):
+    """Evict a cache entry, renaming it out of the way first so no process sees a partial entry."""
+    doomed = path + '.' + uuid.uuid4().hex[:8] + '.deleting'
+    try:
+        os.rename(path, doomed)
+    except OSError:
+        return False # Another process has evicted it
+    shutil.rmtree(doomed, ignore_errors=True)
+    return True
+
+def List(cacheFolder):
+    entries = GetEntries(cacheFolder)
+    for last_used, size, path, info in reversed(entries):
+        print os.path.basename(path), '%8.1f MB' % (size / 1048576.0), time.strftime('%Y-%m-%d %H:%M', time.localtime(last_used)), \
+            info.get('model', '(compiled protocol)'), info.get('protocol', '?')
+    print len(entries), 'entries using', '%.1f MB' % (sum(entry[1] for entry in entries) / 1048576.0)
+
+def Prune(cacheFolder, maxSize=None, unusedDays=None):
+    num_evicted = 0
+    now = time.time()
+    entries = GetEntries(cacheFolder)
+    total_size = sum(entry[1] for entry in entries)
+    for last_used, size, path, info in entries:
+        too_big = maxSize is not None and total_size > maxSize
+        too_old = unusedDays is not None and now - last_used > unusedDays * 24 * 60 * 60
+        if too_big or too_old:
+            num_evicted += Evict(path)
+            total_size -= size
+    for name in os.listdir(cacheFolder):
+        path = os.path.join(cacheFolder, name)
+        if name.endswith('.tmp') or name.endswith('.deleting'):
+            if now - os.path.getmtime(path) > STALE_AGE:
+                shutil.rmtree(path, ignore_errors=True)
+    print 'Evicted', num_evicted, 'entries;', '%.1f MB' % (total_size / 1048576.0), 'remain'
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Inspect or prune a cache of libraries built from CellML models.')
+    parser.add_argument('cache_folder', help='the cache folder, as given to FunctionalCuration --model-cache')
+    parser.add_argument('action', choices=['list', 'prune', 'clear'], help='what to do')
+    parser.add_argument('--max-size', type=float, help='when pruning, evict entries until the cache is no bigger than this many MB')
+    parser.add_argument('--unused-days', type=float, help='when pruning, evict entries not used for this many days')
+    args = parser.parse_args()
+    if not os.path.isdir(args.cache_folder):
+        print >> sys.stderr, 'No model cache found at', args.cache_folder
+        sys.exit(1)
+    if args.action == 'list':
+        List(args.cache_folder)
+    elif args.action == 'prune':
+        max_size = None if args.max_size is None else args.max_size * 1048576
+        Prune(args.cache_folder, max_size, args.unused_days)
+    else:
+        Prune(args.cache_folder, maxSize=0)
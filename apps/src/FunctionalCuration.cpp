@@ -60,8 +60,8 @@ int main(int argc, char *argv[])
     {
         if (argc < 3)
         {
-            ExecutableSupport::PrintError("Usage: FunctionalCuration [--png] model.cellml proto.xml|proto.txt [output_dir]\n"
-                                          "OR: FunctionalCuration [--png] [--output-dir output_dir] --protocols ... --models ...",
+            ExecutableSupport::PrintError("Usage: FunctionalCuration [--png] [--memoise] [--threads n] [--ensemble n] [--optimise] [--check-shapes] [--lazy] [--prune-outputs] [--compile] [--native-loops] [--trust-libraries] [--analytic-jacobian] [--linear-solver dense|krylov] [--warm-restarts] [--solver cvode|rush-larsen|grl1] [--model-cache dir [--model-cache-size MB]] model.cellml proto.xml|proto.txt [output_dir]\n"
+                                          "OR: FunctionalCuration [--png] [--memoise] [--threads n] [--ensemble n] [--optimise] [--check-shapes] [--lazy] [--prune-outputs] [--compile] [--native-loops] [--trust-libraries] [--analytic-jacobian] [--linear-solver dense|krylov] [--warm-restarts] [--solver cvode|rush-larsen|grl1] [--model-cache dir [--model-cache-size MB]] [--output-dir output_dir] --protocols ... --models ...",
                                           true);
             exit_code = ExecutableSupport::EXIT_BAD_ARGUMENTS;
         }
@@ -42,6 +42,12 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <dirent.h>
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <sstream>
 #include <boost/foreach.hpp>
 
 #ifdef CHASTE_CVODE
@@ -329,7 +335,8 @@ public:
     /**
      * This method compares experiment results against historical data, to ensure that code changes aren't
      * introducing errors.  It will trigger a test failure if results do not match, as well as returning false
-     * and recording the model/protocol combination.
+     * and recording the model/protocol combination.  If SetReportAccuracyOnly has been called, how closely
+     * each output matches is recorded instead.
      *
      * @param rHandler  a handler for the results just produced
      * @param rModelName  the name of the model, and hence the CellML file
@@ -370,6 +377,14 @@ public:
                 std::cout << std::endl;
                 all_match = all_match && !ref_output.Exists();
             }
+            else if (mReportAccuracyOnly)
+            {
+                double max_difference = GetMaxRelativeDifference(test_output, ref_output, absTol);
+                std::cout << "maximum relative difference " << max_difference << "." << std::endl;
+                std::stringstream accuracy;
+                accuracy << rModelName << " / " << rProtocolName << " / " << output_name << ": " << max_difference;
+                mAccuracies.push_back(accuracy.str());
+            }
             else
             {
                 NumericFileComparison comp(test_output.GetAbsolutePath(), ref_output.GetAbsolutePath());
@@ -439,17 +454,114 @@ public:
             }
             PetscTools::EndRoundRobin();
         }
+
+        unsigned num_accuracies = mAccuracies.size();
+        unsigned total_accuracies = 0u;
+        MPI_Allreduce(&num_accuracies, &total_accuracies, 1, MPI_UNSIGNED, MPI_SUM, PetscTools::GetWorld());
+        if (total_accuracies > 0u)
+        {
+            if (PetscTools::AmMaster())
+            {
+                std::cout << "Maximum relative differences from historical data:" << std::endl;
+            }
+            PetscTools::BeginRoundRobin();
+            BOOST_FOREACH(const std::string& r_accuracy, mAccuracies)
+            {
+                std::cout << "    accuracy: " << r_accuracy << std::endl;
+            }
+            PetscTools::EndRoundRobin();
+        }
         PetscTools::Barrier(); // Prevent printing cxxtest pass/fail lines until above completed for all processes
     }
 
+    /**
+     * Report how closely results match historical data, rather than requiring them to match to within
+     * tolerances.  This is useful when solving models with a different method from that used to produce
+     * the historical data, e.g. a fixed step Rush-Larsen scheme.
+     */
+    void SetReportAccuracyOnly()
+    {
+        mReportAccuracyOnly = true;
+    }
+
     /**
      * This simple constructor just initialises our data structures to reflect no results tested yet.
      */
     HistoricalResultTester()
-        : mNumCombinations(0u)
+        : mNumCombinations(0u),
+          mReportAccuracyOnly(false)
     {}
 
 private:
+    /**
+     * Compute the largest relative difference between corresponding numbers in two CSV files.
+     *
+     * @param rTestOutput  the results just produced
+     * @param rRefOutput  the historical data
+     * @param absTol  values smaller than this are compared in absolute rather than relative terms
+     * @return  the largest difference, or infinity if the files contain different numbers of values
+     */
+    double GetMaxRelativeDifference(const FileFinder& rTestOutput, const FileFinder& rRefOutput, double absTol)
+    {
+        std::vector<double> test_values = ReadCsvValues(rTestOutput);
+        std::vector<double> ref_values = ReadCsvValues(rRefOutput);
+        if (test_values.size() != ref_values.size())
+        {
+            return std::numeric_limits<double>::infinity();
+        }
+        double max_difference = 0.0;
+        for (unsigned i=0; i<test_values.size(); ++i)
+        {
+            const double test = test_values[i];
+            const double ref = ref_values[i];
+            if (std::isnan(test) || std::isnan(ref))
+            {
+                if (std::isnan(test) != std::isnan(ref))
+                {
+                    return std::numeric_limits<double>::infinity();
+                }
+            }
+            else if (test != ref)
+            {
+                max_difference = std::max(max_difference, fabs(test - ref) / std::max(fabs(ref), absTol));
+            }
+        }
+        return max_difference;
+    }
+
+    /**
+     * Read all the numbers in a CSV file, ignoring comment lines.
+     *
+     * @param rFile  the file
+     */
+    std::vector<double> ReadCsvValues(const FileFinder& rFile)
+    {
+        std::vector<double> values;
+        std::ifstream file(rFile.GetAbsolutePath().c_str());
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (line.empty() || line[0] == '#')
+            {
+                continue;
+            }
+            std::replace(line.begin(), line.end(), ',', ' ');
+            std::istringstream line_stream(line);
+            std::string token;
+            while (line_stream >> token)
+            {
+                values.push_back(strtod(token.c_str(), NULL));
+            }
+        }
+        return values;
+    }
+
+    /** Whether to report how closely results match historical data, rather than testing that they match. */
+    bool mReportAccuracyOnly;
+
+    /** How closely each output compared matched historical data, if #mReportAccuracyOnly is set. */
+    std::vector<std::string> mAccuracies;
+
     /** A count of how many experiments (model/protocol combinations) have been run. */
     unsigned mNumCombinations;
 
@@ -35,6 +35,9 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "AbstractSystemWithOutputs.hpp"
 
+#include <cassert>
+#include <limits>
+
 #include "Exception.hpp"
 
 unsigned AbstractSystemWithOutputs::GetNumberOfOutputs() const
@@ -61,6 +64,66 @@ const std::vector<std::string>& AbstractSystemWithOutputs::rGetInputNames() cons
 }
 
 
+bool AbstractSystemWithOutputs::GetOutputValues(std::vector<double>& rValues)
+{
+    return false;
+}
+
+
+bool AbstractSystemWithOutputs::GetStateValues(std::vector<double>& rValues)
+{
+    return false;
+}
+
+
+bool AbstractSystemWithOutputs::SetStateValues(const std::vector<double>& rValues)
+{
+    return false;
+}
+
+
+boost::shared_ptr<AbstractSystemWithOutputs> AbstractSystemWithOutputs::Clone()
+{
+    EXCEPTION("This model does not support cloning.");
+}
+
+
+void AbstractSystemWithOutputs::SetRequiredOutputs(const std::set<std::string>& rNames)
+{
+    mRequiredOutputs.assign(mOutputNames.size(), false);
+    for (unsigned i=0; i<mOutputNames.size(); ++i)
+    {
+        mRequiredOutputs[i] = (rNames.find(mOutputNames[i]) != rNames.end());
+    }
+}
+
+
+void AbstractSystemWithOutputs::SetRequiredOutputs(const std::vector<bool>& rRequired)
+{
+    assert(rRequired.empty() || rRequired.size() == mOutputNames.size());
+    mRequiredOutputs = rRequired;
+}
+
+
+void AbstractSystemWithOutputs::SetAllOutputsRequired()
+{
+    mRequiredOutputs.clear();
+}
+
+
+const std::vector<bool>& AbstractSystemWithOutputs::rGetRequiredOutputs() const
+{
+    return mRequiredOutputs;
+}
+
+
+bool AbstractSystemWithOutputs::IsOutputRequired(unsigned i) const
+{
+    assert(i < mOutputNames.size());
+    return mRequiredOutputs.empty() || mRequiredOutputs[i];
+}
+
+
 void AbstractSystemWithOutputs::SetFreeVariable(double freeVariable)
 {
     mFreeVariable = freeVariable;
@@ -73,6 +136,85 @@ double AbstractSystemWithOutputs::GetFreeVariable() const
 }
 
 
+bool AbstractSystemWithOutputs::CanStopAtStimulusChanges()
+{
+    return false;
+}
+
+
+void AbstractSystemWithOutputs::SetStopAtStimulusChanges(bool stop)
+{
+}
+
+
+AbstractSystemWithOutputs::SolverSettings::SolverSettings()
+    : relTol(DOUBLE_UNSET),
+      absTol(DOUBLE_UNSET),
+      maxStep(DOUBLE_UNSET),
+      maxSteps(DOUBLE_UNSET),
+      analyticJacobian(DOUBLE_UNSET),
+      krylovLinearSolver(DOUBLE_UNSET)
+{
+}
+
+
+bool AbstractSystemWithOutputs::SolverSettings::IsAnySet() const
+{
+    return relTol != DOUBLE_UNSET || absTol != DOUBLE_UNSET || maxStep != DOUBLE_UNSET || maxSteps != DOUBLE_UNSET
+           || analyticJacobian != DOUBLE_UNSET || krylovLinearSolver != DOUBLE_UNSET;
+}
+
+
+AbstractSystemWithOutputs::SolverSettings AbstractSystemWithOutputs::GetSolverSettings()
+{
+    return SolverSettings();
+}
+
+
+void AbstractSystemWithOutputs::SetSolverSettings(const SolverSettings& rSettings)
+{
+    if (rSettings.IsAnySet())
+    {
+        EXCEPTION("This model does not support changing its solver settings.");
+    }
+}
+
+
+void AbstractSystemWithOutputs::SetWarmRestarts(bool warmRestarts)
+{
+}
+
+
+double AbstractSystemWithOutputs::GetSolverStepSize()
+{
+    return 0.0;
+}
+
+
+void AbstractSystemWithOutputs::SetInitialSolverStepSize(double stepSize)
+{
+}
+
+
+void AbstractSystemWithOutputs::SetEvents(const std::vector<EventInfo>& rEvents)
+{
+    mEvents = rEvents;
+    mEventTimes.assign(mEvents.size(), std::numeric_limits<double>::quiet_NaN());
+}
+
+
+const std::vector<AbstractSystemWithOutputs::EventInfo>& AbstractSystemWithOutputs::rGetEvents() const
+{
+    return mEvents;
+}
+
+
+const std::vector<double>& AbstractSystemWithOutputs::rGetEventTimes() const
+{
+    return mEventTimes;
+}
+
+
 const std::map<std::string, EnvironmentPtr>& AbstractSystemWithOutputs::rGetEnvironmentMap() const
 {
     return mEnvironmentMap;
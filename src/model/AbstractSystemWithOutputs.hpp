@@ -38,6 +38,7 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <vector>
 #include <string>
 #include <map>
+#include <set>
 
 #include "Environment.hpp"
 #include "OutputFileHandler.hpp"
@@ -74,6 +75,81 @@ public:
      */
     virtual EnvironmentCPtr GetOutputs() =0;
 
+    /**
+     * Get the current values of this system's outputs without wrapping them in an Environment, for
+     * simulations that record outputs directly into their results arrays.  The values of each required
+     * output, in the order given by rGetOutputNames, are concatenated into a single vector.
+     *
+     * The default implementation returns false, indicating that this is not supported and GetOutputs
+     * must be used instead.
+     *
+     * @param rValues  filled in with the output values
+     * @return  whether the values were filled in
+     */
+    virtual bool GetOutputValues(std::vector<double>& rValues);
+
+    /**
+     * Get the current values of this system's state variables, for simulations that manipulate the
+     * state directly.  The default implementation returns false, indicating that this is not supported.
+     *
+     * @param rValues  filled in with the state variable values
+     * @return  whether the values were filled in
+     */
+    virtual bool GetStateValues(std::vector<double>& rValues);
+
+    /**
+     * Set the values of this system's state variables, as obtained from GetStateValues.
+     * The default implementation returns false, indicating that this is not supported.
+     *
+     * @param rValues  the new state variable values
+     * @return  whether the values were set
+     */
+    virtual bool SetStateValues(const std::vector<double>& rValues);
+
+    /**
+     * Create an independent copy of this system, e.g. so that different parts of a simulation can be
+     * solved concurrently.  The copy has the same state, parameters, free variable, solver settings and
+     * required outputs, its own ODE solver and stimulus function, and its own wrapper environments for the
+     * same namespace bindings.  Events, saved states, the solver's internal history and the output folder
+     * are not copied.  Not all models support this; the default implementation throws.
+     *
+     * @return  the copy
+     */
+    virtual boost::shared_ptr<AbstractSystemWithOutputs> Clone();
+
+    /**
+     * Restrict the outputs provided by GetOutputs and GetOutputValues to those with the given names,
+     * so that values nothing will use are neither computed by the model nor recorded by simulations.
+     * Names that are not outputs of this system are ignored.
+     *
+     * @param rNames  the names of the outputs required
+     */
+    void SetRequiredOutputs(const std::set<std::string>& rNames);
+
+    /**
+     * Restore a restriction on the outputs provided, as previously given by rGetRequiredOutputs.
+     *
+     * @param rRequired  whether each output is required, or empty if all are
+     */
+    void SetRequiredOutputs(const std::vector<bool>& rRequired);
+
+    /**
+     * Provide all outputs from GetOutputs and GetOutputValues, as is the default.
+     */
+    void SetAllOutputsRequired();
+
+    /**
+     * @return  whether each output, in the order given by rGetOutputNames, is currently provided,
+     * or an empty vector if there is no restriction.
+     */
+    const std::vector<bool>& rGetRequiredOutputs() const;
+
+    /**
+     * @return  whether an output is currently provided.
+     * @param i  the index of the output within rGetOutputNames
+     */
+    bool IsOutputRequired(unsigned i) const;
+
     /**
      * @return  the names of this system's inputs.
      */
@@ -98,6 +174,129 @@ public:
      */
     virtual void SolveModel(double endPoint) =0;
 
+    /**
+     * @return  whether SolveModel stops the solver exactly wherever the model's stimulus current
+     * switches on or off, so that there is no need to cap the solver's step size to avoid stepping
+     * over a stimulus.  The default implementation returns false.
+     */
+    virtual bool CanStopAtStimulusChanges();
+
+    /**
+     * Set whether SolveModel may stop the solver at stimulus changes (see CanStopAtStimulusChanges).
+     * This is on by default; turning it off leaves the caller to make sure the solver's maximum step
+     * can't skip a stimulus.  The default implementation ignores this.
+     *
+     * @param stop  whether to stop at stimulus changes where possible
+     */
+    virtual void SetStopAtStimulusChanges(bool stop);
+
+    /** Settings for the ODE solver used by SolveModel; any left as DOUBLE_UNSET are not changed. */
+    struct SolverSettings
+    {
+        /** Default constructor leaves all settings unset. */
+        SolverSettings();
+
+        /** @return whether any setting has been given a value. */
+        bool IsAnySet() const;
+
+        /** The relative tolerance. */
+        double relTol;
+
+        /** The absolute tolerance. */
+        double absTol;
+
+        /** The largest step the solver may take. */
+        double maxStep;
+
+        /** The largest number of internal steps the solver may take to reach each end point. */
+        double maxSteps;
+
+        /** Whether to use the model's analytic Jacobian, if it has one (1), or approximate it numerically (0). */
+        double analyticJacobian;
+
+        /**
+         * Whether to solve the linear systems arising in the solver's Newton iterations with a matrix-free
+         * Krylov method (1), which suits models with sparse Jacobians, or a dense direct method (0).
+         */
+        double krylovLinearSolver;
+    };
+
+    /**
+     * @return  the current settings of the solver used by SolveModel.  Those the model can't report
+     * are left unset; the default implementation leaves them all unset.
+     */
+    virtual SolverSettings GetSolverSettings();
+
+    /**
+     * Change the settings of the solver used by SolveModel, e.g. to use looser tolerances while
+     * pacing to steady state.  Not all models support this; those that don't will throw if any
+     * setting is given.
+     *
+     * @param rSettings  the settings to change
+     */
+    virtual void SetSolverSettings(const SolverSettings& rSettings);
+
+    /**
+     * Set whether the solver's step size should be saved along with model states (see
+     * ModelStateCollection), so that solving from a restored state can resume at the step size the
+     * solver had reached, rather than working up from a cautious initial step each time.  This helps
+     * protocols that repeatedly reset to a steady state.  Not all models support this; those that
+     * don't ignore it, as does the default implementation.
+     *
+     * @param warmRestarts  whether to enable warm restarts
+     */
+    virtual void SetWarmRestarts(bool warmRestarts);
+
+    /**
+     * @return  the step size the solver will next attempt, if warm restarts are enabled and the
+     * model knows it; otherwise 0.  The default implementation returns 0.
+     */
+    virtual double GetSolverStepSize();
+
+    /**
+     * Have the next call to SolveModel start the solver with the given step size, e.g. as
+     * previously returned by GetSolverStepSize for a saved state that has just been restored.
+     * Ignored unless warm restarts are enabled, and by the default implementation.
+     *
+     * @param stepSize  the initial step size, or 0 to let the solver estimate one
+     */
+    virtual void SetInitialSolverStepSize(double stepSize);
+
+    /** Describes an event whose occurrences are located while solving the system (see SetEvents). */
+    struct EventInfo
+    {
+        /** The name of the model variable monitored, as used within the model's wrapper environments. */
+        std::string variable;
+
+        /** Whether to monitor the time derivative of the variable, which must then be a state variable. */
+        bool rateOfChange;
+
+        /** The level whose crossing constitutes the event. */
+        double threshold;
+
+        /** Which crossings count: 1 for rising only, -1 for falling only, or 0 for either. */
+        int direction;
+    };
+
+    /**
+     * Set the events to locate when solving the system.  An event occurs when the monitored quantity
+     * crosses its threshold, and the solver finds the time of each crossing as it integrates, so it
+     * does not need to be recovered afterwards from densely sampled outputs.  Not all models support
+     * this; those that don't will throw from SolveModel.
+     *
+     * @param rEvents  the events to locate; an empty vector stops locating events
+     */
+    virtual void SetEvents(const std::vector<EventInfo>& rEvents);
+
+    /** @return the events currently being located. */
+    const std::vector<EventInfo>& rGetEvents() const;
+
+    /**
+     * @return for each event, the time at which it first occurred during the last call to SolveModel,
+     * or NaN if it did not occur then.
+     */
+    const std::vector<double>& rGetEventTimes() const;
+
 
     /**
      * @return whether the model doesn't maintain internal state between successive calls to SolveModel,
@@ -158,12 +357,21 @@ protected:
     /** Units of system outputs. */
     std::vector<std::string> mOutputUnits;
 
+    /** Which outputs are currently provided, in the order of #mOutputNames; empty means all are. */
+    std::vector<bool> mRequiredOutputs;
+
     /** Names of system inputs. */
     std::vector<std::string> mInputNames;
 
     /** Stores the current value of the free variable; used for solving the system. */
     double mFreeVariable;
 
+    /** The events to locate when solving the system. */
+    std::vector<EventInfo> mEvents;
+
+    /** When each event first occurred during the last call to SolveModel, or NaN if it didn't. */
+    std::vector<double> mEventTimes;
+
     /** Environments wrapping model variables, with their prefixes. */
     std::map<std::string, EnvironmentPtr> mEnvironmentMap;
 
@@ -36,6 +36,10 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "AbstractTemplatedSystemWithOutputs.hpp"
 
 #include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <typeinfo>
 #include <boost/foreach.hpp>
 
 #include "ModelWrapperEnvironment.hpp"
@@ -45,6 +49,16 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "AbstractParameterisedSystem.hpp"
 #include "AbstractCardiacCellInterface.hpp"
+#include "AbstractCardiacCell.hpp"
+#include "AbstractDynamicallyLoadableEntity.hpp"
+#include "DynamicCellModelLoader.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "HeunIvpOdeSolver.hpp"
+#include "RungeKutta2IvpOdeSolver.hpp"
+#include "RungeKutta4IvpOdeSolver.hpp"
+#include "RegularStimulus.hpp"
+#include "SimpleStimulus.hpp"
+#include "ZeroStimulus.hpp"
 #include "VectorHelperFunctions.hpp"
 #include "Warnings.hpp"
 #include "Exception.hpp"
@@ -52,21 +66,386 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifdef CHASTE_CVODE
 // CVODE headers
 #include <nvector/nvector_serial.h>
+#include "AbstractCvodeCell.hpp"
+#include "CvodeEventLocator.hpp"
 #endif
 
 
+/** The names of the model variables giving the timing of a regular stimulus, in the order we store them. */
+static const char* STIMULUS_TIMING_NAMES[] = {"membrane_stimulus_current_offset",
+                                              "membrane_stimulus_current_period",
+                                              "membrane_stimulus_current_duration",
+                                              "membrane_stimulus_current_end"};
+
+
+template<typename VECTOR>
+AbstractTemplatedSystemWithOutputs<VECTOR>::AbstractTemplatedSystemWithOutputs()
+    : mWarmRestarts(false),
+      mKrylovLinearSolver(false),
+      mInitialSolverStepSize(0.0),
+      mStopAtStimulusChanges(true),
+      mStimulusResolved(false)
+{
+}
+
+
 template<typename VECTOR>
 void AbstractTemplatedSystemWithOutputs<VECTOR>::SolveModel(double endPoint)
 {
     AbstractCardiacCellInterface* p_model = dynamic_cast<AbstractCardiacCellInterface*>(this);
+    if (!this->mEvents.empty())
+    {
+        this->mEventTimes.assign(this->mEvents.size(), std::numeric_limits<double>::quiet_NaN());
+    }
+    // Events can only occur as the state evolves
     if (p_model->GetNumberOfStateVariables() > 0u)
     {
-        p_model->SolveAndUpdateState(this->mFreeVariable, endPoint);
+        // Stop exactly wherever the stimulus switches on or off, and restart the solver there,
+        // so it never has to step across a discontinuity
+        std::vector<double> stop_points;
+        GetStimulusSwitchTimes(this->mFreeVariable, endPoint, stop_points);
+        stop_points.push_back(endPoint);
+#ifdef CHASTE_CVODE
+        AbstractCvodeSystem* p_cvode_system = dynamic_cast<AbstractCvodeSystem*>(this);
+#endif
+        for (unsigned i=0; i<stop_points.size(); ++i)
+        {
+#ifdef CHASTE_CVODE
+            if (i > 0u && p_cvode_system)
+            {
+                p_cvode_system->ResetSolver();
+                if (mpEventLocator)
+                {
+                    mpEventLocator->Reset();
+                }
+            }
+#endif
+            if (this->mEvents.empty() && !mWarmRestarts && !mKrylovLinearSolver)
+            {
+                p_model->SolveAndUpdateState(this->mFreeVariable, stop_points[i]);
+            }
+            else
+            {
+                SolveLocatingEvents(stop_points[i]);
+            }
+            this->mFreeVariable = stop_points[i];
+        }
     }
     this->mFreeVariable = endPoint;
 }
 
 
+template<typename VECTOR>
+bool AbstractTemplatedSystemWithOutputs<VECTOR>::CanStopAtStimulusChanges()
+{
+    if (!mStimulusResolved)
+    {
+        // The offset, period and duration are needed; the end is optional
+        AbstractParameterisedSystem<VECTOR>* p_system = dynamic_cast<AbstractParameterisedSystem<VECTOR>*>(this);
+        assert(p_system);
+        for (unsigned i=0; i<4u && p_system->HasAnyVariable(STIMULUS_TIMING_NAMES[i]); ++i)
+        {
+            mStimulusIndices.push_back(p_system->GetAnyVariableIndex(STIMULUS_TIMING_NAMES[i]));
+        }
+        if (mStimulusIndices.size() < 3u)
+        {
+            mStimulusIndices.clear();
+        }
+        mStimulusResolved = true;
+    }
+    return mStopAtStimulusChanges && !mStimulusIndices.empty();
+}
+
+
+template<typename VECTOR>
+void AbstractTemplatedSystemWithOutputs<VECTOR>::SetStopAtStimulusChanges(bool stop)
+{
+    mStopAtStimulusChanges = stop;
+}
+
+
+template<typename VECTOR>
+void AbstractTemplatedSystemWithOutputs<VECTOR>::GetStimulusSwitchTimes(double startPoint,
+                                                                        double endPoint,
+                                                                        std::vector<double>& rTimes)
+{
+    if (!CanStopAtStimulusChanges())
+    {
+        return;
+    }
+    // The protocol may change the stimulus between solves, so always use the current values
+    AbstractParameterisedSystem<VECTOR>* p_system = dynamic_cast<AbstractParameterisedSystem<VECTOR>*>(this);
+    const double offset = p_system->GetAnyVariable(mStimulusIndices[0], startPoint);
+    const double period = p_system->GetAnyVariable(mStimulusIndices[1], startPoint);
+    const double duration = p_system->GetAnyVariable(mStimulusIndices[2], startPoint);
+    double stim_end = std::numeric_limits<double>::max();
+    if (mStimulusIndices.size() > 3u)
+    {
+        stim_end = p_system->GetAnyVariable(mStimulusIndices[3], startPoint);
+    }
+    if (!(period > 0.0) || duration < 0.0)
+    {
+        return;
+    }
+
+    // Pulses start at offset + k*period for k >= 0 and last for the given duration, until the end time
+    const double last_point = std::min(endPoint, stim_end);
+    double k = std::max(0.0, std::floor((startPoint - offset) / period));
+    for (double pulse_on = offset + k*period; pulse_on < last_point; pulse_on = offset + (++k)*period)
+    {
+        if (pulse_on > startPoint)
+        {
+            rTimes.push_back(pulse_on);
+        }
+        const double pulse_off = pulse_on + duration;
+        if (pulse_off > startPoint && pulse_off < last_point)
+        {
+            rTimes.push_back(pulse_off);
+        }
+    }
+    if (stim_end > startPoint && stim_end < endPoint)
+    {
+        rTimes.push_back(stim_end);
+    }
+    std::sort(rTimes.begin(), rTimes.end());
+    rTimes.erase(std::unique(rTimes.begin(), rTimes.end()), rTimes.end());
+}
+
+
+template<typename VECTOR>
+void AbstractTemplatedSystemWithOutputs<VECTOR>::SetEvents(const std::vector<EventInfo>& rEvents)
+{
+    AbstractSystemWithOutputs::SetEvents(rEvents);
+    mpEventLocator.reset(); // A new one will be created for these events when needed
+}
+
+
+template<typename VECTOR>
+void AbstractTemplatedSystemWithOutputs<VECTOR>::SolveLocatingEvents(double endPoint)
+{
+    EXCEPTION("Events can only be located in models solved using CVODE.");
+}
+
+
+#ifdef CHASTE_CVODE
+/**
+ * Models solved using CVODE can locate events, by integrating with a separate CVODE instance that
+ * has root finding enabled.  The same instance is used for warm restarts.
+ *
+ * @param endPoint  the final value of the free variable
+ */
+template<>
+void AbstractTemplatedSystemWithOutputs<N_Vector>::SolveLocatingEvents(double endPoint)
+{
+    AbstractCvodeCell* p_cell = dynamic_cast<AbstractCvodeCell*>(this);
+    if (!p_cell)
+    {
+        EXCEPTION("Events can only be located in models solved using CVODE.");
+    }
+    if (!mpEventLocator)
+    {
+        mpEventLocator.reset(new CvodeEventLocator(p_cell, this->mEvents, mKrylovLinearSolver));
+    }
+    if (mInitialSolverStepSize > 0.0)
+    {
+        mpEventLocator->SetInitialStepSize(mInitialSolverStepSize);
+        mInitialSolverStepSize = 0.0;
+    }
+    std::vector<double> event_times;
+    mpEventLocator->Solve(this->mFreeVariable, endPoint, p_cell->GetTimestep(), event_times);
+    for (unsigned i=0; i<event_times.size(); ++i)
+    {
+        if (std::isnan(this->mEventTimes[i]))
+        {
+            this->mEventTimes[i] = event_times[i];
+        }
+    }
+    // The model's own solver must start afresh from the state we've reached
+    p_cell->ResetSolver();
+}
+#endif // CHASTE_CVODE
+
+
+template<typename VECTOR>
+AbstractSystemWithOutputs::SolverSettings AbstractTemplatedSystemWithOutputs<VECTOR>::GetSolverSettings()
+{
+    AbstractCardiacCell* p_cell = dynamic_cast<AbstractCardiacCell*>(this);
+    if (!p_cell)
+    {
+        return AbstractSystemWithOutputs::GetSolverSettings();
+    }
+    // Fixed step methods, such as Rush-Larsen, just have a step size
+    SolverSettings settings;
+    settings.maxStep = p_cell->GetTimestep();
+    return settings;
+}
+
+
+template<typename VECTOR>
+void AbstractTemplatedSystemWithOutputs<VECTOR>::SetSolverSettings(const SolverSettings& rSettings)
+{
+    AbstractCardiacCell* p_cell = dynamic_cast<AbstractCardiacCell*>(this);
+    if (!p_cell)
+    {
+        AbstractSystemWithOutputs::SetSolverSettings(rSettings);
+    }
+    else if (rSettings.maxStep != DOUBLE_UNSET)
+    {
+        // Tolerances don't apply to fixed step methods, so protocols written for CVODE still run
+        p_cell->SetTimestep(rSettings.maxStep);
+    }
+}
+
+
+#ifdef CHASTE_CVODE
+/**
+ * Models solved using CVODE report their tolerances, maximum step size and maximum number of steps,
+ * and how their linear systems are formed and solved.
+ *
+ * @return  the current settings
+ */
+template<>
+AbstractSystemWithOutputs::SolverSettings AbstractTemplatedSystemWithOutputs<N_Vector>::GetSolverSettings()
+{
+    SolverSettings settings;
+    AbstractCvodeCell* p_cell = dynamic_cast<AbstractCvodeCell*>(this);
+    if (p_cell)
+    {
+        settings.relTol = p_cell->GetRelativeTolerance();
+        settings.absTol = p_cell->GetAbsoluteTolerance();
+        settings.maxStep = p_cell->GetTimestep();
+        settings.maxSteps = p_cell->GetMaxSteps();
+        if (p_cell->HasAnalyticJacobian())
+        {
+            settings.analyticJacobian = p_cell->GetUseAnalyticJacobian() ? 1.0 : 0.0;
+        }
+        settings.krylovLinearSolver = mKrylovLinearSolver ? 1.0 : 0.0;
+    }
+    return settings;
+}
+
+
+/**
+ * Models solved using CVODE can change their tolerances, maximum step size and maximum number of steps,
+ * and how their linear systems are formed and solved.  Asking for an analytic Jacobian has no effect
+ * if the model wasn't generated with one.  The Krylov linear solver is only available with our own
+ * CVODE instance, so the model will then always be solved using that.
+ *
+ * @param rSettings  the settings to change
+ */
+template<>
+void AbstractTemplatedSystemWithOutputs<N_Vector>::SetSolverSettings(const SolverSettings& rSettings)
+{
+    AbstractCvodeCell* p_cell = dynamic_cast<AbstractCvodeCell*>(this);
+    if (!p_cell)
+    {
+        AbstractSystemWithOutputs::SetSolverSettings(rSettings);
+        return;
+    }
+    if (rSettings.relTol != DOUBLE_UNSET || rSettings.absTol != DOUBLE_UNSET)
+    {
+        p_cell->SetTolerances(rSettings.relTol != DOUBLE_UNSET ? rSettings.relTol : p_cell->GetRelativeTolerance(),
+                              rSettings.absTol != DOUBLE_UNSET ? rSettings.absTol : p_cell->GetAbsoluteTolerance());
+    }
+    if (rSettings.maxStep != DOUBLE_UNSET)
+    {
+        p_cell->SetTimestep(rSettings.maxStep);
+    }
+    if (rSettings.maxSteps != DOUBLE_UNSET)
+    {
+        p_cell->SetMaxSteps(static_cast<long>(rSettings.maxSteps));
+    }
+    if (rSettings.analyticJacobian != DOUBLE_UNSET && p_cell->HasAnalyticJacobian()
+        && (rSettings.analyticJacobian != 0.0) != p_cell->GetUseAnalyticJacobian())
+    {
+        p_cell->ForceUseOfNumericalJacobian(rSettings.analyticJacobian == 0.0);
+        mpEventLocator.reset(); // It checks which Jacobian to use when created
+    }
+    if (rSettings.krylovLinearSolver != DOUBLE_UNSET && (rSettings.krylovLinearSolver != 0.0) != mKrylovLinearSolver)
+    {
+        mKrylovLinearSolver = (rSettings.krylovLinearSolver != 0.0);
+        mpEventLocator.reset();
+    }
+    // Make sure the solver picks up the new settings
+    p_cell->ResetSolver();
+}
+#endif // CHASTE_CVODE
+
+
+template<typename VECTOR>
+void AbstractTemplatedSystemWithOutputs<VECTOR>::SetWarmRestarts(bool warmRestarts)
+{
+    AbstractSystemWithOutputs::SetWarmRestarts(warmRestarts);
+}
+
+
+template<typename VECTOR>
+double AbstractTemplatedSystemWithOutputs<VECTOR>::GetSolverStepSize()
+{
+    return AbstractSystemWithOutputs::GetSolverStepSize();
+}
+
+
+template<typename VECTOR>
+void AbstractTemplatedSystemWithOutputs<VECTOR>::SetInitialSolverStepSize(double stepSize)
+{
+    AbstractSystemWithOutputs::SetInitialSolverStepSize(stepSize);
+}
+
+
+#ifdef CHASTE_CVODE
+/**
+ * Models solved using CVODE support warm restarts, by solving with our own CVODE instance,
+ * since Chaste's wrapper doesn't allow its initial step size to be set.
+ *
+ * @param warmRestarts  whether to enable warm restarts
+ */
+template<>
+void AbstractTemplatedSystemWithOutputs<N_Vector>::SetWarmRestarts(bool warmRestarts)
+{
+    mWarmRestarts = warmRestarts && dynamic_cast<AbstractCvodeCell*>(this);
+    mInitialSolverStepSize = 0.0;
+}
+
+
+/**
+ * Models solved using CVODE report the step size their own CVODE instance will attempt next: the
+ * initial step size given for the next solve, if any, or else the step size it has reached.
+ *
+ * @return  the step size, or 0 if warm restarts aren't enabled or the model hasn't been solved yet
+ */
+template<>
+double AbstractTemplatedSystemWithOutputs<N_Vector>::GetSolverStepSize()
+{
+    double step_size = 0.0;
+    if (mWarmRestarts && mInitialSolverStepSize > 0.0)
+    {
+        step_size = mInitialSolverStepSize;
+    }
+    else if (mWarmRestarts && mpEventLocator)
+    {
+        step_size = mpEventLocator->GetCurrentStepSize();
+    }
+    return step_size;
+}
+
+
+/**
+ * Models solved using CVODE can start their own CVODE instance with a given step size.
+ *
+ * @param stepSize  the initial step size for the next solve
+ */
+template<>
+void AbstractTemplatedSystemWithOutputs<N_Vector>::SetInitialSolverStepSize(double stepSize)
+{
+    if (mWarmRestarts)
+    {
+        mInitialSolverStepSize = stepSize;
+    }
+}
+#endif // CHASTE_CVODE
+
+
 template<typename VECTOR>
 void AbstractTemplatedSystemWithOutputs<VECTOR>::ProcessOutputsInfo()
 {
@@ -109,6 +488,38 @@ void AbstractTemplatedSystemWithOutputs<VECTOR>::ProcessOutputsInfo()
 }
 
 
+template<typename VECTOR>
+double AbstractTemplatedSystemWithOutputs<VECTOR>::GetOutputValue(AbstractParameterisedSystem<VECTOR>* pSystem,
+                                                                  const std::pair<unsigned, OutputTypes>& rInfo,
+                                                                  VECTOR& rDerivedQuantities,
+                                                                  bool& rComputedDerivedQuantities)
+{
+    double value = DOUBLE_UNSET;
+    switch (rInfo.second)
+    {
+        case FREE:
+            value = this->mFreeVariable;
+            break;
+        case STATE:
+            value = GetVectorComponent(pSystem->rGetStateVariables(), rInfo.first);
+            break;
+        case PARAMETER:
+            value = pSystem->GetParameter(rInfo.first);
+            break;
+        case DERIVED:
+            if (!rComputedDerivedQuantities)
+            {
+                rDerivedQuantities = pSystem->ComputeDerivedQuantities(this->mFreeVariable,
+                                                                       pSystem->rGetStateVariables());
+                rComputedDerivedQuantities = true;
+            }
+            value = GetVectorComponent(rDerivedQuantities, rInfo.first);
+            break;
+    }
+    return value;
+}
+
+
 template<typename VECTOR>
 EnvironmentCPtr AbstractTemplatedSystemWithOutputs<VECTOR>::GetOutputs()
 {
@@ -125,28 +536,11 @@ EnvironmentCPtr AbstractTemplatedSystemWithOutputs<VECTOR>::GetOutputs()
     // Add 'normal' outputs to the environment (single values per output step)
     for (unsigned i=0; i<num_normal_outputs; i++)
     {
-        double value = DOUBLE_UNSET;
-        switch (mOutputsInfo[i].second)
+        if (!this->IsOutputRequired(i))
         {
-            case FREE:
-                value = this->mFreeVariable;
-                break;
-            case STATE:
-                value = GetVectorComponent(p_this->rGetStateVariables(), mOutputsInfo[i].first);
-                break;
-            case PARAMETER:
-                value = p_this->GetParameter(mOutputsInfo[i].first);
-                break;
-            case DERIVED:
-                if (!computed_derived_quantities)
-                {
-                    derived_quantities = p_this->ComputeDerivedQuantities(this->mFreeVariable,
-                                                                          p_this->rGetStateVariables());
-                    computed_derived_quantities = true;
-                }
-                value = GetVectorComponent(derived_quantities, mOutputsInfo[i].first);
-                break;
+            continue;
         }
+        double value = GetOutputValue(p_this, mOutputsInfo[i], derived_quantities, computed_derived_quantities);
         AbstractValuePtr p_value(new SimpleValue(value));
         p_value->SetUnits(this->mOutputUnits[i]);
         p_outputs->DefineName(this->mOutputNames[i], p_value, loc_info);
@@ -156,33 +550,17 @@ EnvironmentCPtr AbstractTemplatedSystemWithOutputs<VECTOR>::GetOutputs()
     const unsigned num_vector_outputs = mVectorOutputsInfo.size();
     for (unsigned i=0; i<num_vector_outputs; i++)
     {
+        if (!this->IsOutputRequired(num_normal_outputs + i))
+        {
+            continue;
+        }
         const unsigned output_length = mVectorOutputsInfo[i].size();
         const NdArray<double>::Extents shape(1u, output_length);
         NdArray<double> value(shape);
         for (NdArray<double>::Iterator iter = value.Begin(); iter != value.End(); ++iter)
         {
             const unsigned j = iter.rGetIndices()[0];
-            switch (mVectorOutputsInfo[i][j].second)
-            {
-            case FREE:
-                *iter = this->mFreeVariable;
-                break;
-            case STATE:
-                *iter = GetVectorComponent(p_this->rGetStateVariables(), mVectorOutputsInfo[i][j].first);
-                break;
-            case PARAMETER:
-                *iter = p_this->GetParameter(mVectorOutputsInfo[i][j].first);
-                break;
-            case DERIVED:
-                if (!computed_derived_quantities)
-                {
-                    derived_quantities = p_this->ComputeDerivedQuantities(this->mFreeVariable,
-                                                                          p_this->rGetStateVariables());
-                    computed_derived_quantities = true;
-                }
-                *iter = GetVectorComponent(derived_quantities, mVectorOutputsInfo[i][j].first);
-                break;
-            }
+            *iter = GetOutputValue(p_this, mVectorOutputsInfo[i][j], derived_quantities, computed_derived_quantities);
         }
         AbstractValuePtr p_value(new ArrayValue(value));
         p_value->SetUnits(this->mOutputUnits[num_normal_outputs + i]);
@@ -198,12 +576,198 @@ EnvironmentCPtr AbstractTemplatedSystemWithOutputs<VECTOR>::GetOutputs()
 }
 
 
+template<typename VECTOR>
+bool AbstractTemplatedSystemWithOutputs<VECTOR>::GetOutputValues(std::vector<double>& rValues)
+{
+    AbstractParameterisedSystem<VECTOR>* p_this = dynamic_cast<AbstractParameterisedSystem<VECTOR>*>(this);
+    assert(p_this);
+
+    bool computed_derived_quantities = false;
+    VECTOR derived_quantities = CreateEmptyVector<VECTOR>();
+    rValues.clear();
+
+    // Values are ordered as for mOutputNames: 'normal' outputs then vector outputs
+    const unsigned num_normal_outputs = mOutputsInfo.size();
+    for (unsigned i=0; i<num_normal_outputs; i++)
+    {
+        if (!this->IsOutputRequired(i))
+        {
+            continue;
+        }
+        rValues.push_back(GetOutputValue(p_this, mOutputsInfo[i], derived_quantities, computed_derived_quantities));
+    }
+    for (unsigned i=0; i<mVectorOutputsInfo.size(); i++)
+    {
+        if (!this->IsOutputRequired(num_normal_outputs + i))
+        {
+            continue;
+        }
+        for (unsigned j=0; j<mVectorOutputsInfo[i].size(); j++)
+        {
+            rValues.push_back(GetOutputValue(p_this, mVectorOutputsInfo[i][j], derived_quantities, computed_derived_quantities));
+        }
+    }
+
+    if (computed_derived_quantities)
+    {
+        DeleteVector(derived_quantities);
+    }
+    return true;
+}
+
+
+template<typename VECTOR>
+bool AbstractTemplatedSystemWithOutputs<VECTOR>::GetStateValues(std::vector<double>& rValues)
+{
+    AbstractParameterisedSystem<VECTOR>* p_this = dynamic_cast<AbstractParameterisedSystem<VECTOR>*>(this);
+    assert(p_this);
+    const VECTOR& r_state = p_this->rGetStateVariables();
+    rValues.resize(p_this->GetNumberOfStateVariables());
+    for (unsigned i=0; i<rValues.size(); ++i)
+    {
+        rValues[i] = GetVectorComponent(r_state, i);
+    }
+    return true;
+}
+
+
+template<typename VECTOR>
+bool AbstractTemplatedSystemWithOutputs<VECTOR>::SetStateValues(const std::vector<double>& rValues)
+{
+    AbstractParameterisedSystem<VECTOR>* p_this = dynamic_cast<AbstractParameterisedSystem<VECTOR>*>(this);
+    assert(p_this);
+    assert(rValues.size() == p_this->GetNumberOfStateVariables());
+    VECTOR state = p_this->GetStateVariables();
+    for (unsigned i=0; i<rValues.size(); ++i)
+    {
+        SetVectorComponent(state, i, rValues[i]);
+    }
+    p_this->SetStateVariables(state);
+    DeleteVector(state);
+    return true;
+}
+
+
+/**
+ * Create a new ODE solver of the same type as a model's, so that a copy of the model doesn't share it.
+ * Chaste's solvers can't be copied in general, so only the one-step methods, which have no settings, are
+ * supported.
+ *
+ * @param pSolver  the model's solver; empty for models which solve themselves, e.g. with CVODE
+ * @return  a new solver, or an empty pointer if pSolver is empty
+ */
+static boost::shared_ptr<AbstractIvpOdeSolver> CopySolver(const boost::shared_ptr<AbstractIvpOdeSolver> pSolver)
+{
+    boost::shared_ptr<AbstractIvpOdeSolver> p_copy;
+    if (!pSolver)
+    {
+        // Nothing to copy
+    }
+    else if (typeid(*pSolver) == typeid(EulerIvpOdeSolver))
+    {
+        p_copy.reset(new EulerIvpOdeSolver);
+    }
+    else if (typeid(*pSolver) == typeid(HeunIvpOdeSolver))
+    {
+        p_copy.reset(new HeunIvpOdeSolver);
+    }
+    else if (typeid(*pSolver) == typeid(RungeKutta2IvpOdeSolver))
+    {
+        p_copy.reset(new RungeKutta2IvpOdeSolver);
+    }
+    else if (typeid(*pSolver) == typeid(RungeKutta4IvpOdeSolver))
+    {
+        p_copy.reset(new RungeKutta4IvpOdeSolver);
+    }
+    else
+    {
+        EXCEPTION("Unable to copy the model's ODE solver, so the model can't be cloned.");
+    }
+    return p_copy;
+}
+
+
+/**
+ * Copy a model's stimulus function, so that a copy of the model doesn't share it.
+ *
+ * @param pStimulus  the model's stimulus; may be empty
+ * @return  a copy, or an empty pointer if pStimulus is empty
+ */
+static boost::shared_ptr<AbstractStimulusFunction> CopyStimulus(const boost::shared_ptr<AbstractStimulusFunction> pStimulus)
+{
+    boost::shared_ptr<AbstractStimulusFunction> p_copy;
+    if (!pStimulus)
+    {
+        // Nothing to copy
+    }
+    else if (typeid(*pStimulus) == typeid(RegularStimulus))
+    {
+        p_copy.reset(new RegularStimulus(static_cast<const RegularStimulus&>(*pStimulus)));
+    }
+    else if (typeid(*pStimulus) == typeid(SimpleStimulus))
+    {
+        p_copy.reset(new SimpleStimulus(static_cast<const SimpleStimulus&>(*pStimulus)));
+    }
+    else if (typeid(*pStimulus) == typeid(ZeroStimulus))
+    {
+        p_copy.reset(new ZeroStimulus);
+    }
+    else
+    {
+        EXCEPTION("Unable to copy the model's stimulus function, so the model can't be cloned.");
+    }
+    return p_copy;
+}
+
+
+template<typename VECTOR>
+boost::shared_ptr<AbstractSystemWithOutputs> AbstractTemplatedSystemWithOutputs<VECTOR>::Clone()
+{
+    AbstractDynamicallyLoadableEntity* p_entity = dynamic_cast<AbstractDynamicallyLoadableEntity*>(this);
+    if (!p_entity || !p_entity->GetLoader())
+    {
+        return AbstractSystemWithOutputs::Clone();
+    }
+    AbstractCardiacCellInterface* p_cell = dynamic_cast<AbstractCardiacCellInterface*>(this);
+    assert(p_cell);
+    // The copy may be solved on another thread, so mustn't share anything mutable with us
+    boost::shared_ptr<AbstractCardiacCellInterface> p_new_cell(
+            p_entity->GetLoader()->CreateCell(CopySolver(p_cell->GetSolver()), CopyStimulus(p_cell->GetStimulusFunction())));
+    boost::shared_ptr<AbstractTemplatedSystemWithOutputs<VECTOR> > p_clone
+            = boost::dynamic_pointer_cast<AbstractTemplatedSystemWithOutputs<VECTOR> >(p_new_cell);
+    assert(p_clone);
+
+    // Copy the state and parameters
+    AbstractParameterisedSystem<VECTOR>* p_this = dynamic_cast<AbstractParameterisedSystem<VECTOR>*>(this);
+    AbstractParameterisedSystem<VECTOR>* p_new_system = dynamic_cast<AbstractParameterisedSystem<VECTOR>*>(p_clone.get());
+    assert(p_this && p_new_system);
+    p_new_system->SetStateVariables(p_this->rGetStateVariables());
+    for (unsigned i=0; i<p_this->GetNumberOfParameters(); ++i)
+    {
+        p_new_system->SetParameter(i, p_this->GetParameter(i));
+    }
+    p_clone->mFreeVariable = this->mFreeVariable;
+
+    // And how it is solved and observed
+    p_clone->SetSolverSettings(GetSolverSettings());
+    p_clone->SetWarmRestarts(mWarmRestarts);
+    p_clone->SetStopAtStimulusChanges(mStopAtStimulusChanges);
+    p_clone->mRequiredOutputs = this->mRequiredOutputs;
+    if (!mNamespaceBindings.empty())
+    {
+        p_clone->SetNamespaceBindings(mNamespaceBindings);
+    }
+    return p_clone;
+}
+
+
 template<typename VECTOR>
 void AbstractTemplatedSystemWithOutputs<VECTOR>::SetNamespaceBindings(const std::map<std::string, std::string>& rNamespaceBindings)
 {
     ///\todo Go back to the assert when nested protocols are done properly
 //    assert(mEnvironmentMap.empty());
     mEnvironmentMap.clear();
+    mNamespaceBindings = rNamespaceBindings;
     // Create the wrapper Environment(s)
     boost::shared_ptr<AbstractParameterisedSystem<VECTOR> > p_system(dynamic_cast<AbstractParameterisedSystem<VECTOR>*>(this),
                                                                      NullDeleter());
@@ -41,9 +41,13 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <vector>
 #include <map>
 #include <string>
+#include <boost/shared_ptr.hpp>
 
 #include "Environment.hpp"
 
+template<typename VECTOR> class AbstractParameterisedSystem;
+class CvodeEventLocator;
+
 /**
  * An intermediate base class for models created from CellML by PyCml.
  *
@@ -55,11 +59,47 @@ template<typename VECTOR>
 class AbstractTemplatedSystemWithOutputs : public AbstractSystemWithOutputs
 {
 public:
+    /** Default constructor. */
+    AbstractTemplatedSystemWithOutputs();
+
     /**
      * Get the current values of this system's outputs.
      */
     EnvironmentCPtr GetOutputs();
 
+    /**
+     * Get the current values of this system's outputs as a single vector, without creating an
+     * Environment to hold them.
+     *
+     * @param rValues  filled in with the output values, in the order given by rGetOutputNames
+     * @return  true, since this is always supported
+     */
+    bool GetOutputValues(std::vector<double>& rValues);
+
+    /**
+     * Get the current values of this system's state variables.
+     *
+     * @param rValues  filled in with the state variable values
+     * @return  true, since this is always supported
+     */
+    bool GetStateValues(std::vector<double>& rValues);
+
+    /**
+     * Set the values of this system's state variables.
+     *
+     * @param rValues  the new state variable values
+     * @return  true, since this is always supported
+     */
+    bool SetStateValues(const std::vector<double>& rValues);
+
+    /**
+     * Create an independent copy of this system, using the loader that created it to make a new
+     * instance of the same model.  Only dynamically loaded models can be cloned.
+     *
+     * @return  the copy
+     */
+    boost::shared_ptr<AbstractSystemWithOutputs> Clone();
+
     /**
      * Set the bindings from prefix to namespace URI used by the protocol for accessing model
      * variables.  The Environment wrappers around this model can then be created and
@@ -71,9 +111,69 @@ public:
 
     /**
      * Solve the system from the current state up to the given end point.
+     * If events have been set, their occurrences are located along the way.
+     *
+     * If the model exposes the timing of a regular stimulus (see CanStopAtStimulusChanges), the
+     * solver is stopped exactly wherever the stimulus switches on or off, and restarted from there.
      */
     void SolveModel(double endPoint);
 
+    /**
+     * @return  whether the model exposes the timing of a regular stimulus, so that SolveModel can
+     * stop the solver exactly where the stimulus switches on or off.  The stimulus offset, period
+     * and duration variables (annotated as oxmeta:membrane_stimulus_current_offset etc.) must all
+     * exist; the end time is used if present.  If so, no cap on the solver's step size is needed
+     * to avoid stepping over a stimulus.
+     */
+    virtual bool CanStopAtStimulusChanges();
+
+    /**
+     * Set whether SolveModel may stop the solver at stimulus changes.
+     *
+     * @param stop  whether to do so; see AbstractSystemWithOutputs::SetStopAtStimulusChanges
+     */
+    void SetStopAtStimulusChanges(bool stop);
+
+    /**
+     * @return  the current solver settings.  Models solved with a fixed step method (e.g. Rush-Larsen)
+     * report just their step size, as maxStep.
+     */
+    SolverSettings GetSolverSettings();
+
+    /**
+     * Change the solver settings.  For models solved with a fixed step method (e.g. Rush-Larsen)
+     * maxStep sets the step size, and the other settings are ignored.
+     *
+     * @param rSettings  the settings to change; see AbstractSystemWithOutputs::SetSolverSettings
+     */
+    void SetSolverSettings(const SolverSettings& rSettings);
+
+    /**
+     * Set whether to enable warm restarts.  Only models solved using CVODE support this; they are
+     * then solved with a CVODE instance of our own, whose step size can be saved and restored.
+     *
+     * @param warmRestarts  whether to enable warm restarts; see AbstractSystemWithOutputs::SetWarmRestarts
+     */
+    void SetWarmRestarts(bool warmRestarts);
+
+    /** @return  the step size the solver will next attempt, if warm restarts are enabled; otherwise 0. */
+    double GetSolverStepSize();
+
+    /**
+     * Start the solver with the given step size on the next call to SolveModel, if warm restarts are enabled.
+     *
+     * @param stepSize  the initial step size, or 0 to let the solver estimate one
+     */
+    void SetInitialSolverStepSize(double stepSize);
+
+    /**
+     * Set the events to locate when solving the system.
+     * Only models solved using CVODE support this.
+     *
+     * @param rEvents  the events; see AbstractSystemWithOutputs::SetEvents
+     */
+    void SetEvents(const std::vector<EventInfo>& rEvents);
+
 protected:
     /**
      * Must be called by subclasses after they have set up #mOutputsInfo, #mVectorOutputsInfo
@@ -113,6 +213,67 @@ protected:
      * has such outputs.
      */
     std::vector<std::string> mVectorOutputNames;
+
+private:
+    /** The namespace bindings given to SetNamespaceBindings, so clones can wrap themselves alike. */
+    std::map<std::string, std::string> mNamespaceBindings;
+
+    /** Solves the system when events are being located or warm restarts are enabled; created when first needed. */
+    boost::shared_ptr<CvodeEventLocator> mpEventLocator;
+
+    /** Whether warm restarts are enabled, in which case #mpEventLocator is always used to solve the system. */
+    bool mWarmRestarts;
+
+    /**
+     * Whether to use a Krylov linear solver (see SolverSettings::krylovLinearSolver), in which case
+     * #mpEventLocator is always used to solve the system.
+     */
+    bool mKrylovLinearSolver;
+
+    /** The step size to start the solver with on the next solve, or 0 to let it estimate one. */
+    double mInitialSolverStepSize;
+
+    /**
+     * Solve the system from the current state up to the given end point using #mpEventLocator, with
+     * root finding enabled for any events, filling in any entries of #mEventTimes not yet set.
+     *
+     * @param endPoint  the final value of the free variable
+     */
+    void SolveLocatingEvents(double endPoint);
+
+    /** Whether SolveModel may stop the solver at stimulus changes, if the model allows. */
+    bool mStopAtStimulusChanges;
+
+    /** Whether #mStimulusIndices has been filled in yet. */
+    bool mStimulusResolved;
+
+    /**
+     * The indices, as used by GetAnyVariable, of the stimulus offset, period, duration and (if
+     * present) end variables.  Empty if the model doesn't expose its stimulus timing.
+     */
+    std::vector<unsigned> mStimulusIndices;
+
+    /**
+     * Find where a regular stimulus switches on or off between two points, if its timing is known.
+     *
+     * @param startPoint  the current value of the free variable
+     * @param endPoint  the value of the free variable the system will be solved up to
+     * @param rTimes  filled in with the switching times strictly between the two points, in order
+     */
+    void GetStimulusSwitchTimes(double startPoint, double endPoint, std::vector<double>& rTimes);
+
+    /**
+     * Get the current value of a single output variable.
+     *
+     * @param pSystem  this system, cast to its parameterised system base
+     * @param rInfo  which variable to read
+     * @param rDerivedQuantities  the system's derived quantities, which are computed on first use
+     * @param rComputedDerivedQuantities  whether rDerivedQuantities has been computed yet
+     */
+    double GetOutputValue(AbstractParameterisedSystem<VECTOR>* pSystem,
+                          const std::pair<unsigned, OutputTypes>& rInfo,
+                          VECTOR& rDerivedQuantities,
+                          bool& rComputedDerivedQuantities);
 };
 
 #endif // ABSTRACTTEMPLATEDSYSTEMWITHOUTPUTS_HPP_
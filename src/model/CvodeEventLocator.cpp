@@ -0,0 +1,366 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "CvodeEventLocator.hpp"
+
+#ifdef CHASTE_CVODE
+
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include <boost/foreach.hpp>
+
+// CVODE headers
+#include <cvode/cvode.h>
+#include <cvode/cvode_dense.h>
+#include <cvode/cvode_spgmr.h>
+
+#include "VectorHelperFunctions.hpp"
+#include "Exception.hpp"
+
+CvodeEventLocator::CvodeEventLocator(AbstractCvodeSystem* pSystem,
+                                     const std::vector<AbstractSystemWithOutputs::EventInfo>& rEvents,
+                                     bool krylovLinearSolver)
+    : mpSystem(pSystem),
+      mEvents(rEvents),
+      mKrylovLinearSolver(krylovLinearSolver),
+      mpCvodeMem(NULL),
+      mRates(NULL),
+      mLastEndPoint(DOUBLE_UNSET),
+      mForceReset(false),
+      mInitialStepSize(0.0)
+{
+    assert(mpSystem);
+    bool need_rates = false;
+    BOOST_FOREACH(const AbstractSystemWithOutputs::EventInfo& r_event, mEvents)
+    {
+        const std::string& r_name = r_event.variable;
+        if (r_event.rateOfChange)
+        {
+            if (!mpSystem->HasStateVariable(r_name))
+            {
+                EXCEPTION("Only the rate of change of a state variable can be monitored for events; '"
+                          << r_name << "' is not a state variable.");
+            }
+            mQuantities.push_back(std::make_pair(RATE, mpSystem->GetStateVariableIndex(r_name)));
+            need_rates = true;
+        }
+        else if (mpSystem->HasStateVariable(r_name))
+        {
+            mQuantities.push_back(std::make_pair(STATE, mpSystem->GetStateVariableIndex(r_name)));
+        }
+        else if (mpSystem->HasDerivedQuantity(r_name))
+        {
+            mQuantities.push_back(std::make_pair(DERIVED, mpSystem->GetDerivedQuantityIndex(r_name)));
+        }
+        else
+        {
+            EXCEPTION("Events can only monitor state variables or derived quantities of the model; '"
+                      << r_name << "' is neither.");
+        }
+    }
+    if (need_rates)
+    {
+        mRates = N_VNew_Serial(mpSystem->GetNumberOfStateVariables());
+    }
+}
+
+
+CvodeEventLocator::~CvodeEventLocator()
+{
+    if (mpCvodeMem)
+    {
+        CVodeFree(&mpCvodeMem);
+    }
+    if (mRates)
+    {
+        DeleteVector(mRates);
+    }
+}
+
+
+void CvodeEventLocator::Solve(double startPoint, double endPoint, double maxStep, std::vector<double>& rEventTimes)
+{
+    N_Vector& r_state = mpSystem->rGetStateVariables();
+    // The tolerances are set on each call, since the solver settings may have been changed in between
+    // (see AbstractSystemWithOutputs::SetSolverSettings)
+    const double rel_tol = mpSystem->GetRelativeTolerance();
+    double abs_tol = mpSystem->GetAbsoluteTolerance();
+    if (!mpCvodeMem)
+    {
+        mpCvodeMem = CVodeCreate(CV_BDF, CV_NEWTON);
+        if (!mpCvodeMem)
+        {
+            EXCEPTION("Failed to create CVODE memory for locating events.");
+        }
+#if CHASTE_SUNDIALS_VERSION >= 20400
+        CVodeInit(mpCvodeMem, &CvodeEventLocator::EvaluateRhs, startPoint, r_state);
+        CVodeSetUserData(mpCvodeMem, this);
+        if (!mEvents.empty())
+        {
+            CVodeRootInit(mpCvodeMem, mEvents.size(), &CvodeEventLocator::EvaluateEvents);
+        }
+#else
+        CVodeMalloc(mpCvodeMem, &CvodeEventLocator::EvaluateRhs, startPoint, r_state, CV_SS, rel_tol, &abs_tol);
+        CVodeSetFdata(mpCvodeMem, this);
+        if (!mEvents.empty())
+        {
+            CVodeRootInit(mpCvodeMem, mEvents.size(), &CvodeEventLocator::EvaluateEvents, this);
+        }
+#endif
+        if (mKrylovLinearSolver)
+        {
+            // Only products of the Jacobian with vectors are needed, approximated by difference quotients
+            CVSpgmr(mpCvodeMem, PREC_NONE, 0);
+        }
+        else
+        {
+            CVDense(mpCvodeMem, mpSystem->GetNumberOfStateVariables());
+            if (mpSystem->HasAnalyticJacobian() && mpSystem->GetUseAnalyticJacobian())
+            {
+#if CHASTE_SUNDIALS_VERSION >= 20400
+                CVDlsSetDenseJacFn(mpCvodeMem, &CvodeEventLocator::EvaluateJacobian);
+#else
+                CVDenseSetJacFn(mpCvodeMem, &CvodeEventLocator::EvaluateJacobian, this);
+#endif
+            }
+        }
+        CVodeSetInitStep(mpCvodeMem, mInitialStepSize);
+        mInitialStepSize = 0.0;
+    }
+    else
+    {
+        // Only carry on from the last solve if the protocol hasn't altered the model in between
+        std::vector<double> values;
+        GetModelValues(values);
+        if (mForceReset || startPoint != mLastEndPoint || values != mLastValues)
+        {
+#if CHASTE_SUNDIALS_VERSION >= 20400
+            CVodeReInit(mpCvodeMem, startPoint, r_state);
+#else
+            CVodeReInit(mpCvodeMem, &CvodeEventLocator::EvaluateRhs, startPoint, r_state, CV_SS, rel_tol, &abs_tol);
+#endif
+            // This persists across reinitialisations, so must be cleared once used
+            CVodeSetInitStep(mpCvodeMem, mInitialStepSize);
+            mInitialStepSize = 0.0;
+        }
+    }
+    mForceReset = false;
+#if CHASTE_SUNDIALS_VERSION >= 20400
+    CVodeSStolerances(mpCvodeMem, rel_tol, abs_tol);
+    const int itask = CV_NORMAL;
+#else
+    CVodeSetTolerances(mpCvodeMem, CV_SS, rel_tol, &abs_tol);
+    // Older versions only honour the stop time if asked to
+    const int itask = CV_NORMAL_TSTOP;
+#endif
+    CVodeSetMaxNumSteps(mpCvodeMem, mpSystem->GetMaxSteps());
+    CVodeSetMaxStep(mpCvodeMem, maxStep);
+    CVodeSetStopTime(mpCvodeMem, endPoint);
+
+    rEventTimes.assign(mEvents.size(), std::numeric_limits<double>::quiet_NaN());
+    std::vector<int> roots_found(mEvents.size());
+    double t = startPoint;
+    while (true)
+    {
+        int flag = CVode(mpCvodeMem, endPoint, r_state, &t, itask);
+        if (flag < 0)
+        {
+            char* p_flag_name = CVodeGetReturnFlagName(flag);
+            std::string flag_name(p_flag_name);
+            free(p_flag_name);
+            EXCEPTION("CVODE failed to solve the model at time " << t << " while locating events: " << flag_name);
+        }
+        if (flag != CV_ROOT_RETURN)
+        {
+            break; // We've reached the end point (CV_SUCCESS, or CV_TSTOP_RETURN for older versions)
+        }
+        // Record the first crossing of each event in the desired direction
+        CVodeGetRootInfo(mpCvodeMem, &roots_found[0]);
+        for (unsigned i=0; i<mEvents.size(); ++i)
+        {
+            if (roots_found[i] != 0 && std::isnan(rEventTimes[i])
+                && (mEvents[i].direction == 0 || mEvents[i].direction == roots_found[i]))
+            {
+                rEventTimes[i] = t;
+            }
+        }
+    }
+    mLastEndPoint = endPoint;
+    GetModelValues(mLastValues);
+}
+
+
+void CvodeEventLocator::Reset()
+{
+    mForceReset = true;
+}
+
+
+void CvodeEventLocator::SetInitialStepSize(double stepSize)
+{
+    mInitialStepSize = stepSize;
+    mForceReset = true;
+}
+
+
+double CvodeEventLocator::GetCurrentStepSize() const
+{
+    double step_size = 0.0;
+    if (mpCvodeMem)
+    {
+        CVodeGetCurrentStep(mpCvodeMem, &step_size);
+    }
+    return step_size;
+}
+
+
+long CvodeEventLocator::GetNumSteps() const
+{
+    long num_steps = 0;
+    if (mpCvodeMem)
+    {
+        CVodeGetNumSteps(mpCvodeMem, &num_steps);
+    }
+    return num_steps;
+}
+
+
+void CvodeEventLocator::GetModelValues(std::vector<double>& rValues) const
+{
+    const N_Vector& r_state = mpSystem->rGetStateVariables();
+    const unsigned num_state_vars = mpSystem->GetNumberOfStateVariables();
+    const unsigned num_params = mpSystem->GetNumberOfParameters();
+    rValues.resize(num_state_vars + num_params);
+    for (unsigned i=0; i<num_state_vars; ++i)
+    {
+        rValues[i] = NV_Ith_S(r_state, i);
+    }
+    for (unsigned i=0; i<num_params; ++i)
+    {
+        rValues[num_state_vars + i] = mpSystem->GetParameter(i);
+    }
+}
+
+
+int CvodeEventLocator::EvaluateRhs(realtype t, N_Vector y, N_Vector ydot, void* pData)
+{
+    CvodeEventLocator* p_locator = static_cast<CvodeEventLocator*>(pData);
+    try
+    {
+        p_locator->mpSystem->EvaluateYDerivatives(t, y, ydot);
+    }
+    catch (const Exception&)
+    {
+        return 1; // Recoverable, so CVODE may try a smaller step
+    }
+    return 0;
+}
+
+
+#if CHASTE_SUNDIALS_VERSION >= 20400
+int CvodeEventLocator::EvaluateJacobian(long int numStateVars, realtype t, N_Vector y, N_Vector ydot,
+                                        CHASTE_CVODE_DENSE_MATRIX jacobian, void* pData,
+                                        N_Vector tmp1, N_Vector tmp2, N_Vector tmp3)
+#else
+int CvodeEventLocator::EvaluateJacobian(long int numStateVars, CHASTE_CVODE_DENSE_MATRIX jacobian, realtype t,
+                                        N_Vector y, N_Vector ydot, void* pData,
+                                        N_Vector tmp1, N_Vector tmp2, N_Vector tmp3)
+#endif
+{
+    CvodeEventLocator* p_locator = static_cast<CvodeEventLocator*>(pData);
+    try
+    {
+        p_locator->mpSystem->EvaluateAnalyticJacobian(t, y, ydot, jacobian, tmp1, tmp2, tmp3);
+    }
+    catch (const Exception&)
+    {
+        return 1; // Recoverable, so CVODE may try a smaller step
+    }
+    return 0;
+}
+
+
+int CvodeEventLocator::EvaluateEvents(realtype t, N_Vector y, realtype* pValues, void* pData)
+{
+    CvodeEventLocator* p_locator = static_cast<CvodeEventLocator*>(pData);
+    AbstractCvodeSystem* p_system = p_locator->mpSystem;
+    N_Vector derived_quantities = NULL;
+    bool computed_rates = false;
+    int result = 0;
+    try
+    {
+        for (unsigned i=0; i<p_locator->mEvents.size(); ++i)
+        {
+            const unsigned index = p_locator->mQuantities[i].second;
+            double value = 0.0;
+            switch (p_locator->mQuantities[i].first)
+            {
+                case STATE:
+                    value = NV_Ith_S(y, index);
+                    break;
+                case DERIVED:
+                    if (!derived_quantities)
+                    {
+                        derived_quantities = p_system->ComputeDerivedQuantities(t, y);
+                    }
+                    value = NV_Ith_S(derived_quantities, index);
+                    break;
+                case RATE:
+                    if (!computed_rates)
+                    {
+                        p_system->EvaluateYDerivatives(t, y, p_locator->mRates);
+                        computed_rates = true;
+                    }
+                    value = NV_Ith_S(p_locator->mRates, index);
+                    break;
+            }
+            pValues[i] = value - p_locator->mEvents[i].threshold;
+        }
+    }
+    catch (const Exception&)
+    {
+        result = 1;
+    }
+    if (derived_quantities)
+    {
+        DeleteVector(derived_quantities);
+    }
+    return result;
+}
+
+#endif // CHASTE_CVODE
@@ -0,0 +1,217 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+#ifndef CVODEEVENTLOCATOR_HPP_
+#define CVODEEVENTLOCATOR_HPP_
+
+#ifdef CHASTE_CVODE
+
+#include <vector>
+#include <utility>
+#include <boost/noncopyable.hpp>
+
+// CVODE headers
+#include <nvector/nvector_serial.h>
+
+#include "AbstractCvodeSystem.hpp"
+#include "AbstractSystemWithOutputs.hpp"
+
+/**
+ * Solves a CVODE-based model with root finding enabled, so that the times at which events (threshold
+ * crossings; see AbstractSystemWithOutputs::SetEvents) occur are located as the model is integrated.
+ *
+ * Chaste's own CVODE wrapper in AbstractCvodeSystem always integrates right up to the requested end
+ * point, so this class maintains a separate CVODE instance for the model, using the same right-hand
+ * side and tolerances.  The solver is reinitialised at the start of a call to Solve if the protocol
+ * has changed the model's state or parameters since the previous call, or if Reset has been called;
+ * otherwise it carries on from where it stopped, keeping its step size and order.
+ *
+ * Since the step size the solver has reached can be read and used to start it again, this class is
+ * also used (with no events) to solve models for which warm restarts are enabled; see
+ * AbstractSystemWithOutputs::SetWarmRestarts.
+ *
+ * The linear systems in CVODE's Newton iterations may be solved with a dense direct method, using the
+ * model's analytic Jacobian if it has one and hasn't been told not to use it, or with a matrix-free
+ * Krylov method (GMRES), which never forms the Jacobian, and so suits large models whose Jacobians
+ * are sparse.
+ *
+ * Like Chaste's wrapper, this works with the CVODE interface of SUNDIALS 2.3 (CVodeMalloc) as well
+ * as that of 2.4 onwards (CVodeInit), chosen by CHASTE_SUNDIALS_VERSION.
+ */
+class CvodeEventLocator : private boost::noncopyable
+{
+public:
+    /**
+     * Create a locator for the given events.
+     *
+     * @param pSystem  the model to solve
+     * @param rEvents  the events to locate, if any; their variables must be state variables or derived quantities
+     * @param krylovLinearSolver  whether to use a Krylov linear solver rather than a dense one
+     */
+    CvodeEventLocator(AbstractCvodeSystem* pSystem,
+                      const std::vector<AbstractSystemWithOutputs::EventInfo>& rEvents,
+                      bool krylovLinearSolver=false);
+
+    /** Free the CVODE memory. */
+    ~CvodeEventLocator();
+
+    /**
+     * Solve the model from its current state, updating the state in place.
+     *
+     * @param startPoint  the current value of the free variable
+     * @param endPoint  the value of the free variable to solve up to
+     * @param maxStep  the maximum internal step size CVODE may take
+     * @param rEventTimes  filled in with the time each event first occurred, or NaN if it didn't
+     */
+    void Solve(double startPoint, double endPoint, double maxStep, std::vector<double>& rEventTimes);
+
+    /**
+     * Make the next call to Solve reinitialise the solver even if the model hasn't changed, e.g. at
+     * a discontinuity in the right-hand side.
+     */
+    void Reset();
+
+    /**
+     * Make the next call to Solve reinitialise the solver, starting with the given step size rather
+     * than letting CVODE estimate a (typically very small) one.
+     *
+     * @param stepSize  the initial step size, or 0 to have CVODE estimate it
+     */
+    void SetInitialStepSize(double stepSize);
+
+    /** @return  the step size CVODE will attempt next, or 0 if it hasn't taken any steps yet. */
+    double GetCurrentStepSize() const;
+
+    /** @return  the number of internal steps CVODE has taken since the solver was last (re)initialised. */
+    long GetNumSteps() const;
+
+private:
+    /** The kinds of quantity an event function can monitor. */
+    enum QuantityType
+    {
+        STATE,   ///< A state variable
+        DERIVED, ///< A derived quantity
+        RATE     ///< The time derivative of a state variable
+    };
+
+    /** The model being solved. */
+    AbstractCvodeSystem* mpSystem;
+
+    /** The events being located. */
+    std::vector<AbstractSystemWithOutputs::EventInfo> mEvents;
+
+    /** For each event, what kind of quantity it monitors, and the index of that quantity. */
+    std::vector<std::pair<QuantityType, unsigned> > mQuantities;
+
+    /** Whether to use a Krylov linear solver rather than a dense one. */
+    bool mKrylovLinearSolver;
+
+    /** CVODE's internal data, or NULL if the solver hasn't been set up yet. */
+    void* mpCvodeMem;
+
+    /** Workspace for the state derivatives, if any event monitors a rate of change. */
+    N_Vector mRates;
+
+    /** The end point of the last call to Solve. */
+    double mLastEndPoint;
+
+    /** The model's state variables followed by its parameters, as they were after the last call to Solve. */
+    std::vector<double> mLastValues;
+
+    /** Whether the next call to Solve must reinitialise the solver regardless. */
+    bool mForceReset;
+
+    /** The step size to start with when the solver is next reinitialised, or 0 to let CVODE choose. */
+    double mInitialStepSize;
+
+    /**
+     * Get the model's current state variables followed by its parameters, to detect changes made by
+     * the protocol between calls to Solve.
+     *
+     * @param rValues  filled in with the values
+     */
+    void GetModelValues(std::vector<double>& rValues) const;
+
+    /**
+     * The right-hand side function given to CVODE, which evaluates the model's derivatives.
+     *
+     * @param t  the free variable
+     * @param y  the state variables
+     * @param ydot  filled in with the derivatives
+     * @param pData  the locator
+     * @return  0 on success, or 1 for a recoverable error
+     */
+    static int EvaluateRhs(realtype t, N_Vector y, N_Vector ydot, void* pData);
+
+    /**
+     * The dense Jacobian function given to CVODE, which evaluates the model's analytic Jacobian.
+     * The order of the arguments depends on the version of SUNDIALS.
+     *
+     * @param numStateVars  the number of state variables
+     * @param t  the free variable
+     * @param y  the state variables
+     * @param ydot  the state derivatives
+     * @param jacobian  filled in with the Jacobian
+     * @param pData  the locator
+     * @param tmp1  workspace
+     * @param tmp2  workspace
+     * @param tmp3  workspace
+     * @return  0 on success, or 1 for a recoverable error
+     */
+#if CHASTE_SUNDIALS_VERSION >= 20400
+    static int EvaluateJacobian(long int numStateVars, realtype t, N_Vector y, N_Vector ydot,
+                                CHASTE_CVODE_DENSE_MATRIX jacobian, void* pData,
+                                N_Vector tmp1, N_Vector tmp2, N_Vector tmp3);
+#else
+    static int EvaluateJacobian(long int numStateVars, CHASTE_CVODE_DENSE_MATRIX jacobian, realtype t,
+                                N_Vector y, N_Vector ydot, void* pData,
+                                N_Vector tmp1, N_Vector tmp2, N_Vector tmp3);
+#endif
+
+    /**
+     * The root function given to CVODE, which evaluates how far each monitored quantity is above
+     * its threshold.
+     *
+     * @param t  the free variable
+     * @param y  the state variables
+     * @param pValues  filled in with the event function values
+     * @param pData  the locator
+     * @return  0 on success, or 1 on error
+     */
+    static int EvaluateEvents(realtype t, N_Vector y, realtype* pValues, void* pData);
+};
+
+#endif // CHASTE_CVODE
+
+#endif // CVODEEVENTLOCATOR_HPP_
@@ -0,0 +1,196 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "CvodeJacobianInfo.hpp"
+
+#ifdef CHASTE_CVODE
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+// CVODE headers
+#include <cvode/cvode_dense.h>
+
+#include "PetscTools.hpp"
+#include "VectorHelperFunctions.hpp"
+
+/** Each way of evaluating the Jacobian is repeated for at least this long (in seconds) to time it. */
+static const double MIN_TIMING_DURATION = 0.01;
+
+/**
+ * Approximate the Jacobian by forward differences, as CVODE does when it has no analytic Jacobian.
+ *
+ * @param pSystem  the model
+ * @param time  the value of the free variable
+ * @param y  the state variables; restored after each is perturbed
+ * @param ydot  workspace for the derivatives at y
+ * @param perturbedYdot  workspace for the derivatives with one state variable perturbed
+ * @param rJacobian  filled in with the Jacobian, in column-major order
+ */
+static void EvaluateNumericalJacobian(AbstractCvodeSystem* pSystem, double time, N_Vector y,
+                                      N_Vector ydot, N_Vector perturbedYdot, std::vector<double>& rJacobian)
+{
+    const unsigned size = pSystem->GetNumberOfStateVariables();
+    const double sqrt_eps = std::sqrt(DBL_EPSILON);
+    pSystem->EvaluateYDerivatives(time, y, ydot);
+    for (unsigned j=0; j<size; ++j)
+    {
+        const double y_j = NV_Ith_S(y, j);
+        const double increment = sqrt_eps * std::max(std::fabs(y_j), 1.0);
+        NV_Ith_S(y, j) = y_j + increment;
+        pSystem->EvaluateYDerivatives(time, y, perturbedYdot);
+        NV_Ith_S(y, j) = y_j;
+        for (unsigned i=0; i<size; ++i)
+        {
+            rJacobian[j*size + i] = (NV_Ith_S(perturbedYdot, i) - NV_Ith_S(ydot, i)) / increment;
+        }
+    }
+}
+
+
+CvodeJacobianInfo::CvodeJacobianInfo(AbstractCvodeSystem* pSystem, double time)
+    : mNumEntries(0u),
+      mNumNonZeros(0u),
+      mAnalyticSpeedup(DOUBLE_UNSET)
+{
+    const unsigned size = pSystem->GetNumberOfStateVariables();
+    mNumEntries = size * size;
+    // Work on a copy of the state, so the model is unaffected
+    N_Vector y = N_VNew_Serial(size);
+    N_Vector ydot = N_VNew_Serial(size);
+    N_Vector perturbed_ydot = N_VNew_Serial(size);
+    const N_Vector& r_state = pSystem->rGetStateVariables();
+    for (unsigned i=0; i<size; ++i)
+    {
+        NV_Ith_S(y, i) = NV_Ith_S(r_state, i);
+    }
+    std::vector<double> numerical_jacobian(mNumEntries);
+    EvaluateNumericalJacobian(pSystem, time, y, ydot, perturbed_ydot, numerical_jacobian);
+
+    if (!pSystem->HasAnalyticJacobian())
+    {
+        mNumNonZeros = mNumEntries - std::count(numerical_jacobian.begin(), numerical_jacobian.end(), 0.0);
+    }
+    else
+    {
+#if CHASTE_SUNDIALS_VERSION >= 20400
+        CHASTE_CVODE_DENSE_MATRIX jacobian = NewDenseMat(size, size);
+#else
+        CHASTE_CVODE_DENSE_MATRIX jacobian = DenseAllocMat(size, size);
+#endif
+        N_Vector tmp1 = N_VNew_Serial(size);
+        N_Vector tmp2 = N_VNew_Serial(size);
+        N_Vector tmp3 = N_VNew_Serial(size);
+
+        // Time each way of evaluating the Jacobian, repeating it enough times to measure reliably
+        unsigned num_evaluations = 0u;
+        double start_time = MPI_Wtime();
+        double numerical_time;
+        do
+        {
+            EvaluateNumericalJacobian(pSystem, time, y, ydot, perturbed_ydot, numerical_jacobian);
+            ++num_evaluations;
+            numerical_time = MPI_Wtime() - start_time;
+        }
+        while (numerical_time < MIN_TIMING_DURATION);
+        numerical_time /= num_evaluations;
+
+        num_evaluations = 0u;
+        start_time = MPI_Wtime();
+        double analytic_time;
+        do
+        {
+            // CVODE zeroes the matrix before asking for the Jacobian, so only non-zeros need be filled in
+#if CHASTE_SUNDIALS_VERSION >= 20400
+            SetToZero(jacobian);
+#else
+            DenseZero(jacobian);
+#endif
+            pSystem->EvaluateYDerivatives(time, y, ydot);
+            pSystem->EvaluateAnalyticJacobian(time, y, ydot, jacobian, tmp1, tmp2, tmp3);
+            ++num_evaluations;
+            analytic_time = MPI_Wtime() - start_time;
+        }
+        while (analytic_time < MIN_TIMING_DURATION);
+        analytic_time /= num_evaluations;
+        mAnalyticSpeedup = numerical_time / analytic_time;
+
+        for (unsigned j=0; j<size; ++j)
+        {
+            for (unsigned i=0; i<size; ++i)
+            {
+                if (DENSE_ELEM(jacobian, i, j) != 0.0)
+                {
+                    ++mNumNonZeros;
+                }
+            }
+        }
+
+        DeleteVector(tmp1);
+        DeleteVector(tmp2);
+        DeleteVector(tmp3);
+#if CHASTE_SUNDIALS_VERSION >= 20400
+        DestroyMat(jacobian);
+#else
+        DenseFreeMat(jacobian);
+#endif
+    }
+
+    DeleteVector(y);
+    DeleteVector(ydot);
+    DeleteVector(perturbed_ydot);
+}
+
+
+unsigned CvodeJacobianInfo::GetNumEntries() const
+{
+    return mNumEntries;
+}
+
+
+unsigned CvodeJacobianInfo::GetNumNonZeros() const
+{
+    return mNumNonZeros;
+}
+
+
+double CvodeJacobianInfo::GetAnalyticSpeedup() const
+{
+    return mAnalyticSpeedup;
+}
+
+#endif // CHASTE_CVODE
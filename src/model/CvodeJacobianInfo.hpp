@@ -0,0 +1,84 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+#ifndef CVODEJACOBIANINFO_HPP_
+#define CVODEJACOBIANINFO_HPP_
+
+#ifdef CHASTE_CVODE
+
+#include "AbstractCvodeSystem.hpp"
+
+/**
+ * Measures the Jacobian of a model solved using CVODE at its current state, to help choose how CVODE
+ * should form and solve its linear systems (see AbstractSystemWithOutputs::SolverSettings): how many
+ * of its entries are non-zero, and, if the model has an analytic Jacobian, how much faster that is to
+ * evaluate than the difference quotient approximation CVODE otherwise makes.
+ */
+class CvodeJacobianInfo
+{
+public:
+    /**
+     * Measure the Jacobian.  The model's state is left unchanged.
+     *
+     * @param pSystem  the model
+     * @param time  the value of the free variable at which to evaluate the Jacobian
+     */
+    CvodeJacobianInfo(AbstractCvodeSystem* pSystem, double time);
+
+    /** @return  the number of entries in the Jacobian, i.e. the square of the number of state variables */
+    unsigned GetNumEntries() const;
+
+    /** @return  the number of entries in the Jacobian that are non-zero at the state measured */
+    unsigned GetNumNonZeros() const;
+
+    /**
+     * @return  how many times faster the model's analytic Jacobian is to evaluate than a difference
+     * quotient approximation, or DOUBLE_UNSET if it has no analytic Jacobian
+     */
+    double GetAnalyticSpeedup() const;
+
+private:
+    /** The number of entries in the Jacobian. */
+    unsigned mNumEntries;
+
+    /** The number of non-zero entries in the Jacobian. */
+    unsigned mNumNonZeros;
+
+    /** How many times faster the analytic Jacobian is to evaluate, if the model has one. */
+    double mAnalyticSpeedup;
+};
+
+#endif // CHASTE_CVODE
+
+#endif // CVODEJACOBIANINFO_HPP_
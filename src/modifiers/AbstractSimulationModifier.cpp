@@ -85,3 +85,8 @@ bool AbstractSimulationModifier::IsReset() const
 {
     return false;
 }
+
+
+void AbstractSimulationModifier::CollectExpressions(std::vector<AbstractExpressionPtr>& rExpressions) const
+{
+}
@@ -111,6 +111,14 @@ public:
      */
     virtual bool IsReset() const;
 
+    /**
+     * Get the protocol language expressions this modifier evaluates, so callers can determine
+     * which names it may reference.  The default implementation gives none.
+     *
+     * @param rExpressions  the expressions will be appended to this vector
+     */
+    virtual void CollectExpressions(std::vector<AbstractExpressionPtr>& rExpressions) const;
+
 protected:
     /**
      * Method subclasses must supply which really implements the modification.
@@ -37,6 +37,7 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <boost/pointer_cast.hpp> // NB: Not available on Boost 1.33.1
 
+#include "AbstractSystemWithOutputs.hpp"
 #include "VectorHelperFunctions.hpp"
 
 /** Opaque model state type. */
@@ -58,9 +59,11 @@ public:
     /**
      * Create a new state from a state vector.
      * @param rStateVector  the vector of state variables
+     * @param solverStepSize  the step size the model's solver had reached, or 0 if unknown
      */
-    ModelState(const VECTOR& rStateVector)
-        : mStateVector(rStateVector)
+    ModelState(const VECTOR& rStateVector, double solverStepSize)
+        : mStateVector(rStateVector),
+          mSolverStepSize(solverStepSize)
     {}
 
     /**
@@ -71,6 +74,14 @@ public:
         return mStateVector;
     }
 
+    /**
+     * Get the step size the model's solver had reached when the state was saved, or 0 if unknown.
+     */
+    double GetSolverStepSize() const
+    {
+        return mSolverStepSize;
+    }
+
     /**
      * Delete the encapsulated vector, if required.
      */
@@ -82,6 +93,9 @@ public:
 private:
     /** The encapsulated state vector. */
     VECTOR mStateVector;
+
+    /** The step size the model's solver had reached, so solving from this state can resume warm. */
+    double mSolverStepSize;
 };
 
 
@@ -90,7 +104,13 @@ void ModelStateCollection::SaveState(const std::string& rName,
                                      const boost::shared_ptr<AbstractParameterisedSystem<VECTOR> > pModel)
 {
     const VECTOR state_vec = pModel->GetStateVariables();
-    boost::shared_ptr<ModelStateCollection::AbstractModelState> p_state(new ModelState<VECTOR>(state_vec));
+    double solver_step_size = 0.0;
+    AbstractSystemWithOutputs* p_system = dynamic_cast<AbstractSystemWithOutputs*>(pModel.get());
+    if (p_system)
+    {
+        solver_step_size = p_system->GetSolverStepSize();
+    }
+    boost::shared_ptr<ModelStateCollection::AbstractModelState> p_state(new ModelState<VECTOR>(state_vec, solver_step_size));
     mStates[rName] = p_state;
 }
 
@@ -101,6 +121,11 @@ void ModelStateCollection::SetModelState(boost::shared_ptr<AbstractParameterised
 {
     boost::shared_ptr<ModelState<VECTOR> > p_state = boost::dynamic_pointer_cast<ModelState<VECTOR> >(mStates[rName]);
     pModel->SetStateVariables(p_state->rGetStateVector());
+    AbstractSystemWithOutputs* p_system = dynamic_cast<AbstractSystemWithOutputs*>(pModel.get());
+    if (p_system && p_state->GetSolverStepSize() > 0.0)
+    {
+        p_system->SetInitialSolverStepSize(p_state->GetSolverStepSize());
+    }
 }
 
 
@@ -45,6 +45,10 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 /**
  * A collection of saved model states that can be applied back to the model.
+ *
+ * If the model has warm restarts enabled (see AbstractSystemWithOutputs::SetWarmRestarts), the step
+ * size its solver had reached is saved with each state, and used to restart the solver when the
+ * state is restored.
  */
 class ModelStateCollection : private boost::noncopyable
 {
@@ -83,3 +83,12 @@ void ModifierCollection::ApplyAtEnd(boost::shared_ptr<AbstractSystemWithOutputs>
         (*it)->ApplyAtEnd(pModel, pStepper);
     }
 }
+
+
+void ModifierCollection::CollectExpressions(std::vector<AbstractExpressionPtr>& rExpressions) const
+{
+    for (Collection::const_iterator it = mModifiers.begin(); it != mModifiers.end(); ++it)
+    {
+        (*it)->CollectExpressions(rExpressions);
+    }
+}
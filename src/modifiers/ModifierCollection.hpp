@@ -105,6 +105,13 @@ public:
     void ApplyAtEnd(boost::shared_ptr<AbstractSystemWithOutputs> pModel,
                     AbstractStepperPtr pStepper);
 
+    /**
+     * Get the protocol language expressions evaluated by any modifier in this collection.
+     *
+     * @param rExpressions  the expressions will be appended to this vector
+     */
+    void CollectExpressions(std::vector<AbstractExpressionPtr>& rExpressions) const;
+
 private:
     /** To reduce typing. */
     typedef std::vector<AbstractSimulationModifierPtr> Collection;
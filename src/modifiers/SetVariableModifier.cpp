@@ -71,3 +71,9 @@ void SetVariableModifier::ReallyApply(boost::shared_ptr<AbstractSystemWithOutput
 
     pStepper->rGetEnvironment().OverwriteDefinition(mVariableName, p_value, GetLocationInfo());
 }
+
+
+void SetVariableModifier::CollectExpressions(std::vector<AbstractExpressionPtr>& rExpressions) const
+{
+    rExpressions.push_back(mpValueExpression);
+}
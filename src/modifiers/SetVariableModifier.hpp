@@ -58,6 +58,13 @@ public:
                         const std::string& rVariableName,
                         const AbstractExpressionPtr pValue);
 
+    /**
+     * Get the protocol language expressions this modifier evaluates, i.e. the value to set.
+     *
+     * @param rExpressions  the expressions will be appended to this vector
+     */
+    void CollectExpressions(std::vector<AbstractExpressionPtr>& rExpressions) const;
+
 private:
     /**
      * Apply this modification to the model.
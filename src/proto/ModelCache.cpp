@@ -0,0 +1,318 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "ModelCache.hpp"
+
+#include <algorithm>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <utility>
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+#include <boost/regex.hpp>
+
+#include "ChasteBuildInfo.hpp"
+#include "Exception.hpp"
+#include "Warnings.hpp"
+#include "HashText.hpp"
+
+namespace fs = boost::filesystem;
+
+/** Changing this invalidates all cache entries, e.g. if the interface generated models must implement changes. */
+const char* MODEL_CACHE_FORMAT_VERSION = "1";
+
+const boost::uint64_t ModelCache::DEFAULT_MAX_SIZE = 1024ull * 1024ull * 1024ull;
+
+const std::string ModelCache::INFO_FILE_NAME = "info.txt";
+
+/**
+ * Add the content of a file to the text to hash for a cache key, followed by the content of any files it
+ * references, recursively.  References are the source attributes of protocol imports and nested protocols,
+ * and the xlink:href attributes of CellML imports.  Their values are left out of the text, since only the
+ * content of the files referred to matters, and converted text syntax protocols are given temporary names.
+ *
+ * @param rPath  the file
+ * @param rText  the text to add to
+ * @param rSeen  the files added already, so each is added once
+ */
+static void AddFileContent(const fs::path& rPath, std::ostringstream& rText, std::set<fs::path>& rSeen)
+{
+    if (!rSeen.insert(rPath).second)
+    {
+        return;
+    }
+    std::ifstream file(rPath.string().c_str());
+    if (!file.is_open())
+    {
+        // The converter will report this
+        rText << "<missing file " << rPath.filename().string() << ">\n";
+        return;
+    }
+    std::stringstream content;
+    content << file.rdbuf();
+    const std::string text = content.str();
+    const boost::regex reference("\\b(source|xlink:href)\\s*=\\s*(\"([^\"]*)\"|'([^']*)')");
+    rText << boost::regex_replace(text, reference, "$1=\"\"") << "\n";
+    for (boost::sregex_iterator it(text.begin(), text.end(), reference); it != boost::sregex_iterator(); ++it)
+    {
+        std::string uri = (*it)[3].matched ? (*it)[3].str() : (*it)[4].str();
+        if (uri.substr(0, 7) == "file://")
+        {
+            uri = uri.substr(7);
+        }
+        if (uri.empty())
+        {
+            continue;
+        }
+        else if (uri.find("://") != std::string::npos)
+        {
+            rText << "<remote file " << uri << ">\n";
+        }
+        else
+        {
+            fs::path referenced(uri);
+            if (referenced.is_relative())
+            {
+                referenced = rPath.parent_path() / referenced;
+            }
+            AddFileContent(referenced, rText, rSeen);
+        }
+    }
+}
+
+
+ModelCache::ModelCache(const FileFinder& rFolder, boost::uint64_t maxSize)
+    : mFolder(rFolder),
+      mMaxSize(maxSize)
+{
+    boost::system::error_code error;
+    fs::create_directories(mFolder.GetAbsolutePath(), error);
+    if (!mFolder.IsDir())
+    {
+        EXCEPTION("Unable to create model cache folder " << mFolder.GetAbsolutePath() << ".");
+    }
+}
+
+
+std::string ModelCache::GetKey(const FileFinder& rModelFile,
+                               const FileFinder& rProtocolFile,
+                               const std::vector<std::string>& rOptions)
+{
+    std::ostringstream text;
+    text << MODEL_CACHE_FORMAT_VERSION << "\n"
+         << ChasteBuildInfo::GetVersionString() << " " << ChasteBuildInfo::GetBuildTime() << "\n"
+         << ChasteBuildInfo::GetBuildInformation() << "\n"
+         << ChasteBuildInfo::GetCompilerType() << " " << ChasteBuildInfo::GetCompilerVersion() << "\n"
+         << ChasteBuildInfo::GetCompilerFlags() << "\n";
+    BOOST_FOREACH(const std::string& r_option, rOptions)
+    {
+        // The protocol is often a temporary file converted from text syntax, so only its content counts
+        if (r_option.substr(0, 11) != "--protocol=")
+        {
+            text << r_option << "\n";
+        }
+    }
+    // Generated files and classes are named after the model file
+    text << rModelFile.GetLeafNameNoExtension() << "\n";
+    std::set<fs::path> seen;
+    AddFileContent(rModelFile.GetAbsolutePath(), text, seen);
+    AddFileContent(rProtocolFile.GetAbsolutePath(), text, seen);
+    return HashText(text.str());
+}
+
+
+bool ModelCache::Fetch(const std::string& rKey, const std::string& rModelName, const OutputFileHandler& rHandler)
+{
+    return FetchFiles(rKey, GetEntryFileNames(rModelName),
+                      FileFinder(rHandler.GetOutputDirectoryFullPath(), RelativeTo::Absolute));
+}
+
+
+void ModelCache::Store(const std::string& rKey, const std::string& rModelName, const OutputFileHandler& rHandler,
+                       const std::string& rDescription)
+{
+    StoreFiles(rKey, GetEntryFileNames(rModelName),
+               FileFinder(rHandler.GetOutputDirectoryFullPath(), RelativeTo::Absolute),
+               "model: " + rModelName + "\n" + rDescription);
+}
+
+
+bool ModelCache::FetchFiles(const std::string& rKey, const std::vector<std::string>& rFileNames,
+                            const FileFinder& rFolder)
+{
+    const fs::path entry = fs::path(mFolder.GetAbsolutePath()) / rKey;
+    const fs::path output = rFolder.GetAbsolutePath();
+    boost::system::error_code error;
+    if (!fs::exists(entry / INFO_FILE_NAME, error))
+    {
+        return false;
+    }
+    // If the entry is evicted while we copy it, the caller just builds the files as usual
+    BOOST_FOREACH(const std::string& r_name, rFileNames)
+    {
+        fs::copy_file(entry / r_name, output / r_name, fs::copy_option::overwrite_if_exists, error);
+        if (error)
+        {
+            return false;
+        }
+    }
+    fs::last_write_time(entry / INFO_FILE_NAME, std::time(NULL), error);
+    return true;
+}
+
+
+void ModelCache::StoreFiles(const std::string& rKey, const std::vector<std::string>& rFileNames,
+                            const FileFinder& rFolder, const std::string& rInfo)
+{
+    const fs::path folder = mFolder.GetAbsolutePath();
+    const fs::path output = rFolder.GetAbsolutePath();
+    boost::system::error_code error;
+    if (fs::exists(folder / rKey, error))
+    {
+        return; // Another process got there first
+    }
+    // Build the entry under a temporary name then rename it, so other processes never see a partial entry
+    const fs::path temp = folder / (rKey + "." + fs::unique_path().string() + ".tmp");
+    fs::create_directory(temp, error);
+    BOOST_FOREACH(const std::string& r_name, rFileNames)
+    {
+        if (!error)
+        {
+            fs::copy_file(output / r_name, temp / r_name, error);
+        }
+    }
+    if (!error)
+    {
+        std::ofstream info((temp / INFO_FILE_NAME).string().c_str());
+        info << rInfo;
+        info.close();
+        if (info.fail())
+        {
+            error = boost::system::errc::make_error_code(boost::system::errc::io_error);
+        }
+    }
+    if (!error)
+    {
+        fs::rename(temp, folder / rKey, error);
+        boost::system::error_code ignored;
+        if (error && fs::exists(folder / rKey, ignored))
+        {
+            error.clear(); // Another process got there first
+        }
+    }
+    if (error)
+    {
+        WARNING("Unable to store " << rFileNames.front() << " in the cache at " << folder.string()
+                << ": " << error.message());
+    }
+    fs::remove_all(temp, error); // In case the rename failed
+    Prune(mMaxSize, rKey);
+}
+
+
+const FileFinder& ModelCache::rGetFolder() const
+{
+    return mFolder;
+}
+
+
+unsigned ModelCache::Prune(boost::uint64_t maxSize, const std::string& rKeep)
+{
+    // Find the complete entries, their sizes, and when they were last used
+    typedef std::pair<std::time_t, fs::path> TimePathPair;
+    std::vector<TimePathPair> entries;
+    std::map<fs::path, boost::uint64_t> sizes;
+    boost::uint64_t total_size = 0u;
+    boost::system::error_code error;
+    for (fs::directory_iterator it(mFolder.GetAbsolutePath(), error); !error && it != fs::directory_iterator(); it.increment(error))
+    {
+        const fs::path entry = it->path();
+        const std::time_t last_used = fs::last_write_time(entry / INFO_FILE_NAME, error);
+        if (error || entry.filename().string().find('.') != std::string::npos)
+        {
+            error.clear();
+            continue; // Not a complete entry
+        }
+        boost::uint64_t size = 0u;
+        for (fs::recursive_directory_iterator file_it(entry, error); !error && file_it != fs::recursive_directory_iterator(); file_it.increment(error))
+        {
+            if (fs::is_regular_file(file_it->status()))
+            {
+                size += fs::file_size(file_it->path(), error);
+            }
+        }
+        error.clear();
+        entries.push_back(std::make_pair(last_used, entry));
+        sizes[entry] = size;
+        total_size += size;
+    }
+    // Evict the least recently used first, renaming each out of the way in case other processes are pruning too
+    std::sort(entries.begin(), entries.end());
+    unsigned num_evicted = 0u;
+    BOOST_FOREACH(const TimePathPair& r_entry, entries)
+    {
+        if (total_size <= maxSize)
+        {
+            break;
+        }
+        if (r_entry.second.filename().string() == rKeep)
+        {
+            continue;
+        }
+        const fs::path doomed = r_entry.second.string() + "." + fs::unique_path().string() + ".deleting";
+        fs::rename(r_entry.second, doomed, error);
+        if (!error)
+        {
+            fs::remove_all(doomed, error);
+            ++num_evicted;
+        }
+        error.clear();
+        total_size -= sizes[r_entry.second];
+    }
+    return num_evicted;
+}
+
+
+std::vector<std::string> ModelCache::GetEntryFileNames(const std::string& rModelName)
+{
+    std::vector<std::string> names;
+    names.push_back("lib" + rModelName + ".so");
+    names.push_back(rModelName + ".hpp");
+    names.push_back(rModelName + ".cpp");
+    return names;
+}
@@ -0,0 +1,171 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef MODELCACHE_HPP_
+#define MODELCACHE_HPP_
+
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+#include "FileFinder.hpp"
+#include "OutputFileHandler.hpp"
+
+/**
+ * A persistent cache of the shared libraries built from CellML models, so that a model need only be
+ * converted and compiled once for each protocol, rather than on every run.
+ *
+ * Entries are named by a hash (see GetKey) of everything that affects the generated code: the CellML
+ * file and any files it imports, the protocol and any protocols it imports or nests (which together
+ * define the model interface), the options given to the converter, and the Chaste build.  Each entry is
+ * a subfolder of the cache folder holding the library, the generated source code, and an information
+ * file describing where it came from.  The libraries ProtocolCompiler builds from protocol functions
+ * may be kept in the same cache, using FetchFiles and StoreFiles.
+ *
+ * Many processes may share a cache, even on different machines.  Entries are built under a temporary
+ * name and renamed into place, and are renamed out of the way before being deleted, so no process ever
+ * sees a partial entry.  Fetching an entry copies its files into the caller's output folder, so an
+ * entry may be evicted while the model built from it is in use.
+ *
+ * Each use of an entry updates the modification time of its information file.  Whenever storing an
+ * entry takes the total size of the cache over its limit, the least recently used entries are evicted.
+ * The apps/ModelCache.py script lists the entries in a cache, and prunes or clears it.
+ */
+class ModelCache
+{
+public:
+    /**
+     * Create a cache, creating its folder if need be.
+     *
+     * @param rFolder  the folder holding the cache
+     * @param maxSize  the size in bytes above which least recently used entries are evicted
+     */
+    ModelCache(const FileFinder& rFolder, boost::uint64_t maxSize=DEFAULT_MAX_SIZE);
+
+    /**
+     * Compute the key of the cache entry for the library built from a model for a given protocol.
+     *
+     * @param rModelFile  the model CellML file
+     * @param rProtocolFile  the protocol definition file, in XML syntax
+     * @param rOptions  the options given to the converter
+     * @return  the key
+     */
+    static std::string GetKey(const FileFinder& rModelFile,
+                              const FileFinder& rProtocolFile,
+                              const std::vector<std::string>& rOptions);
+
+    /**
+     * Copy the library and generated code stored with the given key, if there are any, into an output
+     * folder, and note that the entry has been used.
+     *
+     * @param rKey  the entry key, from GetKey
+     * @param rModelName  the name of the model, which the files are named after
+     * @param rHandler  the output folder
+     * @return  whether the files were found and copied
+     */
+    bool Fetch(const std::string& rKey, const std::string& rModelName, const OutputFileHandler& rHandler);
+
+    /**
+     * Store a newly built library and its generated code with the given key, then evict least recently
+     * used entries if the cache has grown too big.  If another process has already stored the entry,
+     * or the files can't be stored, nothing is changed; failures give a warning.
+     *
+     * @param rKey  the entry key, from GetKey
+     * @param rModelName  the name of the model, which the files are named after
+     * @param rHandler  the output folder the files were built in
+     * @param rDescription  where the entry came from, for listing the cache contents
+     */
+    void Store(const std::string& rKey, const std::string& rModelName, const OutputFileHandler& rHandler,
+               const std::string& rDescription);
+
+    /**
+     * Copy the given files from the entry with the given key, if there is one, into a folder, and note
+     * that the entry has been used.  This is how other kinds of build product (e.g. see ProtocolCompiler)
+     * share the cache with models.
+     *
+     * @param rKey  the entry key, which must not contain dots
+     * @param rFileNames  the names of the files to copy
+     * @param rFolder  the folder to copy them to
+     * @return  whether the entry was found and all the files copied
+     */
+    bool FetchFiles(const std::string& rKey, const std::vector<std::string>& rFileNames, const FileFinder& rFolder);
+
+    /**
+     * Store the given files from a folder as the entry with the given key, then evict least recently
+     * used entries if the cache has grown too big.  As with Store, nothing is changed if the entry
+     * exists already, and failures give a warning.
+     *
+     * @param rKey  the entry key, which must not contain dots
+     * @param rFileNames  the names of the files to store; there must be at least one
+     * @param rFolder  the folder holding them
+     * @param rInfo  the content of the entry's information file, as "name: value" lines; the "model"
+     *     and "protocol" values are shown when listing the cache contents
+     */
+    void StoreFiles(const std::string& rKey, const std::vector<std::string>& rFileNames,
+                    const FileFinder& rFolder, const std::string& rInfo);
+
+    /** Get the folder holding the cache. */
+    const FileFinder& rGetFolder() const;
+
+    /**
+     * Evict least recently used entries until the cache is no bigger than the given size.
+     *
+     * @param maxSize  the size in bytes to shrink the cache to
+     * @param rKeep  the key of an entry never to evict, if any
+     * @return  the number of entries evicted
+     */
+    unsigned Prune(boost::uint64_t maxSize, const std::string& rKeep="");
+
+    /** The default size limit of a cache: 1 GiB. */
+    static const boost::uint64_t DEFAULT_MAX_SIZE;
+
+    /** The name of the information file in each cache entry, whose modification time records its last use. */
+    static const std::string INFO_FILE_NAME;
+
+private:
+    /** The folder holding the cache. */
+    FileFinder mFolder;
+
+    /** The size in bytes above which least recently used entries are evicted. */
+    boost::uint64_t mMaxSize;
+
+    /**
+     * @return  the names of the files kept in a cache entry
+     * @param rModelName  the name of the model, which the files are named after
+     */
+    static std::vector<std::string> GetEntryFileNames(const std::string& rModelName);
+};
+
+#endif // MODELCACHE_HPP_
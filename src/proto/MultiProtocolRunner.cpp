@@ -39,7 +39,9 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <string>
 #include <cstdlib> // For setenv()
 #include <iostream>
+#include <boost/cstdint.hpp>
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
 
 #include "CommandLineArguments.hpp"
 #include "OutputFileHandler.hpp"
@@ -47,6 +49,7 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "Warnings.hpp"
 
 #include "ProtocolRunner.hpp"
+#include "ModelCache.hpp"
 
 /**
  * Utility method to find any command line arguments that aren't associated with our options.
@@ -62,7 +65,8 @@ std::vector<std::string> GetNonOptionArguments()
         bool is_opt = (arg.substr(0, 2) == "--");
         if (is_opt)
         {
-            if (arg == "--models" || arg == "--protocols" || arg == "--output-dir")
+            if (arg == "--models" || arg == "--protocols" || arg == "--output-dir"
+                || arg == "--model-cache" || arg == "--model-cache-size")
             {
                 ignore_next = true;
             }
@@ -180,6 +184,78 @@ void MultiProtocolRunner::RunProtocols()
     // Determine whether to write PNG graphs
     bool png_output = CommandLineArguments::Instance()->OptionExists("--png");
 
+    // Determine whether to cache results of pure function calls
+    bool memoise = CommandLineArguments::Instance()->OptionExists("--memoise");
+
+    // Determine how many threads to use for simulation loops and post-processing
+    unsigned num_threads = 1u;
+    if (CommandLineArguments::Instance()->OptionExists("--threads"))
+    {
+        num_threads = CommandLineArguments::Instance()->GetUnsignedCorrespondingToOption("--threads");
+    }
+
+    // Determine how many independent simulation loop iterations to run together
+    unsigned ensemble_size = 1u;
+    if (CommandLineArguments::Instance()->OptionExists("--ensemble"))
+    {
+        ensemble_size = CommandLineArguments::Instance()->GetUnsignedCorrespondingToOption("--ensemble");
+    }
+
+    // Determine whether to optimise protocol library and post-processing programs
+    bool optimise = CommandLineArguments::Instance()->OptionExists("--optimise");
+
+    // Determine whether to check post-processing programs before simulating
+    bool check_shapes = CommandLineArguments::Instance()->OptionExists("--check-shapes");
+
+    // Determine whether to evaluate protocol definitions only when needed
+    bool lazy = CommandLineArguments::Instance()->OptionExists("--lazy");
+
+    // Determine whether simulations should record only the model outputs that protocols refer to
+    bool prune_outputs = CommandLineArguments::Instance()->OptionExists("--prune-outputs");
+
+    // Determine whether to compile protocol functions to native code
+    bool compile = CommandLineArguments::Instance()->OptionExists("--compile");
+
+    // Determine whether to use specialised simulation loops
+    bool native_loops = CommandLineArguments::Instance()->OptionExists("--native-loops");
+
+    // Determine whether to skip assertions in imported libraries
+    bool trust_libraries = CommandLineArguments::Instance()->OptionExists("--trust-libraries");
+
+    // Determine whether to generate analytic Jacobians for models
+    bool analytic_jacobian = CommandLineArguments::Instance()->OptionExists("--analytic-jacobian");
+
+    // Determine whether saved model states should include the solver's step size
+    bool warm_restarts = CommandLineArguments::Instance()->OptionExists("--warm-restarts");
+
+    // Determine how to solve models
+    ProtocolRunner::SolverBackend solver = ProtocolRunner::CVODE;
+    if (CommandLineArguments::Instance()->OptionExists("--solver"))
+    {
+        solver = ProtocolRunner::GetSolverBackend(CommandLineArguments::Instance()->GetStringCorrespondingToOption("--solver"));
+    }
+
+    // Determine how CVODE should solve its linear systems
+    ProtocolRunner::LinearSolver linear_solver = ProtocolRunner::DENSE;
+    if (CommandLineArguments::Instance()->OptionExists("--linear-solver"))
+    {
+        linear_solver = ProtocolRunner::GetLinearSolver(CommandLineArguments::Instance()->GetStringCorrespondingToOption("--linear-solver"));
+    }
+
+    // Determine whether to keep the libraries built from models for use by later runs
+    FileFinder model_cache_folder;
+    boost::uint64_t model_cache_size = ModelCache::DEFAULT_MAX_SIZE;
+    if (CommandLineArguments::Instance()->OptionExists("--model-cache"))
+    {
+        model_cache_folder.SetPath(CommandLineArguments::Instance()->GetStringCorrespondingToOption("--model-cache"),
+                                   RelativeTo::AbsoluteOrCwd);
+        if (CommandLineArguments::Instance()->OptionExists("--model-cache-size"))
+        {
+            model_cache_size = CommandLineArguments::Instance()->GetUnsignedCorrespondingToOption("--model-cache-size")
+                               * 1024ull * 1024ull;
+        }
+    }
+
     // Check arguments
     if (protocols.empty())
     {
@@ -197,6 +273,21 @@ void MultiProtocolRunner::RunProtocols()
     {
         OutputFileHandler sub_handler(base_handler.FindFile(r_model.GetLeafNameNoExtension()), false);
     }
+    boost::shared_ptr<ModelCache> p_model_cache;
+    if (model_cache_folder.IsPathSet())
+    {
+        p_model_cache.reset(new ModelCache(model_cache_folder, model_cache_size));
+    }
+    // Compiled code is shared by all runs of a protocol, whichever model it is run on, and kept for later runs
+    boost::shared_ptr<ModelCache> p_compiled_code_cache;
+    if (compile)
+    {
+        p_compiled_code_cache = p_model_cache;
+        if (!p_compiled_code_cache)
+        {
+            p_compiled_code_cache.reset(new ModelCache(base_handler.FindFile("compiled_protocols")));
+        }
+    }
     PetscTools::IsolateProcesses(true);
 
     // Run protocols
@@ -216,8 +307,45 @@ void MultiProtocolRunner::RunProtocols()
 
             try
             {
-                ProtocolRunner runner(r_model, r_protocol, sub_output_folder.GetRelativePath(chaste_test_output));
+                ProtocolRunner runner(r_model, r_protocol, sub_output_folder.GetRelativePath(chaste_test_output),
+                                      false, analytic_jacobian, solver, p_model_cache, linear_solver);
                 runner.SetPngOutput(png_output);
+                if (memoise)
+                {
+                    runner.GetProtocol()->SetMemoisation();
+                }
+                runner.GetProtocol()->SetNumPostProcessingThreads(num_threads);
+                runner.GetProtocol()->SetNumSimulationThreads(num_threads);
+                runner.GetProtocol()->SetSimulationEnsembleSize(ensemble_size);
+                runner.GetProtocol()->SetNativeSimulationLoops(native_loops);
+                if (optimise)
+                {
+                    runner.GetProtocol()->SetOptimisation();
+                }
+                if (check_shapes)
+                {
+                    runner.GetProtocol()->SetShapeChecking();
+                }
+                if (lazy)
+                {
+                    runner.GetProtocol()->SetLazyEvaluation();
+                }
+                if (prune_outputs)
+                {
+                    runner.GetProtocol()->SetOutputPruning();
+                }
+                if (compile)
+                {
+                    runner.GetProtocol()->SetCompilation(p_compiled_code_cache);
+                }
+                if (trust_libraries)
+                {
+                    runner.GetProtocol()->SetTrustedImports();
+                }
+                if (warm_restarts)
+                {
+                    runner.GetProtocol()->GetModel()->SetWarmRestarts(true);
+                }
                 runner.RunProtocol();
             }
             catch (const Exception& r_e)
@@ -52,6 +52,38 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  *  - --protocols <path/to/proto/1.xml> <path/to/proto/2.txt> ...
  *    Relative paths for both models and protocols are interpreted relative to the current folder.
  *  - --png - if present, save figures as PNG format as well as EPS
+ *  - --memoise - if present, cache the results of calls to pure library and post-processing functions
+ *  - --threads <n> - use n threads for independent iterations of nested simulation loops, each with its
+ *    own copy of the model, and for map, fold and array comprehensions over large arrays in post-processing
+ *  - --ensemble <n> - run n independent iterations of a nested simulation loop at a time, stepping copies
+ *    of the model through its timecourse in lock-step
+ *  - --optimise - if present, optimise protocol library and post-processing programs once their inputs
+ *    are known (see ProtocolOptimiser)
+ *  - --check-shapes - if present, check post-processing programs for errors that are certain to occur
+ *    before running simulations (see ShapeInference)
+ *  - --lazy - if present, evaluate protocol library definitions only when first used, and skip
+ *    post-processing statements that don't contribute to an output or assertion
+ *  - --prune-outputs - if present, have simulations record only the model outputs that the protocol
+ *    refers to
+ *  - --compile - if present, compile simple arithmetic protocol functions to native code, kept in the
+ *    model cache if one is given, or else a compiled_protocols subfolder of the output folder, so each
+ *    protocol is only compiled once
+ *  - --native-loops - if present, run simulations with fixed-length loops using specialised code that
+ *    records model outputs directly, avoiding per-step interpreter overheads
+ *  - --trust-libraries - if present, don't check assertions within imported protocol libraries, other
+ *    than cheap checks that array shapes match
+ *  - --analytic-jacobian - if present, generate analytic Jacobians for CVODE models, so the solver
+ *    needn't approximate them by finite differences
+ *  - --linear-solver dense|krylov - how CVODE should solve its linear systems, unless a protocol says
+ *    otherwise; krylov uses matrix-free GMRES, which suits large models with sparse Jacobians
+ *  - --warm-restarts - if present, save the CVODE solver's step size with model states, so solving can
+ *    restart from it when a state is restored
+ *  - --solver cvode|rush-larsen|grl1 - how to solve models; the fixed step methods are faster for stiff
+ *    cardiac models with gating variables, but less accurate than CVODE
+ *  - --model-cache <dir> - keep the libraries built from models (and from protocols, with --compile) in
+ *    the given folder, so later runs of the same model and protocol needn't build them again (see ModelCache)
+ *  - --model-cache-size <MB> - the size above which least recently used models are evicted from the
+ *    cache; defaults to 1024
  *  - --output-dir - base folder to save protocol outputs under.
  *    Results will be placed in a subfolder hierarchy named after the model and protocol leaf names.
  *    If the output-dir is a relative path, it will be treated relative to CHASTE_TEST_OUTPUT.
@@ -56,7 +56,12 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "ExceptionSet.hpp"
 #include "DebugProto.hpp"
 #include "ProtocolTimer.hpp"
+#include "ThreadPool.hpp"
 #include "FileLoader.hpp"
+#include "AssignmentStatement.hpp"
+#include "NestedSimulation.hpp"
+#include "OneStepSimulation.hpp"
+#include "TimecourseSimulation.hpp"
 
 // Typedefs for use with BOOST_FOREACH and std::maps
 typedef std::pair<std::string, std::string> StringPair;
@@ -68,7 +73,19 @@ Protocol::Protocol()
       mpLibrary(new Environment),
       mpModelStateCollection(new ModelStateCollection),
       mWritePng(false),
-      mParalleliseLoops(false)
+      mParalleliseLoops(false),
+      mBalanceLoad(false),
+      mNativeSimulationLoops(false),
+      mOptimise(false),
+      mNumPostProcessingThreads(1u),
+      mMinParallelIterations(1000u),
+      mNumSimulationThreads(1u),
+      mSimulationEnsembleSize(1u),
+      mCheckShapes(false),
+      mLazyEvaluation(false),
+      mPruneOutputs(false),
+      mTrustedLibrary(false),
+      mTrustedImports(false)
 {
     mpLibrary->SetDelegateeEnvironment(mpInputs->GetAsDelegatee());
 }
@@ -147,6 +164,7 @@ void Protocol::InitialiseLibrary(bool reinit)
 {
     if (reinit)
     {
+        mLibraryOptimiser.Restore();
         mpLibrary->Clear();
         mManifest.Clear();
     }
@@ -160,15 +178,502 @@ void Protocol::InitialiseLibrary(bool reinit)
     assert(library_size == 0 || library_size == mLibraryStatements.size());
     if (library_size == 0)
     {
-        mpLibrary->ExecuteStatements(mLibraryStatements);
+        PrepareLibrary();
+        BOOST_FOREACH(AbstractStatementPtr p_stmt, mLibraryStatements)
+        {
+            // Simple definitions can wait until they are used; others may have side effects
+            AssignmentStatement* p_assign = dynamic_cast<AssignmentStatement*>(p_stmt.get());
+            if (mLazyEvaluation && p_assign && p_assign->rGetNamesToAssign().size() == 1u
+                && !p_assign->GetTrace() && !p_assign->IsOptional())
+            {
+                mpLibrary->DefineLazily(p_assign->rGetNamesToAssign().front(), p_stmt, p_stmt->GetLocationInfo());
+            }
+            else
+            {
+                mpLibrary->ExecuteStatement(p_stmt);
+            }
+        }
+    }
+}
+
+
+void Protocol::PrepareLibrary()
+{
+    // Optimisations depend on the input values, so undo any made for previous values
+    mLibraryOptimiser.Restore();
+    ElideTrustedAssertions();
+    BOOST_FOREACH(StringProtoPair import, mImports)
+    {
+        mLibraryOptimiser.AddStablePrefix(import.first);
+    }
+    if (mOptimise)
+    {
+        mLibraryOptimiser.Optimise(mLibraryStatements, *mpLibrary, false);
+    }
+    if (mpMemoStatistics)
+    {
+        mLibraryOptimiser.EnableMemoisation(mLibraryStatements, mpMemoStatistics);
+    }
+    // Constant folding may have changed the code, so this comes last
+    mLibraryCompiler.Restore();
+    if (mpCompiledCodeCache)
+    {
+        mLibraryCompiler.Compile(mLibraryStatements, *mpCompiledCodeCache, GetCompiledCodeSource("library"));
     }
 }
 
 
-void Protocol::SetParalleliseLoops(bool paralleliseLoops)
+void Protocol::ElideTrustedAssertions()
+{
+    if (mTrustedLibrary)
+    {
+        mLibraryOptimiser.ElideAssertions(mLibraryStatements, 0u, mLibraryStatements.size());
+        return;
+    }
+    // Work backwards, since removing statements moves those after them
+    for (unsigned i=mImportedLibraries.size(); i-- > 0; )
+    {
+        const ImportedLibrary& r_import = mImportedLibraries[i];
+        if (mTrustedImports || r_import.trusted)
+        {
+            mLibraryOptimiser.ElideAssertions(mLibraryStatements, r_import.start, r_import.end);
+        }
+    }
+}
+
+
+void Protocol::SetParalleliseLoops(bool paralleliseLoops, bool balanceLoad)
 {
     // The last clause checks that process isolation isn't already active
     mParalleliseLoops = paralleliseLoops && PetscTools::IsParallel() && !PetscTools::IsSequential();
+    mBalanceLoad = balanceLoad;
+}
+
+
+void Protocol::SetNativeSimulationLoops(bool nativeLoops)
+{
+    mNativeSimulationLoops = nativeLoops;
+}
+
+
+void Protocol::SetOptimisation(bool optimise)
+{
+    // Imported libraries are optimised along with ours, so share the setting with them
+    std::vector<Protocol*> protocols(1u, this);
+    for (unsigned i=0; i<protocols.size(); ++i)
+    {
+        Protocol* p_proto = protocols[i];
+        p_proto->mOptimise = optimise;
+        if (!optimise)
+        {
+            p_proto->mLibraryOptimiser.Restore();
+            p_proto->mPostProcessingOptimiser.Restore();
+            p_proto->ElideTrustedAssertions();
+            if (p_proto->mpMemoStatistics)
+            {
+                p_proto->mLibraryOptimiser.EnableMemoisation(p_proto->mLibraryStatements, p_proto->mpMemoStatistics);
+            }
+        }
+        BOOST_FOREACH(StringProtoPair import, p_proto->mImports)
+        {
+            protocols.push_back(import.second.get());
+        }
+    }
+    if (optimise && mpLibrary->GetNumberOfDefinitions() > 0u)
+    {
+        // Existing definitions were made from the unoptimised library
+        InitialiseLibrary(true);
+    }
+}
+
+
+void Protocol::SetMemoisation(bool memoise, unsigned maxEntries)
+{
+    MemoCache::StatisticsPtr p_stats;
+    if (memoise)
+    {
+        p_stats.reset(new MemoCache::Statistics(maxEntries));
+    }
+    // Imported libraries' functions are called from ours, so share the setting with them
+    std::vector<Protocol*> protocols(1u, this);
+    for (unsigned i=0; i<protocols.size(); ++i)
+    {
+        protocols[i]->mpMemoStatistics = p_stats;
+        BOOST_FOREACH(StringProtoPair import, protocols[i]->mImports)
+        {
+            protocols.push_back(import.second.get());
+        }
+    }
+    if (mpLibrary->GetNumberOfDefinitions() > 0u)
+    {
+        // Existing closures were created with the old setting
+        InitialiseLibrary(true);
+    }
+}
+
+
+MemoCache::StatisticsPtr Protocol::GetMemoStatistics() const
+{
+    return mpMemoStatistics;
+}
+
+
+void Protocol::SetNumPostProcessingThreads(unsigned numThreads, unsigned minIterations)
+{
+    mNumPostProcessingThreads = numThreads;
+    mMinParallelIterations = minIterations;
+}
+
+
+void Protocol::SetNumSimulationThreads(unsigned numThreads)
+{
+    mNumSimulationThreads = numThreads;
+}
+
+
+void Protocol::SetSimulationEnsembleSize(unsigned ensembleSize)
+{
+    mSimulationEnsembleSize = ensembleSize;
+}
+
+
+std::string Protocol::GetCompiledCodeSource(const std::string& rProgram) const
+{
+    const std::string file = mSourceFilePath.IsPathSet() ? mSourceFilePath.GetAbsolutePath() : "<unknown>";
+    return file + " (" + rProgram + ")";
+}
+
+
+void Protocol::SetCompilation(boost::shared_ptr<ModelCache> pCache)
+{
+    // Imported libraries' functions are called from ours, so share the setting with them
+    std::vector<Protocol*> protocols(1u, this);
+    for (unsigned i=0; i<protocols.size(); ++i)
+    {
+        protocols[i]->mpCompiledCodeCache = pCache;
+        BOOST_FOREACH(StringProtoPair import, protocols[i]->mImports)
+        {
+            protocols.push_back(import.second.get());
+        }
+    }
+    if (mpLibrary->GetNumberOfDefinitions() > 0u)
+    {
+        // Existing closures were created with the old setting
+        InitialiseLibrary(true);
+    }
+}
+
+
+void Protocol::SetShapeChecking(bool checkShapes)
+{
+    mCheckShapes = checkShapes;
+}
+
+
+void Protocol::SetLazyEvaluation(bool lazy)
+{
+    // Imported libraries are where most unused definitions will be, so share the setting with them
+    std::vector<Protocol*> protocols(1u, this);
+    for (unsigned i=0; i<protocols.size(); ++i)
+    {
+        protocols[i]->mLazyEvaluation = lazy;
+        BOOST_FOREACH(StringProtoPair import, protocols[i]->mImports)
+        {
+            protocols.push_back(import.second.get());
+        }
+    }
+    if (mpLibrary->GetNumberOfDefinitions() > 0u)
+    {
+        // Existing definitions were made with the old setting
+        InitialiseLibrary(true);
+    }
+}
+
+
+void Protocol::SetOutputPruning(bool prune)
+{
+    mPruneOutputs = prune;
+}
+
+
+void Protocol::SetTrustedLibrary(bool trusted)
+{
+    mTrustedLibrary = trusted;
+    // The libraries we use are trusted if we are
+    SetTrustedImports(trusted);
+}
+
+
+void Protocol::SetTrustedImports(bool trusted)
+{
+    mTrustedImports = trusted;
+    std::vector<Protocol*> protocols;
+    BOOST_FOREACH(StringProtoPair import, mImports)
+    {
+        protocols.push_back(import.second.get());
+    }
+    for (unsigned i=0; i<protocols.size(); ++i)
+    {
+        protocols[i]->mTrustedLibrary = protocols[i]->mTrustedImports = trusted;
+        BOOST_FOREACH(StringProtoPair import, protocols[i]->mImports)
+        {
+            protocols.push_back(import.second.get());
+        }
+    }
+    if (mpLibrary->GetNumberOfDefinitions() > 0u)
+    {
+        // Existing closures were created with the old setting
+        InitialiseLibrary(true);
+    }
+}
+
+
+const std::map<std::string, NdArray<double>::Extents>& Protocol::rGetInferredShapes() const
+{
+    return mShapeInference.rGetInferredShapes();
+}
+
+
+/**
+ * @return  the innermost simulation of a (possibly nested) simulation.
+ * @param rSimulation  the simulation
+ * @param pInnermostReducer  if given, set to the innermost NestedSimulation that reduces the results of
+ *     each iteration, or NULL if there is none
+ */
+static AbstractSimulation* FindInnermostSimulation(AbstractSimulation& rSimulation,
+                                                   NestedSimulation** pInnermostReducer=NULL)
+{
+    AbstractSimulation* p_innermost = &rSimulation;
+    if (pInnermostReducer)
+    {
+        *pInnermostReducer = NULL;
+    }
+    while (NestedSimulation* p_nested = dynamic_cast<NestedSimulation*>(p_innermost))
+    {
+        if (pInnermostReducer && !p_nested->rGetReductions().empty())
+        {
+            *pInnermostReducer = p_nested;
+        }
+        p_innermost = p_nested->GetNestedSimulation().get();
+    }
+    return p_innermost;
+}
+
+
+/**
+ * @return  whether a simulation's innermost simulation is a TimecourseSimulation or OneStepSimulation,
+ * so it records model outputs at each iteration.
+ * @param rSimulation  the simulation
+ */
+static bool RecordsModelOutputs(AbstractSimulation& rSimulation)
+{
+    AbstractSimulation* p_innermost = FindInnermostSimulation(rSimulation);
+    return dynamic_cast<TimecourseSimulation*>(p_innermost) || dynamic_cast<OneStepSimulation*>(p_innermost);
+}
+
+
+/**
+ * @return  whether a simulation's results are just the model outputs at each iteration, i.e. it records
+ * model outputs and no loop reduces them.
+ * @param rSimulation  the simulation
+ */
+static bool ResultsAreModelOutputs(AbstractSimulation& rSimulation)
+{
+    NestedSimulation* p_reducer;
+    FindInnermostSimulation(rSimulation, &p_reducer);
+    return !p_reducer && RecordsModelOutputs(rSimulation);
+}
+
+
+/**
+ * Determine the shapes of the results a simulation will produce, as far as is possible before it runs.
+ * This can be done for (possibly nested) simulations of the model itself, whose results are the model
+ * outputs with a dimension added for each loop.  Loop extents are generally unknown, since ranges can
+ * depend on earlier simulations or outer loops, but the first simulation's outermost range is evaluated
+ * in the same state as it will be when the simulation starts, so is found by initialising its stepper.
+ *
+ * @param rSimulation  the simulation
+ * @param isFirst  whether this is the first simulation to be run
+ * @param rShapes  filled in with the shape of each result
+ * @return  whether the results could be described
+ */
+static bool GetSimulationResultShapes(AbstractSimulation& rSimulation,
+                                      bool isFirst,
+                                      std::map<std::string, NdArray<double>::Extents>& rShapes)
+{
+    boost::shared_ptr<AbstractSystemWithOutputs> p_model = rSimulation.GetModel();
+    if (!p_model || !ResultsAreModelOutputs(rSimulation))
+    {
+        return false;
+    }
+    const std::vector<AbstractStepperPtr>& r_steppers = rSimulation.rGetSteppers();
+    NdArray<double>::Extents loop_shape(r_steppers.size(), ShapeInference::UNKNOWN_EXTENT);
+    try
+    {
+        if (isFirst && !r_steppers.empty() && r_steppers.front()->IsEndFixed())
+        {
+            r_steppers.front()->Initialise();
+            loop_shape.front() = r_steppers.front()->GetNumberOfOutputPoints();
+        }
+        EnvironmentCPtr p_outputs = p_model->GetOutputs();
+        BOOST_FOREACH(const std::string& r_name, p_outputs->GetDefinedNames())
+        {
+            AbstractValuePtr p_output = p_outputs->Lookup(r_name, rSimulation.GetLocationInfo());
+            if (p_output->IsArray())
+            {
+                NdArray<double>::Extents shape = loop_shape;
+                if (!p_output->IsDouble())
+                {
+                    const NdArray<double>::Extents output_shape = GET_ARRAY(p_output).GetShape();
+                    shape.insert(shape.end(), output_shape.begin(), output_shape.end());
+                }
+                rShapes[r_name] = shape;
+            }
+        }
+        // Event times are recorded alongside the model outputs, one per output point
+        AbstractSimulation* p_innermost = FindInnermostSimulation(rSimulation);
+        if (TimecourseSimulation* p_timecourse = dynamic_cast<TimecourseSimulation*>(p_innermost))
+        {
+            BOOST_FOREACH(const std::string& r_name, p_timecourse->rGetEventNames())
+            {
+                rShapes[r_name] = loop_shape;
+            }
+        }
+    }
+    catch (const Exception&)
+    {
+        return false;
+    }
+    return true;
+}
+
+
+void Protocol::CheckPostProcessing()
+{
+    mShapeInference.Reset();
+    BOOST_FOREACH(StringProtoPair import, mImports)
+    {
+        mShapeInference.AddStablePrefix(import.first);
+    }
+    for (unsigned i=0; i<mSimulations.size(); ++i)
+    {
+        const std::string prefix = mSimulations[i]->GetOutputsPrefix();
+        std::map<std::string, NdArray<double>::Extents> shapes;
+        if (prefix.empty())
+        {
+            continue;
+        }
+        else if (GetSimulationResultShapes(*mSimulations[i], i == 0u, shapes))
+        {
+            mShapeInference.DeclareResults(prefix, shapes);
+        }
+        else
+        {
+            mShapeInference.DeclareUnknownResults(prefix);
+        }
+    }
+    if (mLazyEvaluation)
+    {
+        // Only check what will actually be run
+        std::vector<AbstractStatementPtr> post_processing(mPostProcessing);
+        ProtocolOptimiser pruner;
+        pruner.RemoveUnusedStatements(post_processing, GetRequiredPostProcessingNames());
+        mShapeInference.Check(post_processing, *mpLibrary);
+    }
+    else
+    {
+        mShapeInference.Check(mPostProcessing, *mpLibrary);
+    }
+}
+
+
+std::set<std::string> Protocol::GetRequiredPostProcessingNames() const
+{
+    std::set<std::string> names;
+    BOOST_FOREACH(OutputSpecificationPtr p_spec, mOutputSpecifications)
+    {
+        // Prefixed references are to simulation results, not post-processing definitions
+        const std::string& r_ref = p_spec->rGetOutputRef();
+        if (r_ref.find(':') == std::string::npos)
+        {
+            names.insert(r_ref);
+        }
+    }
+    return names;
+}
+
+
+void Protocol::SetRequiredSimulationOutputs()
+{
+    // Find every name that may be looked up once the simulations start
+    std::set<std::string> referenced;
+    if (mPruneOutputs)
+    {
+        std::vector<AbstractStatementPtr> post_processing(mPostProcessing);
+        if (mLazyEvaluation)
+        {
+            // Only the post-processing that will actually be run matters
+            ProtocolOptimiser pruner;
+            pruner.RemoveUnusedStatements(post_processing, GetRequiredPostProcessingNames());
+        }
+        ProtocolOptimiser::CollectReferencedNames(post_processing, referenced);
+        ProtocolOptimiser::CollectReferencedNames(mLibraryStatements, referenced);
+        BOOST_FOREACH(OutputSpecificationPtr p_spec, mOutputSpecifications)
+        {
+            referenced.insert(p_spec->rGetOutputRef());
+        }
+        std::vector<AbstractExpressionPtr> sim_expressions;
+        BOOST_FOREACH(boost::shared_ptr<AbstractSimulation> p_sim, mSimulations)
+        {
+            p_sim->CollectExpressions(sim_expressions);
+        }
+        ProtocolOptimiser::CollectReferencedNames(sim_expressions, referenced);
+        BOOST_FOREACH(boost::shared_ptr<AbstractSimulation> p_sim, mSimulations)
+        {
+            // Reductions may refer to other simulations' results too
+            AbstractSimulation* p_inner = p_sim.get();
+            while (NestedSimulation* p_nested = dynamic_cast<NestedSimulation*>(p_inner))
+            {
+                ProtocolOptimiser::CollectReferencedNames(p_nested->rGetReductions(), referenced);
+                p_inner = p_nested->GetNestedSimulation().get();
+            }
+        }
+    }
+
+    BOOST_FOREACH(boost::shared_ptr<AbstractSimulation> p_sim, mSimulations)
+    {
+        const std::string prefix = p_sim->GetOutputsPrefix();
+        boost::shared_ptr<AbstractSystemWithOutputs> p_model = p_sim->GetModel();
+        if (!mPruneOutputs || prefix.empty() || !p_model || !RecordsModelOutputs(*p_sim))
+        {
+            // Results other than model outputs (e.g. from nested protocols) are not restricted here
+            p_sim->SetAllOutputsRequired();
+            continue;
+        }
+        // If a loop reduces each iteration's results, only its reductions see the model outputs
+        NestedSimulation* p_reducer;
+        FindInnermostSimulation(*p_sim, &p_reducer);
+        std::set<std::string> reducer_referenced;
+        if (p_reducer)
+        {
+            ProtocolOptimiser::CollectReferencedNames(p_reducer->rGetReductions(), reducer_referenced);
+        }
+        std::set<std::string> required;
+        BOOST_FOREACH(const std::string& r_name, p_model->rGetOutputNames())
+        {
+            if (p_reducer ? reducer_referenced.find(r_name) != reducer_referenced.end()
+                          : referenced.find(prefix + ":" + r_name) != referenced.end())
+            {
+                required.insert(r_name);
+            }
+        }
+        p_sim->SetRequiredOutputs(required);
+        if (required.size() < p_model->GetNumberOfOutputs())
+        {
+            std::cout << mIndent << "Simulation " << prefix << " will record " << required.size() << " of "
+                      << p_model->GetNumberOfOutputs() << " model outputs." << std::endl;
+        }
+    }
 }
 
 
@@ -189,55 +694,129 @@ void Protocol::Run()
         mManifest.AddEntry("trace.txt", "text/plain");
     }
     ResetOutputs(mOutputs);
+    if (mpMemoStatistics)
+    {
+        // Results cached by previous runs may refer to old model results
+        mpMemoStatistics->generation++;
+    }
     // If we get an error at any stage, we want to ensure as many partial results as possible
     // are stored, but still report the error(s)
     std::vector<Exception> errors;
+    // Look for errors in post-processing before spending time on simulations
+    bool checks_passed = true;
+    if (mCheckShapes)
+    {
+        try
+        {
+            CheckPostProcessing();
+        }
+        catch (const Exception& e)
+        {
+            std::cerr << mIndent << e.GetMessage();
+            errors.push_back(e);
+            checks_passed = false;
+            WriteError("Error(s) checking post-processing; not running simulations:");
+            WriteError(e);
+        }
+    }
+    SetRequiredSimulationOutputs();
     ProtocolTimer::EndEvent(ProtocolTimer::SETUP);
     ProtocolTimer::BeginEvent(ProtocolTimer::SIMULATE);
     // Run the simulation(s)
-    try
+    if (checks_passed)
     {
-        unsigned simulation_number = 0u;
-        BOOST_FOREACH(boost::shared_ptr<AbstractSimulation> p_sim, mSimulations)
+        try
         {
-            const std::string prefix = p_sim->GetOutputsPrefix();
-            std::cout << mIndent << "Running simulation " << simulation_number << " " << prefix
-                      << " on process " << PetscTools::GetMyRank() << "..." << std::endl;
-            p_sim->SetIndent(mIndent + "  ");
-            p_sim->InitialiseSteppers();
-            p_sim->SetParalleliseLoops(mParalleliseLoops);
-            p_sim->Run();
-            if (mpOutputHandler)
+            unsigned simulation_number = 0u;
+            BOOST_FOREACH(boost::shared_ptr<AbstractSimulation> p_sim, mSimulations)
             {
-                // Re-set the trace folder in case a nested protocol changed it
-                DebugProto::SetTraceFolder(*mpOutputHandler);
-                // Remove the simulation output folder if empty
-                FileFinder sim_debug_output = p_sim->GetOutputFolder();
-                if (sim_debug_output.IsPathSet() && sim_debug_output.IsDir() && sim_debug_output.IsEmpty() && PetscTools::AmMaster())
+                const std::string prefix = p_sim->GetOutputsPrefix();
+                std::cout << mIndent << "Running simulation " << simulation_number << " " << prefix
+                          << " on process " << PetscTools::GetMyRank() << "..." << std::endl;
+                p_sim->SetIndent(mIndent + "  ");
+                p_sim->InitialiseSteppers();
+                p_sim->SetParalleliseLoops(mParalleliseLoops, mBalanceLoad);
+                p_sim->SetNativeLoops(mNativeSimulationLoops);
+                p_sim->SetNumThreads(mNumSimulationThreads);
+                p_sim->SetEnsembleSize(mSimulationEnsembleSize);
+                p_sim->Run();
+                if (mpOutputHandler)
                 {
-                    sim_debug_output.Remove();
+                    // Re-set the trace folder in case a nested protocol changed it
+                    DebugProto::SetTraceFolder(*mpOutputHandler);
+                    // Remove the simulation output folder if empty
+                    FileFinder sim_debug_output = p_sim->GetOutputFolder();
+                    if (sim_debug_output.IsPathSet() && sim_debug_output.IsDir() && sim_debug_output.IsEmpty() && PetscTools::AmMaster())
+                    {
+                        sim_debug_output.Remove();
+                    }
                 }
+                simulation_number++;
             }
-            simulation_number++;
         }
-    }
-    catch (const Exception& e)
-    {
-        std::cerr << mIndent << e.GetMessage();
-        errors.push_back(e);
-        WriteError("Error running simulations:");
-        WriteError(e);
+        catch (const Exception& e)
+        {
+            std::cerr << mIndent << e.GetMessage();
+            errors.push_back(e);
+            WriteError("Error running simulations:");
+            WriteError(e);
+        }
     }
     ProtocolTimer::EndEvent(ProtocolTimer::SIMULATE);
     ProtocolTimer::BeginEvent(ProtocolTimer::POSTPROCESS);
-    if (!mParalleliseLoops || PetscTools::AmMaster())
+    if (checks_passed && (!mParalleliseLoops || PetscTools::AmMaster()))
     {
         // Post-process the results
         EnvironmentPtr p_post_proc_env(new Environment(mpLibrary->GetAsDelegatee()));
         std::cout << mIndent << "Running post-processing..." << std::endl;
+        // Model state isn't changing now, so it's safe to use threads if requested
+        ThreadPool* p_pool = ThreadPool::Instance();
+        const unsigned old_num_threads = p_pool->GetNumThreads();
+        const unsigned old_min_iterations = p_pool->GetMinimumIterations();
+        if (mNumPostProcessingThreads > 1u)
+        {
+            p_pool->SetNumThreads(mNumPostProcessingThreads);
+            p_pool->SetMinimumIterations(mMinParallelIterations);
+        }
         try
         {
+            mPostProcessingOptimiser.Restore();
+            BOOST_FOREACH(StringProtoPair import, mImports)
+            {
+                mPostProcessingOptimiser.AddStablePrefix(import.first);
+            }
+            if (mLazyEvaluation)
+            {
+                mPostProcessingOptimiser.RemoveUnusedStatements(mPostProcessing, GetRequiredPostProcessingNames());
+                if (mPostProcessingOptimiser.GetNumberRemoved() > 0u)
+                {
+                    std::cout << mIndent << "Skipping " << mPostProcessingOptimiser.GetNumberRemoved()
+                              << " post-processing statements not needed for outputs." << std::endl;
+                }
+            }
+            if (mOptimise)
+            {
+                mPostProcessingOptimiser.Optimise(mPostProcessing, *mpLibrary, true);
+            }
+            if (mpMemoStatistics)
+            {
+                mPostProcessingOptimiser.EnableMemoisation(mPostProcessing, mpMemoStatistics);
+            }
+            mPostProcessingCompiler.Restore();
+            if (mpCompiledCodeCache)
+            {
+                mPostProcessingCompiler.Compile(mPostProcessing, *mpCompiledCodeCache,
+                                                GetCompiledCodeSource("post-processing"));
+                std::cout << mIndent << "Using native code for " << mLibraryCompiler.GetNumberCompiled()
+                          << " library and " << mPostProcessingCompiler.GetNumberCompiled()
+                          << " post-processing functions." << std::endl;
+            }
             p_post_proc_env->ExecuteStatements(mPostProcessing);
+            if (mpMemoStatistics)
+            {
+                std::cout << mIndent << "Memoised function calls: " << mpMemoStatistics->numHits << " hits, "
+                          << mpMemoStatistics->numMisses << " misses." << std::endl;
+            }
         }
         catch (const Exception& e)
         {
@@ -246,6 +825,11 @@ void Protocol::Run()
             WriteError("Error(s) running post-processing:");
             WriteError(e);
         }
+        if (mNumPostProcessingThreads > 1u)
+        {
+            p_pool->SetNumThreads(old_num_threads);
+            p_pool->SetMinimumIterations(old_min_iterations);
+        }
         // Transfer requested outputs to mOutputs[""]
         std::cout << mIndent << "Recording protocol outputs..." << std::endl;
         EnvironmentPtr p_proto_outputs = mOutputs[""];
@@ -785,10 +1369,12 @@ void Protocol::GeneratePlots(const std::string& rFileNameBase)
                         if (prefix == p_sim->GetOutputsPrefix())
                         {
                             std::vector<AbstractStepperPtr>& r_steppers = p_sim->rGetSteppers();
-                            if (!r_steppers.empty() && r_steppers.back())
+                            unsigned first_loop, end_loop;
+                            p_sim->GetResultsLoops(first_loop, end_loop);
+                            if (end_loop > 0u && r_steppers[end_loop-1])
                             {
                                 // Create a new array containing the stepper data
-                                AbstractStepperPtr p_stepper = r_steppers.back();
+                                AbstractStepperPtr p_stepper = r_steppers[end_loop-1];
                                 PROTO_ASSERT2(p_stepper->IsEndFixed(),
                                               "Unable to plot against a while loop at present.",
                                               p_plot_spec->GetLocationInfo());
@@ -1152,6 +1738,8 @@ boost::shared_ptr<ModelStateCollection> Protocol::GetStateCollection()
 
 void Protocol::SetInput(const std::string& rName, AbstractExpressionPtr pValue)
 {
+    // Library optimisations may have assumed the old value
+    mLibraryOptimiser.Restore();
     mpInputs->RemoveDefinition(rName, "Setting protocol input");
     AbstractValuePtr p_value = (*pValue)(*mpInputs);
     mpInputs->DefineName(rName, p_value, "Setting protocol input");
@@ -1218,6 +1806,19 @@ std::vector<boost::shared_ptr<AbstractSimulation> >& Protocol::rGetSimulations()
 }
 
 
+bool Protocol::HasSolverSetting(const std::string& rName) const
+{
+    BOOST_FOREACH(AbstractSimulationPtr p_sim, mSimulations)
+    {
+        if (p_sim->HasSolverSetting(rName))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+
 std::vector<AbstractStatementPtr>& Protocol::rGetPostProcessing()
 {
     return mPostProcessing;
@@ -1290,6 +1891,17 @@ void Protocol::AddLibrary(const std::vector<AbstractStatementPtr>& rStatements)
 }
 
 
+void Protocol::AddImportedLibrary(const std::vector<AbstractStatementPtr>& rStatements, bool trusted)
+{
+    ImportedLibrary import;
+    import.start = mLibraryStatements.size();
+    import.end = import.start + rStatements.size();
+    import.trusted = trusted;
+    mImportedLibraries.push_back(import);
+    AddLibrary(rStatements);
+}
+
+
 void Protocol::AddSimulation(boost::shared_ptr<AbstractSimulation> pSimulation)
 {
     mSimulations.push_back(pSimulation);
@@ -36,6 +36,7 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef PROTOCOL_HPP_
 #define PROTOCOL_HPP_
 
+#include <set>
 #include <vector>
 #include <string>
 #include <boost/shared_ptr.hpp>
@@ -49,6 +50,9 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "OutputSpecification.hpp"
 #include "PlotSpecification.hpp"
 #include "Manifest.hpp"
+#include "ProtocolOptimiser.hpp"
+#include "ProtocolCompiler.hpp"
+#include "ShapeInference.hpp"
 
 #include "OutputFileHandler.hpp"
 #include "FileFinder.hpp"
@@ -135,8 +139,144 @@ public:
      * Set whether to use automatic parallelisation of nested simulation loops.
      *
      * @param paralleliseLoops  whether to parallelise whenever safe
+     * @param balanceLoad  whether the master process should hand out loop iterations to the others as
+     *     they become free, costliest first, rather than sharing them out in a fixed pattern; this is
+     *     better when iterations vary widely in cost, and the results are the same either way
      */
-    void SetParalleliseLoops(bool paralleliseLoops=true);
+    void SetParalleliseLoops(bool paralleliseLoops=true, bool balanceLoad=false);
+
+    /**
+     * Set whether simulations should use specialised loops where possible, avoiding the overheads
+     * of the general simulation machinery at each step; see AbstractSimulation::SetNativeLoops.
+     * Results are unchanged.  This is off by default.
+     *
+     * @param nativeLoops  whether to use the specialised loops
+     */
+    void SetNativeSimulationLoops(bool nativeLoops=true);
+
+    /**
+     * Set whether to optimise the library and post-processing programs once input values are known;
+     * see ProtocolOptimiser for details.  The setting is shared with imported protocols.  This is off
+     * by default.  If the library has already been initialised, it is re-initialised so the change
+     * takes effect.
+     *
+     * @param optimise  whether to optimise
+     */
+    void SetOptimisation(bool optimise=true);
+
+    /**
+     * Set whether named pure functions in the library and post-processing programs (and those of
+     * imported protocols) should cache the results of calls; see MemoCache for details.  This is off
+     * by default.  If the library has already been initialised, it is re-initialised so the change
+     * takes effect.  Cached results are discarded at the start of each run.
+     *
+     * @param memoise  whether to cache results
+     * @param maxEntries  the maximum number of results to cache for each function
+     */
+    void SetMemoisation(bool memoise=true, unsigned maxEntries=64u);
+
+    /**
+     * Get the settings and hit/miss counters for memoisation, or an empty pointer if it is not enabled.
+     */
+    MemoCache::StatisticsPtr GetMemoStatistics() const;
+
+    /**
+     * Set how many threads to use for map, fold and array comprehensions over large arrays during
+     * post-processing; see ThreadPool for details.  By default post-processing is sequential.
+     *
+     * @param numThreads  the number of threads; 0 or 1 means run sequentially
+     * @param minIterations  the minimum number of iterations for a loop to be run in parallel
+     */
+    void SetNumPostProcessingThreads(unsigned numThreads, unsigned minIterations=1000u);
+
+    /**
+     * Set how many threads may share the iterations of nested simulation loops that are provably
+     * independent, each running its own copy of the model; see NestedSimulation::SetNumThreads.
+     * Results are unchanged.  By default simulations are sequential.
+     *
+     * @param numThreads  the number of threads; 0 or 1 means run sequentially
+     */
+    void SetNumSimulationThreads(unsigned numThreads);
+
+    /**
+     * Set how many iterations of nested simulation loops that are provably independent may be run
+     * together as an ensemble, stepping copies of the model through a timecourse in lock-step; see
+     * NestedSimulation::SetEnsembleSize.  Results are unchanged.  By default iterations run in turn.
+     *
+     * @param ensembleSize  the number of iterations to run together; 0 or 1 means run each in turn
+     */
+    void SetSimulationEnsembleSize(unsigned ensembleSize);
+
+    /**
+     * Set whether functions in the library and post-processing programs (and those of imported
+     * protocols) that only do arithmetic on simple values should be compiled to native code; see
+     * ProtocolCompiler for details.  This is off by default.  Compiled libraries are kept in the
+     * given cache, which may be shared with other runs and processes, so that the compiler only needs
+     * to run the first time a protocol is used.  If the library has already been initialised, it is
+     * re-initialised so the change takes effect.
+     *
+     * @param pCache  cache to keep compiled code in; if empty, compilation is disabled
+     */
+    void SetCompilation(boost::shared_ptr<ModelCache> pCache);
+
+    /**
+     * Set whether to check the post-processing program before running simulations, so that errors
+     * certain to occur in it are reported without waiting for the simulations to finish; see
+     * ShapeInference for details.  This is off by default.
+     *
+     * @param checkShapes  whether to check the post-processing program
+     */
+    void SetShapeChecking(bool checkShapes=true);
+
+    /**
+     * Set whether to evaluate library and post-processing definitions only when needed.  If so,
+     * library definitions of single names are computed the first time the name is looked up (see
+     * Environment::DefineLazily), and post-processing statements are only run if they contribute to
+     * a protocol output or assertion (see ProtocolOptimiser::RemoveUnusedStatements).  Hence errors
+     * in definitions that aren't used are not reported.  The setting is shared with imported protocols.
+     * This is off by default.  If the library has already been initialised, it is re-initialised so
+     * the change takes effect.
+     *
+     * @param lazy  whether to evaluate definitions only when needed
+     */
+    void SetLazyEvaluation(bool lazy=true);
+
+    /**
+     * Set whether simulations should only record the model outputs that the library, post-processing,
+     * protocol outputs or simulations refer to (see AbstractSimulation::SetRequiredOutputs), so that
+     * rGetOutputsCollection for a simulation prefix will not contain the others.  Post-processing
+     * statements that lazy evaluation would skip don't count as references.  This is off by default.
+     *
+     * @param prune  whether to record only the model outputs referred to
+     */
+    void SetOutputPruning(bool prune=true);
+
+    /**
+     * Set whether this protocol's library, and those of the protocols it imports, should be trusted
+     * to be used correctly.  Assertions in trusted libraries are not checked, except that those
+     * comparing array shapes are replaced by cheap native checks; see
+     * ProtocolOptimiser::ElideAssertions.  Assertions in the post-processing program are unaffected.
+     * If the library has already been initialised, it is re-initialised so the change takes effect.
+     *
+     * @param trusted  whether the library is trusted
+     */
+    void SetTrustedLibrary(bool trusted=true);
+
+    /**
+     * Set whether the libraries of all protocols imported by this one (whether by prefix or by
+     * merging definitions) should be trusted, as for SetTrustedLibrary.  This protocol's own library
+     * is unaffected.  This is off by default, but individual imports may be marked as trusted within
+     * the protocol.
+     *
+     * @param trusted  whether imported libraries are trusted
+     */
+    void SetTrustedImports(bool trusted=true);
+
+    /**
+     * Get the shapes of the post-processing results that were known before the last run started,
+     * for those whose shape could be fully determined.
+     */
+    const std::map<std::string, NdArray<double>::Extents>& rGetInferredShapes() const;
 
     /**
      * Get the number of protocol outputs defined.
@@ -247,6 +387,14 @@ public:
     /** Get the list of simulations to be performed. */
     std::vector<AbstractSimulationPtr>& rGetSimulations();
 
+    /**
+     * @return  whether any simulation in this protocol has been given the named solver setting, so
+     *     that the model can be built to honour it (see ProtocolRunner)
+     *
+     * @param rName  the setting
+     */
+    bool HasSolverSetting(const std::string& rName) const;
+
     /** Get the post-processing program part of the protocol. */
     std::vector<AbstractStatementPtr>& rGetPostProcessing();
 
@@ -296,6 +444,14 @@ public:
      */
     void AddLibrary(const std::vector<AbstractStatementPtr>& rStatements);
 
+    /**
+     * Add the library of a protocol whose definitions are being merged into this one.
+     *
+     * @param rStatements  the statements to append
+     * @param trusted  whether the import was marked as trusted (see SetTrustedLibrary)
+     */
+    void AddImportedLibrary(const std::vector<AbstractStatementPtr>& rStatements, bool trusted);
+
     /**
      * Add a simulation to run.  Simulations will be run in the order in which they are added.
      *
@@ -421,6 +577,110 @@ private:
     /** Whether to use automatic parallelisation of nested simulation loops. */
     bool mParalleliseLoops;
 
+    /** Whether parallelised loops hand out iterations to processes as they become free. */
+    bool mBalanceLoad;
+
+    /** Whether simulations should use specialised loops where possible. */
+    bool mNativeSimulationLoops;
+
+    /** Whether to optimise our programs once input values are known. */
+    bool mOptimise;
+
+    /** Optimiser for the library program; changes depend on input values. */
+    ProtocolOptimiser mLibraryOptimiser;
+
+    /** Optimiser for the post-processing program; changes depend on library values. */
+    ProtocolOptimiser mPostProcessingOptimiser;
+
+    /** Settings and counters for caching pure function results, if enabled. */
+    MemoCache::StatisticsPtr mpMemoStatistics;
+
+    /** How many threads to use for loops during post-processing. */
+    unsigned mNumPostProcessingThreads;
+
+    /** The minimum number of iterations for a post-processing loop to be run in parallel. */
+    unsigned mMinParallelIterations;
+
+    /** How many threads may share the iterations of independent nested simulation loops. */
+    unsigned mNumSimulationThreads;
+
+    /** How many iterations of independent nested simulation loops may be run together in lock-step. */
+    unsigned mSimulationEnsembleSize;
+
+    /** Where to cache compiled code, if compilation is enabled. */
+    boost::shared_ptr<ModelCache> mpCompiledCodeCache;
+
+    /** Compiler for the library program. */
+    ProtocolCompiler mLibraryCompiler;
+
+    /** Compiler for the post-processing program. */
+    ProtocolCompiler mPostProcessingCompiler;
+
+    /** Whether to check the post-processing program before running simulations. */
+    bool mCheckShapes;
+
+    /** Checker for the post-processing program. */
+    ShapeInference mShapeInference;
+
+    /** Whether to evaluate library and post-processing definitions only when needed. */
+    bool mLazyEvaluation;
+
+    /** Whether simulations record only the model outputs referred to. */
+    bool mPruneOutputs;
+
+    /** Whether our whole library is trusted to be used correctly. */
+    bool mTrustedLibrary;
+
+    /** Whether the libraries we import are all trusted to be used correctly. */
+    bool mTrustedImports;
+
+    /** A range of our library statements that were merged from an imported protocol. */
+    struct ImportedLibrary
+    {
+        unsigned start;  /**< Index of the first statement */
+        unsigned end;    /**< Index one past the last statement */
+        bool trusted;    /**< Whether the import was marked as trusted */
+    };
+
+    /** The ranges of our library statements that were merged from imported protocols, in order. */
+    std::vector<ImportedLibrary> mImportedLibraries;
+
+    /**
+     * Undo library optimisations and re-apply them (and compilation) if enabled.  Must be called
+     * before the library statements are executed.
+     */
+    void PrepareLibrary();
+
+    /**
+     * Get the names defined by the post-processing program that are needed for protocol outputs.
+     */
+    std::set<std::string> GetRequiredPostProcessingNames() const;
+
+    /**
+     * Tell each simulation which model outputs it needs to record, i.e. those referenced with its
+     * prefix by the library, the post-processing that will be run, the protocol outputs, or the
+     * expressions controlling any simulation.  If output pruning is disabled, all are recorded.
+     */
+    void SetRequiredSimulationOutputs();
+
+    /**
+     * Remove the assertions from those parts of the library that are trusted.  Called by
+     * PrepareLibrary after undoing previous changes, and before optimising.
+     */
+    void ElideTrustedAssertions();
+
+    /**
+     * @return  a description of one of our programs, recorded in the cache when it is compiled
+     * @param rProgram  which program, e.g. "library"
+     */
+    std::string GetCompiledCodeSource(const std::string& rProgram) const;
+
+    /**
+     * Check the post-processing program for errors that are certain to occur, given what is known
+     * of the simulation results before the simulations are run.  Throws if any are found.
+     */
+    void CheckPostProcessing();
+
     /**
      * Check that the supplied model does have outputs, and cast it.
      *
@@ -0,0 +1,982 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "ProtocolCompiler.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <set>
+#include <sstream>
+#include <typeindex>
+#include <typeinfo>
+#include <utility>
+#include <dlfcn.h>
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+#include <boost/make_shared.hpp>
+
+#include "Warnings.hpp"
+#include "ValueTypes.hpp"
+#include "ProtoHelperMacros.hpp"
+#include "AssignmentStatement.hpp"
+#include "AssertStatement.hpp"
+#include "ReturnStatement.hpp"
+#include "NameLookup.hpp"
+#include "ValueExpression.hpp"
+#include "LambdaExpression.hpp"
+#include "FunctionCall.hpp"
+#include "ArrayCreate.hpp"
+#include "TupleExpression.hpp"
+#include "If.hpp"
+#include "MathmlAll.hpp"
+#include "CompiledFunction.hpp"
+#include "HashText.hpp"
+
+namespace fs = boost::filesystem;
+
+/** Changing this invalidates all cached libraries, e.g. if the calling convention changes. */
+const char* CODE_FORMAT_VERSION = "1";
+
+/** Code included at the top of every generated file, defining helpers for some operators. */
+const char* CODE_PREAMBLE =
+    "#include <algorithm>\n"
+    "#include <cmath>\n"
+    "#include <limits>\n"
+    "\n"
+    "static inline double fc_quotient(double a, double b)\n"
+    "{\n"
+    "    double result;\n"
+    "    modf(a / b, &result);\n"
+    "    return result;\n"
+    "}\n"
+    "\n"
+    "static inline double fc_root(double degree, double a)\n"
+    "{\n"
+    "    return degree == 2 ? sqrt(a) : pow(a, 1/degree);\n"
+    "}\n"
+    "\n"
+    "static inline bool fc_test(double a)\n"
+    "{\n"
+    "    return a != 0.0;\n"
+    "}\n";
+
+/**
+ * @return C++ code for a numeric literal, which reproduces the value exactly
+ * @param value  the value
+ */
+static std::string Literal(double value)
+{
+    std::ostringstream code;
+    if (std::isnan(value))
+    {
+        code << "std::numeric_limits<double>::quiet_NaN()";
+    }
+    else if (std::isinf(value))
+    {
+        code << (value < 0 ? "(-" : "(") << "std::numeric_limits<double>::infinity())";
+    }
+    else
+    {
+        code << "(" << std::setprecision(17) << std::scientific << value << ")";
+    }
+    return code.str();
+}
+
+/**
+ * @return the operands joined with the given operator, in brackets
+ * @param rOperands  the operands' code
+ * @param rOperator  the infix operator
+ */
+static std::string Join(const std::vector<std::string>& rOperands, const std::string& rOperator)
+{
+    std::string code = "(" + rOperands.front();
+    for (unsigned i=1; i<rOperands.size(); ++i)
+    {
+        code += " " + rOperator + " " + rOperands[i];
+    }
+    return code + ")";
+}
+
+/**
+ * @return the C++ functions used for MathML operators taking a single operand, keyed by operator type.
+ * Reciprocal functions are given as an expression with the operand in the middle.
+ */
+static const std::map<std::type_index, std::pair<std::string, std::string> >& GetUnaryOperators()
+{
+    static std::map<std::type_index, std::pair<std::string, std::string> > operators;
+    if (operators.empty())
+    {
+#define UNARY_OPERATOR(cls, before, after) \
+        operators[std::type_index(typeid(Mathml##cls))] = std::make_pair(std::string(before), std::string(after))
+        UNARY_OPERATOR(Abs, "fabs(", ")");
+        UNARY_OPERATOR(Floor, "floor(", ")");
+        UNARY_OPERATOR(Ceiling, "ceil(", ")");
+        UNARY_OPERATOR(Exp, "exp(", ")");
+        UNARY_OPERATOR(Ln, "log(", ")");
+        UNARY_OPERATOR(Log, "log10(", ")");
+        UNARY_OPERATOR(Sin, "sin(", ")");
+        UNARY_OPERATOR(Cos, "cos(", ")");
+        UNARY_OPERATOR(Tan, "tan(", ")");
+        UNARY_OPERATOR(ArcSin, "asin(", ")");
+        UNARY_OPERATOR(ArcCos, "acos(", ")");
+        UNARY_OPERATOR(ArcTan, "atan(", ")");
+        UNARY_OPERATOR(Sinh, "sinh(", ")");
+        UNARY_OPERATOR(Cosh, "cosh(", ")");
+        UNARY_OPERATOR(Tanh, "tanh(", ")");
+        UNARY_OPERATOR(ArcSinh, "asinh(", ")");
+        UNARY_OPERATOR(ArcCosh, "acosh(", ")");
+        UNARY_OPERATOR(ArcTanh, "atanh(", ")");
+        UNARY_OPERATOR(Sec, "(1.0 / cos(", "))");
+        UNARY_OPERATOR(Csc, "(1.0 / sin(", "))");
+        UNARY_OPERATOR(Cot, "(1.0 / tan(", "))");
+        UNARY_OPERATOR(Sech, "(1.0 / cosh(", "))");
+        UNARY_OPERATOR(Csch, "(1.0 / sinh(", "))");
+        UNARY_OPERATOR(Coth, "(1.0 / tanh(", "))");
+        UNARY_OPERATOR(ArcSec, "acos(1.0 / ", ")");
+        UNARY_OPERATOR(ArcCsc, "asin(1.0 / ", ")");
+        UNARY_OPERATOR(ArcCot, "atan(1.0 / ", ")");
+        UNARY_OPERATOR(ArcSech, "acosh(1.0 / ", ")");
+        UNARY_OPERATOR(ArcCsch, "asinh(1.0 / ", ")");
+        UNARY_OPERATOR(ArcCoth, "atanh(1.0 / ", ")");
+#undef UNARY_OPERATOR
+    }
+    return operators;
+}
+
+/**
+ * @return the C++ operators used for MathML relations, keyed by operator type
+ */
+static const std::map<std::type_index, std::string>& GetRelations()
+{
+    static std::map<std::type_index, std::string> relations;
+    if (relations.empty())
+    {
+        relations[std::type_index(typeid(MathmlEq))] = "==";
+        relations[std::type_index(typeid(MathmlNeq))] = "!=";
+        relations[std::type_index(typeid(MathmlLt))] = "<";
+        relations[std::type_index(typeid(MathmlGt))] = ">";
+        relations[std::type_index(typeid(MathmlLeq))] = "<=";
+        relations[std::type_index(typeid(MathmlGeq))] = ">=";
+    }
+    return relations;
+}
+
+/**
+ * Determine the names of the index variables bound by an array comprehension, if this can be done statically.
+ *
+ * @param rComprehension  the comprehension
+ * @param rNames  filled in with the index variable names, in the order their ranges are given
+ * @return  whether all names could be determined
+ */
+static bool GetIndexNames(ArrayCreate& rComprehension, std::vector<std::string>& rNames)
+{
+    BOOST_FOREACH(AbstractExpressionPtr p_range, rComprehension.rGetChildren())
+    {
+        // The range may be a tuple expression, or have been folded to a constant tuple
+        AbstractValuePtr p_name;
+        if (TupleExpression* p_tuple = dynamic_cast<TupleExpression*>(p_range.get()))
+        {
+            ValueExpression* p_name_expr = dynamic_cast<ValueExpression*>(p_tuple->rGetChildren().back().get());
+            if (p_name_expr)
+            {
+                p_name = p_name_expr->GetValue();
+            }
+        }
+        else if (ValueExpression* p_value_expr = dynamic_cast<ValueExpression*>(p_range.get()))
+        {
+            if (p_value_expr->GetValue()->IsTuple())
+            {
+                TupleValue* p_tuple = static_cast<TupleValue*>(p_value_expr->GetValue().get());
+                p_name = p_tuple->GetItem(p_tuple->GetNumItems() - 1);
+            }
+        }
+        if (!p_name || !p_name->IsString())
+        {
+            return false;
+        }
+        rNames.push_back(static_cast<StringValue*>(p_name.get())->GetString());
+    }
+    return true;
+}
+
+/**
+ * Translates the functions of a program into C++.  Translation of a function fails if it uses any
+ * construct outside the supported subset, or calls a function whose translation failed, so we keep
+ * going until no more failures occur.
+ */
+class CodeGenerator
+{
+public:
+    /**
+     * Find the candidate functions in a program.
+     *
+     * @param rStatements  the program
+     */
+    CodeGenerator(const std::vector<AbstractStatementPtr>& rStatements)
+    {
+        FindCandidates(const_cast<std::vector<AbstractStatementPtr>&>(rStatements), NameSet(), true);
+    }
+
+    /**
+     * Translate as many candidates as possible.
+     *
+     * @param rFunctions  will be filled in with the functions translated
+     * @return  the code for them, or an empty string if there are none
+     */
+    std::string Generate(std::vector<AbstractExpression*>& rFunctions)
+    {
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (unsigned i=0; i<mCandidates.size(); ++i)
+            {
+                if (mCandidates[i].translated && !TranslateFunction(i))
+                {
+                    mCandidates[i].translated = false;
+                    changed = true;
+                }
+            }
+        }
+        // Assign native names to the translated functions, then generate their code
+        rFunctions.clear();
+        for (unsigned i=0; i<mCandidates.size(); ++i)
+        {
+            if (mCandidates[i].translated)
+            {
+                mCandidates[i].nativeIndex = rFunctions.size();
+                rFunctions.push_back(mCandidates[i].pExpression);
+            }
+        }
+        if (rFunctions.empty())
+        {
+            return "";
+        }
+        std::ostringstream code;
+        code << "// Generated by ProtocolCompiler\n" << CODE_PREAMBLE << "\n";
+        for (unsigned i=0; i<mCandidates.size(); ++i)
+        {
+            if (mCandidates[i].translated)
+            {
+                code << "static double " << GetImplementationName(i) << "(" << GetParameterList(i) << ");\n";
+            }
+        }
+        for (unsigned i=0; i<mCandidates.size(); ++i)
+        {
+            if (mCandidates[i].translated)
+            {
+                // The body was translated on the final pass above
+                const Candidate& r_candidate = mCandidates[i];
+                const unsigned num_params = r_candidate.parameters.size();
+                code << "\n// " << (!r_candidate.name.empty() ? r_candidate.name
+                                     : dynamic_cast<ArrayCreate*>(r_candidate.pExpression) ? "array comprehension"
+                                     : "anonymous function") << "\n"
+                     << "static double " << GetImplementationName(i) << "(" << GetParameterList(i) << ")\n"
+                     << "{\n" << r_candidate.body << "}\n\n"
+                     << "extern \"C\" double fc_function_" << r_candidate.nativeIndex << "(const double* pArgs)\n"
+                     << "{\n"
+                     << "    return " << GetImplementationName(i) << "(";
+                for (unsigned j=0; j<num_params; ++j)
+                {
+                    code << (j == 0u ? "" : ", ") << "pArgs[" << j << "]";
+                }
+                code << ");\n}\n";
+            }
+        }
+        return code.str();
+    }
+
+private:
+    /** A set of names. */
+    typedef std::set<std::string> NameSet;
+
+    /** Details of a function that might be translated. */
+    struct Candidate
+    {
+        /** The name the function is assigned to, or empty if it is anonymous. */
+        std::string name;
+        /** The function definition: a LambdaExpression, or an ArrayCreate whose generator is translated. */
+        AbstractExpression* pExpression;
+        /** The function's parameters; for a comprehension generator, its index variables. */
+        std::vector<std::string> parameters;
+        /** Names bound by enclosing functions and comprehensions, which hide top-level functions. */
+        NameSet shadowed;
+        /** Whether the function can (still) be translated. */
+        bool translated;
+        /** The index of the function's native version, once known. */
+        unsigned nativeIndex;
+        /** The code for the function's body, if translated. */
+        std::string body;
+    };
+
+    /** Map from local names to the C++ variables holding their values. */
+    typedef std::map<std::string, std::string> LocalMap;
+
+    /** The functions that might be translated, in definition order. */
+    std::vector<Candidate> mCandidates;
+
+    /** Map from names to indices in #mCandidates. */
+    std::map<std::string, unsigned> mCandidateIndices;
+
+    /**
+     * Find the candidate functions in a block of statements: functions assigned to a name at the top
+     * level of the program, and anonymous functions (e.g. those given to map and fold) and array
+     * comprehensions anywhere within it.
+     *
+     * @param rBlock  the statements
+     * @param rShadowed  names bound by enclosing functions and comprehensions
+     * @param topLevel  whether the block is the top level of the program
+     */
+    void FindCandidates(std::vector<AbstractStatementPtr>& rBlock, const NameSet& rShadowed, bool topLevel)
+    {
+        BOOST_FOREACH(AbstractStatementPtr p_stmt, rBlock)
+        {
+            if (AssignmentStatement* p_assign = dynamic_cast<AssignmentStatement*>(p_stmt.get()))
+            {
+                LambdaExpression* p_lambda = dynamic_cast<LambdaExpression*>(p_assign->rGetRhs().get());
+                if (topLevel && p_lambda && !p_assign->GetTrace() && p_assign->rGetNamesToAssign().size() == 1u)
+                {
+                    AddFunction(p_lambda, p_assign->rGetNamesToAssign().front(), rShadowed);
+                }
+                else
+                {
+                    FindCandidates(p_assign->rGetRhs(), rShadowed);
+                }
+            }
+            else if (AssertStatement* p_assert = dynamic_cast<AssertStatement*>(p_stmt.get()))
+            {
+                FindCandidates(p_assert->rGetAssertion(), rShadowed);
+            }
+            else if (ReturnStatement* p_return = dynamic_cast<ReturnStatement*>(p_stmt.get()))
+            {
+                BOOST_FOREACH(AbstractExpressionPtr p_expr, p_return->rGetExpressions())
+                {
+                    FindCandidates(p_expr, rShadowed);
+                }
+            }
+        }
+    }
+
+    /**
+     * Find the candidate functions within an expression.
+     *
+     * @param pExpr  the expression
+     * @param rShadowed  names bound by enclosing functions and comprehensions
+     */
+    void FindCandidates(const AbstractExpressionPtr pExpr, const NameSet& rShadowed)
+    {
+        if (LambdaExpression* p_lambda = dynamic_cast<LambdaExpression*>(pExpr.get()))
+        {
+            AddFunction(p_lambda, "", rShadowed);
+            return;
+        }
+        if (FunctionCall* p_call = dynamic_cast<FunctionCall*>(pExpr.get()))
+        {
+            FindCandidates(p_call->rGetFunction(), rShadowed);
+        }
+        BOOST_FOREACH(AbstractExpressionPtr p_child, pExpr->rGetChildren())
+        {
+            FindCandidates(p_child, rShadowed);
+        }
+        ArrayCreate* p_comp = dynamic_cast<ArrayCreate*>(pExpr.get());
+        std::vector<std::string> index_names;
+        if (p_comp && p_comp->rGetElementGenerator() && GetIndexNames(*p_comp, index_names))
+        {
+            // Generators that use hoisted definitions need the interpreter to supply them
+            if (p_comp->rGetHoistedDefinitions().empty() && index_names.size() <= CompiledFunction::MAX_PARAMETERS)
+            {
+                AddCandidate("", p_comp, index_names, rShadowed);
+            }
+            NameSet shadowed(rShadowed);
+            shadowed.insert(index_names.begin(), index_names.end());
+            FindCandidates(p_comp->rGetElementGenerator(), shadowed);
+        }
+    }
+
+    /**
+     * Add a function definition as a candidate if it might be translatable, and find the candidates
+     * within its body.
+     *
+     * @param pLambda  the definition
+     * @param rName  the name it is assigned to, or empty if it is anonymous
+     * @param rShadowed  names bound by enclosing functions and comprehensions
+     */
+    void AddFunction(LambdaExpression* pLambda, const std::string& rName, const NameSet& rShadowed)
+    {
+        const std::vector<std::string>& r_params = pLambda->rGetFormalParameters();
+        if (!pLambda->GetTrace() && r_params.size() <= CompiledFunction::MAX_PARAMETERS)
+        {
+            AddCandidate(rName, pLambda, r_params, rShadowed);
+        }
+        // Functions nested within this one see its parameters and locals in preference to top-level names
+        NameSet shadowed(rShadowed);
+        shadowed.insert(r_params.begin(), r_params.end());
+        BOOST_FOREACH(AbstractStatementPtr p_stmt, pLambda->rGetBody())
+        {
+            if (AssignmentStatement* p_assign = dynamic_cast<AssignmentStatement*>(p_stmt.get()))
+            {
+                shadowed.insert(p_assign->rGetNamesToAssign().begin(), p_assign->rGetNamesToAssign().end());
+            }
+        }
+        FindCandidates(pLambda->rGetBody(), shadowed, false);
+    }
+
+    /**
+     * Add a candidate function.
+     *
+     * @param rName  the name it is assigned to, or empty if it is anonymous
+     * @param pExpression  the definition
+     * @param rParameters  its parameters
+     * @param rShadowed  names bound by enclosing functions and comprehensions
+     */
+    void AddCandidate(const std::string& rName, AbstractExpression* pExpression,
+                      const std::vector<std::string>& rParameters, const NameSet& rShadowed)
+    {
+        Candidate candidate;
+        candidate.name = rName;
+        candidate.pExpression = pExpression;
+        candidate.parameters = rParameters;
+        candidate.shadowed = rShadowed;
+        candidate.translated = true;
+        if (!rName.empty())
+        {
+            mCandidateIndices[rName] = mCandidates.size();
+        }
+        mCandidates.push_back(candidate);
+    }
+
+    /**
+     * @return the name of the C++ function implementing a candidate
+     * @param index  the candidate's index
+     */
+    std::string GetImplementationName(unsigned index) const
+    {
+        std::ostringstream name;
+        name << "fc_impl_" << index;
+        return name.str();
+    }
+
+    /**
+     * @return the parameter list for the C++ function implementing a candidate
+     * @param index  the candidate's index
+     */
+    std::string GetParameterList(unsigned index) const
+    {
+        std::ostringstream params;
+        for (unsigned i=0; i<mCandidates[index].parameters.size(); ++i)
+        {
+            params << (i == 0u ? "" : ", ") << "double v" << i;
+        }
+        return params.str();
+    }
+
+    /**
+     * Try to translate the body of a candidate function.
+     *
+     * @param index  the candidate's index
+     * @return  whether translation succeeded; if so the body code is stored in the candidate
+     */
+    bool TranslateFunction(unsigned index)
+    {
+        Candidate& r_candidate = mCandidates[index];
+        LocalMap locals;
+        const std::vector<std::string>& r_params = r_candidate.parameters;
+        for (unsigned i=0; i<r_params.size(); ++i)
+        {
+            if (locals.find(r_params[i]) != locals.end())
+            {
+                return false;
+            }
+            std::ostringstream var;
+            var << "v" << i;
+            locals[r_params[i]] = var.str();
+        }
+        std::string code;
+        if (ArrayCreate* p_comp = dynamic_cast<ArrayCreate*>(r_candidate.pExpression))
+        {
+            // The generator is a single expression
+            if (!TranslateExpression(p_comp->rGetElementGenerator(), locals, index, code))
+            {
+                return false;
+            }
+            r_candidate.body = "    return " + code + ";\n";
+            return true;
+        }
+        LambdaExpression* p_lambda = static_cast<LambdaExpression*>(r_candidate.pExpression);
+        std::ostringstream body;
+        const std::vector<AbstractStatementPtr>& r_body = p_lambda->rGetBody();
+        if (r_body.empty() || !p_lambda->rGetHoistedDefinitions().empty())
+        {
+            return false;
+        }
+        for (unsigned i=0; i<r_body.size(); ++i)
+        {
+            if (r_body[i]->GetTrace())
+            {
+                return false;
+            }
+            if (i + 1u < r_body.size())
+            {
+                // Must be a single assignment to a new local
+                AssignmentStatement* p_assign = dynamic_cast<AssignmentStatement*>(r_body[i].get());
+                if (!p_assign || p_assign->rGetNamesToAssign().size() != 1u
+                    || !TranslateExpression(p_assign->rGetRhs(), locals, index, code))
+                {
+                    return false;
+                }
+                const std::string& r_name = p_assign->rGetNamesToAssign().front();
+                if (locals.find(r_name) != locals.end() || r_name.find(':') != std::string::npos)
+                {
+                    return false;
+                }
+                std::ostringstream var;
+                var << "v" << locals.size();
+                locals[r_name] = var.str();
+                body << "    const double " << var.str() << " = " << code << ";\n";
+            }
+            else
+            {
+                // Must be a return of a single value
+                ReturnStatement* p_return = dynamic_cast<ReturnStatement*>(r_body[i].get());
+                if (!p_return || p_return->rGetExpressions().size() != 1u
+                    || !TranslateExpression(p_return->rGetExpressions().front(), locals, index, code))
+                {
+                    return false;
+                }
+                body << "    return " << code << ";\n";
+            }
+        }
+        r_candidate.body = body.str();
+        return true;
+    }
+
+    /**
+     * Try to translate an expression within a candidate function.
+     *
+     * @param pExpr  the expression
+     * @param rLocals  the names visible in the function
+     * @param caller  the index of the function containing the expression
+     * @param rCode  will be set to the translation
+     * @return  whether translation succeeded
+     */
+    bool TranslateExpression(const AbstractExpressionPtr pExpr,
+                             const LocalMap& rLocals,
+                             unsigned caller,
+                             std::string& rCode)
+    {
+        AbstractExpression* p_expr = pExpr.get();
+        if (p_expr->GetTrace())
+        {
+            return false;
+        }
+        if (ValueExpression* p_value = dynamic_cast<ValueExpression*>(p_expr))
+        {
+            if (!p_value->GetValue()->IsDouble())
+            {
+                return false;
+            }
+            rCode = Literal(GET_SIMPLE_VALUE(p_value->GetValue()));
+            return true;
+        }
+        if (NameLookup* p_lookup = dynamic_cast<NameLookup*>(p_expr))
+        {
+            LocalMap::const_iterator it = rLocals.find(p_lookup->rGetName());
+            if (it == rLocals.end())
+            {
+                return false;
+            }
+            rCode = it->second;
+            return true;
+        }
+        // All other supported expressions only have numeric children
+        std::vector<std::string> operands;
+        BOOST_FOREACH(AbstractExpressionPtr p_child, p_expr->rGetChildren())
+        {
+            std::string code;
+            if (!TranslateExpression(p_child, rLocals, caller, code))
+            {
+                return false;
+            }
+            operands.push_back(code);
+        }
+        const std::type_index type(typeid(*p_expr));
+        if (type == typeid(FunctionCall))
+        {
+            return TranslateCall(static_cast<FunctionCall*>(p_expr), operands, rLocals, caller, rCode);
+        }
+        if (type == typeid(If))
+        {
+            rCode = "(fc_test(" + operands[0] + ") ? " + operands[1] + " : " + operands[2] + ")";
+            return true;
+        }
+        std::map<std::type_index, std::pair<std::string, std::string> >::const_iterator unary_it
+            = GetUnaryOperators().find(type);
+        if (unary_it != GetUnaryOperators().end() && operands.size() == 1u)
+        {
+            rCode = unary_it->second.first + operands[0] + unary_it->second.second;
+            return true;
+        }
+        std::map<std::type_index, std::string>::const_iterator relation_it = GetRelations().find(type);
+        if (relation_it != GetRelations().end())
+        {
+            rCode = "(" + Join(operands, relation_it->second) + " ? 1.0 : 0.0)";
+            return true;
+        }
+        if (type == typeid(MathmlPlus))
+        {
+            operands.insert(operands.begin(), "0.0");
+            rCode = Join(operands, "+");
+        }
+        else if (type == typeid(MathmlTimes))
+        {
+            operands.insert(operands.begin(), "1.0");
+            rCode = Join(operands, "*");
+        }
+        else if (type == typeid(MathmlMinus))
+        {
+            rCode = operands.size() == 1u ? "(-" + operands[0] + ")" : Join(operands, "-");
+        }
+        else if (type == typeid(MathmlDivide))
+        {
+            rCode = Join(operands, "/");
+        }
+        else if (type == typeid(MathmlMax) || type == typeid(MathmlMin))
+        {
+            const bool is_max = (type == typeid(MathmlMax));
+            rCode = is_max ? "std::numeric_limits<double>::lowest()" : "std::numeric_limits<double>::max()";
+            BOOST_FOREACH(const std::string& r_operand, operands)
+            {
+                rCode = (is_max ? "std::max(" : "std::min(") + rCode + ", " + r_operand + ")";
+            }
+        }
+        else if (type == typeid(MathmlRem))
+        {
+            rCode = "fmod(" + operands[0] + ", " + operands[1] + ")";
+        }
+        else if (type == typeid(MathmlQuotient))
+        {
+            rCode = "fc_quotient(" + operands[0] + ", " + operands[1] + ")";
+        }
+        else if (type == typeid(MathmlPower))
+        {
+            rCode = "pow(" + operands[0] + ", " + operands[1] + ")";
+        }
+        else if (type == typeid(MathmlRoot))
+        {
+            // The optional degree comes first
+            rCode = operands.size() == 1u ? "sqrt(" + operands[0] + ")"
+                                          : "fc_root(" + operands[0] + ", " + operands[1] + ")";
+        }
+        else if (type == typeid(MathmlAnd) || type == typeid(MathmlOr))
+        {
+            for (unsigned i=0; i<operands.size(); ++i)
+            {
+                operands[i] = "fc_test(" + operands[i] + ")";
+            }
+            rCode = "(" + Join(operands, type == typeid(MathmlAnd) ? "&&" : "||") + " ? 1.0 : 0.0)";
+        }
+        else if (type == typeid(MathmlXor))
+        {
+            for (unsigned i=0; i<operands.size(); ++i)
+            {
+                operands[i] = "fc_test(" + operands[i] + ")";
+            }
+            operands.insert(operands.begin(), "false");
+            rCode = "(" + Join(operands, "^") + " ? 1.0 : 0.0)";
+        }
+        else if (type == typeid(MathmlNot))
+        {
+            rCode = "(fc_test(" + operands[0] + ") ? 0.0 : 1.0)";
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Try to translate a call to a named function.  The function must be translatable, and defined
+     * before the caller (or be the caller), so the name refers to it whenever the caller runs.
+     *
+     * @param pCall  the call
+     * @param rArgs  the translated arguments
+     * @param rLocals  the names visible in the calling function
+     * @param caller  the index of the calling function
+     * @param rCode  will be set to the translation
+     * @return  whether translation succeeded
+     */
+    bool TranslateCall(FunctionCall* pCall,
+                       const std::vector<std::string>& rArgs,
+                       const LocalMap& rLocals,
+                       unsigned caller,
+                       std::string& rCode)
+    {
+        NameLookup* p_lookup = dynamic_cast<NameLookup*>(pCall->rGetFunction().get());
+        if (!p_lookup || p_lookup->GetTrace() || rLocals.find(p_lookup->rGetName()) != rLocals.end()
+            || mCandidates[caller].shadowed.count(p_lookup->rGetName()) > 0u)
+        {
+            return false;
+        }
+        std::map<std::string, unsigned>::const_iterator it = mCandidateIndices.find(p_lookup->rGetName());
+        if (it == mCandidateIndices.end() || it->second > caller || !mCandidates[it->second].translated)
+        {
+            return false;
+        }
+        // Only named functions are callable, so the callee is a lambda
+        const LambdaExpression* p_callee = static_cast<LambdaExpression*>(mCandidates[it->second].pExpression);
+        const std::vector<AbstractValuePtr>& r_defaults = p_callee->rGetDefaultParameters();
+        const unsigned num_params = p_callee->rGetFormalParameters().size();
+        if (rArgs.size() > num_params || (rArgs.size() < num_params && r_defaults.empty()))
+        {
+            return false;
+        }
+        std::vector<std::string> args(num_params);
+        const std::vector<AbstractExpressionPtr>& r_arg_exprs = pCall->rGetChildren();
+        for (unsigned i=0; i<num_params; ++i)
+        {
+            bool use_default = (i >= rArgs.size());
+            if (!use_default)
+            {
+                ValueExpression* p_value = dynamic_cast<ValueExpression*>(r_arg_exprs[i].get());
+                use_default = p_value && p_value->GetValue()->IsDefault();
+            }
+            if (use_default)
+            {
+                if (r_defaults.empty() || !r_defaults[i] || !r_defaults[i]->IsDouble())
+                {
+                    return false;
+                }
+                args[i] = Literal(GET_SIMPLE_VALUE(r_defaults[i]));
+            }
+            else
+            {
+                args[i] = rArgs[i];
+            }
+        }
+        rCode = GetImplementationName(it->second) + "(";
+        for (unsigned i=0; i<num_params; ++i)
+        {
+            rCode += (i == 0u ? "" : ", ") + args[i];
+        }
+        rCode += ")";
+        return true;
+    }
+};
+
+/**
+ * Close a shared library opened by ProtocolCompiler::Compile.
+ *
+ * @param pLibrary  the library handle
+ */
+static void CloseLibrary(void* pLibrary)
+{
+    dlclose(pLibrary);
+}
+
+/**
+ * Set or clear the native version of a translated function.
+ *
+ * @param pFunction  a LambdaExpression or array comprehension, as given by ProtocolCompiler::GenerateCode
+ * @param pCompiled  the native version, or an empty pointer to use the interpreter
+ */
+static void SetNativeCode(AbstractExpression* pFunction, const CompiledFunctionPtr pCompiled)
+{
+    if (LambdaExpression* p_lambda = dynamic_cast<LambdaExpression*>(pFunction))
+    {
+        p_lambda->SetCompiledFunction(pCompiled);
+    }
+    else
+    {
+        static_cast<ArrayCreate*>(pFunction)->SetCompiledGenerator(pCompiled);
+    }
+}
+
+/**
+ * A folder that is deleted, along with its contents, when this object goes out of scope, so it is
+ * removed however compilation ends.
+ */
+class TemporaryFolder
+{
+public:
+    /**
+     * Create the folder.
+     *
+     * @param rPath  its path, which should be unique
+     */
+    TemporaryFolder(const fs::path& rPath)
+        : mPath(rPath)
+    {
+        boost::system::error_code error;
+        fs::create_directories(mPath, error);
+    }
+
+    /** Delete the folder. */
+    ~TemporaryFolder()
+    {
+        boost::system::error_code error;
+        fs::remove_all(mPath, error);
+    }
+
+    /** Get the folder's path. */
+    const fs::path& rGetPath() const
+    {
+        return mPath;
+    }
+
+    /** Get the folder. */
+    FileFinder GetFolder() const
+    {
+        return FileFinder(mPath.string(), RelativeTo::Absolute);
+    }
+
+private:
+    /** The folder's path. */
+    fs::path mPath;
+};
+
+ProtocolCompiler::ProtocolCompiler()
+    : mUsedCachedLibrary(false)
+{
+}
+
+std::string ProtocolCompiler::GenerateCode(const std::vector<AbstractStatementPtr>& rStatements,
+                                           std::vector<AbstractExpression*>& rFunctions)
+{
+    CodeGenerator generator(rStatements);
+    return generator.Generate(rFunctions);
+}
+
+void ProtocolCompiler::Compile(const std::vector<AbstractStatementPtr>& rStatements, ModelCache& rCache,
+                               const std::string& rSource)
+{
+    mUsedCachedLibrary = false;
+    std::vector<AbstractExpression*> functions;
+    const std::string code = GenerateCode(rStatements, functions);
+    if (functions.empty())
+    {
+        return;
+    }
+    const char* p_cxx = getenv("CXX");
+    const std::string compiler = (p_cxx && *p_cxx) ? p_cxx : "g++";
+    const std::string flags = " -O2 -fPIC -shared";
+    const std::string key = "protocol_" + HashText(std::string(CODE_FORMAT_VERSION) + compiler + flags + code);
+    const std::string library_name = "protocol.so";
+    const std::string source_name = "protocol.cpp";
+
+    // Work in a private folder, so the library we load can't be changed under us
+    const fs::path cache_folder = rCache.rGetFolder().GetAbsolutePath();
+    TemporaryFolder work(cache_folder / (key + "." + fs::unique_path().string() + ".tmp"));
+    const fs::path library_path = work.rGetPath() / library_name;
+    if (rCache.FetchFiles(key, std::vector<std::string>(1, library_name), work.GetFolder()))
+    {
+        mUsedCachedLibrary = true;
+    }
+    else
+    {
+        const fs::path source_path = work.rGetPath() / source_name;
+        const fs::path log_path = work.rGetPath() / "compiler.log";
+        {
+            std::ofstream source(source_path.string().c_str());
+            source << code;
+        }
+        const std::string command = compiler + flags + " -o \"" + library_path.string() + "\" \""
+                                    + source_path.string() + "\" > \"" + log_path.string() + "\" 2>&1";
+        if (system(command.c_str()) != 0)
+        {
+            std::ifstream log(log_path.string().c_str());
+            std::stringstream output;
+            output << log.rdbuf();
+            WARNING("Unable to compile protocol functions, so they will be interpreted instead. Compiler output:\n"
+                    << output.str());
+            return;
+        }
+        std::ostringstream info;
+        info << "protocol: " << rSource << "\n"
+             << "functions: " << functions.size() << "\n";
+        std::vector<std::string> file_names = {library_name, source_name};
+        rCache.StoreFiles(key, file_names, work.GetFolder(), info.str());
+    }
+
+    // The library stays loaded once its file is removed along with the work folder
+    void* p_handle = dlopen(library_path.string().c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!p_handle)
+    {
+        WARNING("Unable to load compiled protocol functions from " << library_path.string() << ": " << dlerror());
+        return;
+    }
+    boost::shared_ptr<void> p_library(p_handle, CloseLibrary);
+    for (unsigned i=0; i<functions.size(); ++i)
+    {
+        std::ostringstream symbol;
+        symbol << "fc_function_" << i;
+        CompiledFunction::FunctionPointer p_function
+            = reinterpret_cast<CompiledFunction::FunctionPointer>(dlsym(p_handle, symbol.str().c_str()));
+        if (!p_function)
+        {
+            // Shouldn't happen unless the cache has been tampered with
+            WARNING("Compiled protocol library " << key << " is missing " << symbol.str() << ".");
+            Restore();
+            return;
+        }
+        LambdaExpression* p_lambda = dynamic_cast<LambdaExpression*>(functions[i]);
+        const unsigned num_params = p_lambda ? p_lambda->rGetFormalParameters().size() : functions[i]->rGetChildren().size();
+        SetNativeCode(functions[i], boost::make_shared<CompiledFunction>(p_function, num_params, p_library));
+        mCompiledFunctions.push_back(functions[i]);
+    }
+}
+
+void ProtocolCompiler::Restore()
+{
+    BOOST_FOREACH(AbstractExpression* p_function, mCompiledFunctions)
+    {
+        SetNativeCode(p_function, CompiledFunctionPtr());
+    }
+    mCompiledFunctions.clear();
+}
+
+unsigned ProtocolCompiler::GetNumberCompiled() const
+{
+    return mCompiledFunctions.size();
+}
+
+bool ProtocolCompiler::GetUsedCachedLibrary() const
+{
+    return mUsedCachedLibrary;
+}
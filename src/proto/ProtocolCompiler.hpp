@@ -0,0 +1,121 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef PROTOCOLCOMPILER_HPP_
+#define PROTOCOLCOMPILER_HPP_
+
+#include <string>
+#include <vector>
+
+#include "AbstractStatement.hpp"
+#include "AbstractExpression.hpp"
+#include "ModelCache.hpp"
+
+/**
+ * Translates the scalar subset of a protocol program into C++, compiles it into a shared library,
+ * and loads that library so the translated functions run natively.
+ *
+ * Candidates for translation are functions assigned to a name at the top level of the program,
+ * anonymous functions anywhere within it (such as those given to map and fold, which then call native
+ * code for each element), and the generators of array comprehensions.  A function is translated if
+ * its body consists only of single-name assignments followed by a return of a single value, where
+ * every expression is built from numeric literals, its parameters and locals, MathML operators, if
+ * expressions, and calls to translated named functions defined earlier in the program (or itself).
+ * When all the arguments are simple values, such a function can only produce simple values, so the
+ * types of the whole body are known statically.  Calls with any other arguments (e.g. arrays, which
+ * MathML operators broadcast over) fall back to the interpreter, as do all other functions.  A
+ * comprehension generator is translated if it is such an expression of the index variables alone, and
+ * the native version then fills in the whole array.
+ *
+ * Libraries are kept in a ModelCache, keyed by a hash of the generated code (which covers everything
+ * about the protocol that affects the library), so the compiler is only run the first time a given
+ * protocol is used; later runs, even in other processes, just load the existing library.  If the
+ * compiler fails, a warning giving its output is shown and the program is interpreted as normal.
+ */
+class ProtocolCompiler
+{
+public:
+    /**
+     * Create a compiler.  No changes are made until Compile is called.
+     */
+    ProtocolCompiler();
+
+    /**
+     * Compile the translatable functions defined by a program, and set the corresponding
+     * LambdaExpression objects to use the native code.  Closures created before this call
+     * are not affected.
+     *
+     * The compiler run is given by the CXX environment variable, defaulting to g++.  It works in a
+     * temporary folder within the cache folder, which is removed however compilation ends.
+     *
+     * @param rStatements  the program
+     * @param rCache  the cache to store generated code and compiled libraries in
+     * @param rSource  where the program came from, recorded in the cache
+     */
+    void Compile(const std::vector<AbstractStatementPtr>& rStatements, ModelCache& rCache,
+                 const std::string& rSource);
+
+    /**
+     * Generate C++ code for the translatable functions defined by a program.
+     *
+     * @param rStatements  the program
+     * @param rFunctions  will be filled in with the functions translated, each a LambdaExpression or an
+     *     ArrayCreate whose generator was translated; the native version of rFunctions[i] is called
+     *     fc_function_i
+     * @return  the code, or an empty string if no functions could be translated
+     */
+    static std::string GenerateCode(const std::vector<AbstractStatementPtr>& rStatements,
+                                    std::vector<AbstractExpression*>& rFunctions);
+
+    /**
+     * Make all functions given native code by Compile use the interpreter again.
+     */
+    void Restore();
+
+    /** Get the number of functions given native code since the last Restore. */
+    unsigned GetNumberCompiled() const;
+
+    /** Whether the last call to Compile loaded an existing library, rather than running the compiler. */
+    bool GetUsedCachedLibrary() const;
+
+private:
+    /** Functions we have given native code to. */
+    std::vector<AbstractExpression*> mCompiledFunctions;
+
+    /** Whether the last call to Compile loaded an existing library. */
+    bool mUsedCachedLibrary;
+};
+
+#endif /* PROTOCOLCOMPILER_HPP_ */
@@ -0,0 +1,1211 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "ProtocolOptimiser.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <typeinfo>
+#include <boost/foreach.hpp>
+#include <boost/make_shared.hpp>
+
+#include "BacktraceException.hpp"
+#include "ProtoHelperMacros.hpp"
+#include "ValueTypes.hpp"
+#include "AssignmentStatement.hpp"
+#include "AssertStatement.hpp"
+#include "ReturnStatement.hpp"
+#include "NameLookup.hpp"
+#include "ValueExpression.hpp"
+#include "LambdaExpression.hpp"
+#include "TupleExpression.hpp"
+#include "Accessor.hpp"
+#include "FunctionCall.hpp"
+#include "ShapeCheck.hpp"
+#include "If.hpp"
+#include "ArrayCreate.hpp"
+#include "Find.hpp"
+#include "Fold.hpp"
+#include "Index.hpp"
+#include "Map.hpp"
+#include "View.hpp"
+#include "FileLoader.hpp"
+#include "MathmlAll.hpp"
+
+/** Type of a set of names. */
+typedef std::set<std::string> NameSet;
+
+/**
+ * @return whether the given name is prefixed, i.e. refers into a delegatee environment
+ * @param rName  the name
+ */
+static bool IsPrefixed(const std::string& rName)
+{
+    return rName.find(':') != std::string::npos;
+}
+
+/**
+ * @return the prefix of a prefixed name
+ * @param rName  the name
+ */
+static std::string GetPrefix(const std::string& rName)
+{
+    return rName.substr(0, rName.find(':'));
+}
+
+/**
+ * Get the names assigned to by a range of statements within a block.
+ *
+ * @param rBlock  the statements
+ * @param rNames  the names assigned will be added to this set
+ * @param start  index of the first statement to consider
+ * @param end  index one past the last statement to consider
+ */
+static void CollectAssignedNames(const std::vector<AbstractStatementPtr>& rBlock, NameSet& rNames,
+                                 unsigned start, unsigned end)
+{
+    for (unsigned i=start; i<end; ++i)
+    {
+        AssignmentStatement* p_assign = dynamic_cast<AssignmentStatement*>(rBlock[i].get());
+        if (p_assign)
+        {
+            rNames.insert(p_assign->rGetNamesToAssign().begin(), p_assign->rGetNamesToAssign().end());
+        }
+    }
+}
+
+/**
+ * Get references to the top-level expressions used by a statement.
+ *
+ * @param pStatement  the statement
+ */
+static std::vector<AbstractExpressionPtr*> GetExpressionSlots(const AbstractStatementPtr pStatement)
+{
+    std::vector<AbstractExpressionPtr*> slots;
+    if (AssignmentStatement* p_assign = dynamic_cast<AssignmentStatement*>(pStatement.get()))
+    {
+        slots.push_back(&p_assign->rGetRhs());
+    }
+    else if (AssertStatement* p_assert = dynamic_cast<AssertStatement*>(pStatement.get()))
+    {
+        slots.push_back(&p_assert->rGetAssertion());
+    }
+    else if (ReturnStatement* p_return = dynamic_cast<ReturnStatement*>(pStatement.get()))
+    {
+        BOOST_FOREACH(AbstractExpressionPtr& r_expr, p_return->rGetExpressions())
+        {
+            slots.push_back(&r_expr);
+        }
+    }
+    return slots;
+}
+
+/**
+ * @return whether the expression is a built-in operation implemented as a FunctionCall subclass,
+ * in which case the function expression is a dummy that is never evaluated.
+ * @param pExpr  the expression
+ */
+static bool IsBuiltinCall(const AbstractExpression* pExpr)
+{
+    return dynamic_cast<const ArrayCreate*>(pExpr) || dynamic_cast<const Map*>(pExpr)
+            || dynamic_cast<const Fold*>(pExpr) || dynamic_cast<const Index*>(pExpr)
+            || dynamic_cast<const View*>(pExpr) || dynamic_cast<const Find*>(pExpr);
+}
+
+/**
+ * @return whether the expression is an array comprehension
+ * @param pExpr  the expression
+ */
+static ArrayCreate* GetComprehension(AbstractExpression* pExpr)
+{
+    ArrayCreate* p_create = dynamic_cast<ArrayCreate*>(pExpr);
+    if (p_create && !p_create->rGetElementGenerator())
+    {
+        p_create = NULL;
+    }
+    return p_create;
+}
+
+/**
+ * Determine the names of the index variables bound by an array comprehension, if this can be done statically.
+ *
+ * @param rComprehension  the comprehension
+ * @param rNames  filled in with the index variable names
+ * @return  whether all names could be determined
+ */
+static bool GetIndexNames(ArrayCreate& rComprehension, NameSet& rNames)
+{
+    BOOST_FOREACH(AbstractExpressionPtr p_range, rComprehension.rGetChildren())
+    {
+        // The range may be a tuple expression, or have been folded to a constant tuple
+        AbstractValuePtr p_name;
+        if (TupleExpression* p_tuple = dynamic_cast<TupleExpression*>(p_range.get()))
+        {
+            ValueExpression* p_name_expr = dynamic_cast<ValueExpression*>(p_tuple->rGetChildren().back().get());
+            if (p_name_expr)
+            {
+                p_name = p_name_expr->GetValue();
+            }
+        }
+        else if (ValueExpression* p_value_expr = dynamic_cast<ValueExpression*>(p_range.get()))
+        {
+            if (p_value_expr->GetValue()->IsTuple())
+            {
+                TupleValue* p_tuple = static_cast<TupleValue*>(p_value_expr->GetValue().get());
+                p_name = p_tuple->GetItem(p_tuple->GetNumItems() - 1);
+            }
+        }
+        if (!p_name || !p_name->IsString())
+        {
+            return false;
+        }
+        rNames.insert(static_cast<StringValue*>(p_name.get())->GetString());
+    }
+    return true;
+}
+
+/**
+ * Determine how many of an expression's children are always evaluated when it is; these come first.
+ *
+ * @param pExpr  the expression
+ */
+static unsigned GetNumUnconditionalChildren(AbstractExpression* pExpr)
+{
+    unsigned num_children = pExpr->rGetChildren().size();
+    if (dynamic_cast<If*>(pExpr) || dynamic_cast<MathmlAnd*>(pExpr) || dynamic_cast<MathmlOr*>(pExpr))
+    {
+        num_children = 1u; // Only the test, or first operand of a short-circuit operator
+    }
+    else if (dynamic_cast<HoistedExpression*>(pExpr))
+    {
+        num_children = 0u; // The original expression is only evaluated as a fallback
+    }
+    return num_children;
+}
+
+/**
+ * Find the free names referenced by an expression.
+ *
+ * @param pExpr  the expression
+ * @param rBound  names bound locally, so not free
+ * @param rFree  free names will be added to this set
+ */
+static void CollectFreeNames(const AbstractExpressionPtr pExpr, const NameSet& rBound, NameSet& rFree)
+{
+    if (NameLookup* p_lookup = dynamic_cast<NameLookup*>(pExpr.get()))
+    {
+        if (rBound.find(p_lookup->rGetName()) == rBound.end())
+        {
+            rFree.insert(p_lookup->rGetName());
+        }
+    }
+    else if (LambdaExpression* p_lambda = dynamic_cast<LambdaExpression*>(pExpr.get()))
+    {
+        NameSet bound(rBound);
+        bound.insert(p_lambda->rGetFormalParameters().begin(), p_lambda->rGetFormalParameters().end());
+        std::vector<AbstractStatementPtr>& r_body = p_lambda->rGetBody();
+        CollectAssignedNames(r_body, bound, 0u, r_body.size());
+        BOOST_FOREACH(AbstractStatementPtr p_stmt, r_body)
+        {
+            BOOST_FOREACH(AbstractExpressionPtr* p_slot, GetExpressionSlots(p_stmt))
+            {
+                CollectFreeNames(*p_slot, bound, rFree);
+            }
+        }
+        BOOST_FOREACH(HoistedDefinitions::value_type& r_def, p_lambda->rGetHoistedDefinitions())
+        {
+            CollectFreeNames(r_def.second, rBound, rFree);
+        }
+    }
+    else
+    {
+        if (ArrayCreate* p_comp = GetComprehension(pExpr.get()))
+        {
+            // Over-approximate the free names if we can't tell what the index names are
+            NameSet bound(rBound);
+            GetIndexNames(*p_comp, bound);
+            CollectFreeNames(p_comp->rGetElementGenerator(), bound, rFree);
+            BOOST_FOREACH(HoistedDefinitions::value_type& r_def, p_comp->rGetHoistedDefinitions())
+            {
+                CollectFreeNames(r_def.second, rBound, rFree);
+            }
+        }
+        FunctionCall* p_call = dynamic_cast<FunctionCall*>(pExpr.get());
+        if (p_call && !IsBuiltinCall(p_call))
+        {
+            CollectFreeNames(p_call->rGetFunction(), rBound, rFree);
+        }
+        BOOST_FOREACH(AbstractExpressionPtr p_child, pExpr->rGetChildren())
+        {
+            CollectFreeNames(p_child, rBound, rFree);
+        }
+    }
+}
+
+/**
+ * Determine whether an expression is pure, i.e. cannot read files, and isn't being traced
+ * (which would make the number of evaluations visible).
+ *
+ * @param pExpr  the expression
+ */
+static bool IsPure(const AbstractExpressionPtr pExpr)
+{
+    if (pExpr->GetTrace() || dynamic_cast<FileLoader*>(pExpr.get()))
+    {
+        return false;
+    }
+    if (LambdaExpression* p_lambda = dynamic_cast<LambdaExpression*>(pExpr.get()))
+    {
+        BOOST_FOREACH(AbstractStatementPtr p_stmt, p_lambda->rGetBody())
+        {
+            if (p_stmt->GetTrace())
+            {
+                return false;
+            }
+            BOOST_FOREACH(AbstractExpressionPtr* p_slot, GetExpressionSlots(p_stmt))
+            {
+                if (!IsPure(*p_slot))
+                {
+                    return false;
+                }
+            }
+        }
+        BOOST_FOREACH(HoistedDefinitions::value_type& r_def, p_lambda->rGetHoistedDefinitions())
+        {
+            if (!IsPure(r_def.second))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    if (ArrayCreate* p_comp = GetComprehension(pExpr.get()))
+    {
+        if (!IsPure(p_comp->rGetElementGenerator()))
+        {
+            return false;
+        }
+        BOOST_FOREACH(HoistedDefinitions::value_type& r_def, p_comp->rGetHoistedDefinitions())
+        {
+            if (!IsPure(r_def.second))
+            {
+                return false;
+            }
+        }
+    }
+    FunctionCall* p_call = dynamic_cast<FunctionCall*>(pExpr.get());
+    if (p_call && !IsBuiltinCall(p_call))
+    {
+        NameLookup* p_fn_name = dynamic_cast<NameLookup*>(p_call->rGetFunction().get());
+        if ((p_fn_name && p_fn_name->rGetName() == "load") || !IsPure(p_call->rGetFunction()))
+        {
+            return false;
+        }
+    }
+    BOOST_FOREACH(AbstractExpressionPtr p_child, pExpr->rGetChildren())
+    {
+        if (!IsPure(p_child))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Find all the nodes in an expression tree, not including function bodies.
+ *
+ * @param pExpr  the expression
+ * @param rNodes  the nodes will be added to this set
+ */
+static void CollectNodes(const AbstractExpressionPtr pExpr, std::set<AbstractExpression*>& rNodes)
+{
+    rNodes.insert(pExpr.get());
+    if (ArrayCreate* p_comp = GetComprehension(pExpr.get()))
+    {
+        CollectNodes(p_comp->rGetElementGenerator(), rNodes);
+    }
+    FunctionCall* p_call = dynamic_cast<FunctionCall*>(pExpr.get());
+    if (p_call && !IsBuiltinCall(p_call))
+    {
+        CollectNodes(p_call->rGetFunction(), rNodes);
+    }
+    BOOST_FOREACH(AbstractExpressionPtr p_child, pExpr->rGetChildren())
+    {
+        CollectNodes(p_child, rNodes);
+    }
+}
+
+/**
+ * @return whether an expression just combines the values of its children, with no effect beyond
+ * computing its result, so may be evaluated in advance if all its children are constant.
+ * @param pExpr  the expression
+ */
+static bool IsFoldable(AbstractExpression* pExpr)
+{
+    return dynamic_cast<MathmlOperator*>(pExpr) || dynamic_cast<TupleExpression*>(pExpr)
+            || dynamic_cast<Accessor*>(pExpr) || dynamic_cast<Index*>(pExpr)
+            || dynamic_cast<View*>(pExpr) || dynamic_cast<Find*>(pExpr)
+            || (dynamic_cast<ArrayCreate*>(pExpr) && !GetComprehension(pExpr));
+}
+
+/**
+ * Create an expression that just yields the given value.
+ *
+ * @param pValue  the value
+ * @param rLoc  location information for the new expression
+ */
+static AbstractExpressionPtr MakeConstant(const AbstractValuePtr pValue, const std::string& rLoc)
+{
+    AbstractExpressionPtr p_const = boost::make_shared<ValueExpression>(pValue);
+    p_const->SetLocationInfo(rLoc);
+    return p_const;
+}
+
+/**
+ * Find the constant values visible from an environment, i.e. all non-function values that may be
+ * referenced without a prefix.
+ *
+ * @param rEnv  the environment
+ * @param rConstants  the constants will be added to this map
+ * @param rSeen  names already found in an environment that delegates to this one
+ */
+static void CollectConstants(const Environment& rEnv, std::map<std::string, AbstractValuePtr>& rConstants,
+                             NameSet& rSeen)
+{
+    BOOST_FOREACH(const std::string& r_name, rEnv.GetDefinedNames())
+    {
+        // Don't compute lazy definitions that may never be needed
+        if (!IsPrefixed(r_name) && rSeen.insert(r_name).second && !rEnv.IsDefinitionPending(r_name))
+        {
+            AbstractValuePtr p_value = rEnv.Lookup(r_name);
+            if (!p_value->IsLambda())
+            {
+                rConstants[r_name] = p_value;
+            }
+        }
+    }
+    EnvironmentCPtr p_delegatee = rEnv.GetDelegateeEnvironment();
+    if (p_delegatee)
+    {
+        CollectConstants(*p_delegatee, rConstants, rSeen);
+    }
+}
+
+
+/**
+ * If an expression is a call to a function whose name (ignoring any prefix) is the one given,
+ * with two arguments, get the arguments.
+ *
+ * @param pExpr  the expression
+ * @param rName  the function name
+ * @return the arguments, or an empty vector if the expression doesn't match
+ */
+static std::vector<AbstractExpressionPtr> GetBinaryCallArguments(const AbstractExpressionPtr pExpr,
+                                                                 const std::string& rName)
+{
+    FunctionCall* p_call = dynamic_cast<FunctionCall*>(pExpr.get());
+    if (p_call && !IsBuiltinCall(p_call) && p_call->rGetChildren().size() == 2u)
+    {
+        NameLookup* p_lookup = dynamic_cast<NameLookup*>(p_call->rGetFunction().get());
+        if (p_lookup)
+        {
+            const std::string& r_name = p_lookup->rGetName();
+            if (r_name == rName || (IsPrefixed(r_name) && r_name.substr(r_name.rfind(':') + 1) == rName))
+            {
+                return p_call->rGetChildren();
+            }
+        }
+    }
+    return std::vector<AbstractExpressionPtr>();
+}
+
+/**
+ * Create a native check equivalent to an assertion that two arrays have the same shape.
+ *
+ * @param pAssertion  the asserted expression
+ * @return the check, or an empty pointer if the assertion isn't recognised as a shape comparison
+ */
+static AbstractExpressionPtr MakeShapeCheck(const AbstractExpressionPtr pAssertion)
+{
+    AbstractExpressionPtr p_check;
+    std::vector<AbstractExpressionPtr> args = GetBinaryCallArguments(pAssertion, "ShapeEq");
+    if (!args.empty())
+    {
+        p_check = boost::make_shared<ShapeCheck>(args[0], false, args[1], false);
+    }
+    else
+    {
+        args = GetBinaryCallArguments(pAssertion, "ArrayEq");
+        if (!args.empty())
+        {
+            // At least one side must take the shape of an array for this to be a shape comparison
+            AbstractExpressionPtr operands[2];
+            bool is_shape[2];
+            for (unsigned i=0; i<2u; ++i)
+            {
+                Accessor* p_accessor = dynamic_cast<Accessor*>(args[i].get());
+                is_shape[i] = !(p_accessor && p_accessor->GetAttribute() == Accessor::SHAPE);
+                operands[i] = is_shape[i] ? args[i] : p_accessor->rGetChildren().front();
+            }
+            if (!is_shape[0] || !is_shape[1])
+            {
+                p_check = boost::make_shared<ShapeCheck>(operands[0], is_shape[0], operands[1], is_shape[1]);
+            }
+        }
+    }
+    if (p_check)
+    {
+        p_check->SetLocationInfo(pAssertion->GetLocationInfo());
+    }
+    return p_check;
+}
+
+
+ProtocolOptimiser::ProtocolOptimiser()
+    : mNumFolded(0u),
+      mNumEliminated(0u),
+      mNumHoisted(0u),
+      mNumRemoved(0u),
+      mNumAssertionsElided(0u)
+{}
+
+
+void ProtocolOptimiser::AddStablePrefix(const std::string& rPrefix)
+{
+    mStablePrefixes.insert(rPrefix);
+}
+
+
+void ProtocolOptimiser::Optimise(std::vector<AbstractStatementPtr>& rStatements,
+                                 const Environment& rEnv,
+                                 bool allowNewDefinitions)
+{
+    ConstantMap constants;
+    NameSet seen;
+    CollectConstants(rEnv, constants, seen);
+    FoldBlock(rStatements, constants);
+    OptimiseBlock(rStatements, NameSet());
+    if (allowNewDefinitions)
+    {
+        EliminateCommonSubexpressions(rStatements);
+    }
+}
+
+
+void ProtocolOptimiser::EnableMemoisation(std::vector<AbstractStatementPtr>& rStatements,
+                                          const MemoCache::StatisticsPtr pStatistics)
+{
+    BOOST_FOREACH(AbstractStatementPtr p_stmt, rStatements)
+    {
+        AssignmentStatement* p_assign = dynamic_cast<AssignmentStatement*>(p_stmt.get());
+        if (!p_assign || p_assign->GetTrace() || p_assign->rGetNamesToAssign().size() != 1u)
+        {
+            continue;
+        }
+        AbstractExpressionPtr p_rhs = p_assign->rGetRhs();
+        LambdaExpression* p_lambda = dynamic_cast<LambdaExpression*>(p_rhs.get());
+        if (!p_lambda || !IsPure(p_rhs))
+        {
+            continue;
+        }
+        NameSet free_names;
+        CollectFreeNames(p_rhs, NameSet(), free_names);
+        bool uses_model = false;
+        BOOST_FOREACH(const std::string& r_name, free_names)
+        {
+            if (IsPrefixed(r_name) && mStablePrefixes.find(GetPrefix(r_name)) == mStablePrefixes.end())
+            {
+                uses_model = true;
+                break;
+            }
+        }
+        if (!uses_model)
+        {
+            p_lambda->SetMemoisation(pStatistics);
+            mMemoisedFunctions.push_back(p_lambda);
+        }
+    }
+}
+
+
+void ProtocolOptimiser::Restore()
+{
+    for (unsigned i=mReplacedExpressions.size(); i-- > 0; )
+    {
+        *mReplacedExpressions[i].first = mReplacedExpressions[i].second;
+    }
+    for (unsigned i=mReplacedBlocks.size(); i-- > 0; )
+    {
+        *mReplacedBlocks[i].first = mReplacedBlocks[i].second;
+    }
+    BOOST_FOREACH(HoistedDefinitions* p_defs, mHoistingSites)
+    {
+        p_defs->clear();
+    }
+    BOOST_FOREACH(LambdaExpression* p_lambda, mMemoisedFunctions)
+    {
+        p_lambda->SetMemoisation(MemoCache::StatisticsPtr());
+    }
+    mReplacedExpressions.clear();
+    mReplacedBlocks.clear();
+    mHoistingSites.clear();
+    mMemoisedFunctions.clear();
+    mKeyIds.clear();
+    mNumFolded = mNumEliminated = mNumHoisted = mNumRemoved = mNumAssertionsElided = 0u;
+}
+
+
+unsigned ProtocolOptimiser::GetNumberFolded() const
+{
+    return mNumFolded;
+}
+
+
+unsigned ProtocolOptimiser::GetNumberEliminated() const
+{
+    return mNumEliminated;
+}
+
+
+unsigned ProtocolOptimiser::GetNumberHoisted() const
+{
+    return mNumHoisted;
+}
+
+
+unsigned ProtocolOptimiser::GetNumberMemoised() const
+{
+    return mMemoisedFunctions.size();
+}
+
+
+unsigned ProtocolOptimiser::GetNumberRemoved() const
+{
+    return mNumRemoved;
+}
+
+
+unsigned ProtocolOptimiser::GetNumberAssertionsElided() const
+{
+    return mNumAssertionsElided;
+}
+
+
+void ProtocolOptimiser::RemoveUnusedStatements(std::vector<AbstractStatementPtr>& rStatements,
+                                               const NameSet& rRequiredNames)
+{
+    // Work backwards, so we know what later statements need by the time we reach each one
+    NameSet required(rRequiredNames);
+    std::vector<bool> keep(rStatements.size(), false);
+    for (unsigned i=rStatements.size(); i-- > 0; )
+    {
+        AssignmentStatement* p_assign = dynamic_cast<AssignmentStatement*>(rStatements[i].get());
+        keep[i] = !p_assign || rStatements[i]->GetTrace();
+        if (p_assign)
+        {
+            BOOST_FOREACH(const std::string& r_name, p_assign->rGetNamesToAssign())
+            {
+                keep[i] = keep[i] || required.find(r_name) != required.end();
+            }
+        }
+        if (keep[i])
+        {
+            BOOST_FOREACH(AbstractExpressionPtr* p_slot, GetExpressionSlots(rStatements[i]))
+            {
+                CollectFreeNames(*p_slot, NameSet(), required);
+            }
+        }
+    }
+    std::vector<AbstractStatementPtr> new_statements;
+    for (unsigned i=0; i<rStatements.size(); ++i)
+    {
+        if (keep[i])
+        {
+            new_statements.push_back(rStatements[i]);
+        }
+    }
+    if (new_statements.size() < rStatements.size())
+    {
+        mNumRemoved += rStatements.size() - new_statements.size();
+        mReplacedBlocks.push_back(std::make_pair(&rStatements, rStatements));
+        rStatements = new_statements;
+    }
+}
+
+
+void ProtocolOptimiser::CollectReferencedNames(const std::vector<AbstractStatementPtr>& rStatements,
+                                               NameSet& rNames)
+{
+    BOOST_FOREACH(AbstractStatementPtr p_stmt, rStatements)
+    {
+        BOOST_FOREACH(AbstractExpressionPtr* p_slot, GetExpressionSlots(p_stmt))
+        {
+            CollectFreeNames(*p_slot, NameSet(), rNames);
+        }
+    }
+}
+
+
+void ProtocolOptimiser::CollectReferencedNames(const std::vector<AbstractExpressionPtr>& rExpressions,
+                                               NameSet& rNames)
+{
+    BOOST_FOREACH(AbstractExpressionPtr p_expr, rExpressions)
+    {
+        CollectFreeNames(p_expr, NameSet(), rNames);
+    }
+}
+
+
+void ProtocolOptimiser::ElideAssertions(std::vector<AbstractStatementPtr>& rStatements, unsigned start, unsigned end)
+{
+    ElideBlockAssertions(rStatements, start, std::min(end, (unsigned)rStatements.size()));
+}
+
+
+void ProtocolOptimiser::FoldBlock(std::vector<AbstractStatementPtr>& rBlock, ConstantMap constants)
+{
+    // Names assigned anywhere in the block shadow outer constants, since closures may be called later
+    NameSet assigned;
+    CollectAssignedNames(rBlock, assigned, 0u, rBlock.size());
+    BOOST_FOREACH(const std::string& r_name, assigned)
+    {
+        constants.erase(r_name);
+    }
+    BOOST_FOREACH(AbstractStatementPtr p_stmt, rBlock)
+    {
+        BOOST_FOREACH(AbstractExpressionPtr* p_slot, GetExpressionSlots(p_stmt))
+        {
+            FoldExpression(*p_slot, constants);
+        }
+        // An assignment of a constant value makes the name available for propagation
+        AssignmentStatement* p_assign = dynamic_cast<AssignmentStatement*>(p_stmt.get());
+        if (p_assign && p_assign->rGetNamesToAssign().size() == 1u)
+        {
+            ValueExpression* p_value = dynamic_cast<ValueExpression*>(p_assign->rGetRhs().get());
+            if (p_value)
+            {
+                constants[p_assign->rGetNamesToAssign().front()] = p_value->GetValue();
+            }
+        }
+    }
+}
+
+
+void ProtocolOptimiser::FoldExpression(AbstractExpressionPtr& rSlot, const ConstantMap& rConstants)
+{
+    AbstractExpressionPtr p_expr = rSlot;
+    if (p_expr->GetTrace() || dynamic_cast<ValueExpression*>(p_expr.get())
+        || dynamic_cast<HoistedExpression*>(p_expr.get()))
+    {
+        return;
+    }
+    if (NameLookup* p_lookup = dynamic_cast<NameLookup*>(p_expr.get()))
+    {
+        ConstantMap::const_iterator it = rConstants.find(p_lookup->rGetName());
+        if (it != rConstants.end())
+        {
+            ReplaceExpression(rSlot, MakeConstant(it->second, p_expr->GetLocationInfo()));
+            mNumFolded++;
+        }
+        return;
+    }
+    if (LambdaExpression* p_lambda = dynamic_cast<LambdaExpression*>(p_expr.get()))
+    {
+        ConstantMap local_constants(rConstants);
+        BOOST_FOREACH(const std::string& r_param, p_lambda->rGetFormalParameters())
+        {
+            local_constants.erase(r_param);
+        }
+        FoldBlock(p_lambda->rGetBody(), local_constants);
+        return;
+    }
+    if (ArrayCreate* p_comp = GetComprehension(p_expr.get()))
+    {
+        NameSet index_names;
+        ConstantMap local_constants;
+        if (GetIndexNames(*p_comp, index_names))
+        {
+            local_constants = rConstants;
+            BOOST_FOREACH(const std::string& r_name, index_names)
+            {
+                local_constants.erase(r_name);
+            }
+        }
+        FoldExpression(p_comp->rGetElementGenerator(), local_constants);
+    }
+    FunctionCall* p_call = dynamic_cast<FunctionCall*>(p_expr.get());
+    if (p_call && !IsBuiltinCall(p_call))
+    {
+        FoldExpression(p_call->rGetFunction(), rConstants);
+    }
+    bool all_constant = true;
+    BOOST_FOREACH(AbstractExpressionPtr& r_child, p_expr->rGetChildren())
+    {
+        FoldExpression(r_child, rConstants);
+        all_constant = all_constant && dynamic_cast<ValueExpression*>(r_child.get());
+    }
+    if (dynamic_cast<If*>(p_expr.get()))
+    {
+        // A constant test selects one branch
+        ValueExpression* p_test = dynamic_cast<ValueExpression*>(p_expr->rGetChildren()[0].get());
+        if (p_test && p_test->GetValue()->IsDouble())
+        {
+            double test = GET_SIMPLE_VALUE(p_test->GetValue());
+            ReplaceExpression(rSlot, p_expr->rGetChildren()[test ? 1 : 2]);
+            mNumFolded++;
+        }
+    }
+    else if (all_constant && IsFoldable(p_expr.get()))
+    {
+        try
+        {
+            EnvironmentPtr p_env(new Environment);
+            AbstractValuePtr p_value = (*p_expr)(*p_env);
+            ReplaceExpression(rSlot, MakeConstant(p_value, p_expr->GetLocationInfo()));
+            mNumFolded++;
+        }
+        catch (const Exception&)
+        {
+            // Leave it to fail at run time, with the proper context
+        }
+    }
+}
+
+
+void ProtocolOptimiser::OptimiseBlock(std::vector<AbstractStatementPtr>& rBlock, const NameSet& rUnstable)
+{
+    for (unsigned i=0; i<rBlock.size(); ++i)
+    {
+        // Closures created by this statement may be called after later statements have shadowed outer names
+        NameSet unstable(rUnstable);
+        CollectAssignedNames(rBlock, unstable, i, rBlock.size());
+        BOOST_FOREACH(AbstractExpressionPtr* p_slot, GetExpressionSlots(rBlock[i]))
+        {
+            OptimiseNestedScopes(*p_slot, unstable);
+        }
+    }
+}
+
+
+void ProtocolOptimiser::OptimiseNestedScopes(AbstractExpressionPtr& rSlot, const NameSet& rUnstable)
+{
+    AbstractExpressionPtr p_expr = rSlot;
+    if (dynamic_cast<HoistedExpression*>(p_expr.get()))
+    {
+        return;
+    }
+    if (LambdaExpression* p_lambda = dynamic_cast<LambdaExpression*>(p_expr.get()))
+    {
+        std::vector<AbstractStatementPtr>& r_body = p_lambda->rGetBody();
+        OptimiseBlock(r_body, rUnstable);
+        EliminateCommonSubexpressions(r_body);
+        // Parameters and local names vary between calls
+        NameSet varying(p_lambda->rGetFormalParameters().begin(), p_lambda->rGetFormalParameters().end());
+        CollectAssignedNames(r_body, varying, 0u, r_body.size());
+        HoistedDefinitions& r_defs = p_lambda->rGetHoistedDefinitions();
+        const unsigned num_defs = r_defs.size();
+        BOOST_FOREACH(AbstractStatementPtr p_stmt, r_body)
+        {
+            if (!p_stmt->GetTrace())
+            {
+                BOOST_FOREACH(AbstractExpressionPtr* p_slot, GetExpressionSlots(p_stmt))
+                {
+                    HoistInvariants(*p_slot, true, varying, rUnstable, false, r_defs);
+                }
+            }
+        }
+        if (num_defs == 0u && !r_defs.empty())
+        {
+            mHoistingSites.push_back(&r_defs);
+        }
+        return;
+    }
+    FunctionCall* p_call = dynamic_cast<FunctionCall*>(p_expr.get());
+    if (p_call && !IsBuiltinCall(p_call))
+    {
+        OptimiseNestedScopes(p_call->rGetFunction(), rUnstable);
+    }
+    BOOST_FOREACH(AbstractExpressionPtr& r_child, p_expr->rGetChildren())
+    {
+        OptimiseNestedScopes(r_child, rUnstable);
+    }
+    if (ArrayCreate* p_comp = GetComprehension(p_expr.get()))
+    {
+        OptimiseNestedScopes(p_comp->rGetElementGenerator(), rUnstable);
+        NameSet index_names;
+        if (GetIndexNames(*p_comp, index_names))
+        {
+            // Nothing can change while the array is being created, so all other names are fixed
+            HoistedDefinitions& r_defs = p_comp->rGetHoistedDefinitions();
+            const unsigned num_defs = r_defs.size();
+            HoistInvariants(p_comp->rGetElementGenerator(), false, index_names, NameSet(), true, r_defs);
+            if (num_defs == 0u && !r_defs.empty())
+            {
+                mHoistingSites.push_back(&r_defs);
+            }
+        }
+    }
+}
+
+
+void ProtocolOptimiser::EliminateCommonSubexpressions(std::vector<AbstractStatementPtr>& rBlock)
+{
+    // Find candidate sub-expressions, grouped by structure
+    std::vector<Occurrence> occurrences;
+    for (unsigned i=0; i<rBlock.size(); ++i)
+    {
+        // Errors within optional assignments are ignored, so we can't move their computations elsewhere
+        AssignmentStatement* p_assign = dynamic_cast<AssignmentStatement*>(rBlock[i].get());
+        const bool record = !rBlock[i]->GetTrace() && !(p_assign && p_assign->IsOptional());
+        BOOST_FOREACH(AbstractExpressionPtr* p_slot, GetExpressionSlots(rBlock[i]))
+        {
+            bool pure;
+            unsigned size;
+            AnalyseExpression(*p_slot, i, true, record, occurrences, pure, size);
+        }
+    }
+    std::map<unsigned, std::vector<unsigned> > occurrences_by_key;
+    std::vector<std::pair<unsigned, unsigned> > candidate_keys; // (size, key) pairs
+    for (unsigned i=0; i<occurrences.size(); ++i)
+    {
+        std::vector<unsigned>& r_group = occurrences_by_key[occurrences[i].keyId];
+        r_group.push_back(i);
+        if (r_group.size() == 2u)
+        {
+            candidate_keys.push_back(std::make_pair(occurrences[i].size, occurrences[i].keyId));
+        }
+    }
+    // Consider the largest expressions first, since replacing them subsumes their sub-expressions
+    std::sort(candidate_keys.rbegin(), candidate_keys.rend());
+
+    // Replace each set of duplicates that hasn't been subsumed by a larger replacement
+    std::set<AbstractExpression*> replaced_nodes;
+    std::vector<std::pair<unsigned, AbstractStatementPtr> > new_statements;
+    typedef std::pair<unsigned, unsigned> UnsignedPair;
+    BOOST_FOREACH(const UnsignedPair& r_candidate, candidate_keys)
+    {
+        std::vector<Occurrence> live;
+        BOOST_FOREACH(unsigned i, occurrences_by_key[r_candidate.second])
+        {
+            if (replaced_nodes.find(occurrences[i].pExpression) == replaced_nodes.end()
+                && occurrences[i].pSlot->get() == occurrences[i].pExpression)
+            {
+                live.push_back(occurrences[i]);
+            }
+        }
+        if (live.size() < 2u)
+        {
+            continue;
+        }
+        // Names referenced must mean the same thing at every occurrence
+        const unsigned first = live.front().statementIndex;
+        const unsigned last = live.back().statementIndex;
+        AbstractExpressionPtr p_expr = *live.front().pSlot;
+        NameSet free_names, assigned;
+        CollectFreeNames(p_expr, NameSet(), free_names);
+        CollectAssignedNames(rBlock, assigned, first, last);
+        bool shadowed = false;
+        BOOST_FOREACH(const std::string& r_name, free_names)
+        {
+            shadowed = shadowed || assigned.find(r_name) != assigned.end();
+        }
+        if (shadowed)
+        {
+            continue;
+        }
+        const std::string name = Environment::FreshIdent();
+        BOOST_FOREACH(Occurrence& r_occurrence, live)
+        {
+            CollectNodes(*r_occurrence.pSlot, replaced_nodes);
+            AbstractExpressionPtr p_lookup = boost::make_shared<NameLookup>(name);
+            p_lookup->SetLocationInfo(r_occurrence.pExpression->GetLocationInfo());
+            ReplaceExpression(*r_occurrence.pSlot, p_lookup);
+        }
+        AbstractStatementPtr p_assign = boost::make_shared<AssignmentStatement>(name, p_expr);
+        p_assign->SetLocationInfo(rBlock[first]->GetLocationInfo());
+        new_statements.push_back(std::make_pair(first, p_assign));
+        mNumEliminated += live.size() - 1u;
+    }
+
+    // Insert the new definitions before their first use
+    if (!new_statements.empty())
+    {
+        mReplacedBlocks.push_back(std::make_pair(&rBlock, rBlock));
+        std::vector<AbstractStatementPtr> new_block;
+        for (unsigned i=0; i<rBlock.size(); ++i)
+        {
+            for (unsigned j=0; j<new_statements.size(); ++j)
+            {
+                if (new_statements[j].first == i)
+                {
+                    new_block.push_back(new_statements[j].second);
+                }
+            }
+            new_block.push_back(rBlock[i]);
+        }
+        rBlock = new_block;
+    }
+}
+
+
+unsigned ProtocolOptimiser::AnalyseExpression(AbstractExpressionPtr& rSlot,
+                                              unsigned statementIndex,
+                                              bool isRoot,
+                                              bool record,
+                                              std::vector<Occurrence>& rOccurrences,
+                                              bool& rPure,
+                                              unsigned& rSize)
+{
+    AbstractExpression* p_expr = rSlot.get();
+    std::stringstream key;
+    key << typeid(*p_expr).name();
+    rPure = !p_expr->GetTrace();
+    rSize = 1u;
+    bool trivial = true;
+    if (NameLookup* p_lookup = dynamic_cast<NameLookup*>(p_expr))
+    {
+        key << ":" << p_lookup->rGetName();
+    }
+    else if (ValueExpression* p_value_expr = dynamic_cast<ValueExpression*>(p_expr))
+    {
+        AbstractValuePtr p_value = p_value_expr->GetValue();
+        if (SimpleValue* p_simple = dynamic_cast<SimpleValue*>(p_value.get()))
+        {
+            key << ":" << std::setprecision(17) << p_simple->GetValue();
+        }
+        else if (p_value->IsString())
+        {
+            key << ":\"" << static_cast<StringValue*>(p_value.get())->GetString() << "\"";
+        }
+        else if (!p_value->IsNull() && !p_value->IsDefault())
+        {
+            key << ":" << p_value.get(); // Compare other values by identity
+        }
+    }
+    else if (dynamic_cast<LambdaExpression*>(p_expr) || dynamic_cast<HoistedExpression*>(p_expr))
+    {
+        // Function bodies are a separate scope, so we don't look inside
+        key << ":" << p_expr;
+        rPure = rPure && IsPure(rSlot);
+    }
+    else
+    {
+        trivial = false;
+        if (Accessor* p_accessor = dynamic_cast<Accessor*>(p_expr))
+        {
+            key << ":" << p_accessor->GetAttribute();
+        }
+        else if (Map* p_map = dynamic_cast<Map*>(p_expr))
+        {
+            key << ":" << p_map->GetAllowImplicitArrays();
+        }
+        else if (dynamic_cast<FileLoader*>(p_expr))
+        {
+            rPure = false;
+        }
+        key << "(";
+        bool child_pure;
+        unsigned child_size;
+        FunctionCall* p_call = dynamic_cast<FunctionCall*>(p_expr);
+        if (p_call && !IsBuiltinCall(p_call))
+        {
+            NameLookup* p_fn_name = dynamic_cast<NameLookup*>(p_call->rGetFunction().get());
+            rPure = rPure && !(p_fn_name && p_fn_name->rGetName() == "load");
+            key << AnalyseExpression(p_call->rGetFunction(), statementIndex, false, record,
+                                     rOccurrences, child_pure, child_size) << ";";
+            rPure = rPure && child_pure;
+            rSize += child_size;
+        }
+        if (ArrayCreate* p_comp = GetComprehension(p_expr))
+        {
+            // The generator is evaluated in a nested scope, so only contributes to our key
+            key << AnalyseExpression(p_comp->rGetElementGenerator(), statementIndex, false, false,
+                                     rOccurrences, child_pure, child_size) << ";";
+            rPure = rPure && child_pure;
+            rSize += child_size;
+        }
+        std::vector<AbstractExpressionPtr>& r_children = p_expr->rGetChildren();
+        const unsigned num_unconditional = GetNumUnconditionalChildren(p_expr);
+        for (unsigned i=0; i<r_children.size(); ++i)
+        {
+            key << AnalyseExpression(r_children[i], statementIndex, false, record && i < num_unconditional,
+                                     rOccurrences, child_pure, child_size) << ",";
+            rPure = rPure && child_pure;
+            rSize += child_size;
+        }
+        key << ")";
+    }
+    // Intern the key
+    std::map<std::string, unsigned>::iterator it = mKeyIds.find(key.str());
+    if (it == mKeyIds.end())
+    {
+        const unsigned next_id = mKeyIds.size();
+        it = mKeyIds.insert(std::make_pair(key.str(), next_id)).first;
+    }
+    const unsigned key_id = it->second;
+    if (record && !isRoot && !trivial && rPure)
+    {
+        Occurrence occurrence = {&rSlot, p_expr, statementIndex, rSize, key_id};
+        rOccurrences.push_back(occurrence);
+    }
+    return key_id;
+}
+
+
+void ProtocolOptimiser::HoistInvariants(AbstractExpressionPtr& rSlot,
+                                        bool isRoot,
+                                        const NameSet& rVarying,
+                                        const NameSet& rUnstable,
+                                        bool allPrefixesStable,
+                                        HoistedDefinitions& rDefinitions)
+{
+    AbstractExpressionPtr p_expr = rSlot;
+    if (dynamic_cast<LambdaExpression*>(p_expr.get()) || dynamic_cast<HoistedExpression*>(p_expr.get())
+        || dynamic_cast<NameLookup*>(p_expr.get()) || dynamic_cast<ValueExpression*>(p_expr.get()))
+    {
+        return;
+    }
+    if (!isRoot && IsPure(p_expr))
+    {
+        NameSet free_names;
+        CollectFreeNames(p_expr, NameSet(), free_names);
+        bool invariant = true;
+        BOOST_FOREACH(const std::string& r_name, free_names)
+        {
+            if (rVarying.find(r_name) != rVarying.end())
+            {
+                invariant = false;
+            }
+            else if (IsPrefixed(r_name))
+            {
+                invariant = invariant && (allPrefixesStable
+                                          || mStablePrefixes.find(GetPrefix(r_name)) != mStablePrefixes.end());
+            }
+            else
+            {
+                invariant = invariant && rUnstable.find(r_name) == rUnstable.end();
+            }
+        }
+        if (invariant)
+        {
+            const std::string name = Environment::FreshIdent();
+            rDefinitions.push_back(std::make_pair(name, p_expr));
+            AbstractExpressionPtr p_hoisted = boost::make_shared<HoistedExpression>(name, p_expr);
+            p_hoisted->SetLocationInfo(p_expr->GetLocationInfo());
+            ReplaceExpression(rSlot, p_hoisted);
+            mNumHoisted++;
+            return;
+        }
+    }
+    // Look for invariant parts that are always evaluated
+    FunctionCall* p_call = dynamic_cast<FunctionCall*>(p_expr.get());
+    if (p_call && !IsBuiltinCall(p_call))
+    {
+        HoistInvariants(p_call->rGetFunction(), false, rVarying, rUnstable, allPrefixesStable, rDefinitions);
+    }
+    std::vector<AbstractExpressionPtr>& r_children = p_expr->rGetChildren();
+    const unsigned num_unconditional = GetNumUnconditionalChildren(p_expr.get());
+    for (unsigned i=0; i<num_unconditional; ++i)
+    {
+        HoistInvariants(r_children[i], false, rVarying, rUnstable, allPrefixesStable, rDefinitions);
+    }
+}
+
+
+void ProtocolOptimiser::ElideBlockAssertions(std::vector<AbstractStatementPtr>& rBlock, unsigned start, unsigned end)
+{
+    std::vector<AbstractStatementPtr> new_block(rBlock.begin(), rBlock.begin() + start);
+    bool changed = false;
+    for (unsigned i=start; i<end; ++i)
+    {
+        if (AssertStatement* p_assert = dynamic_cast<AssertStatement*>(rBlock[i].get()))
+        {
+            mNumAssertionsElided++;
+            changed = true;
+            AbstractExpressionPtr p_check = MakeShapeCheck(p_assert->rGetAssertion());
+            if (p_check)
+            {
+                AbstractStatementPtr p_new_assert = boost::make_shared<AssertStatement>(p_check);
+                p_new_assert->SetLocationInfo(p_assert->GetLocationInfo());
+                new_block.push_back(p_new_assert);
+            }
+            continue;
+        }
+        BOOST_FOREACH(AbstractExpressionPtr* p_slot, GetExpressionSlots(rBlock[i]))
+        {
+            ElideNestedAssertions(*p_slot);
+        }
+        new_block.push_back(rBlock[i]);
+    }
+    if (changed)
+    {
+        new_block.insert(new_block.end(), rBlock.begin() + end, rBlock.end());
+        mReplacedBlocks.push_back(std::make_pair(&rBlock, rBlock));
+        rBlock = new_block;
+    }
+}
+
+
+void ProtocolOptimiser::ElideNestedAssertions(AbstractExpressionPtr& rSlot)
+{
+    AbstractExpressionPtr p_expr = rSlot;
+    if (LambdaExpression* p_lambda = dynamic_cast<LambdaExpression*>(p_expr.get()))
+    {
+        std::vector<AbstractStatementPtr>& r_body = p_lambda->rGetBody();
+        ElideBlockAssertions(r_body, 0u, r_body.size());
+    }
+    FunctionCall* p_call = dynamic_cast<FunctionCall*>(p_expr.get());
+    if (p_call && !IsBuiltinCall(p_call) && p_call->rGetFunction())
+    {
+        ElideNestedAssertions(p_call->rGetFunction());
+    }
+    BOOST_FOREACH(AbstractExpressionPtr& r_child, p_expr->rGetChildren())
+    {
+        ElideNestedAssertions(r_child);
+    }
+    if (ArrayCreate* p_comp = GetComprehension(p_expr.get()))
+    {
+        ElideNestedAssertions(p_comp->rGetElementGenerator());
+    }
+}
+
+
+void ProtocolOptimiser::ReplaceExpression(AbstractExpressionPtr& rSlot, const AbstractExpressionPtr pNewExpression)
+{
+    mReplacedExpressions.push_back(std::make_pair(&rSlot, rSlot));
+    rSlot = pNewExpression;
+}
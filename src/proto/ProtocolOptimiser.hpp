@@ -0,0 +1,337 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef PROTOCOLOPTIMISER_HPP_
+#define PROTOCOLOPTIMISER_HPP_
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "AbstractExpression.hpp"
+#include "AbstractStatement.hpp"
+#include "Environment.hpp"
+#include "HoistedExpression.hpp"
+#include "MemoCache.hpp"
+
+class LambdaExpression;
+
+/**
+ * Rewrites the expression trees of a protocol's library and post-processing programs to avoid
+ * repeated work, once the values of the protocol inputs are known.  Three passes are applied:
+ *  - constant folding and propagation: sub-expressions depending only on literals and constant
+ *    names (inputs, and earlier assignments that themselves folded) are evaluated up front;
+ *  - common sub-expression elimination: pure sub-expressions occurring more than once within a
+ *    function body (or top-level program, where new definitions are allowed) are computed once
+ *    and bound to a fresh name;
+ *  - invariant hoisting: pure sub-expressions of a function body or array comprehension generator
+ *    that do not depend on the parameters or index variables are evaluated once per closure or
+ *    array creation, rather than once per call or element (see HoistedExpression).
+ *
+ * Only sub-expressions that are always evaluated are shared or hoisted, and none that might read
+ * files or model state, so the results of a program are unchanged.  Since the optimisations depend
+ * on input values, all changes made are logged so they can be reverted before the inputs change.
+ *
+ * Separately, RemoveUnusedStatements removes top-level statements whose results are never used, and
+ * ElideAssertions removes the assertions from library code that is trusted to be
+ * called correctly, which does change behaviour if it is not.
+ */
+class ProtocolOptimiser
+{
+public:
+    /**
+     * Create an optimiser.  No changes are made until Optimise is called.
+     */
+    ProtocolOptimiser();
+
+    /**
+     * Note that names with the given prefix refer to an imported library, so their values will
+     * not change once defined.  Other prefixed names (e.g. model variables) are assumed to vary.
+     *
+     * @param rPrefix  the prefix
+     */
+    void AddStablePrefix(const std::string& rPrefix);
+
+    /**
+     * Optimise a program.
+     *
+     * @param rStatements  the program, which will be rewritten in place
+     * @param rEnv  the environment the program will be executed within (or its delegatee); all
+     *     non-function values visible in here without a prefix are treated as constants
+     * @param allowNewDefinitions  whether new names may be defined at the top level of the program
+     */
+    void Optimise(std::vector<AbstractStatementPtr>& rStatements,
+                  const Environment& rEnv,
+                  bool allowNewDefinitions);
+
+    /**
+     * Make the pure functions defined by a program cache the results of calls (see MemoCache).
+     * Only functions assigned to a name at the top level of the program are considered, since
+     * anonymous functions are typically small and called with different arguments each time.
+     * A function is pure if it (and any function defined within it) does not call load, is not
+     * traced, and does not reference prefixed names other than those from stable prefixes, i.e.
+     * it cannot access model state.  Closures created before this call are not affected.
+     *
+     * @param rStatements  the program
+     * @param pStatistics  settings and counters for the caches
+     */
+    void EnableMemoisation(std::vector<AbstractStatementPtr>& rStatements,
+                           const MemoCache::StatisticsPtr pStatistics);
+
+    /**
+     * Remove the statements from a program that cannot affect the values of the given names.  A
+     * statement is kept if it assigns to a required name, or to a name referenced by a statement that
+     * is kept.  Assertions and traced statements are always kept, since their effects are visible.
+     * This should be done before calling Optimise, so that no work is spent on the removed statements.
+     *
+     * @param rStatements  the program, which will be rewritten in place
+     * @param rRequiredNames  the names whose values are needed after the program has run
+     */
+    void RemoveUnusedStatements(std::vector<AbstractStatementPtr>& rStatements,
+                                const std::set<std::string>& rRequiredNames);
+
+    /**
+     * Remove the assertions from a range of statements within a trusted library program, including
+     * those within any functions the statements define.  Assertions that two arrays have the same
+     * shape, written as ShapeEq(a, b) or ArrayEq(a.SHAPE, b.SHAPE) (where either side may be any
+     * expression giving a shape), are instead replaced by a native ShapeCheck, since they are cheap
+     * to test this way and guard against errors that would otherwise surface far from their cause.
+     * This should be done before calling Optimise, so that the assertions are seen as written.
+     *
+     * @param rStatements  the program, which will be rewritten in place
+     * @param start  index of the first statement to consider
+     * @param end  index one past the last statement to consider
+     */
+    void ElideAssertions(std::vector<AbstractStatementPtr>& rStatements, unsigned start, unsigned end);
+
+    /**
+     * Find the names a program may look up from the environment it is executed within.  Names
+     * assigned by one statement and used by a later one are included, so this over-approximates.
+     *
+     * @param rStatements  the program
+     * @param rNames  the names referenced will be added to this set
+     */
+    static void CollectReferencedNames(const std::vector<AbstractStatementPtr>& rStatements,
+                                       std::set<std::string>& rNames);
+
+    /**
+     * Find the names some expressions may look up from the environment they are evaluated within.
+     *
+     * @param rExpressions  the expressions
+     * @param rNames  the names referenced will be added to this set
+     */
+    static void CollectReferencedNames(const std::vector<AbstractExpressionPtr>& rExpressions,
+                                       std::set<std::string>& rNames);
+
+    /**
+     * Undo all changes made by previous calls to Optimise, EnableMemoisation, RemoveUnusedStatements
+     * and ElideAssertions, and reset the statistics.
+     */
+    void Restore();
+
+    /** Get the number of sub-expressions replaced by constant values since the last Restore. */
+    unsigned GetNumberFolded() const;
+
+    /** Get the number of repeated sub-expression evaluations removed since the last Restore. */
+    unsigned GetNumberEliminated() const;
+
+    /** Get the number of sub-expressions hoisted out of loops since the last Restore. */
+    unsigned GetNumberHoisted() const;
+
+    /** Get the number of functions made to cache their results since the last Restore. */
+    unsigned GetNumberMemoised() const;
+
+    /** Get the number of unused statements removed since the last Restore. */
+    unsigned GetNumberRemoved() const;
+
+    /** Get the number of assertions removed or replaced by shape checks since the last Restore. */
+    unsigned GetNumberAssertionsElided() const;
+
+private:
+    /** Type of a map from names to constant values. */
+    typedef std::map<std::string, AbstractValuePtr> ConstantMap;
+
+    /** Details of a candidate sub-expression for elimination. */
+    struct Occurrence
+    {
+        /** Where the sub-expression is referenced from. */
+        AbstractExpressionPtr* pSlot;
+        /** The sub-expression itself. */
+        AbstractExpression* pExpression;
+        /** Index of the statement containing it. */
+        unsigned statementIndex;
+        /** The number of nodes in the sub-expression. */
+        unsigned size;
+        /** Identifier for the structure of the sub-expression. */
+        unsigned keyId;
+    };
+
+    /**
+     * Fold constants within a block of statements.
+     *
+     * @param rBlock  the statements
+     * @param constants  constants visible to the block (names assigned in the block shadow these)
+     */
+    void FoldBlock(std::vector<AbstractStatementPtr>& rBlock, ConstantMap constants);
+
+    /**
+     * Fold constants within an expression.
+     *
+     * @param rSlot  where the expression is referenced from
+     * @param rConstants  constants visible to the expression
+     */
+    void FoldExpression(AbstractExpressionPtr& rSlot, const ConstantMap& rConstants);
+
+    /**
+     * Apply elimination and hoisting to all functions and array comprehensions within a block.
+     *
+     * @param rBlock  the statements
+     * @param rUnstable  names whose binding may change after functions defined here are created
+     */
+    void OptimiseBlock(std::vector<AbstractStatementPtr>& rBlock, const std::set<std::string>& rUnstable);
+
+    /**
+     * Apply elimination and hoisting to all functions and array comprehensions within an expression.
+     *
+     * @param rSlot  where the expression is referenced from
+     * @param rUnstable  names whose binding may change after functions defined here are created
+     */
+    void OptimiseNestedScopes(AbstractExpressionPtr& rSlot, const std::set<std::string>& rUnstable);
+
+    /**
+     * Compute common sub-expressions in a block of statements just once.
+     *
+     * @param rBlock  the statements
+     */
+    void EliminateCommonSubexpressions(std::vector<AbstractStatementPtr>& rBlock);
+
+    /**
+     * Compute a key for an expression such that structurally identical expressions have the same key,
+     * and record candidates for elimination.
+     *
+     * @param rSlot  where the expression is referenced from
+     * @param statementIndex  index of the statement containing the expression
+     * @param isRoot  whether this is the top-level expression of the statement
+     * @param record  whether this expression is always evaluated, so may be recorded as a candidate
+     * @param rOccurrences  candidates found
+     * @param rPure  set to whether the expression is pure and untraced
+     * @param rSize  set to the number of nodes in the expression
+     */
+    unsigned AnalyseExpression(AbstractExpressionPtr& rSlot,
+                               unsigned statementIndex,
+                               bool isRoot,
+                               bool record,
+                               std::vector<Occurrence>& rOccurrences,
+                               bool& rPure,
+                               unsigned& rSize);
+
+    /**
+     * Hoist maximal invariant sub-expressions out of a function body or comprehension generator.
+     *
+     * @param rSlot  where the expression is referenced from
+     * @param isRoot  whether this expression's value is the result of the statement, in which case it may escape
+     * @param rVarying  names bound afresh on each iteration
+     * @param rUnstable  names from enclosing scopes whose binding may change
+     * @param allPrefixesStable  whether all prefixed names may be treated as fixed
+     * @param rDefinitions  the hoisted definitions to add to
+     */
+    void HoistInvariants(AbstractExpressionPtr& rSlot,
+                         bool isRoot,
+                         const std::set<std::string>& rVarying,
+                         const std::set<std::string>& rUnstable,
+                         bool allPrefixesStable,
+                         HoistedDefinitions& rDefinitions);
+
+    /**
+     * Remove assertions from a range of statements within a block, and from any functions they define.
+     *
+     * @param rBlock  the statements
+     * @param start  index of the first statement to consider
+     * @param end  index one past the last statement to consider
+     */
+    void ElideBlockAssertions(std::vector<AbstractStatementPtr>& rBlock, unsigned start, unsigned end);
+
+    /**
+     * Remove assertions from all functions defined within an expression.
+     *
+     * @param rSlot  where the expression is referenced from
+     */
+    void ElideNestedAssertions(AbstractExpressionPtr& rSlot);
+
+    /**
+     * Replace an expression, logging the change so it can be undone.
+     *
+     * @param rSlot  where the expression is referenced from
+     * @param pNewExpression  the replacement
+     */
+    void ReplaceExpression(AbstractExpressionPtr& rSlot, const AbstractExpressionPtr pNewExpression);
+
+    /** Prefixes of names that will not change once defined. */
+    std::set<std::string> mStablePrefixes;
+
+    /** Log of replaced expressions, in order of replacement. */
+    std::vector<std::pair<AbstractExpressionPtr*, AbstractExpressionPtr> > mReplacedExpressions;
+
+    /** Log of rewritten statement lists, in order of rewriting. */
+    std::vector<std::pair<std::vector<AbstractStatementPtr>*, std::vector<AbstractStatementPtr> > > mReplacedBlocks;
+
+    /** Functions and comprehensions we have hoisted expressions out of. */
+    std::vector<HoistedDefinitions*> mHoistingSites;
+
+    /** Functions we have enabled memoisation for. */
+    std::vector<LambdaExpression*> mMemoisedFunctions;
+
+    /** Unique identifiers for the keys computed by AnalyseExpression. */
+    std::map<std::string, unsigned> mKeyIds;
+
+    /** Number of sub-expressions replaced by constants. */
+    unsigned mNumFolded;
+
+    /** Number of repeated sub-expression evaluations removed. */
+    unsigned mNumEliminated;
+
+    /** Number of sub-expressions hoisted. */
+    unsigned mNumHoisted;
+
+    /** Number of unused statements removed. */
+    unsigned mNumRemoved;
+
+    /** Number of assertions removed or replaced. */
+    unsigned mNumAssertionsElided;
+};
+
+#endif /* PROTOCOLOPTIMISER_HPP_ */
@@ -37,14 +37,21 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <vector>
 #include <iostream>
+#include <sstream>
+#include <cfloat>
 #include <boost/pointer_cast.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/foreach.hpp>
 
 #include "AbstractCvodeCell.hpp"
+#include "AbstractCardiacCellInterface.hpp"
+#include "AbstractUntemplatedParameterisedSystem.hpp"
 #include "CellMLToSharedLibraryConverter.hpp"
 #include "DynamicCellModelLoader.hpp"
 #include "AbstractDynamicallyLoadableEntity.hpp"
+#include "CvodeJacobianInfo.hpp"
+#include "PetscTools.hpp"
+#include "Warnings.hpp"
 
 #include "ProtocolParser.hpp"
 #include "ProtocolTimer.hpp"
@@ -55,8 +62,18 @@ typedef N_Vector VECTOR;
 ProtocolRunner::ProtocolRunner(const FileFinder& rModelFile,
                                const ProtocolFileFinder& rProtoXmlFile,
                                const std::string& rOutputFolder,
-                               bool optimiseModel)
-    : mHandler(rOutputFolder)
+                               bool optimiseModel,
+                               bool analyticJacobian,
+                               SolverBackend solver,
+                               boost::shared_ptr<ModelCache> pModelCache,
+                               LinearSolver linearSolver)
+    : mHandler(rOutputFolder),
+      mUsingAnalyticJacobian(false),
+      mAnalyticJacobianSpeedup(DOUBLE_UNSET),
+      mSolver(solver),
+      mLinearSolver(linearSolver),
+      mpModelCache(pModelCache),
+      mUsedCachedModel(false)
 {
     ProtocolTimer::Reset();
     ProtocolTimer::BeginEvent(ProtocolTimer::ALL);
@@ -64,10 +81,20 @@ ProtocolRunner::ProtocolRunner(const FileFinder& rModelFile,
               << rModelFile.GetAbsolutePath() << "' and writing output to "
               << mHandler.GetOutputDirectoryFullPath() << std::endl;
 
+    // The protocol is loaded first, since it may affect how the model is built
+    try
+    {
+        LoadProtocol(rProtoXmlFile);
+    }
+    catch (const Exception& r_e)
+    {
+        Protocol::WriteError(r_e.GetMessage(), mHandler);
+        throw;
+    }
     boost::shared_ptr<AbstractSystemWithOutputs> p_model;
     try
     {
-        p_model = LoadModel(rModelFile, rProtoXmlFile, optimiseModel);
+        p_model = LoadModel(rModelFile, rProtoXmlFile, optimiseModel, analyticJacobian, solver, linearSolver);
     }
     catch (...)
     {
@@ -77,7 +104,9 @@ ProtocolRunner::ProtocolRunner(const FileFinder& rModelFile,
     }
     try
     {
-        LoadProtocol(rProtoXmlFile, p_model);
+        ProtocolTimer::BeginEvent(ProtocolTimer::LOAD_PROTO);
+        mpProtocol->SetModel(p_model);
+        ProtocolTimer::EndEvent(ProtocolTimer::LOAD_PROTO);
     }
     catch (const Exception& r_e)
     {
@@ -102,31 +131,100 @@ ProtocolRunner::ProtocolRunner(const FileFinder& rModelFile,
 
 boost::shared_ptr<AbstractSystemWithOutputs> ProtocolRunner::LoadModel(const FileFinder& rModelFile,
                                                                        const ProtocolFileFinder& rProtoXmlFile,
-                                                                       bool optimiseModel)
+                                                                       bool optimiseModel,
+                                                                       bool analyticJacobian,
+                                                                       SolverBackend solver,
+                                                                       LinearSolver linearSolver)
 {
     ProtocolTimer::BeginEvent(ProtocolTimer::LOAD_MODEL);
     // Copy CellML file into output dir and create conf file
     std::string model_name = rModelFile.GetLeafNameNoExtension();
     std::cout << "Generating modified model " << model_name << std::endl;
     FileFinder copied_model = mHandler.CopyFileTo(rModelFile);
-    std::vector<std::string> options {"--cvode", "--expose-annotated-variables"};
+    std::vector<std::string> options {"--expose-annotated-variables"};
+    switch (solver)
+    {
+        case CVODE:
+            options.push_back("--cvode");
+            break;
+        case RUSH_LARSEN:
+            options.push_back("--rush-larsen");
+            break;
+        case GRL1:
+            options.push_back("--grl1");
+            break;
+    }
     options.push_back("--protocol=" + rProtoXmlFile.GetAbsolutePath());
     if (optimiseModel)
     {
         options.push_back("--opt");
     }
+    // The protocol may choose which Jacobian to use for each simulation, so needs an analytic one available
+    const bool protocol_jacobian = mpProtocol->HasSolverSetting("analyticJacobian");
+    if ((analyticJacobian || protocol_jacobian) && solver == CVODE)
+    {
+        // Saves CVODE approximating the Jacobian by difference quotients, which dominates for large models
+        options.push_back("--use-analytic-jacobian");
+    }
 
-    // Do the conversion
+    // Do the conversion, unless the model has been built for this protocol before
     CellMLToSharedLibraryConverter converter(true, "projects/FunctionalCuration");
     converter.CreateOptionsFile(mHandler, model_name, options);
-    DynamicCellModelLoaderPtr p_loader = converter.Convert(copied_model); // Note: collective call unless processes isolated
+    FileFinder model_to_load = copied_model;
+    std::string cache_key;
+    if (mpModelCache)
+    {
+        cache_key = ModelCache::GetKey(rModelFile, rProtoXmlFile, options);
+        // Only the master copies files, in case processes share the output folder; this also synchronises them
+        mUsedCachedModel = PetscTools::ReplicateBool(PetscTools::AmMaster() && mpModelCache->Fetch(cache_key, model_name, mHandler));
+        if (mUsedCachedModel)
+        {
+            std::cout << "Using cached build of model " << model_name << std::endl;
+            model_to_load = mHandler.FindFile("lib" + model_name + ".so");
+        }
+    }
+    DynamicCellModelLoaderPtr p_loader = converter.Convert(model_to_load); // Note: collective call unless processes isolated
+    if (mpModelCache && !mUsedCachedModel && PetscTools::AmMaster())
+    {
+        std::ostringstream description;
+        description << "source: " << rModelFile.GetAbsolutePath() << "\n"
+                    << "protocol: " << rProtoXmlFile.rGetOriginalSource().GetAbsolutePath() << "\n"
+                    << "options:";
+        BOOST_FOREACH(const std::string& r_option, options)
+        {
+            if (r_option.substr(0, 11) != "--protocol=")
+            {
+                description << " " << r_option;
+            }
+        }
+        description << "\n";
+        mpModelCache->Store(cache_key, model_name, mHandler, description.str());
+    }
     boost::shared_ptr<AbstractStimulusFunction> p_stimulus;
     boost::shared_ptr<AbstractIvpOdeSolver> p_solver;
-    boost::shared_ptr<AbstractCvodeCell> p_cell(dynamic_cast<AbstractCvodeCell*>(p_loader->CreateCell(p_solver, p_stimulus)));
+    boost::shared_ptr<AbstractCardiacCellInterface> p_cell(p_loader->CreateCell(p_solver, p_stimulus));
     // Check we have the right bases
     assert(dynamic_cast<AbstractDynamicallyLoadableEntity*>(p_cell.get()));
     boost::shared_ptr<AbstractSystemWithOutputs> p_model = boost::dynamic_pointer_cast<AbstractSystemWithOutputs>(p_cell);
     assert(p_model);
+    AbstractUntemplatedParameterisedSystem* p_system = dynamic_cast<AbstractUntemplatedParameterisedSystem*>(p_cell.get());
+    assert(p_system);
+    AbstractCvodeCell* p_cvode_cell = dynamic_cast<AbstractCvodeCell*>(p_cell.get());
+    assert(bool(p_cvode_cell) == (solver == CVODE));
+    if (p_cvode_cell)
+    {
+        if ((analyticJacobian || protocol_jacobian) && !p_cvode_cell->HasAnalyticJacobian())
+        {
+            WARNING("No analytic Jacobian could be generated for model " << model_name
+                    << "; CVODE will approximate it numerically.");
+        }
+        if (!analyticJacobian && p_cvode_cell->HasAnalyticJacobian())
+        {
+            // It was only generated for the protocol's simulations that ask for it
+            p_cvode_cell->ForceUseOfNumericalJacobian();
+        }
+        mUsingAnalyticJacobian = p_cvode_cell->HasAnalyticJacobian() && p_cvode_cell->GetUseAnalyticJacobian();
+    }
     // Write info about the model into the output folder
     out_stream p_model_info = mHandler.OpenOutputFile("model_info.txt");
     (*p_model_info) << p_model->rGetInputNames().size() << " inputs:\n";
@@ -139,35 +237,135 @@ boost::shared_ptr<AbstractSystemWithOutputs> ProtocolRunner::LoadModel(const Fil
     {
         (*p_model_info) << "\t" << r_name << "\n";
     }
-    (*p_model_info) << p_cell->GetNumberOfStateVariables() << " state variables:\n";
-    BOOST_FOREACH(const std::string& r_name, p_cell->rGetStateVariableNames())
+    (*p_model_info) << p_system->GetNumberOfStateVariables() << " state variables:\n";
+    BOOST_FOREACH(const std::string& r_name, p_system->rGetStateVariableNames())
     {
         (*p_model_info) << "\t" << r_name << "\n";
     }
-    *p_model_info << p_cell->GetNumberOfParameters() << " model parameters:\n";
-    BOOST_FOREACH(const std::string& r_name, p_cell->rGetParameterNames())
+    *p_model_info << p_system->GetNumberOfParameters() << " model parameters:\n";
+    BOOST_FOREACH(const std::string& r_name, p_system->rGetParameterNames())
     {
         (*p_model_info) << "\t" << r_name << "\n";
     }
+    (*p_model_info) << "Solver: " << GetSolverName(solver) << "\n";
+    (*p_model_info) << "Jacobian: " << (mUsingAnalyticJacobian ? "analytic" : "numerical") << "\n";
+    if (p_cvode_cell)
+    {
+        // Measuring the Jacobian shows whether an analytic one, or a sparse linear solver, is worthwhile
+        CvodeJacobianInfo jacobian_info(p_cvode_cell, p_model->GetFreeVariable());
+        (*p_model_info) << "Jacobian non-zeros: " << jacobian_info.GetNumNonZeros() << " of "
+                        << jacobian_info.GetNumEntries() << " entries\n";
+        mAnalyticJacobianSpeedup = jacobian_info.GetAnalyticSpeedup();
+        if (mAnalyticJacobianSpeedup != DOUBLE_UNSET)
+        {
+            (*p_model_info) << "Analytic Jacobian speedup: " << mAnalyticJacobianSpeedup << "\n";
+        }
+        (*p_model_info) << "Linear solver: " << GetLinearSolverName(linearSolver) << "\n";
+    }
 
-    p_cell->SetMaxSteps(2e7); // We need to allow CVODE to take lots of internal steps for some protocols
-    p_cell->SetTimestep(0.5); // Max dt = 0.5ms to ensure stimulus isn't missed
-    p_cell->SetTolerances(/*rel*/1e-6, /*abs*/1e-8); // Guard against changes to defaults
-    // p_cell->SetForceReset(false); // This is now the default behaviour.
+    if (p_cvode_cell)
+    {
+        p_cvode_cell->SetMaxSteps(2e7); // We need to allow CVODE to take lots of internal steps for some protocols
+        if (p_model->CanStopAtStimulusChanges())
+        {
+            // The solver is stopped and restarted at each stimulus switch, so needn't be limited
+            p_cvode_cell->SetTimestep(DBL_MAX);
+        }
+        else
+        {
+            p_cvode_cell->SetTimestep(0.5); // Max dt = 0.5ms to ensure stimulus isn't missed
+        }
+        p_cvode_cell->SetTolerances(/*rel*/1e-6, /*abs*/1e-8); // Guard against changes to defaults
+        if (linearSolver == KRYLOV)
+        {
+            AbstractSystemWithOutputs::SolverSettings settings;
+            settings.krylovLinearSolver = 1.0;
+            p_model->SetSolverSettings(settings);
+        }
+        // p_cell->SetForceReset(false); // This is now the default behaviour.
+    }
+    else
+    {
+        // Fixed step methods need a step small enough to resolve the upstroke; simulations may change it
+        p_cell->SetTimestep(0.01);
+    }
 
     ProtocolTimer::EndEvent(ProtocolTimer::LOAD_MODEL);
     return p_model;
 }
 
 
-void ProtocolRunner::LoadProtocol(const ProtocolFileFinder& rProtoXmlFile,
-                                  boost::shared_ptr<AbstractSystemWithOutputs> pModel)
+std::string ProtocolRunner::GetSolverName(SolverBackend solver)
+{
+    std::string name;
+    switch (solver)
+    {
+        case CVODE:
+            name = "cvode";
+            break;
+        case RUSH_LARSEN:
+            name = "rush-larsen";
+            break;
+        case GRL1:
+            name = "grl1";
+            break;
+    }
+    return name;
+}
+
+
+ProtocolRunner::SolverBackend ProtocolRunner::GetSolverBackend(const std::string& rName)
+{
+    SolverBackend solver = CVODE;
+    if (rName == "rush-larsen")
+    {
+        solver = RUSH_LARSEN;
+    }
+    else if (rName == "grl1")
+    {
+        solver = GRL1;
+    }
+    else if (rName != "cvode")
+    {
+        EXCEPTION("Unknown solver '" << rName << "'; must be one of cvode, rush-larsen or grl1.");
+    }
+    return solver;
+}
+
+
+std::string ProtocolRunner::GetLinearSolverName(LinearSolver linearSolver)
+{
+    return linearSolver == KRYLOV ? "krylov" : "dense";
+}
+
+
+ProtocolRunner::LinearSolver ProtocolRunner::GetLinearSolver(const std::string& rName)
+{
+    LinearSolver linear_solver = DENSE;
+    if (rName == "krylov")
+    {
+        linear_solver = KRYLOV;
+    }
+    else if (rName != "dense")
+    {
+        EXCEPTION("Unknown linear solver '" << rName << "'; must be dense or krylov.");
+    }
+    return linear_solver;
+}
+
+
+double ProtocolRunner::GetAnalyticJacobianSpeedup() const
+{
+    return mAnalyticJacobianSpeedup;
+}
+
+
+void ProtocolRunner::LoadProtocol(const ProtocolFileFinder& rProtoXmlFile)
 {
     ProtocolTimer::BeginEvent(ProtocolTimer::LOAD_PROTO);
     ProtocolParser parser;
     mpProtocol = parser.ParseFile(rProtoXmlFile);
     mpProtocol->SetOutputFolder(mHandler);
-    mpProtocol->SetModel(pModel);
     ProtocolTimer::EndEvent(ProtocolTimer::LOAD_PROTO);
 }
 
@@ -183,6 +381,25 @@ void ProtocolRunner::RunProtocol()
     mpProtocol->RunAndWrite("outputs");
     ProtocolTimer::Headings();
     ProtocolTimer::Report();
+    // Comparing the simulation time between runs with different solver options shows their benefit
+    std::cout << "Model solved using " << GetSolverName(mSolver);
+    if (mSolver == CVODE)
+    {
+        std::cout << " with " << (mUsingAnalyticJacobian ? "an analytic" : "a numerical") << " Jacobian and a "
+                  << GetLinearSolverName(mLinearSolver) << " linear solver";
+        if (mAnalyticJacobianSpeedup != DOUBLE_UNSET)
+        {
+            std::cout << "; the analytic Jacobian was measured to be " << mAnalyticJacobianSpeedup
+                      << " times faster to evaluate than the numerical approximation";
+        }
+    }
+    std::cout << "." << std::endl;
+}
+
+
+bool ProtocolRunner::GetUsedCachedModel() const
+{
+    return mUsedCachedModel;
 }
 
 
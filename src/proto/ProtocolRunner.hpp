@@ -37,11 +37,13 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define PROTOCOLRUNNER_HPP_
 
 #include <string>
+#include <boost/shared_ptr.hpp>
 
 #include "FileFinder.hpp"
 #include "OutputFileHandler.hpp"
 #include "ProtocolFileFinder.hpp"
 #include "Protocol.hpp"
+#include "ModelCache.hpp"
 
 /**
  * This class encapsulates the typical logic required to load a model and run a protocol on it.
@@ -49,6 +51,21 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 class ProtocolRunner
 {
 public:
+    /** The methods that may be used to solve models, as selected when the model is converted. */
+    enum SolverBackend
+    {
+        CVODE,       ///< Adaptive step size, using CVODE
+        RUSH_LARSEN, ///< Fixed step size, using the Rush-Larsen exponential integrator for gating variables
+        GRL1         ///< Fixed step size, using the first order generalised Rush-Larsen method
+    };
+
+    /** The methods CVODE may use to solve the linear systems in its Newton iterations. */
+    enum LinearSolver
+    {
+        DENSE, ///< Dense direct solution, using the Jacobian or its difference quotient approximation
+        KRYLOV ///< Matrix-free iterative solution (GMRES), which suits models with sparse Jacobians
+    };
+
     /**
      * Create a protocol runner, providing the paths to model and protocol definitions.
      * The constructor will perform the model modifications and code generation for the model.
@@ -57,11 +74,23 @@ public:
      * @param rProtoXmlFile  the protocol definition file
      * @param rOutputFolder  where to put generated files and protocol outputs
      * @param optimiseModel  whether to apply PyCml optimisations to the model
+     * @param analyticJacobian  whether to generate an analytic Jacobian for CVODE to use, rather
+     *     than letting it approximate the Jacobian by difference quotients.  One is also generated if
+     *     any simulation in the protocol chooses which to use (see AbstractSimulation::SetSolverSetting),
+     *     but then only used where the protocol says.
+     * @param solver  the method to generate code for solving the model with
+     * @param pModelCache  if given, a cache of libraries built from models, to use instead of converting
+     *     and compiling the model again if it has been built for this protocol before
+     * @param linearSolver  how CVODE should solve its linear systems, unless the protocol says otherwise
      */
     ProtocolRunner(const FileFinder& rModelFile,
                    const ProtocolFileFinder& rProtoXmlFile,
                    const std::string& rOutputFolder,
-                   bool optimiseModel=false);
+                   bool optimiseModel=false,
+                   bool analyticJacobian=false,
+                   SolverBackend solver=CVODE,
+                   boost::shared_ptr<ModelCache> pModelCache=boost::shared_ptr<ModelCache>(),
+                   LinearSolver linearSolver=DENSE);
 
     /**
      * Run the protocol and write out results.
@@ -80,33 +109,89 @@ public:
      */
     void SetPngOutput(bool writePng);
 
+    /** Whether the model was loaded from the model cache, rather than being converted and compiled. */
+    bool GetUsedCachedModel() const;
+
+    /**
+     * @return  the name of a solver backend, as used on the command line.
+     * @param solver  the backend
+     */
+    static std::string GetSolverName(SolverBackend solver);
+
+    /**
+     * @return  the solver backend with the given name, as used on the command line.
+     * @param rName  the name: cvode, rush-larsen or grl1
+     */
+    static SolverBackend GetSolverBackend(const std::string& rName);
+
+    /**
+     * @return  the name of a linear solver, as used on the command line.
+     * @param linearSolver  the linear solver
+     */
+    static std::string GetLinearSolverName(LinearSolver linearSolver);
+
+    /**
+     * @return  the linear solver with the given name, as used on the command line.
+     * @param rName  the name: dense or krylov
+     */
+    static LinearSolver GetLinearSolver(const std::string& rName);
+
+    /**
+     * @return  how many times faster the model's analytic Jacobian was measured to be to evaluate than
+     * the difference quotient approximation, or DOUBLE_UNSET if it has none (see CvodeJacobianInfo)
+     */
+    double GetAnalyticJacobianSpeedup() const;
+
 private:
     /**
-     * Load a model from a CellML file.
+     * Load a model from a CellML file.  The protocol must have been loaded already, since it may
+     * affect how the model is built.
      *
      * @param rModelFile  the model CellML file
      * @param rProtoXmlFile  the protocol definition file
      * @param optimiseModel  whether to apply PyCml optimisations to the model
+     * @param analyticJacobian  whether to generate an analytic Jacobian for the model, and use it by default
+     * @param solver  the method to generate code for solving the model with
+     * @param linearSolver  how CVODE should solve its linear systems by default
      * @return
      */
     boost::shared_ptr<AbstractSystemWithOutputs> LoadModel(const FileFinder& rModelFile,
                                                            const ProtocolFileFinder& rProtoXmlFile,
-                                                           bool optimiseModel);
+                                                           bool optimiseModel,
+                                                           bool analyticJacobian,
+                                                           SolverBackend solver,
+                                                           LinearSolver linearSolver);
 
     /**
      * Load a protocol from its definition file.
      *
      * @param rProtoXmlFile  the protocol definition file
-     * @param pModel  the model to experiment on
      */
-    void LoadProtocol(const ProtocolFileFinder& rProtoXmlFile,
-                      boost::shared_ptr<AbstractSystemWithOutputs> pModel);
+    void LoadProtocol(const ProtocolFileFinder& rProtoXmlFile);
 
     /** The handler for file output. */
     OutputFileHandler mHandler;
 
     /** The protocol object. */
     ProtocolPtr mpProtocol;
+
+    /** Whether the model is solved using an analytic Jacobian, for reporting with the timings. */
+    bool mUsingAnalyticJacobian;
+
+    /** How many times faster the model's analytic Jacobian is to evaluate, if it has one, for reporting with the timings. */
+    double mAnalyticJacobianSpeedup;
+
+    /** The method used to solve the model. */
+    SolverBackend mSolver;
+
+    /** How CVODE solves its linear systems by default. */
+    LinearSolver mLinearSolver;
+
+    /** The cache of libraries built from models, if any. */
+    boost::shared_ptr<ModelCache> mpModelCache;
+
+    /** Whether the model was loaded from #mpModelCache. */
+    bool mUsedCachedModel;
 };
 
 #endif // PROTOCOLRUNNER_HPP_
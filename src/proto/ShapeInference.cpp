@@ -0,0 +1,997 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "ShapeInference.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include <boost/foreach.hpp>
+#include <boost/make_shared.hpp>
+
+#include "BacktraceException.hpp"
+#include "ProtoHelperMacros.hpp"
+#include "ValueTypes.hpp"
+#include "VectorStreaming.hpp"
+#include "LambdaClosure.hpp"
+#include "AssignmentStatement.hpp"
+#include "AssertStatement.hpp"
+#include "ReturnStatement.hpp"
+#include "NameLookup.hpp"
+#include "ValueExpression.hpp"
+#include "LambdaExpression.hpp"
+#include "TupleExpression.hpp"
+#include "Accessor.hpp"
+#include "If.hpp"
+#include "ArrayCreate.hpp"
+#include "Find.hpp"
+#include "Fold.hpp"
+#include "Index.hpp"
+#include "Map.hpp"
+#include "View.hpp"
+#include "FileLoader.hpp"
+#include "MathmlAll.hpp"
+
+/** Shorthand for an array shape. */
+typedef NdArray<double>::Extents Extents;
+
+const NdArray<double>::Index ShapeInference::UNKNOWN_EXTENT = std::numeric_limits<NdArray<double>::Index>::max();
+
+/**
+ * Report an error if the code being analysed is certain to run, otherwise carry on.
+ * @param msg  the error message, as a streamed expression
+ * @param loc  the source location to report
+ */
+#define INFERENCE_ERROR(msg, loc)                \
+    do {                                         \
+        if (mDefinite) PROTO_EXCEPTION2(msg, loc); \
+    } while (false)
+
+/**
+ * Marks code being analysed that might not run, for the lifetime of this object, so that
+ * errors found within it are not reported.
+ */
+class ConditionalCode
+{
+public:
+    /**
+     * Start analysing conditional code.
+     *
+     * @param rDefinite  the flag recording whether code is certain to run
+     */
+    ConditionalCode(bool& rDefinite)
+        : mrDefinite(rDefinite),
+          mWasDefinite(rDefinite)
+    {
+        mrDefinite = false;
+    }
+
+    /** Return to analysing the enclosing code. */
+    ~ConditionalCode()
+    {
+        mrDefinite = mWasDefinite;
+    }
+
+private:
+    /** The flag recording whether code is certain to run. */
+    bool& mrDefinite;
+
+    /** Its value before this object was created. */
+    bool mWasDefinite;
+};
+
+/**
+ * @return an array shape formatted as by VectorStreaming, but showing unknown extents as ?
+ * @param rExtents  the shape
+ */
+static std::string ShapeToString(const Extents& rExtents)
+{
+    std::stringstream str;
+    str << '{';
+    for (unsigned i=0; i<rExtents.size(); ++i)
+    {
+        if (i > 0)
+        {
+            str << ", ";
+        }
+        if (rExtents[i] == ShapeInference::UNKNOWN_EXTENT)
+        {
+            str << "?";
+        }
+        else
+        {
+            str << rExtents[i];
+        }
+    }
+    str << '}';
+    return str.str();
+}
+
+/**
+ * Determine the names of the index variables bound by an array comprehension, if this can be done statically.
+ *
+ * @param rComprehension  the comprehension
+ * @param rNames  filled in with the index variable names
+ * @return  whether all names could be determined
+ */
+static bool GetIndexNames(ArrayCreate& rComprehension, std::vector<std::string>& rNames)
+{
+    BOOST_FOREACH(AbstractExpressionPtr p_range, rComprehension.rGetChildren())
+    {
+        AbstractValuePtr p_name;
+        if (TupleExpression* p_tuple = dynamic_cast<TupleExpression*>(p_range.get()))
+        {
+            ValueExpression* p_name_expr = dynamic_cast<ValueExpression*>(p_tuple->rGetChildren().back().get());
+            if (p_name_expr)
+            {
+                p_name = p_name_expr->GetValue();
+            }
+        }
+        else if (ValueExpression* p_value_expr = dynamic_cast<ValueExpression*>(p_range.get()))
+        {
+            if (p_value_expr->GetValue()->IsTuple())
+            {
+                TupleValue* p_tuple = static_cast<TupleValue*>(p_value_expr->GetValue().get());
+                p_name = p_tuple->GetItem(p_tuple->GetNumItems() - 1);
+            }
+        }
+        if (!p_name || !p_name->IsString())
+        {
+            return false;
+        }
+        rNames.push_back(static_cast<StringValue*>(p_name.get())->GetString());
+    }
+    return true;
+}
+
+
+//
+// Types
+//
+
+ShapeInference::Type::Type(Kind kind)
+    : kind(kind),
+      rankKnown(false),
+      pLambda(NULL)
+{}
+
+ShapeInference::Type ShapeInference::Type::Array(const Extents& rExtents)
+{
+    Type type(ARRAY);
+    type.rankKnown = true;
+    type.extents = rExtents;
+    return type;
+}
+
+ShapeInference::Type ShapeInference::Type::ArrayOfRank(unsigned rank)
+{
+    return Array(Extents(rank, UNKNOWN_EXTENT));
+}
+
+ShapeInference::Type ShapeInference::Type::Of(const AbstractValuePtr pValue)
+{
+    Type type;
+    if (pValue->IsDouble())
+    {
+        type = Array(Extents());
+    }
+    else if (pValue->IsArray())
+    {
+        type = Array(GET_ARRAY(pValue).GetShape());
+    }
+    else if (pValue->IsTuple())
+    {
+        type.kind = TUPLE;
+        const TupleValue* p_tuple = static_cast<const TupleValue*>(pValue.get());
+        for (unsigned i=0; i<p_tuple->GetNumItems(); ++i)
+        {
+            type.items.push_back(Of(p_tuple->GetItem(i)));
+        }
+    }
+    else if (pValue->IsLambda())
+    {
+        type.kind = FUNCTION;
+    }
+    else if (pValue->IsNull())
+    {
+        type.kind = NULL_VALUE;
+    }
+    else if (pValue->IsString())
+    {
+        type.kind = STRING;
+    }
+    else if (pValue->IsDefault())
+    {
+        type.kind = DEFAULT_VALUE;
+    }
+    type.pValue = pValue;
+    return type;
+}
+
+bool ShapeInference::Type::IsSimpleValue() const
+{
+    return kind == ARRAY && rankKnown && extents.empty();
+}
+
+bool ShapeInference::Type::IsFullyKnownArray() const
+{
+    return kind == ARRAY && rankKnown
+            && std::find(extents.begin(), extents.end(), UNKNOWN_EXTENT) == extents.end();
+}
+
+ShapeInference::Scope::Scope()
+    : pEnv(NULL)
+{}
+
+
+//
+// Public interface
+//
+
+ShapeInference::ShapeInference()
+    : mDefinite(true)
+{}
+
+void ShapeInference::AddStablePrefix(const std::string& rPrefix)
+{
+    mStablePrefixes.insert(rPrefix);
+}
+
+void ShapeInference::DeclareResults(const std::string& rPrefix,
+                                    const std::map<std::string, Extents>& rShapes)
+{
+    mResultShapes[rPrefix] = rShapes;
+}
+
+void ShapeInference::DeclareUnknownResults(const std::string& rPrefix)
+{
+    mUnknownResultPrefixes.insert(rPrefix);
+}
+
+void ShapeInference::Check(const std::vector<AbstractStatementPtr>& rStatements, const Environment& rEnv)
+{
+    mInferredTypes.clear();
+    mInferredShapes.clear();
+    mActiveFunctions.clear();
+    mDefinite = true;
+    ScopePtr p_scope(new Scope);
+    p_scope->pEnv = &rEnv;
+    InferBlock(rStatements, p_scope, true);
+}
+
+const std::map<std::string, Extents>& ShapeInference::rGetInferredShapes() const
+{
+    return mInferredShapes;
+}
+
+ShapeInference::Type ShapeInference::GetInferredType(const std::string& rName) const
+{
+    std::map<std::string, Type>::const_iterator it = mInferredTypes.find(rName);
+    if (it == mInferredTypes.end())
+    {
+        return Type();
+    }
+    return it->second;
+}
+
+void ShapeInference::Reset()
+{
+    mStablePrefixes.clear();
+    mResultShapes.clear();
+    mUnknownResultPrefixes.clear();
+    mInferredTypes.clear();
+    mInferredShapes.clear();
+}
+
+
+//
+// Statements
+//
+
+ShapeInference::Type ShapeInference::InferBlock(const std::vector<AbstractStatementPtr>& rStatements,
+                                                const ScopePtr pScope,
+                                                bool topLevel)
+{
+    BOOST_FOREACH(const AbstractStatementPtr p_stmt, rStatements)
+    {
+        const std::string& r_loc = p_stmt->GetLocationInfo();
+        if (AssignmentStatement* p_assign = dynamic_cast<AssignmentStatement*>(p_stmt.get()))
+        {
+            const std::vector<std::string>& r_names = p_assign->rGetNamesToAssign();
+            Type rhs;
+            if (p_assign->IsOptional())
+            {
+                // Errors are caught, in which case the names are left undefined
+                ConditionalCode optional(mDefinite);
+                Infer(p_assign->rGetRhs(), pScope);
+            }
+            else
+            {
+                rhs = Infer(p_assign->rGetRhs(), pScope);
+            }
+            std::vector<Type> values(r_names.size());
+            if (r_names.size() == 1u)
+            {
+                values[0] = rhs;
+            }
+            else if (rhs.kind == TUPLE)
+            {
+                if (rhs.items.size() == r_names.size())
+                {
+                    values = rhs.items;
+                }
+                else
+                {
+                    INFERENCE_ERROR("Cannot assign " << rhs.items.size() << " values to " << r_names.size() << " names.", r_loc);
+                }
+            }
+            else if (rhs.kind != UNKNOWN)
+            {
+                INFERENCE_ERROR("When assigning multiple names the value to assign must be a tuple.", r_loc);
+            }
+            for (unsigned i=0; i<r_names.size(); ++i)
+            {
+                pScope->bindings[r_names[i]] = values[i];
+                if (topLevel)
+                {
+                    mInferredTypes[r_names[i]] = values[i];
+                    if (values[i].IsFullyKnownArray())
+                    {
+                        mInferredShapes[r_names[i]] = values[i].extents;
+                    }
+                }
+            }
+        }
+        else if (AssertStatement* p_assert = dynamic_cast<AssertStatement*>(p_stmt.get()))
+        {
+            Type result = Infer(p_assert->rGetAssertion(), pScope);
+            if (result.kind == NULL_VALUE)
+            {
+                INFERENCE_ERROR("Assertion failed: result is Null.", r_loc);
+            }
+            else if (result.kind != UNKNOWN && result.kind != ARRAY)
+            {
+                INFERENCE_ERROR("Assertion did not yield a simple value or null.", r_loc);
+            }
+            else if (result.kind == ARRAY && result.rankKnown && !result.extents.empty())
+            {
+                INFERENCE_ERROR("Assertion did not yield a simple value or null.", r_loc);
+            }
+            else if (result.pValue && result.pValue->IsDouble() && !GET_SIMPLE_VALUE(result.pValue))
+            {
+                INFERENCE_ERROR("Assertion failed: result is zero.", r_loc);
+            }
+        }
+        else if (ReturnStatement* p_return = dynamic_cast<ReturnStatement*>(p_stmt.get()))
+        {
+            std::vector<Type> values = InferAll(p_return->rGetExpressions(), pScope);
+            if (values.size() == 1u)
+            {
+                return values.front();
+            }
+            Type result(TUPLE);
+            result.items = values;
+            return result;
+        }
+    }
+    return Type();
+}
+
+
+//
+// Expressions
+//
+
+std::vector<ShapeInference::Type> ShapeInference::InferAll(const std::vector<AbstractExpressionPtr>& rExprs,
+                                                           const ScopePtr pScope)
+{
+    std::vector<Type> types;
+    types.reserve(rExprs.size());
+    BOOST_FOREACH(const AbstractExpressionPtr p_expr, rExprs)
+    {
+        types.push_back(Infer(p_expr, pScope));
+    }
+    return types;
+}
+
+ShapeInference::Type ShapeInference::Infer(const AbstractExpressionPtr pExpr, const ScopePtr pScope)
+{
+    AbstractExpression* p_expr = pExpr.get();
+    const std::string& r_loc = p_expr->GetLocationInfo();
+    std::vector<AbstractExpressionPtr>& r_children = p_expr->rGetChildren();
+
+    if (ValueExpression* p_value = dynamic_cast<ValueExpression*>(p_expr))
+    {
+        return Type::Of(p_value->GetValue());
+    }
+    else if (NameLookup* p_lookup = dynamic_cast<NameLookup*>(p_expr))
+    {
+        return LookupName(p_lookup->rGetName(), pScope, r_loc);
+    }
+    else if (HoistedExpression* p_hoisted = dynamic_cast<HoistedExpression*>(p_expr))
+    {
+        // Evaluated where the hoisted definitions are, but in an equivalent environment
+        return Infer(p_hoisted->rGetChildren().front(), pScope);
+    }
+    else if (LambdaExpression* p_lambda = dynamic_cast<LambdaExpression*>(p_expr))
+    {
+        Type result(FUNCTION);
+        result.pLambda = p_lambda;
+        result.pDefiningScope = pScope;
+        return result;
+    }
+    else if (dynamic_cast<TupleExpression*>(p_expr))
+    {
+        Type result(TUPLE);
+        result.items = InferAll(r_children, pScope);
+        return result;
+    }
+    else if (Accessor* p_accessor = dynamic_cast<Accessor*>(p_expr))
+    {
+        Type operand = Infer(r_children.front(), pScope);
+        const bool not_array = (operand.kind != UNKNOWN && operand.kind != ARRAY);
+        switch (p_accessor->GetAttribute())
+        {
+            case Accessor::NUM_DIMS:
+                if (not_array)
+                {
+                    INFERENCE_ERROR("Cannot get the number of dimensions of a non-array.", r_loc);
+                }
+                break;
+            case Accessor::NUM_ELEMENTS:
+                if (not_array)
+                {
+                    INFERENCE_ERROR("Cannot get the number of elements of a non-array.", r_loc);
+                }
+                break;
+            case Accessor::SHAPE:
+                if (not_array)
+                {
+                    INFERENCE_ERROR("Cannot get the shape of a non-array.", r_loc);
+                }
+                if (operand.kind == ARRAY && operand.rankKnown)
+                {
+                    return Type::Array(Extents(1, operand.extents.size()));
+                }
+                return Type::ArrayOfRank(1u);
+            default:
+                break;
+        }
+        return Type::Array(Extents());
+    }
+    else if (dynamic_cast<If*>(p_expr))
+    {
+        Type test = Infer(r_children[0], pScope);
+        if (test.kind != UNKNOWN && !test.IsSimpleValue() && !(test.kind == ARRAY && !test.rankKnown))
+        {
+            INFERENCE_ERROR("The test in an if expression must be a simple value.", r_loc);
+        }
+        if (test.pValue && test.pValue->IsDouble())
+        {
+            // We know which branch will be taken
+            return Infer(r_children[GET_SIMPLE_VALUE(test.pValue) ? 1 : 2], pScope);
+        }
+        ConditionalCode branches(mDefinite);
+        return Join(Infer(r_children[1], pScope), Infer(r_children[2], pScope));
+    }
+    else if (dynamic_cast<MathmlAnd*>(p_expr) || dynamic_cast<MathmlOr*>(p_expr)
+             || dynamic_cast<MathmlXor*>(p_expr) || dynamic_cast<MathmlNot*>(p_expr))
+    {
+        const std::string& r_name = static_cast<MathmlOperator*>(p_expr)->rGetName();
+        // The 'and' and 'or' operators short-circuit, so only their first operand is always evaluated
+        const bool short_circuit = (r_name == "and" || r_name == "or");
+        for (unsigned i=0; i<r_children.size(); ++i)
+        {
+            boost::shared_ptr<ConditionalCode> p_conditional;
+            if (short_circuit && i > 0)
+            {
+                p_conditional.reset(new ConditionalCode(mDefinite));
+            }
+            Type operand = Infer(r_children[i], pScope);
+            if (operand.kind != UNKNOWN && !operand.IsSimpleValue() && !(operand.kind == ARRAY && !operand.rankKnown))
+            {
+                INFERENCE_ERROR("Boolean '" << r_name << "' operator requires its operand"
+                                << (r_name == "not" ? " to be a simple value." : "s to be simple values."), r_loc);
+            }
+        }
+        return Type::Array(Extents());
+    }
+    else if (MathmlOperator* p_operator = dynamic_cast<MathmlOperator*>(p_expr))
+    {
+        std::vector<Type> operands = InferAll(r_children, pScope);
+        const std::string& r_name = p_operator->rGetName();
+        if ((r_name == "root" || r_name == "log") && operands.size() == 2u)
+        {
+            // The first operand is the degree or logbase qualifier
+            const Type& r_qualifier = operands.front();
+            if (r_qualifier.kind != UNKNOWN && !r_qualifier.IsSimpleValue()
+                && !(r_qualifier.kind == ARRAY && !r_qualifier.rankKnown))
+            {
+                INFERENCE_ERROR("The " << r_name << " operator requires its qualifier to be a simple value.", r_loc);
+            }
+        }
+        return InferBroadcast(operands, r_name, r_loc);
+    }
+    else if (ArrayCreate* p_create = dynamic_cast<ArrayCreate*>(p_expr))
+    {
+        if (!p_create->rGetElementGenerator())
+        {
+            // Array defined by listing elements
+            std::vector<Type> elements = InferAll(r_children, pScope);
+            Type element = elements.front();
+            for (unsigned i=0; i<elements.size(); ++i)
+            {
+                if (elements[i].kind != UNKNOWN && elements[i].kind != ARRAY)
+                {
+                    INFERENCE_ERROR("Elements of an array must be simple values or arrays; element " << i
+                                    << " is neither.", r_loc);
+                    element = Type();
+                }
+                else if (i > 0)
+                {
+                    if (elements[i].IsFullyKnownArray() && elements[0].IsFullyKnownArray()
+                        && elements[i].extents != elements[0].extents)
+                    {
+                        INFERENCE_ERROR("All elements of an array must have the same shape; element " << i
+                                        << " with shape " << elements[i].extents
+                                        << " does not match element 0 of shape " << elements[0].extents << ".", r_loc);
+                    }
+                    // All elements end up the same shape, so combine what we know of each
+                    if (element.kind == ARRAY && elements[i].kind == ARRAY && element.rankKnown && elements[i].rankKnown
+                        && element.extents.size() == elements[i].extents.size())
+                    {
+                        for (unsigned j=0; j<element.extents.size(); ++j)
+                        {
+                            if (element.extents[j] == UNKNOWN_EXTENT)
+                            {
+                                element.extents[j] = elements[i].extents[j];
+                            }
+                        }
+                    }
+                    else if (element.kind == ARRAY && !element.rankKnown && elements[i].kind == ARRAY)
+                    {
+                        element = elements[i];
+                    }
+                }
+            }
+            if (element.kind == ARRAY && element.rankKnown)
+            {
+                Extents shape(1, elements.size());
+                shape.insert(shape.end(), element.extents.begin(), element.extents.end());
+                return Type::Array(shape);
+            }
+            return Type(ARRAY);
+        }
+        else
+        {
+            // Array comprehension; the range specifications are evaluated first
+            InferAll(r_children, pScope);
+            std::vector<std::string> index_names;
+            if (!GetIndexNames(*p_create, index_names))
+            {
+                return Type(ARRAY);
+            }
+            // Ranges may not be empty, so the generator always runs at least once
+            ScopePtr p_generator_scope(new Scope);
+            p_generator_scope->pParent = pScope;
+            BOOST_FOREACH(const std::string& r_name, index_names)
+            {
+                p_generator_scope->bindings[r_name] = Type::Array(Extents());
+            }
+            Type element = Infer(p_create->rGetElementGenerator(), p_generator_scope);
+            if (element.kind != UNKNOWN && element.kind != ARRAY)
+            {
+                INFERENCE_ERROR("The generator expression in an array comprehension must yield arrays.", r_loc);
+            }
+            if (element.kind == ARRAY && element.rankKnown)
+            {
+                return Type::ArrayOfRank(r_children.size() + element.extents.size());
+            }
+            return Type(ARRAY);
+        }
+    }
+    else if (Map* p_map = dynamic_cast<Map*>(p_expr))
+    {
+        std::vector<Type> args = InferAll(r_children, pScope);
+        if (args.front().kind != UNKNOWN && args.front().kind != FUNCTION)
+        {
+            INFERENCE_ERROR("First argument to map is not a function.", r_loc);
+        }
+        // The result has the shape of the array arguments, which must match
+        Type result = Type(ARRAY);
+        int ref_i = -1;
+        for (unsigned i=1; i<args.size(); ++i)
+        {
+            const Type& r_arg = args[i];
+            if (r_arg.kind != UNKNOWN && r_arg.kind != ARRAY)
+            {
+                INFERENCE_ERROR("Except for the first, all arguments to map should be arrays; argument "
+                                << i << " is not.", r_loc);
+            }
+            if (!r_arg.IsFullyKnownArray()
+                || (p_map->GetAllowImplicitArrays() && r_arg.extents.empty()))
+            {
+                continue;
+            }
+            if (ref_i == -1)
+            {
+                ref_i = i;
+                result = r_arg;
+                result.pValue.reset();
+            }
+            else if (r_arg.extents != result.extents)
+            {
+                INFERENCE_ERROR("The shapes of the arrays passed to map must match; argument " << i << " of shape "
+                                << r_arg.extents << " does not match argument " << ref_i
+                                << " of shape " << result.extents << ".", r_loc);
+            }
+        }
+        return result;
+    }
+    else if (dynamic_cast<Fold*>(p_expr))
+    {
+        std::vector<Type> args = InferAll(r_children, pScope);
+        if (args[0].kind != UNKNOWN && args[0].kind != FUNCTION)
+        {
+            INFERENCE_ERROR("First argument to fold should be a function.", r_loc);
+        }
+        if (args.size() < 2u)
+        {
+            return Type();
+        }
+        const Type& r_operand = args[1];
+        if (r_operand.kind != UNKNOWN && r_operand.kind != ARRAY)
+        {
+            INFERENCE_ERROR("Second argument to fold should be an array.", r_loc);
+        }
+        if (r_operand.kind != ARRAY || !r_operand.rankKnown)
+        {
+            return Type(ARRAY);
+        }
+        // The extent along the folded dimension, by default the last, becomes 1
+        Type result = Type::Array(r_operand.extents);
+        const unsigned rank = r_operand.extents.size();
+        if (args.size() > 3u && !args[3].pValue)
+        {
+            return Type::ArrayOfRank(rank);
+        }
+        NdArray<double>::Index dimension = rank - 1;
+        if (args.size() > 3u && args[3].pValue->IsDouble())
+        {
+            dimension = (NdArray<double>::Index)(GET_SIMPLE_VALUE(args[3].pValue));
+        }
+        if (dimension >= rank)
+        {
+            INFERENCE_ERROR("Cannot fold over dimension " << dimension << " as the operand array only has "
+                            << rank << " dimensions.", r_loc);
+            return Type::ArrayOfRank(rank);
+        }
+        result.extents[dimension] = 1u;
+        return result;
+    }
+    else if (dynamic_cast<Find*>(p_expr))
+    {
+        Type operand = Infer(r_children.front(), pScope);
+        if (operand.kind != UNKNOWN && operand.kind != ARRAY)
+        {
+            INFERENCE_ERROR("First argument to find should be an array.", r_loc);
+        }
+        Extents shape(2, UNKNOWN_EXTENT);
+        if (operand.kind == ARRAY && operand.rankKnown)
+        {
+            shape[1] = operand.extents.size();
+        }
+        return Type::Array(shape);
+    }
+    else if (dynamic_cast<Index*>(p_expr))
+    {
+        std::vector<Type> args = InferAll(r_children, pScope);
+        if (args[0].kind != UNKNOWN && args[0].kind != ARRAY)
+        {
+            INFERENCE_ERROR("First argument to index should be an array.", r_loc);
+        }
+        if (args.size() > 1u && args[1].kind != UNKNOWN && args[1].kind != ARRAY)
+        {
+            INFERENCE_ERROR("Second argument to index should be an array.", r_loc);
+        }
+        if (args[0].kind == ARRAY && args[0].rankKnown)
+        {
+            return Type::ArrayOfRank(args[0].extents.size());
+        }
+        return Type(ARRAY);
+    }
+    else if (dynamic_cast<View*>(p_expr))
+    {
+        std::vector<Type> args = InferAll(r_children, pScope);
+        if (args[0].kind != UNKNOWN && args[0].kind != ARRAY)
+        {
+            INFERENCE_ERROR("First argument to view should be an array.", r_loc);
+        }
+        return Type(ARRAY);
+    }
+    else if (dynamic_cast<FileLoader*>(p_expr))
+    {
+        return Type();
+    }
+    else if (FunctionCall* p_call = dynamic_cast<FunctionCall*>(p_expr))
+    {
+        Type function = Infer(p_call->rGetFunction(), pScope);
+        if (function.kind != UNKNOWN && function.kind != FUNCTION)
+        {
+            INFERENCE_ERROR("Tried to call a non-function.", r_loc);
+            return Type();
+        }
+        std::vector<Type> args = InferAll(r_children, pScope);
+        return InferCall(function, args, r_loc);
+    }
+    // Anything else we don't understand
+    InferAll(r_children, pScope);
+    return Type();
+}
+
+ShapeInference::Type ShapeInference::InferBroadcast(const std::vector<Type>& rOperands,
+                                                    const std::string& rOperatorName,
+                                                    const std::string& rLoc)
+{
+    Extents shape;
+    bool rank_known = true;
+    BOOST_FOREACH(const Type& r_operand, rOperands)
+    {
+        if (r_operand.kind != UNKNOWN && r_operand.kind != ARRAY)
+        {
+            INFERENCE_ERROR("The " << rOperatorName << " operator requires its operands to be simple values or arrays.",
+                            rLoc);
+            return Type();
+        }
+        if (r_operand.kind == UNKNOWN || !r_operand.rankKnown)
+        {
+            rank_known = false;
+            continue;
+        }
+        // As for MathmlOperator::GetBroadcastShape, but unknown extents match anything
+        const Extents& r_operand_shape = r_operand.extents;
+        if (r_operand_shape.size() > shape.size())
+        {
+            shape.insert(shape.begin(), r_operand_shape.size() - shape.size(), 1u);
+        }
+        const unsigned offset = shape.size() - r_operand_shape.size();
+        for (unsigned i=0; i<r_operand_shape.size(); ++i)
+        {
+            NdArray<double>::Index& r_extent = shape[offset + i];
+            const NdArray<double>::Index extent = r_operand_shape[i];
+            if (r_extent == 1u || (r_extent == UNKNOWN_EXTENT && extent != 1u))
+            {
+                r_extent = extent;
+            }
+            else if (extent != UNKNOWN_EXTENT && extent != 1u && extent != r_extent)
+            {
+                INFERENCE_ERROR("Operands to the " << rOperatorName << " operator cannot be broadcast together; shape "
+                                << ShapeToString(r_operand_shape) << " is incompatible with "
+                                << ShapeToString(shape) << ".", rLoc);
+                r_extent = UNKNOWN_EXTENT;
+            }
+        }
+    }
+    if (!rank_known)
+    {
+        // The rank is at least that of the known operands, but no more can be said
+        return Type(ARRAY);
+    }
+    return Type::Array(shape);
+}
+
+
+//
+// Names and function calls
+//
+
+ShapeInference::Type ShapeInference::LookupName(const std::string& rName, const ScopePtr pScope, const std::string& rLoc)
+{
+    for (Scope* p_scope = pScope.get(); p_scope; p_scope = p_scope->pParent.get())
+    {
+        std::map<std::string, Type>::const_iterator it = p_scope->bindings.find(rName);
+        if (it != p_scope->bindings.end())
+        {
+            return it->second;
+        }
+        if (p_scope->pEnv)
+        {
+            return LookupInEnvironment(rName, *p_scope->pEnv, rLoc);
+        }
+    }
+    return Type();
+}
+
+ShapeInference::Type ShapeInference::LookupInEnvironment(const std::string& rName,
+                                                         const Environment& rEnv,
+                                                         const std::string& rLoc)
+{
+    const std::string::size_type colon = rName.find(':');
+    if (colon == std::string::npos)
+    {
+        if (!rEnv.HasName(rName, rLoc))
+        {
+            INFERENCE_ERROR("Name " << rName << " is not defined in this environment.", rLoc);
+            return Type();
+        }
+        return Type::Of(rEnv.Lookup(rName, rLoc));
+    }
+    const std::string prefix = rName.substr(0, colon);
+    std::map<std::string, std::map<std::string, Extents> >::const_iterator results = mResultShapes.find(prefix);
+    if (results != mResultShapes.end())
+    {
+        std::map<std::string, Extents>::const_iterator it = results->second.find(rName.substr(colon + 1));
+        if (it != results->second.end())
+        {
+            return Type::Array(it->second);
+        }
+        return Type();
+    }
+    if (mUnknownResultPrefixes.find(prefix) != mUnknownResultPrefixes.end())
+    {
+        return Type();
+    }
+    const bool stable = (mStablePrefixes.find(prefix) != mStablePrefixes.end());
+    Type result;
+    try
+    {
+        if (rEnv.HasName(rName, rLoc))
+        {
+            result = Type::Of(rEnv.Lookup(rName, rLoc));
+            if (!stable && result.kind != FUNCTION)
+            {
+                // Only the type is fixed, e.g. for model variables
+                result.pValue.reset();
+            }
+        }
+        else if (stable)
+        {
+            INFERENCE_ERROR("Name " << rName << " is not defined in this environment.", rLoc);
+        }
+    }
+    catch (const Exception&)
+    {
+        // Unknown prefix; the interpreter will complain if need be
+    }
+    return result;
+}
+
+ShapeInference::Type ShapeInference::InferCall(const Type& rFunction, const std::vector<Type>& rArgs, const std::string& rLoc)
+{
+    if (rFunction.kind != FUNCTION)
+    {
+        return Type();
+    }
+    // Find the definition
+    const std::vector<std::string>* p_params;
+    const std::vector<AbstractStatementPtr>* p_body;
+    const std::vector<AbstractValuePtr>* p_defaults;
+    ScopePtr p_local_scope(new Scope);
+    if (rFunction.pLambda)
+    {
+        p_params = &rFunction.pLambda->rGetFormalParameters();
+        p_body = &rFunction.pLambda->rGetBody();
+        p_defaults = &rFunction.pLambda->rGetDefaultParameters();
+        p_local_scope->pParent = rFunction.pDefiningScope;
+    }
+    else if (rFunction.pValue && rFunction.pValue->IsLambda())
+    {
+        const LambdaClosure* p_closure = static_cast<const LambdaClosure*>(rFunction.pValue.get());
+        p_params = &p_closure->rGetFormalParameters();
+        p_body = &p_closure->rGetBody();
+        p_defaults = &p_closure->rGetDefaultParameters();
+        p_local_scope->pEnvOwner = p_closure->GetDefiningEnvironment();
+        p_local_scope->pEnv = p_local_scope->pEnvOwner.get();
+        if (!p_local_scope->pEnv)
+        {
+            return Type();
+        }
+    }
+    else
+    {
+        return Type();
+    }
+
+    // Check the arguments as LambdaClosure does
+    const unsigned num_params = p_params->size();
+    if (!(num_params == rArgs.size() || (!p_defaults->empty() && num_params > rArgs.size())))
+    {
+        INFERENCE_ERROR("Function expected " << num_params << " parameters, but received " << rArgs.size() << ".",
+                        rLoc);
+        return Type();
+    }
+    // Don't follow recursive calls
+    if (mActiveFunctions.find(p_body) != mActiveFunctions.end())
+    {
+        return Type();
+    }
+    for (unsigned i=0; i<num_params; ++i)
+    {
+        Type arg = (i < rArgs.size() ? rArgs[i] : Type(DEFAULT_VALUE));
+        if (arg.kind == DEFAULT_VALUE && !p_defaults->empty())
+        {
+            arg = (*p_defaults)[i] ? Type::Of((*p_defaults)[i]) : Type();
+        }
+        p_local_scope->bindings[(*p_params)[i]] = arg;
+    }
+    mActiveFunctions.insert(p_body);
+    Type result = InferBlock(*p_body, p_local_scope, false);
+    mActiveFunctions.erase(p_body);
+    return result;
+}
+
+ShapeInference::Type ShapeInference::Join(const Type& rType1, const Type& rType2)
+{
+    if (rType1.kind != rType2.kind)
+    {
+        return Type();
+    }
+    Type result(rType1.kind);
+    if (rType1.pValue == rType2.pValue)
+    {
+        result.pValue = rType1.pValue;
+    }
+    if (rType1.kind == ARRAY && rType1.rankKnown && rType2.rankKnown
+        && rType1.extents.size() == rType2.extents.size())
+    {
+        result.rankKnown = true;
+        result.extents = rType1.extents;
+        for (unsigned i=0; i<result.extents.size(); ++i)
+        {
+            if (rType2.extents[i] != result.extents[i])
+            {
+                result.extents[i] = UNKNOWN_EXTENT;
+            }
+        }
+    }
+    else if (rType1.kind == TUPLE)
+    {
+        if (rType1.items.size() != rType2.items.size())
+        {
+            return Type();
+        }
+        for (unsigned i=0; i<rType1.items.size(); ++i)
+        {
+            result.items.push_back(Join(rType1.items[i], rType2.items[i]));
+        }
+    }
+    else if (rType1.kind == FUNCTION && rType1.pLambda == rType2.pLambda
+             && rType1.pDefiningScope == rType2.pDefiningScope)
+    {
+        result.pLambda = rType1.pLambda;
+        result.pDefiningScope = rType1.pDefiningScope;
+    }
+    return result;
+}
@@ -0,0 +1,332 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef SHAPEINFERENCE_HPP_
+#define SHAPEINFERENCE_HPP_
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
+#include "AbstractExpression.hpp"
+#include "AbstractStatement.hpp"
+#include "AbstractValue.hpp"
+#include "Environment.hpp"
+#include "NdArray.hpp"
+
+class LambdaExpression;
+
+/**
+ * Works out the types and array shapes of the values computed by a protocol's post-processing
+ * program before it is run (indeed, before the simulations that produce its inputs are run), so
+ * that mistakes can be reported without waiting for possibly lengthy simulations to finish.
+ *
+ * The program is interpreted abstractly: instead of values, each expression yields a Type, which
+ * records what kind of value it will produce and, for arrays, as much of the shape as is known.
+ * Names from the library and inputs are looked up in the real environment, so their values are
+ * known exactly; simulation results have the shapes declared with DeclareResults, with extents that
+ * depend on the simulation left unknown.  Calls of named and anonymous functions are followed into
+ * the function body with the argument types bound to its parameters.
+ *
+ * An error is only reported if it is certain to occur when the program is run; anything that
+ * depends on data not yet available, or only occurs on some branches of an if expression, is
+ * ignored.  In such cases the offending value is given an unknown type, and checking continues.
+ * Messages match those that would be produced by the interpreter.
+ *
+ * Once a program has been checked, the shapes of those top-level names whose results are arrays of
+ * fully known shape are available from rGetInferredShapes, so storage for them could be allocated
+ * up front.
+ */
+class ShapeInference
+{
+public:
+    /** Marks an array extent that cannot be determined in advance. */
+    static const NdArray<double>::Index UNKNOWN_EXTENT;
+
+    /** The kinds of value distinguished by the inference. */
+    enum Kind
+    {
+        UNKNOWN,       /**< Could be any kind of value (or none) */
+        NULL_VALUE,    /**< The Null value */
+        ARRAY,         /**< An array; simple values are arrays with no dimensions */
+        TUPLE,         /**< A tuple */
+        STRING,        /**< A string */
+        FUNCTION,      /**< A callable function */
+        DEFAULT_VALUE  /**< The marker requesting a default parameter value */
+    };
+
+    struct Scope;
+
+    /** What is known about the value of an expression. */
+    struct Type
+    {
+        /** The kind of value. */
+        Kind kind;
+
+        /** For arrays, whether the number of dimensions is known. */
+        bool rankKnown;
+
+        /** For arrays of known rank, the extents, some of which may be #UNKNOWN_EXTENT. */
+        NdArray<double>::Extents extents;
+
+        /** For tuples, the types of the items. */
+        std::vector<Type> items;
+
+        /** The actual value, if known. */
+        AbstractValuePtr pValue;
+
+        /** For functions defined within the program being checked, the definition. */
+        LambdaExpression* pLambda;
+
+        /** For functions defined within the program being checked, the scope they were defined in. */
+        boost::shared_ptr<Scope> pDefiningScope;
+
+        /**
+         * Create a type.
+         *
+         * @param kind  the kind of value
+         */
+        Type(Kind kind=UNKNOWN);
+
+        /**
+         * Create the type of an array of the given shape.
+         *
+         * @param rExtents  the shape, some extents of which may be #UNKNOWN_EXTENT
+         */
+        static Type Array(const NdArray<double>::Extents& rExtents);
+
+        /**
+         * Create the type of an array with the given number of dimensions but unknown extents.
+         *
+         * @param rank  the number of dimensions
+         */
+        static Type ArrayOfRank(unsigned rank);
+
+        /**
+         * Determine the type of a known value.
+         *
+         * @param pValue  the value
+         */
+        static Type Of(const AbstractValuePtr pValue);
+
+        /** Whether this is a simple value, i.e. an array with no dimensions. */
+        bool IsSimpleValue() const;
+
+        /** Whether this is an array whose every extent is known. */
+        bool IsFullyKnownArray() const;
+    };
+
+    /**
+     * Create an inference pass.
+     */
+    ShapeInference();
+
+    /**
+     * Note that names with the given prefix refer to an imported library, so their values will
+     * not change once defined.  Other prefixed names (e.g. model variables) are assumed to vary,
+     * so only their types are used.
+     *
+     * @param rPrefix  the prefix
+     */
+    void AddStablePrefix(const std::string& rPrefix);
+
+    /**
+     * Declare the results that will be available under a prefix once simulations have run.
+     * Names under this prefix that are not listed will be given an unknown type.
+     *
+     * @param rPrefix  the prefix
+     * @param rShapes  the shape of each result, some extents of which may be #UNKNOWN_EXTENT
+     */
+    void DeclareResults(const std::string& rPrefix,
+                        const std::map<std::string, NdArray<double>::Extents>& rShapes);
+
+    /**
+     * Declare that values will be available under a prefix once simulations have run, but
+     * nothing is known about them.
+     *
+     * @param rPrefix  the prefix
+     */
+    void DeclareUnknownResults(const std::string& rPrefix);
+
+    /**
+     * Check a program, throwing an exception describing the first error that is certain to occur
+     * when it is run.
+     *
+     * @param rStatements  the program
+     * @param rEnv  the environment the program will be executed within (or its delegatee)
+     */
+    void Check(const std::vector<AbstractStatementPtr>& rStatements, const Environment& rEnv);
+
+    /**
+     * Get the shapes of the arrays assigned to names at the top level of the last program checked,
+     * for those names where the shape is fully known.
+     */
+    const std::map<std::string, NdArray<double>::Extents>& rGetInferredShapes() const;
+
+    /**
+     * Get the inferred type of a name assigned at the top level of the last program checked.
+     *
+     * @param rName  the name
+     */
+    Type GetInferredType(const std::string& rName) const;
+
+    /**
+     * Forget all declarations and inferred types, ready to check a new program.
+     */
+    void Reset();
+
+    /** A set of name bindings used while checking, which may be nested inside another. */
+    struct Scope
+    {
+        /** The names defined in this scope. */
+        std::map<std::string, Type> bindings;
+
+        /** The enclosing scope, if any. */
+        boost::shared_ptr<Scope> pParent;
+
+        /** For outermost scopes, the real environment to look up names not bound within the program. */
+        const Environment* pEnv;
+
+        /** Keeps #pEnv alive, if it is not owned by the caller of Check. */
+        EnvironmentCPtr pEnvOwner;
+
+        /** Create an empty scope. */
+        Scope();
+    };
+
+    /** Type of a pointer to a scope. */
+    typedef boost::shared_ptr<Scope> ScopePtr;
+
+private:
+    /**
+     * Check a block of statements.
+     *
+     * @param rStatements  the statements
+     * @param pScope  the scope they are executed in
+     * @param topLevel  whether this is the program itself, rather than a function body
+     * @return  the type of the value returned, if the block contains a return statement
+     */
+    Type InferBlock(const std::vector<AbstractStatementPtr>& rStatements,
+                    const ScopePtr pScope,
+                    bool topLevel);
+
+    /**
+     * Infer the type of an expression.
+     *
+     * @param pExpr  the expression
+     * @param pScope  the scope it is evaluated in
+     */
+    Type Infer(const AbstractExpressionPtr pExpr, const ScopePtr pScope);
+
+    /**
+     * Infer the types of a list of expressions, all of which are evaluated.
+     *
+     * @param rExprs  the expressions
+     * @param pScope  the scope they are evaluated in
+     */
+    std::vector<Type> InferAll(const std::vector<AbstractExpressionPtr>& rExprs, const ScopePtr pScope);
+
+    /**
+     * Look up the type of a name.
+     *
+     * @param rName  the name
+     * @param pScope  the scope it is looked up in
+     * @param rLoc  location information for error reporting
+     */
+    Type LookupName(const std::string& rName, const ScopePtr pScope, const std::string& rLoc);
+
+    /**
+     * Look up the type of a name in a real environment.
+     *
+     * @param rName  the name
+     * @param rEnv  the environment
+     * @param rLoc  location information for error reporting
+     */
+    Type LookupInEnvironment(const std::string& rName, const Environment& rEnv, const std::string& rLoc);
+
+    /**
+     * Infer the type of the result of calling a function.
+     *
+     * @param rFunction  the type of the function
+     * @param rArgs  the types of the arguments
+     * @param rLoc  location information for error reporting
+     */
+    Type InferCall(const Type& rFunction, const std::vector<Type>& rArgs, const std::string& rLoc);
+
+    /**
+     * Infer the result shape of a MathML operator applied elementwise to the given operands,
+     * following the broadcasting rules of MathmlOperator.
+     *
+     * @param rOperands  the types of the operands
+     * @param rOperatorName  the name of the operator, for error messages
+     * @param rLoc  location information for error reporting
+     */
+    Type InferBroadcast(const std::vector<Type>& rOperands,
+                        const std::string& rOperatorName,
+                        const std::string& rLoc);
+
+    /**
+     * Combine the types of values that could come from different branches of the program.
+     *
+     * @param rType1  one possibility
+     * @param rType2  the other possibility
+     */
+    static Type Join(const Type& rType1, const Type& rType2);
+
+    /** Prefixes of names that will not change once defined. */
+    std::set<std::string> mStablePrefixes;
+
+    /** The shapes of the simulation results available under each declared prefix. */
+    std::map<std::string, std::map<std::string, NdArray<double>::Extents> > mResultShapes;
+
+    /** Prefixes under which simulation results will be available, but nothing is known about them. */
+    std::set<std::string> mUnknownResultPrefixes;
+
+    /** Types of the names assigned at the top level of the last program checked. */
+    std::map<std::string, Type> mInferredTypes;
+
+    /** Shapes of the top-level names whose values are arrays of fully known shape. */
+    std::map<std::string, NdArray<double>::Extents> mInferredShapes;
+
+    /** Function bodies currently being analysed, to avoid following recursive calls. */
+    std::set<const void*> mActiveFunctions;
+
+    /** Whether the code currently being analysed is certain to run, so errors found are definite. */
+    bool mDefinite;
+};
+
+#endif /* SHAPEINFERENCE_HPP_ */
@@ -45,6 +45,11 @@ AbstractExpression::AbstractExpression()
 AbstractExpression::~AbstractExpression()
 {}
 
+std::vector<AbstractExpressionPtr>& AbstractExpression::rGetChildren()
+{
+    return mChildren;
+}
+
 std::vector<AbstractValuePtr> AbstractExpression::EvaluateChildren(const Environment& rEnv) const
 {
     std::vector<AbstractValuePtr> values;
@@ -59,11 +64,13 @@ std::vector<AbstractValuePtr> AbstractExpression::EvaluateChildren(const Environ
 }
 
 #include "DebugProto.hpp"
+#include "ThreadPool.hpp"
 
 AbstractValuePtr AbstractExpression::TraceResult(AbstractValuePtr pResult) const
 {
     if (GetTrace())
     {
+        ThreadPool::CheckThreadSafe();
         TRACE_PROTO("Result: " << pResult << " at " << GetLocationInfo() << std::endl);
     }
     return pResult;
@@ -75,6 +75,12 @@ public:
      */
     virtual AbstractValuePtr operator()(const Environment& rEnv) const =0;
 
+    /**
+     * Get our children in the expression tree.  A non-const reference is returned so that
+     * optimisation passes can rewrite sub-expressions in place.
+     */
+    std::vector<AbstractExpressionPtr>& rGetChildren();
+
 protected:
     /**
      * Evaluate our child expressions within the given environment.
@@ -137,3 +137,8 @@ Accessor::Attribute Accessor::DecodeAttributeString(const std::string& rAttribut
     }
     return attr;
 }
+
+Accessor::Attribute Accessor::GetAttribute() const
+{
+    return mAttribute;
+}
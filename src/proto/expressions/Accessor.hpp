@@ -86,6 +86,9 @@ public:
      */
     AbstractValuePtr operator()(const Environment& rEnv) const;
 
+    /** Get the attribute accessed by this expression. */
+    Attribute GetAttribute() const;
+
 private:
     /** The attribute to access. */
     Attribute mAttribute;
@@ -46,6 +46,7 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "VectorStreaming.hpp"
 #include "ProtoHelperMacros.hpp"
 #include "RangeHelperFunctions.hpp"
+#include "ThreadPool.hpp"
 
 // Save typing...
 typedef NdArray<double>::Range R;
@@ -74,28 +75,348 @@ ArrayCreate::ArrayCreate(const AbstractExpressionPtr pElementGenerator,
 }
 
 /**
- * Define variables in the given environment representing the indices over specified dimensions.
+ * A simple value holding the current value of an index variable in an array comprehension.
+ * Unlike other values, it may be changed in place, so that successive sub-arrays can be
+ * generated without allocating fresh values for each index.
+ */
+class IndexValue : public SimpleValue
+{
+public:
+    /** Create an index value, initially zero. */
+    IndexValue()
+        : SimpleValue(0.0)
+    {}
+
+    /**
+     * Change the value held.
+     *
+     * @param value  the new value
+     */
+    void SetValue(double value)
+    {
+        *mValue.Begin() = value;
+    }
+
+    /**
+     * Whether the array holding our value has been shared with another value, so that
+     * changing it in place would be visible elsewhere.
+     */
+    bool IsAliased() const
+    {
+        return mValue.IsAliased();
+    }
+};
+
+/**
+ * The environment in which the generator of an array comprehension is evaluated, defining
+ * variables representing the indices over the generator dimensions.
  *
- * @param rSubEnv  the environment
- * @param rIndexNames  the variable names
- * @param rIndexCounts  how many steps along each dimension
- * @param rRanges  the ranges over which each dimension can vary
- * @param rLoc  location in the program
+ * A single environment is reused for every sub-array, with the index values updated in place.
+ * If evaluating the generator kept hold of the environment or of an index value (for instance
+ * in a closure returned from a memoised function) then a fresh environment is created for the
+ * next sub-array, so retained values never change.
  */
-void SetIndexValues(Environment& rSubEnv,
-                    const std::vector<std::string>& rIndexNames,
-                    const NdArray<double>::Indices& rIndexCounts,
-                    const std::vector<R>& rRanges,
-                    const std::string& rLoc)
+class ComprehensionFrame
 {
-    const unsigned N = rIndexNames.size();
-    std::vector<AbstractValuePtr> values(N);
-    for (unsigned i=0; i<N; ++i)
+public:
+    /**
+     * Set up the frame.
+     *
+     * @param pGeneratorEnv  the environment to generate sub-arrays within
+     * @param rIndexNames  the variable names
+     * @param rRanges  the ranges over which each index varies
+     * @param rLoc  location in the program
+     */
+    ComprehensionFrame(const EnvironmentCPtr pGeneratorEnv,
+                       const std::vector<std::string>& rIndexNames,
+                       const std::vector<R>& rRanges,
+                       const std::string& rLoc)
+        : mpGeneratorEnv(pGeneratorEnv),
+          mrIndexNames(rIndexNames),
+          mrRanges(rRanges),
+          mrLoc(rLoc)
+    {}
+
+    /**
+     * Get the environment with index variables set for the given sub-array.
+     *
+     * @param rIndexCounts  how many steps along each dimension
+     */
+    const Environment& rSetIndices(const NdArray<double>::Indices& rIndexCounts)
+    {
+        if (!mpEnv || !mpEnv.unique() || IsRetained())
+        {
+            Reset();
+        }
+        for (unsigned i=0; i<mIndexValues.size(); ++i)
+        {
+            mIndexValues[i]->SetValue(mrRanges[i].mBegin + rIndexCounts[i]*mrRanges[i].mStep);
+        }
+        return *mpEnv;
+    }
+
+private:
+    /** Whether anything outside this frame refers to an index value. */
+    bool IsRetained() const
+    {
+        for (unsigned i=0; i<mIndexValues.size(); ++i)
+        {
+            // One reference is ours; the other is the environment binding
+            if (mIndexValues[i].use_count() > 2 || mIndexValues[i]->IsAliased())
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /** Create a fresh environment and index values. */
+    void Reset()
     {
-        values[i] = boost::make_shared<SimpleValue>(rRanges[i].mBegin + rIndexCounts[i]*rRanges[i].mStep);
+        const unsigned N = mrIndexNames.size();
+        std::vector<AbstractValuePtr> values(N);
+        mIndexValues.resize(N);
+        for (unsigned i=0; i<N; ++i)
+        {
+            mIndexValues[i] = boost::make_shared<IndexValue>();
+            values[i] = mIndexValues[i];
+        }
+        mpEnv.reset(new Environment(mpGeneratorEnv));
+        mpEnv->DefineNames(mrIndexNames, values, mrLoc);
     }
-    rSubEnv.DefineNames(rIndexNames, values, rLoc);
-}
+
+    /** The environment to generate sub-arrays within. */
+    const EnvironmentCPtr mpGeneratorEnv;
+
+    /** The names of the index variables. */
+    const std::vector<std::string>& mrIndexNames;
+
+    /** The ranges over which each index varies. */
+    const std::vector<R>& mrRanges;
+
+    /** Location information for error reporting. */
+    const std::string& mrLoc;
+
+    /** The environment defining the index variables. */
+    EnvironmentPtr mpEnv;
+
+    /** The values bound to the index variables in #mpEnv. */
+    std::vector<boost::shared_ptr<IndexValue> > mIndexValues;
+};
+
+/**
+ * The generation of all but the first sub-array of an array comprehension, which may be split
+ * into chunks run in parallel since each sub-array is independent.  Iteration i generates the
+ * sub-array at offset i+1 in the generator's iteration space.
+ *
+ * When the generator dimensions come first in the result, each sub-array occupies a contiguous
+ * block of the result, and is copied straight into place.  Otherwise a view of the result is
+ * created for each sub-array.
+ */
+class ComprehensionLoop : public AbstractParallelLoop
+{
+public:
+    /**
+     * Set up the loop.
+     *
+     * @param rGenerator  the generator expression
+     * @param pGeneratorEnv  the environment to generate sub-arrays within
+     * @param rIndexNames  the names of the index variables
+     * @param rGenerationRanges  the ranges over which each index varies
+     * @param rGeneratorDimensions  which dimensions of the result the indices correspond to
+     * @param rGeneratorExtents  the number of steps along each generator dimension
+     * @param rViewRanges  view specification for a sub-array; generator dimensions will be filled in
+     * @param rSubArrayShape  the shape all sub-arrays must have
+     * @param subArraySize  the number of elements in each sub-array
+     * @param contiguous  whether each sub-array is a contiguous block of the result
+     * @param rResult  the array to fill in
+     * @param rLoc  location information for error reporting
+     */
+    ComprehensionLoop(const AbstractExpression& rGenerator,
+                      const EnvironmentCPtr pGeneratorEnv,
+                      const std::vector<std::string>& rIndexNames,
+                      const std::vector<R>& rGenerationRanges,
+                      const std::vector<Index>& rGeneratorDimensions,
+                      const NdArray<double>::Extents& rGeneratorExtents,
+                      const std::vector<R>& rViewRanges,
+                      const NdArray<double>::Extents& rSubArrayShape,
+                      unsigned subArraySize,
+                      bool contiguous,
+                      NdArray<double>& rResult,
+                      const std::string& rLoc)
+        : mrGenerator(rGenerator),
+          mpGeneratorEnv(pGeneratorEnv),
+          mrIndexNames(rIndexNames),
+          mrGenerationRanges(rGenerationRanges),
+          mrGeneratorDimensions(rGeneratorDimensions),
+          mrGeneratorExtents(rGeneratorExtents),
+          mrViewRanges(rViewRanges),
+          mrSubArrayShape(rSubArrayShape),
+          mIsScalar(rSubArrayShape.empty()),
+          mSubArraySize(subArraySize),
+          mpResultData(contiguous && rResult.GetNumElements() > 0u ? &(*rResult.Begin()) : NULL),
+          mrResult(rResult),
+          mrLoc(rLoc)
+    {}
+
+    /**
+     * Generate a range of sub-arrays.
+     *
+     * @param start  the first iteration to run
+     * @param end  one past the last iteration to run
+     */
+    void RunIterations(unsigned start, unsigned end)
+    {
+        ComprehensionFrame frame(mpGeneratorEnv, mrIndexNames, mrGenerationRanges, mrLoc);
+        NdArray<double>::Indices generator_indices = mrResult.GetIndices(start + 1u, mrGeneratorExtents);
+        std::vector<R> view_ranges(mrViewRanges);
+        for (unsigned i=start+1u; i<end+1u; ++i)
+        {
+            AbstractValuePtr p_sub_array = mrGenerator(frame.rSetIndices(generator_indices));
+            if (mIsScalar && mpResultData && p_sub_array->IsDouble())
+            {
+                // Scalar generators write straight into the result
+                mpResultData[i] = GET_SIMPLE_VALUE(p_sub_array);
+                mrResult.IncrementIndices(generator_indices, mrGeneratorExtents);
+                continue;
+            }
+            PROTO_ASSERT2(p_sub_array->IsArray(),
+                          "The generator expression in an array comprehension must yield arrays.", mrLoc);
+            NdArray<double> sub_array = GET_ARRAY(p_sub_array);
+            PROTO_ASSERT2(mrSubArrayShape == sub_array.GetShape(),
+                          "All sub-arrays in an array comprehension must have the same shape; arrays "
+                          << i << " of shape " << sub_array.GetShape() << " and 0 of shape "
+                          << mrSubArrayShape << " differ.", mrLoc);
+            if (mpResultData)
+            {
+                std::copy(sub_array.Begin(), sub_array.End(), mpResultData + i*mSubArraySize);
+            }
+            else
+            {
+                // Fill in the view of the new array corresponding to this sub-array
+                for (Index j=0; j<mrGeneratorDimensions.size(); ++j)
+                {
+                    Index index_j = generator_indices[j];
+                    view_ranges[mrGeneratorDimensions[j]] = R(index_j, 0, index_j);
+                }
+                NdArray<double> view = mrResult[view_ranges];
+                std::copy(sub_array.Begin(), sub_array.End(), view.Begin());
+            }
+            mrResult.IncrementIndices(generator_indices, mrGeneratorExtents);
+        }
+    }
+
+private:
+    /** The generator expression. */
+    const AbstractExpression& mrGenerator;
+
+    /** The environment to generate sub-arrays within. */
+    const EnvironmentCPtr mpGeneratorEnv;
+
+    /** The names of the index variables. */
+    const std::vector<std::string>& mrIndexNames;
+
+    /** The ranges over which each index varies. */
+    const std::vector<R>& mrGenerationRanges;
+
+    /** Which dimensions of the result the indices correspond to. */
+    const std::vector<Index>& mrGeneratorDimensions;
+
+    /** The number of steps along each generator dimension. */
+    const NdArray<double>::Extents& mrGeneratorExtents;
+
+    /** View specification for a sub-array, except for the generator dimensions. */
+    const std::vector<R>& mrViewRanges;
+
+    /** The shape all sub-arrays must have. */
+    const NdArray<double>::Extents& mrSubArrayShape;
+
+    /** Whether sub-arrays are single values. */
+    const bool mIsScalar;
+
+    /** The number of elements in each sub-array. */
+    const unsigned mSubArraySize;
+
+    /** The start of the result's data, if sub-arrays are contiguous blocks within it; NULL otherwise. */
+    double* const mpResultData;
+
+    /** The array to fill in. */
+    NdArray<double>& mrResult;
+
+    /** Location information for error reporting. */
+    const std::string& mrLoc;
+};
+
+/**
+ * The generation of an array comprehension by a native version of its generator, which yields a
+ * single number for each position in the result, computed straight from the index values.
+ */
+class CompiledComprehensionLoop : public AbstractParallelLoop
+{
+public:
+    /**
+     * Set up the loop.
+     *
+     * @param rGenerator  the native generator
+     * @param rGenerationRanges  the ranges over which each index varies
+     * @param rArgumentIndices  which index variable supplies each argument of the generator
+     * @param rExtents  the shape of the result
+     * @param rResult  the array to fill in
+     */
+    CompiledComprehensionLoop(const CompiledFunction& rGenerator,
+                              const std::vector<R>& rGenerationRanges,
+                              const std::vector<unsigned>& rArgumentIndices,
+                              const NdArray<double>::Extents& rExtents,
+                              NdArray<double>& rResult)
+        : mrGenerator(rGenerator),
+          mrGenerationRanges(rGenerationRanges),
+          mrArgumentIndices(rArgumentIndices),
+          mrExtents(rExtents),
+          mpResultData(&(*rResult.Begin())),
+          mrResult(rResult)
+    {}
+
+    /**
+     * Generate a range of elements.
+     *
+     * @param start  the first element to generate
+     * @param end  one past the last element to generate
+     */
+    void RunIterations(unsigned start, unsigned end)
+    {
+        NdArray<double>::Indices indices = mrResult.GetIndices(start, mrExtents);
+        double args[CompiledFunction::MAX_PARAMETERS];
+        for (unsigned i=start; i<end; ++i)
+        {
+            for (unsigned j=0; j<mrArgumentIndices.size(); ++j)
+            {
+                const unsigned k = mrArgumentIndices[j];
+                args[j] = mrGenerationRanges[k].mBegin + indices[k]*mrGenerationRanges[k].mStep;
+            }
+            mpResultData[i] = mrGenerator(args);
+            mrResult.IncrementIndices(indices, mrExtents);
+        }
+    }
+
+private:
+    /** The native generator. */
+    const CompiledFunction& mrGenerator;
+
+    /** The ranges over which each index varies. */
+    const std::vector<R>& mrGenerationRanges;
+
+    /** Which index variable supplies each argument of the generator. */
+    const std::vector<unsigned>& mrArgumentIndices;
+
+    /** The shape of the result. */
+    const NdArray<double>::Extents& mrExtents;
+
+    /** The start of the result's data. */
+    double* const mpResultData;
+
+    /** The array to fill in. */
+    NdArray<double>& mrResult;
+};
 
 AbstractValuePtr ArrayCreate::operator()(const Environment& rEnv) const
 {
@@ -140,65 +461,93 @@ AbstractValuePtr ArrayCreate::operator()(const Environment& rEnv) const
             view_ranges.push_back(R(0, 1, extents.back()));
             num_sub_arrays *= extents.back();
         }
+        if (mpCompiledGenerator && mHoistedDefinitions.empty() && num_gaps == 0u)
+        {
+            // The native generator takes the index variables in the order their ranges were given
+            assert(mpCompiledGenerator->GetNumParameters() == num_params);
+            std::vector<unsigned> argument_indices(num_params);
+            for (unsigned i=0; i<num_params; ++i)
+            {
+                TupleValue* p_range = static_cast<TupleValue*>(params[i].get());
+                AbstractValuePtr p_name = p_range->GetItem(p_range->GetNumItems() - 1);
+                const std::string name = static_cast<StringValue*>(p_name.get())->GetString();
+                argument_indices[i] = std::find(index_names.begin(), index_names.end(), name) - index_names.begin();
+            }
+            NdArray<double> result(extents);
+            CompiledComprehensionLoop loop(*mpCompiledGenerator, generation_ranges, argument_indices, extents, result);
+            ThreadPool::RunLoop(loop, num_sub_arrays);
+            return TraceResult(boost::make_shared<ArrayValue>(result));
+        }
         // We figure out the shape of sub-arrays based on the first one
         NdArray<double>::Extents sub_array_shape;
         // Iterate over the generation range specifications to build up the new array
         boost::shared_ptr<NdArray<double> > p_array;
         NdArray<double>::Indices generator_indices(generator_extents.size(), 0u);
-        for (Index i=0; i<num_sub_arrays; ++i)
+        // Loop-invariant parts of the generator are evaluated just once, before the loop
+        EnvironmentCPtr p_generator_env = rEnv.GetAsDelegatee();
+        if (!mHoistedDefinitions.empty())
+        {
+            EnvironmentPtr p_hoisted_env(new Environment(p_generator_env));
+            HoistedExpression::DefineValues(mHoistedDefinitions,
+                                            HoistedExpression::EvaluateDefinitions(mHoistedDefinitions, rEnv),
+                                            *p_hoisted_env, GetLocationInfo());
+            p_generator_env = p_hoisted_env;
+        }
+        // If the generator dimensions come first, each sub-array fills a contiguous block of the result
+        const bool contiguous = (num_gaps == 0u);
+        // The first sub-array determines the shape of the result
         {
-            EnvironmentPtr p_sub_env(new Environment(rEnv.GetAsDelegatee()));
-            SetIndexValues(*p_sub_env, index_names, generator_indices, generation_ranges, GetLocationInfo());
-            AbstractValuePtr p_sub_array = (*mpElementGenerator)(*p_sub_env);
+            ComprehensionFrame frame(p_generator_env, index_names, generation_ranges, GetLocationInfo());
+            AbstractValuePtr p_sub_array = (*mpElementGenerator)(frame.rSetIndices(generator_indices));
             PROTO_ASSERT(p_sub_array->IsArray(),
                          "The generator expression in an array comprehension must yield arrays.");
             NdArray<double> sub_array = GET_ARRAY(p_sub_array);
-            if (i == 0)
+            sub_array_shape = sub_array.GetShape();
+//            std::cout << "Comp: sub-array shape: " << sub_array_shape << std::endl;
+            // Check the sub-arrays are large enough to fill any gaps in the range specs
+            Index num_sub_dims = sub_array.GetNumDimensions();
+            PROTO_ASSERT(num_sub_dims >= num_gaps,
+                         "The sub-arrays in this array comprehension have only " << num_sub_dims
+                         << " dimensions; not enough to fill " << num_gaps
+                         << " gaps in the range specifications.");
+            Index sub_i = 0;
+            for (Index j=0; j<extents.size(); ++j)
             {
-                sub_array_shape = sub_array.GetShape();
-//                std::cout << "Comp: sub-array shape: " << sub_array_shape << std::endl;
-                // Check the sub-arrays are large enough to fill any gaps in the range specs
-                Index num_sub_dims = sub_array.GetNumDimensions();
-                PROTO_ASSERT(num_sub_dims >= num_gaps,
-                             "The sub-arrays in this array comprehension have only " << num_sub_dims
-                             << " dimensions; not enough to fill " << num_gaps
-                             << " gaps in the range specifications.");
-                Index sub_i = 0;
-                for (Index j=0; j<extents.size(); ++j)
-                {
-                    if (extents[j] == (Index)R::END)
-                    {
-                        extents[j] = sub_array_shape[sub_i++];
-                    }
-                }
-                // Any extra sub-array dimensions get put on the end
-                for (; sub_i < num_sub_dims; ++sub_i)
+                if (extents[j] == (Index)R::END)
                 {
-                    view_ranges.push_back(R(R::END, 1, R::END));
-                    extents.push_back(sub_array_shape[sub_i]);
+                    extents[j] = sub_array_shape[sub_i++];
                 }
-                // Create the new array
-//                std::cout << "Comp: Creating array shape: " << extents << std::endl;
-                p_array.reset(new NdArray<double>(extents));
             }
-            else
+            // Any extra sub-array dimensions get put on the end
+            for (; sub_i < num_sub_dims; ++sub_i)
             {
-                PROTO_ASSERT(sub_array_shape == sub_array.GetShape(),
-                             "All sub-arrays in an array comprehension must have the same shape; arrays "
-                             << i << " of shape " << sub_array.GetShape() << " and 0 of shape "
-                             << sub_array_shape << " differ.");
+                view_ranges.push_back(R(R::END, 1, R::END));
+                extents.push_back(sub_array_shape[sub_i]);
             }
-//            std::cout << "Sub array " << i << ": " << std::vector<double>(sub_array.Begin(), sub_array.End()) << std::endl;
-            // Fill in the view of the new array corresponding to this sub-array
-            for (Index j=0; j<num_range_specs; ++j)
+            // Create the new array
+//            std::cout << "Comp: Creating array shape: " << extents << std::endl;
+            p_array.reset(new NdArray<double>(extents));
+            if (contiguous)
             {
-                Index index_j = generator_indices[j];
-                view_ranges[generator_dimensions[j]] = R(index_j, 0, index_j);
+                std::copy(sub_array.Begin(), sub_array.End(), p_array->Begin());
+            }
+            else
+            {
+                // Fill in the view of the new array corresponding to this sub-array
+                for (Index j=0; j<num_range_specs; ++j)
+                {
+                    view_ranges[generator_dimensions[j]] = R(0, 0, 0);
+                }
+                NdArray<double> view = (*p_array)[view_ranges];
+                std::copy(sub_array.Begin(), sub_array.End(), view.Begin());
             }
-            NdArray<double> view = (*p_array)[view_ranges];
-            std::copy(sub_array.Begin(), sub_array.End(), view.Begin());
-            p_array->IncrementIndices(generator_indices, generator_extents);
         }
+        // The remaining sub-arrays are independent, so may be generated in parallel
+        ComprehensionLoop loop(*mpElementGenerator, p_generator_env, index_names, generation_ranges,
+                               generator_dimensions, generator_extents, view_ranges, sub_array_shape,
+                               p_array->GetNumElements() / num_sub_arrays, contiguous, *p_array,
+                               GetLocationInfo());
+        ThreadPool::RunLoop(loop, num_sub_arrays - 1u);
         p_result = boost::make_shared<ArrayValue>(*p_array);
     }
     else
@@ -237,3 +586,18 @@ AbstractValuePtr ArrayCreate::operator()(const Environment& rEnv) const
     }
     return TraceResult(p_result);
 }
+
+AbstractExpressionPtr& ArrayCreate::rGetElementGenerator()
+{
+    return mpElementGenerator;
+}
+
+HoistedDefinitions& ArrayCreate::rGetHoistedDefinitions()
+{
+    return mHoistedDefinitions;
+}
+
+void ArrayCreate::SetCompiledGenerator(const CompiledFunctionPtr pFunction)
+{
+    mpCompiledGenerator = pFunction;
+}
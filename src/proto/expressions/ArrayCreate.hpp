@@ -37,6 +37,8 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define ARRAYCREATE_HPP_
 
 #include "FunctionCall.hpp"
+#include "HoistedExpression.hpp"
+#include "CompiledFunction.hpp"
 
 /**
  * Generic array creation functionality, providing the fundamental "array comprehension"
@@ -88,9 +90,33 @@ public:
      */
     AbstractValuePtr operator()(const Environment& rEnv) const;
 
+    /**
+     * Get the expression generating elements of the array, for rewriting by optimisation passes.
+     * This will be empty unless we are an array comprehension.
+     */
+    AbstractExpressionPtr& rGetElementGenerator();
+
+    /** Get the loop-invariant expressions hoisted out of the element generator by optimisation passes. */
+    HoistedDefinitions& rGetHoistedDefinitions();
+
+    /**
+     * Set a native version of the element generator of an array comprehension, used to fill in the
+     * whole array when the generator yields simple values and there are no hoisted definitions.
+     *
+     * @param pFunction  the native generator, taking the index variables in the order their ranges
+     *     are given; or an empty pointer to always interpret the generator
+     */
+    void SetCompiledGenerator(const CompiledFunctionPtr pFunction);
+
 private:
     /** The expression generating elements of the array, if this is an array comprehension. */
     AbstractExpressionPtr mpElementGenerator;
+
+    /** Loop-invariant expressions hoisted out of the generator, evaluated once per array creation. */
+    HoistedDefinitions mHoistedDefinitions;
+
+    /** Native version of the generator, if one has been compiled. */
+    CompiledFunctionPtr mpCompiledGenerator;
 };
 
 #endif // ARRAYCREATE_HPP_
@@ -47,6 +47,7 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "LambdaClosure.hpp"
 #include "NameLookup.hpp"
 #include "ReturnStatement.hpp"
+#include "ThreadPool.hpp"
 #include "ValueTypes.hpp"
 
 FileLoader::FileLoader(const FileFinder& rProtoPath, const std::vector<AbstractExpressionPtr>& rOperands)
@@ -70,6 +71,8 @@ AbstractValuePtr FileLoader::Create(const FileFinder& rProtoPath, EnvironmentCPt
 
 AbstractValuePtr FileLoader::operator ()(const Environment& rEnv) const
 {
+    // Reading files must happen in a predictable order
+    ThreadPool::CheckThreadSafe();
     std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);
     assert(operands.size() == 1u);
     PROTO_ASSERT(operands.front()->IsString(), "The built-in load function requires a string argument.");
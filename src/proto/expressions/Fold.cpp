@@ -42,6 +42,89 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "ValueTypes.hpp"
 #include "NdArray.hpp"
 #include "BacktraceException.hpp"
+#include "ThreadPool.hpp"
+
+/**
+ * The folds for each element of the result array, which may be split into chunks run in parallel
+ * since each element is independent.
+ */
+class FoldLoop : public AbstractParallelLoop
+{
+public:
+    /**
+     * Set up the loop.
+     *
+     * @param rFold  the fold expression
+     * @param rEnv  the environment in which to evaluate the fold call
+     * @param rFunc  the function to be folded
+     * @param pInit  the initial value for the fold, or null to use the first element
+     * @param rOperand  the operand array
+     * @param rResult  the array to fill in
+     * @param dimension  the dimension being folded over
+     * @param length  original length of the dimension being folded
+     */
+    FoldLoop(const Fold& rFold,
+             const Environment& rEnv,
+             const LambdaClosure& rFunc,
+             const AbstractValuePtr pInit,
+             const NdArray<double>& rOperand,
+             NdArray<double>& rResult,
+             NdArray<double>::Index dimension,
+             NdArray<double>::Index length)
+        : mrFold(rFold),
+          mrEnv(rEnv),
+          mrFunc(rFunc),
+          mpInit(pInit),
+          mrOperand(rOperand),
+          mrResult(rResult),
+          mDimension(dimension),
+          mLength(length)
+    {}
+
+    /**
+     * Compute a range of result elements.
+     *
+     * @param start  offset of the first element to compute
+     * @param end  offset one past the last element to compute
+     */
+    void RunIterations(unsigned start, unsigned end)
+    {
+        NdArray<double>::Indices indices = mrResult.GetIndices(start, mrResult.GetShape());
+        for (unsigned i=start; i<end; ++i)
+        {
+            NdArray<double>::Index& r_j = indices[mDimension];
+            double result_item = mrFold.Foldl(mrEnv, mrFunc, mpInit, mrOperand, indices, r_j, mLength);
+            r_j = 0;
+            mrResult[indices] = result_item;
+            mrResult.IncrementIndices(indices);
+        }
+    }
+
+private:
+    /** The fold expression. */
+    const Fold& mrFold;
+
+    /** The environment in which to evaluate the fold call. */
+    const Environment& mrEnv;
+
+    /** The function to be folded. */
+    const LambdaClosure& mrFunc;
+
+    /** The initial value for the fold, or null to use the first element. */
+    const AbstractValuePtr mpInit;
+
+    /** The operand array. */
+    const NdArray<double>& mrOperand;
+
+    /** The array to fill in. */
+    NdArray<double>& mrResult;
+
+    /** The dimension being folded over. */
+    NdArray<double>::Index mDimension;
+
+    /** Original length of the dimension being folded. */
+    NdArray<double>::Index mLength;
+};
 
 Fold::Fold(const std::vector<AbstractExpressionPtr>& rOperands)
     : FunctionCall("~fold", rOperands)
@@ -96,16 +179,8 @@ AbstractValuePtr Fold::operator()(const Environment& rEnv) const
     NdArray<double> result(shape);
 
     // Fill it in
-    const NdArray<double>::Index size = result.GetNumElements();
-    NdArray<double>::Indices indices = result.GetIndices();
-    for (NdArray<double>::Index i=0; i<size; ++i)
-    {
-        NdArray<double>::Index& r_j = indices[dimension];
-        double result_item = Foldl(rEnv, func, p_init, operand, indices, r_j, original_length);
-        r_j = 0;
-        result[indices] = result_item;
-        result.IncrementIndices(indices);
-    }
+    FoldLoop loop(*this, rEnv, func, p_init, operand, result, dimension, original_length);
+    ThreadPool::RunLoop(loop, result.GetNumElements());
     return TraceResult(boost::make_shared<ArrayValue>(result));
 }
 
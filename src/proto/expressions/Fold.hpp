@@ -81,6 +81,9 @@ public:
     AbstractValuePtr operator()(const Environment& rEnv) const;
 
 private:
+    /** The class running the folds for each result element calls Foldl. */
+    friend class FoldLoop;
+
     /**
      * The recursive foldl call.  We use foldl so that it can be implemented more efficiently
      * with iteration, since we don't need to deal with infinite lists!
@@ -65,3 +65,8 @@ AbstractValuePtr FunctionCall::operator()(const Environment& rEnv) const
     PROPAGATE_BACKTRACE_ENV(p_result = (*static_cast<LambdaClosure*>(p_lambda.get()))(rEnv, actual_params), rEnv);
     return TraceResult(p_result);
 }
+
+AbstractExpressionPtr& FunctionCall::rGetFunction()
+{
+    return mpFunction;
+}
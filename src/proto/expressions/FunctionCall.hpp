@@ -80,6 +80,11 @@ public:
      */
     virtual AbstractValuePtr operator()(const Environment& rEnv) const;
 
+    /**
+     * Get the expression giving the function to call, for rewriting by optimisation passes.
+     */
+    AbstractExpressionPtr& rGetFunction();
+
 private:
     /** The expression giving the function to call. */
     AbstractExpressionPtr mpFunction;
@@ -0,0 +1,96 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "HoistedExpression.hpp"
+
+#include <cassert>
+#include "BacktraceException.hpp"
+
+HoistedExpression::HoistedExpression(const std::string& rName, const AbstractExpressionPtr pOriginal)
+    : AbstractExpression(std::vector<AbstractExpressionPtr>(1, pOriginal)),
+      mName(rName)
+{}
+
+AbstractValuePtr HoistedExpression::operator()(const Environment& rEnv) const
+{
+    AbstractValuePtr p_result;
+    if (rEnv.HasName(mName, GetLocationInfo()))
+    {
+        p_result = rEnv.Lookup(mName, GetLocationInfo());
+    }
+    else
+    {
+        p_result = (*mChildren.front())(rEnv);
+    }
+    return TraceResult(p_result);
+}
+
+const std::string& HoistedExpression::rGetName() const
+{
+    return mName;
+}
+
+std::vector<AbstractValuePtr> HoistedExpression::EvaluateDefinitions(const HoistedDefinitions& rDefinitions,
+                                                                     const Environment& rEnv)
+{
+    std::vector<AbstractValuePtr> values(rDefinitions.size());
+    for (unsigned i=0; i<rDefinitions.size(); ++i)
+    {
+        try
+        {
+            values[i] = (*rDefinitions[i].second)(rEnv);
+        }
+        catch (const Exception&)
+        {
+            // Leave the value unset; the original expression will be evaluated in place
+        }
+    }
+    return values;
+}
+
+void HoistedExpression::DefineValues(const HoistedDefinitions& rDefinitions,
+                                     const std::vector<AbstractValuePtr>& rValues,
+                                     Environment& rEnv,
+                                     const std::string& rLoc)
+{
+    assert(rDefinitions.size() == rValues.size());
+    for (unsigned i=0; i<rDefinitions.size(); ++i)
+    {
+        if (rValues[i])
+        {
+            rEnv.DefineName(rDefinitions[i].first, rValues[i], rLoc);
+        }
+    }
+}
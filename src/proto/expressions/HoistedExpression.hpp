@@ -0,0 +1,108 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef HOISTEDEXPRESSION_HPP_
+#define HOISTEDEXPRESSION_HPP_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "AbstractExpression.hpp"
+#include "Environment.hpp"
+
+/**
+ * Loop-invariant sub-expressions hoisted out of a function body or array comprehension
+ * generator, as pairs of (fresh name, original expression).
+ */
+typedef std::vector<std::pair<std::string, AbstractExpressionPtr> > HoistedDefinitions;
+
+/**
+ * An expression that has been hoisted out of a function body or array comprehension generator by
+ * ProtocolOptimiser.  The owning construct evaluates the original expression once, in its defining
+ * environment, and binds the result to a fresh name; this expression then just looks up that name.
+ *
+ * If evaluating the hoisted definition failed, no binding will exist, and we fall back to evaluating
+ * the original expression in place, so that any error is reported exactly as it would have been.
+ */
+class HoistedExpression : public AbstractExpression
+{
+public:
+    /**
+     * Create the expression.
+     *
+     * @param rName  the name the hoisted value will be bound to
+     * @param pOriginal  the original expression
+     */
+    HoistedExpression(const std::string& rName, const AbstractExpressionPtr pOriginal);
+
+    /**
+     * Evaluate the expression in an environment.
+     *
+     * @param rEnv  the environment
+     */
+    AbstractValuePtr operator()(const Environment& rEnv) const;
+
+    /** Get the name the hoisted value is bound to. */
+    const std::string& rGetName() const;
+
+    /**
+     * Evaluate hoisted definitions.  Any definition that fails to evaluate yields a null pointer.
+     *
+     * @param rDefinitions  the hoisted definitions
+     * @param rEnv  the environment to evaluate them in
+     */
+    static std::vector<AbstractValuePtr> EvaluateDefinitions(const HoistedDefinitions& rDefinitions,
+                                                             const Environment& rEnv);
+
+    /**
+     * Bind the successfully evaluated hoisted values to their names.
+     *
+     * @param rDefinitions  the hoisted definitions
+     * @param rValues  their values, as returned by EvaluateDefinitions
+     * @param rEnv  the environment to define the names in
+     * @param rLoc  location information for error reporting
+     */
+    static void DefineValues(const HoistedDefinitions& rDefinitions,
+                             const std::vector<AbstractValuePtr>& rValues,
+                             Environment& rEnv,
+                             const std::string& rLoc);
+
+private:
+    /** The name the hoisted value is bound to. */
+    std::string mName;
+};
+
+#endif /* HOISTEDEXPRESSION_HPP_ */
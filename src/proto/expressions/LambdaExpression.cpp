@@ -63,11 +63,50 @@ LambdaExpression::LambdaExpression(const std::vector<std::string>& rFormalParame
 AbstractValuePtr LambdaExpression::operator()(const Environment& rEnv) const
 {
     boost::shared_ptr<LambdaClosure> p_closure(new LambdaClosure(rEnv.GetAsDelegatee(),
-                                                                 mFormalParameters, mBody, mDefaultParameters));
+                                                                 mFormalParameters, mBody, mDefaultParameters,
+                                                                 mHoistedDefinitions));
     p_closure->SetLocationInfo(GetLocationInfo());
+    if (mpMemoStatistics)
+    {
+        p_closure->EnableMemoisation(mpMemoStatistics);
+    }
+    if (mpCompiledFunction)
+    {
+        p_closure->SetCompiledFunction(mpCompiledFunction);
+    }
     return TraceResult(p_closure);
 }
 
+const std::vector<std::string>& LambdaExpression::rGetFormalParameters() const
+{
+    return mFormalParameters;
+}
+
+std::vector<AbstractStatementPtr>& LambdaExpression::rGetBody()
+{
+    return mBody;
+}
+
+HoistedDefinitions& LambdaExpression::rGetHoistedDefinitions()
+{
+    return mHoistedDefinitions;
+}
+
+void LambdaExpression::SetMemoisation(const MemoCache::StatisticsPtr pStatistics)
+{
+    mpMemoStatistics = pStatistics;
+}
+
+void LambdaExpression::SetCompiledFunction(const CompiledFunctionPtr pFunction)
+{
+    mpCompiledFunction = pFunction;
+}
+
+const std::vector<AbstractValuePtr>& LambdaExpression::rGetDefaultParameters() const
+{
+    return mDefaultParameters;
+}
+
 void LambdaExpression::CheckLengths() const
 {
     PROTO_ASSERT(mDefaultParameters.empty() || mDefaultParameters.size() == mFormalParameters.size(),
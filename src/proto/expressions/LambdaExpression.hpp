@@ -43,6 +43,9 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "AbstractExpression.hpp"
 #include "AbstractStatement.hpp"
+#include "CompiledFunction.hpp"
+#include "HoistedExpression.hpp"
+#include "MemoCache.hpp"
 
 /**
  * An expression defining a function.  It always evaluates to a LambdaClosure containing the defined function.
@@ -89,6 +92,33 @@ public:
     template<typename OPERATOR>
     static AbstractExpressionPtr WrapMathml(unsigned numOperands);
 
+    /** Get the parameter names for the function. */
+    const std::vector<std::string>& rGetFormalParameters() const;
+
+    /** Get the body of the function, for rewriting by optimisation passes. */
+    std::vector<AbstractStatementPtr>& rGetBody();
+
+    /** Get the loop-invariant expressions hoisted out of the body by optimisation passes. */
+    HoistedDefinitions& rGetHoistedDefinitions();
+
+    /**
+     * Set whether closures created by this expression should cache the results of calls.
+     *
+     * @param pStatistics  settings and counters shared by all caches, or an empty pointer to disable caching
+     */
+    void SetMemoisation(const MemoCache::StatisticsPtr pStatistics);
+
+    /**
+     * Set a native version of this function, for closures created by this expression to use
+     * when called with simple value arguments.
+     *
+     * @param pFunction  the native function, or an empty pointer to always interpret the body
+     */
+    void SetCompiledFunction(const CompiledFunctionPtr pFunction);
+
+    /** Get the default values for the function's parameters, if any. */
+    const std::vector<AbstractValuePtr>& rGetDefaultParameters() const;
+
 private:
     /** Parameter names for the function. */
     std::vector<std::string> mFormalParameters;
@@ -99,6 +129,15 @@ private:
     /** Default values for the function's parameters, if any. */
     std::vector<AbstractValuePtr> mDefaultParameters;
 
+    /** Loop-invariant expressions hoisted out of the body, which closures evaluate once. */
+    HoistedDefinitions mHoistedDefinitions;
+
+    /** Settings for caching call results, if this function has been found to be pure. */
+    MemoCache::StatisticsPtr mpMemoStatistics;
+
+    /** Native version of this function, if one has been compiled. */
+    CompiledFunctionPtr mpCompiledFunction;
+
     /**
      * Check that the correct number of default values have been supplied.
      */
@@ -42,6 +42,88 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "LambdaClosure.hpp"
 #include "NdArray.hpp"
 #include "ProtoHelperMacros.hpp"
+#include "ThreadPool.hpp"
+
+/**
+ * The application of a function to each element of the arrays passed to map, which may be split
+ * into chunks run in parallel since each result element is independent.
+ */
+class MapLoop : public AbstractParallelLoop
+{
+public:
+    /**
+     * Set up the loop.
+     *
+     * @param rEnv  the environment map is being evaluated in
+     * @param rFunc  the function to apply
+     * @param rArgArrays  the arrays to take function arguments from
+     * @param rResult  the array to fill in with function results
+     * @param allowImplicitArrays  whether 0-d arrays are broadcast against the other arguments
+     * @param rLoc  location information for error reporting
+     */
+    MapLoop(const Environment& rEnv,
+            const LambdaClosure& rFunc,
+            const std::vector<NdArray<double> >& rArgArrays,
+            NdArray<double>& rResult,
+            bool allowImplicitArrays,
+            const std::string& rLoc)
+        : mrEnv(rEnv),
+          mrFunc(rFunc),
+          mrArgArrays(rArgArrays),
+          mrResult(rResult),
+          mAllowImplicitArrays(allowImplicitArrays),
+          mrLoc(rLoc)
+    {}
+
+    /**
+     * Compute a range of result elements.
+     *
+     * @param start  offset of the first element to compute
+     * @param end  offset one past the last element to compute
+     */
+    void RunIterations(unsigned start, unsigned end)
+    {
+        NdArray<double>::Indices indices = mrResult.GetIndices(start, mrResult.GetShape());
+        for (unsigned i=start; i<end; ++i)
+        {
+            std::vector<AbstractValuePtr> fn_args;
+            for (unsigned j=0; j<mrArgArrays.size(); ++j)
+            {
+                if (mAllowImplicitArrays && mrArgArrays[j].GetShape().empty())
+                {
+                    fn_args.push_back(boost::make_shared<SimpleValue>(*mrArgArrays[j].Begin()));
+                }
+                else
+                {
+                    fn_args.push_back(boost::make_shared<SimpleValue>(mrArgArrays[j][indices]));
+                }
+            }
+            AbstractValuePtr p_result_value = mrFunc(mrEnv, fn_args);
+            PROTO_ASSERT2(p_result_value->IsDouble(), "The function passed to map must only return simple values.", mrLoc);
+            mrResult[indices] = GET_SIMPLE_VALUE(p_result_value);
+            mrResult.IncrementIndices(indices);
+        }
+    }
+
+private:
+    /** The environment map is being evaluated in. */
+    const Environment& mrEnv;
+
+    /** The function to apply. */
+    const LambdaClosure& mrFunc;
+
+    /** The arrays to take function arguments from. */
+    const std::vector<NdArray<double> >& mrArgArrays;
+
+    /** The array to fill in. */
+    NdArray<double>& mrResult;
+
+    /** Whether 0-d arrays are broadcast against the other arguments. */
+    bool mAllowImplicitArrays;
+
+    /** Location information for error reporting. */
+    const std::string& mrLoc;
+};
 
 Map::Map(const std::vector<AbstractExpressionPtr>& rParameters, bool allowImplicitArrays)
     : FunctionCall("~map", rParameters),
@@ -86,26 +168,12 @@ AbstractValuePtr Map::operator()(const Environment& rEnv) const
     // Create result array
     NdArray<double> result = NdArray<double>(shape);
     // Apply fn
-    NdArray<double>::Indices indices = result.GetIndices();
-    const NdArray<double>::Index num_elts = result.GetNumElements();
-    for (NdArray<double>::Index i=0; i<num_elts; ++i)
-    {
-        std::vector<AbstractValuePtr> fn_args;
-        for (unsigned j=0; j<arg_arrays.size(); ++j)
-        {
-            if (mAllowImplicitArrays && arg_arrays[j].GetShape().empty())
-            {
-                fn_args.push_back(boost::make_shared<SimpleValue>(*arg_arrays[j].Begin()));
-            }
-            else
-            {
-                fn_args.push_back(boost::make_shared<SimpleValue>(arg_arrays[j][indices]));
-            }
-        }
-        AbstractValuePtr p_result_value = func(rEnv, fn_args);
-        PROTO_ASSERT(p_result_value->IsDouble(), "The function passed to map must only return simple values.");
-        result[indices] = GET_SIMPLE_VALUE(p_result_value);
-        result.IncrementIndices(indices);
-    }
+    MapLoop loop(rEnv, func, arg_arrays, result, mAllowImplicitArrays, GetLocationInfo());
+    ThreadPool::RunLoop(loop, result.GetNumElements());
     return TraceResult(boost::make_shared<ArrayValue>(result));
 }
+
+bool Map::GetAllowImplicitArrays() const
+{
+    return mAllowImplicitArrays;
+}
@@ -63,6 +63,9 @@ public:
      */
     AbstractValuePtr operator()(const Environment& rEnv) const;
 
+    /** Get whether 0d parameters are treated as implicit arrays. */
+    bool GetAllowImplicitArrays() const;
+
 private:
     /** Whether to treat 0d parameters as implicit arrays. */
     bool mAllowImplicitArrays;
@@ -44,3 +44,8 @@ AbstractValuePtr NameLookup::operator()(const Environment& rEnv) const
 {
     return TraceResult(rEnv.Lookup(mName, GetLocationInfo()));
 }
+
+const std::string& NameLookup::rGetName() const
+{
+    return mName;
+}
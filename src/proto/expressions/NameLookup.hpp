@@ -61,6 +61,9 @@ public:
      */
     AbstractValuePtr operator()(const Environment& rEnv) const;
 
+    /** Get the name to look up. */
+    const std::string& rGetName() const;
+
 private:
     /** The name to look up. */
     std::string mName;
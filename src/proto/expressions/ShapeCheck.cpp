@@ -0,0 +1,98 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "ShapeCheck.hpp"
+
+#include <boost/make_shared.hpp>
+#include "ValueTypes.hpp"
+#include "ProtoHelperMacros.hpp"
+#include "NdArray.hpp"
+
+/**
+ * Get the shape an operand of a shape check refers to.
+ *
+ * @param pValue  the operand's value
+ * @param isShape  whether the value gives a shape directly
+ * @param rShape  will be filled in with the shape
+ * @return false if the value cannot be interpreted as required, in which case the check fails
+ */
+static bool GetOperandShape(const AbstractValuePtr pValue, bool isShape, NdArray<double>::Extents& rShape)
+{
+    if (!pValue->IsArray())
+    {
+        return false;
+    }
+    const NdArray<double> array = GET_ARRAY(pValue);
+    if (!isShape)
+    {
+        rShape = array.GetShape();
+        return true;
+    }
+    if (array.GetNumDimensions() != 1u)
+    {
+        return false;
+    }
+    rShape.clear();
+    for (NdArray<double>::ConstIterator it=array.Begin(); it != array.End(); ++it)
+    {
+        rShape.push_back(static_cast<NdArray<double>::Index>(*it));
+        if (rShape.back() != *it)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+ShapeCheck::ShapeCheck(const AbstractExpressionPtr pFirst, bool firstIsShape,
+                       const AbstractExpressionPtr pSecond, bool secondIsShape)
+{
+    mChildren.push_back(pFirst);
+    mChildren.push_back(pSecond);
+    mIsShape[0] = firstIsShape;
+    mIsShape[1] = secondIsShape;
+}
+
+
+AbstractValuePtr ShapeCheck::operator()(const Environment& rEnv) const
+{
+    std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);
+    NdArray<double>::Extents shapes[2];
+    bool result = GetOperandShape(operands[0], mIsShape[0], shapes[0])
+                  && GetOperandShape(operands[1], mIsShape[1], shapes[1])
+                  && shapes[0] == shapes[1];
+    return TraceResult(boost::make_shared<SimpleValue>(result));
+}
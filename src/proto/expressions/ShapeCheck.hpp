@@ -0,0 +1,74 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef SHAPECHECK_HPP_
+#define SHAPECHECK_HPP_
+
+#include "AbstractExpression.hpp"
+
+/**
+ * An expression that tests whether two arrays have the same shape, evaluating to true (1) or
+ * false (0) accordingly.  Either operand may instead give a shape directly, as a 1d array of
+ * extents.  This is used in place of library assertions such as ShapeEq(a, b) or
+ * ArrayEq(shape, a.SHAPE) when imported libraries are trusted (see ProtocolOptimiser), since it
+ * compares the extents directly without building any intermediate arrays.
+ */
+class ShapeCheck : public AbstractExpression
+{
+public:
+    /**
+     * Create a shape check.
+     *
+     * @param pFirst  the first operand
+     * @param firstIsShape  whether the first operand gives a shape, rather than an array to take the shape of
+     * @param pSecond  the second operand
+     * @param secondIsShape  whether the second operand gives a shape, rather than an array to take the shape of
+     */
+    ShapeCheck(const AbstractExpressionPtr pFirst, bool firstIsShape,
+               const AbstractExpressionPtr pSecond, bool secondIsShape);
+
+    /**
+     * Evaluate the expression in an environment.
+     *
+     * @param rEnv  the environment
+     */
+    AbstractValuePtr operator()(const Environment& rEnv) const;
+
+private:
+    /** Whether each operand gives a shape directly. */
+    bool mIsShape[2];
+};
+
+#endif // SHAPECHECK_HPP_
@@ -63,6 +63,12 @@ public:
         return mpValue;
     }
 
+    /** Get the fixed value. */
+    AbstractValuePtr GetValue() const
+    {
+        return mpValue;
+    }
+
 private:
     /** The fixed value. */
     AbstractValuePtr mpValue;
@@ -43,6 +43,98 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "ValueTypes.hpp"
 #include "ProtoHelperMacros.hpp"
 
+/*
+ * Element-wise versions of the operators below, for use when applied to arrays.
+ */
+
+/**
+ * @return the larger of two numbers
+ * @param a  the first number
+ * @param b  the second number
+ */
+static double MaxElement(double a, double b)
+{
+    return std::max(a, b);
+}
+
+/**
+ * @return the smaller of two numbers
+ * @param a  the first number
+ * @param b  the second number
+ */
+static double MinElement(double a, double b)
+{
+    return std::min(a, b);
+}
+
+/**
+ * @return the remainder on dividing a by b
+ * @param a  the dividend
+ * @param b  the divisor
+ */
+static double RemElement(double a, double b)
+{
+    return fmod(a, b);
+}
+
+/**
+ * @return the integer part of a divided by b
+ * @param a  the dividend
+ * @param b  the divisor
+ */
+static double QuotientElement(double a, double b)
+{
+    double result;
+    modf(a / b, &result);
+    return result;
+}
+
+/**
+ * @return a raised to the power b
+ * @param a  the base
+ * @param b  the exponent
+ */
+static double PowerElement(double a, double b)
+{
+    return pow(a, b);
+}
+
+/**
+ * @return the square root of a number
+ * @param a  the number
+ */
+static double SqrtElement(double a)
+{
+    return sqrt(a);
+}
+
+/**
+ * @return the absolute value of a number
+ * @param a  the number
+ */
+static double AbsElement(double a)
+{
+    return fabs(a);
+}
+
+/**
+ * @return the largest integer not greater than a number
+ * @param a  the number
+ */
+static double FloorElement(double a)
+{
+    return floor(a);
+}
+
+/**
+ * @return the smallest integer not less than a number
+ * @param a  the number
+ */
+static double CeilingElement(double a)
+{
+    return ceil(a);
+}
+
 MathmlMax::MathmlMax(const std::vector<AbstractExpressionPtr>& rOperands)
     : MathmlOperator("max", rOperands)
 {
@@ -51,13 +143,16 @@ MathmlMax::MathmlMax(const std::vector<AbstractExpressionPtr>& rOperands)
 
 AbstractValuePtr MathmlMax::operator()(const Environment& rEnv) const
 {
-    double result = boost::numeric::bounds<double>::lowest();
     std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);
+    if (!CheckNumericOperands(operands, "Max"))
+    {
+        return TraceResult(ElementwiseBinary(operands, MaxElement));
+    }
+    double result = boost::numeric::bounds<double>::lowest();
     for (std::vector<AbstractValuePtr>::const_iterator it = operands.begin();
          it != operands.end();
          ++it)
     {
-        PROTO_ASSERT((*it)->IsDouble(), "Max operator requires its operands to be simple values.");
         result = std::max(result, GET_SIMPLE_VALUE(*it));
     }
     return TraceResult(boost::make_shared<SimpleValue>(result));
@@ -73,13 +168,16 @@ MathmlMin::MathmlMin(const std::vector<AbstractExpressionPtr>& rOperands)
 
 AbstractValuePtr MathmlMin::operator()(const Environment& rEnv) const
 {
-    double result = boost::numeric::bounds<double>::highest();
     std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);
+    if (!CheckNumericOperands(operands, "Min"))
+    {
+        return TraceResult(ElementwiseBinary(operands, MinElement));
+    }
+    double result = boost::numeric::bounds<double>::highest();
     for (std::vector<AbstractValuePtr>::const_iterator it = operands.begin();
          it != operands.end();
          ++it)
     {
-        PROTO_ASSERT((*it)->IsDouble(), "Min operator requires its operands to be simple values.");
         result = std::min(result, GET_SIMPLE_VALUE(*it));
     }
     return TraceResult(boost::make_shared<SimpleValue>(result));
@@ -96,8 +194,10 @@ MathmlRem::MathmlRem(const std::vector<AbstractExpressionPtr>& rOperands)
 AbstractValuePtr MathmlRem::operator()(const Environment& rEnv) const
 {
     std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);
-    PROTO_ASSERT(operands[0]->IsDouble(), "Remainder operator requires its operands to be simple values.");
-    PROTO_ASSERT(operands[1]->IsDouble(), "Remainder operator requires its operands to be simple values.");
+    if (!CheckNumericOperands(operands, "Remainder"))
+    {
+        return TraceResult(ElementwiseBinary(operands, RemElement));
+    }
     double result = fmod(GET_SIMPLE_VALUE(operands[0]), GET_SIMPLE_VALUE(operands[1]));
     return TraceResult(boost::make_shared<SimpleValue>(result));
 }
@@ -113,8 +213,10 @@ MathmlQuotient::MathmlQuotient(const std::vector<AbstractExpressionPtr>& rOperan
 AbstractValuePtr MathmlQuotient::operator()(const Environment& rEnv) const
 {
     std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);
-    PROTO_ASSERT(operands[0]->IsDouble(), "Quotient operator requires its operands to be simple values.");
-    PROTO_ASSERT(operands[1]->IsDouble(), "Quotient operator requires its operands to be simple values.");
+    if (!CheckNumericOperands(operands, "Quotient"))
+    {
+        return TraceResult(ElementwiseBinary(operands, QuotientElement));
+    }
     double result;
     modf(GET_SIMPLE_VALUE(operands[0]) / GET_SIMPLE_VALUE(operands[1]), &result);
     return TraceResult(boost::make_shared<SimpleValue>(result));
@@ -131,8 +233,10 @@ MathmlPower::MathmlPower(const std::vector<AbstractExpressionPtr>& rOperands)
 AbstractValuePtr MathmlPower::operator()(const Environment& rEnv) const
 {
     std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);
-    PROTO_ASSERT(operands[0]->IsDouble(), "Power operator requires its operands to be simple values.");
-    PROTO_ASSERT(operands[1]->IsDouble(), "Power operator requires its operands to be simple values.");
+    if (!CheckNumericOperands(operands, "Power"))
+    {
+        return TraceResult(ElementwiseBinary(operands, PowerElement));
+    }
     double result = pow(GET_SIMPLE_VALUE(operands[0]), GET_SIMPLE_VALUE(operands[1]));
     return TraceResult(boost::make_shared<SimpleValue>(result));
 }
@@ -149,14 +253,23 @@ MathmlRoot::MathmlRoot(const std::vector<AbstractExpressionPtr>& rOperands)
 AbstractValuePtr MathmlRoot::operator()(const Environment& rEnv) const
 {
     std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);
-    PROTO_ASSERT(operands.back()->IsDouble(), "Root operator requires its operand to be a simple value.");
-    double operand = GET_SIMPLE_VALUE(operands.back());
+    PROTO_ASSERT(operands.back()->IsArray(), "Root operator requires its operand to be a simple value or array.");
     double degree = 2;
     if (operands.size() == 2)
     {
         PROTO_ASSERT(operands.front()->IsDouble(), "Root operator requires its qualifier to be a simple value.");
         degree = GET_SIMPLE_VALUE(operands.front());
     }
+    if (!operands.back()->IsDouble())
+    {
+        if (degree == 2)
+        {
+            return TraceResult(ElementwiseUnary(operands.back(), SqrtElement));
+        }
+        std::vector<AbstractValuePtr> power_operands = {operands.back(), boost::make_shared<SimpleValue>(1/degree)};
+        return TraceResult(ElementwiseBinary(power_operands, PowerElement));
+    }
+    double operand = GET_SIMPLE_VALUE(operands.back());
     double result;
     if (degree == 2)
     {
@@ -180,7 +293,10 @@ MathmlAbs::MathmlAbs(const std::vector<AbstractExpressionPtr>& rOperands)
 AbstractValuePtr MathmlAbs::operator()(const Environment& rEnv) const
 {
     std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);
-    PROTO_ASSERT(operands[0]->IsDouble(), "Absolute value operator requires its operand to be a simple value.");
+    if (!CheckNumericOperands(operands, "Absolute value"))
+    {
+        return TraceResult(ElementwiseUnary(operands[0], AbsElement));
+    }
     double result = fabs(GET_SIMPLE_VALUE(operands[0]));
     return TraceResult(boost::make_shared<SimpleValue>(result));
 }
@@ -196,7 +312,10 @@ MathmlFloor::MathmlFloor(const std::vector<AbstractExpressionPtr>& rOperands)
 AbstractValuePtr MathmlFloor::operator()(const Environment& rEnv) const
 {
     std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);
-    PROTO_ASSERT(operands[0]->IsDouble(), "Floor operator requires its operand to be a simple value.");
+    if (!CheckNumericOperands(operands, "Floor"))
+    {
+        return TraceResult(ElementwiseUnary(operands[0], FloorElement));
+    }
     double result = floor(GET_SIMPLE_VALUE(operands[0]));
     return TraceResult(boost::make_shared<SimpleValue>(result));
 }
@@ -212,7 +331,10 @@ MathmlCeiling::MathmlCeiling(const std::vector<AbstractExpressionPtr>& rOperands
 AbstractValuePtr MathmlCeiling::operator()(const Environment& rEnv) const
 {
     std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);
-    PROTO_ASSERT(operands[0]->IsDouble(), "Ceiling operator requires its operand to be a simple value.");
+    if (!CheckNumericOperands(operands, "Ceiling"))
+    {
+        return TraceResult(ElementwiseUnary(operands[0], CeilingElement));
+    }
     double result = ceil(GET_SIMPLE_VALUE(operands[0]));
     return TraceResult(boost::make_shared<SimpleValue>(result));
 }
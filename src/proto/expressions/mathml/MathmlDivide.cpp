@@ -35,6 +35,7 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "MathmlDivide.hpp"
 
+#include <functional>
 #include <boost/make_shared.hpp>
 #include "BacktraceException.hpp"
 #include "ValueTypes.hpp"
@@ -49,11 +50,9 @@ MathmlDivide::MathmlDivide(const std::vector<AbstractExpressionPtr>& rOperands)
 AbstractValuePtr MathmlDivide::operator()(const Environment& rEnv) const
 {
     std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);
-    for (std::vector<AbstractValuePtr>::const_iterator it = operands.begin();
-         it != operands.end();
-         ++it)
+    if (!CheckNumericOperands(operands, "Divide"))
     {
-        PROTO_ASSERT((*it)->IsDouble(), "Divide operator requires its operands to be simple values.");
+        return TraceResult(ElementwiseBinary(operands, std::divides<double>()));
     }
     double result = GET_SIMPLE_VALUE(operands[0]) / GET_SIMPLE_VALUE(operands[1]);
     return TraceResult(boost::make_shared<SimpleValue>(result));
@@ -43,6 +43,43 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "ValueTypes.hpp"
 #include "ProtoHelperMacros.hpp"
 
+/**
+ * @return the exponential of a number
+ * @param a  the number
+ */
+static double ExpElement(double a)
+{
+    return exp(a);
+}
+
+/**
+ * @return the natural logarithm of a number
+ * @param a  the number
+ */
+static double LnElement(double a)
+{
+    return log(a);
+}
+
+/**
+ * @return the base 10 logarithm of a number
+ * @param a  the number
+ */
+static double Log10Element(double a)
+{
+    return log10(a);
+}
+
+/**
+ * @return the logarithm of a to base b
+ * @param a  the number
+ * @param b  the base
+ */
+static double LogElement(double a, double b)
+{
+    return log(a) / log(b);
+}
+
 MathmlExp::MathmlExp(const std::vector<AbstractExpressionPtr>& rOperands)
     : MathmlOperator("exp", rOperands)
 {
@@ -52,7 +89,10 @@ MathmlExp::MathmlExp(const std::vector<AbstractExpressionPtr>& rOperands)
 AbstractValuePtr MathmlExp::operator()(const Environment& rEnv) const
 {
     std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);
-    PROTO_ASSERT(operands[0]->IsDouble(), "Exponential operator requires its operand to be a simple value.");
+    if (!CheckNumericOperands(operands, "Exponential"))
+    {
+        return TraceResult(ElementwiseUnary(operands[0], ExpElement));
+    }
     double result = exp(GET_SIMPLE_VALUE(operands[0]));
     return TraceResult(boost::make_shared<SimpleValue>(result));
 }
@@ -67,7 +107,10 @@ MathmlLn::MathmlLn(const std::vector<AbstractExpressionPtr>& rOperands)
 AbstractValuePtr MathmlLn::operator()(const Environment& rEnv) const
 {
     std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);
-    PROTO_ASSERT(operands[0]->IsDouble(), "Natural logarithm operator requires its operand to be a simple value.");
+    if (!CheckNumericOperands(operands, "Natural logarithm"))
+    {
+        return TraceResult(ElementwiseUnary(operands[0], LnElement));
+    }
     double result = log(GET_SIMPLE_VALUE(operands[0]));
     return TraceResult(boost::make_shared<SimpleValue>(result));
 }
@@ -82,14 +125,23 @@ MathmlLog::MathmlLog(const std::vector<AbstractExpressionPtr>& rOperands)
 AbstractValuePtr MathmlLog::operator()(const Environment& rEnv) const
 {
     std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);
-    PROTO_ASSERT(operands[0]->IsDouble(), "Logarithm operator requires its operand to be a simple value.");
-    double operand = GET_SIMPLE_VALUE(operands.back());
+    PROTO_ASSERT(operands.back()->IsArray(), "Logarithm operator requires its operand to be a simple value or array.");
     double logbase = 10;
     if (operands.size() == 2)
     {
         PROTO_ASSERT(operands.front()->IsDouble(), "Logarithm operator requires its qualifier to be a simple value.");
         logbase = GET_SIMPLE_VALUE(operands.front());
     }
+    if (!operands.back()->IsDouble())
+    {
+        if (logbase == 10)
+        {
+            return TraceResult(ElementwiseUnary(operands.back(), Log10Element));
+        }
+        std::vector<AbstractValuePtr> log_operands = {operands.back(), operands.front()};
+        return TraceResult(ElementwiseBinary(log_operands, LogElement));
+    }
+    double operand = GET_SIMPLE_VALUE(operands.back());
     double result;
     if (logbase == 10)
     {
@@ -122,14 +174,21 @@ AbstractValuePtr MathmlLog::operator()(const Environment& rEnv) const
  * @param cns  suffix for our class name
  * @param fn  C++ function name
  */
-#define TRIG_SIMPLE(mn, cns, fn)                                                                            \
-    MATHML_UNARY_CONSTRUCTOR(mn, cns)                                                                       \
-    AbstractValuePtr Mathml##cns::operator()(const Environment& rEnv) const                                 \
-    {                                                                                                       \
-        std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);                                    \
-        PROTO_ASSERT(operands[0]->IsDouble(), #cns " operator requires its operand to be a simple value."); \
-        double result = fn(GET_SIMPLE_VALUE(operands[0]));                                                  \
-        return TraceResult(boost::make_shared<SimpleValue>(result));                                                     \
+#define TRIG_SIMPLE(mn, cns, fn)                                                                    \
+    static double cns##Element(double x)                                                            \
+    {                                                                                               \
+        return fn(x);                                                                               \
+    }                                                                                               \
+    MATHML_UNARY_CONSTRUCTOR(mn, cns)                                                               \
+    AbstractValuePtr Mathml##cns::operator()(const Environment& rEnv) const                         \
+    {                                                                                               \
+        std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);                            \
+        if (!CheckNumericOperands(operands, #cns))                                                  \
+        {                                                                                           \
+            return TraceResult(ElementwiseUnary(operands[0], cns##Element));                        \
+        }                                                                                           \
+        double result = cns##Element(GET_SIMPLE_VALUE(operands[0]));                                \
+        return TraceResult(boost::make_shared<SimpleValue>(result));                                \
     }
 
 /**
@@ -139,14 +198,21 @@ AbstractValuePtr MathmlLog::operator()(const Environment& rEnv) const
  * @param cns  suffix for our class name
  * @param fn  C++ function name
  */
-#define TRIG_RECIP(mn, cns, fn)                                                                             \
-    MATHML_UNARY_CONSTRUCTOR(mn, cns)                                                                       \
-    AbstractValuePtr Mathml##cns::operator()(const Environment& rEnv) const                                 \
-    {                                                                                                       \
-        std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);                                    \
-        PROTO_ASSERT(operands[0]->IsDouble(), #cns " operator requires its operand to be a simple value."); \
-        double result = 1.0 / fn(GET_SIMPLE_VALUE(operands[0]));                                                  \
-        return TraceResult(boost::make_shared<SimpleValue>(result));                                                     \
+#define TRIG_RECIP(mn, cns, fn)                                                                     \
+    static double cns##Element(double x)                                                            \
+    {                                                                                               \
+        return 1.0 / fn(x);                                                                         \
+    }                                                                                               \
+    MATHML_UNARY_CONSTRUCTOR(mn, cns)                                                               \
+    AbstractValuePtr Mathml##cns::operator()(const Environment& rEnv) const                         \
+    {                                                                                               \
+        std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);                            \
+        if (!CheckNumericOperands(operands, #cns))                                                  \
+        {                                                                                           \
+            return TraceResult(ElementwiseUnary(operands[0], cns##Element));                        \
+        }                                                                                           \
+        double result = cns##Element(GET_SIMPLE_VALUE(operands[0]));                                \
+        return TraceResult(boost::make_shared<SimpleValue>(result));                                \
     }
 
 /**
@@ -156,14 +222,21 @@ AbstractValuePtr MathmlLog::operator()(const Environment& rEnv) const
  * @param cns  suffix for our class name
  * @param fn  C++ function name
  */
-#define TRIG_RECIP_ARG(mn, cns, fn)                                                                             \
-    MATHML_UNARY_CONSTRUCTOR(mn, cns)                                                                       \
-    AbstractValuePtr Mathml##cns::operator()(const Environment& rEnv) const                                 \
-    {                                                                                                       \
-        std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);                                    \
-        PROTO_ASSERT(operands[0]->IsDouble(), #cns " operator requires its operand to be a simple value."); \
-        double result = fn(1.0/GET_SIMPLE_VALUE(operands[0]));                                                  \
-        return TraceResult(boost::make_shared<SimpleValue>(result));                                                     \
+#define TRIG_RECIP_ARG(mn, cns, fn)                                                                 \
+    static double cns##Element(double x)                                                            \
+    {                                                                                               \
+        return fn(1.0/x);                                                                           \
+    }                                                                                               \
+    MATHML_UNARY_CONSTRUCTOR(mn, cns)                                                               \
+    AbstractValuePtr Mathml##cns::operator()(const Environment& rEnv) const                         \
+    {                                                                                               \
+        std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);                            \
+        if (!CheckNumericOperands(operands, #cns))                                                  \
+        {                                                                                           \
+            return TraceResult(ElementwiseUnary(operands[0], cns##Element));                        \
+        }                                                                                           \
+        double result = cns##Element(GET_SIMPLE_VALUE(operands[0]));                                \
+        return TraceResult(boost::make_shared<SimpleValue>(result));                                \
     }
 
 TRIG_SIMPLE("sin", Sin, sin)
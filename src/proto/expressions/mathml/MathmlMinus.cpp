@@ -35,6 +35,7 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "MathmlMinus.hpp"
 
+#include <functional>
 #include <boost/make_shared.hpp>
 #include "BacktraceException.hpp"
 #include "ValueTypes.hpp"
@@ -50,11 +51,13 @@ MathmlMinus::MathmlMinus(const std::vector<AbstractExpressionPtr>& rOperands)
 AbstractValuePtr MathmlMinus::operator()(const Environment& rEnv) const
 {
     std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);
-    for (std::vector<AbstractValuePtr>::const_iterator it = operands.begin();
-         it != operands.end();
-         ++it)
+    if (!CheckNumericOperands(operands, "Minus"))
     {
-        PROTO_ASSERT((*it)->IsDouble(), "Minus operator requires its operands to be simple values.");
+        if (operands.size() == 1u)
+        {
+            return TraceResult(ElementwiseUnary(operands[0], std::negate<double>()));
+        }
+        return TraceResult(ElementwiseBinary(operands, std::minus<double>()));
     }
     double result;
     if (operands.size() == 1u)
@@ -0,0 +1,115 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "MathmlOperator.hpp"
+
+#include <boost/foreach.hpp>
+#include "BacktraceException.hpp"
+#include "VectorStreaming.hpp"
+
+bool MathmlOperator::CheckNumericOperands(const std::vector<AbstractValuePtr>& rOperands,
+                                          const std::string& rDescription) const
+{
+    bool all_simple = true;
+    BOOST_FOREACH(const AbstractValuePtr p_operand, rOperands)
+    {
+        PROTO_ASSERT(p_operand->IsArray(),
+                     rDescription << " operator requires its operands to be simple values or arrays.");
+        all_simple = all_simple && p_operand->IsDouble();
+    }
+    return all_simple;
+}
+
+
+NdArray<double>::Extents MathmlOperator::GetBroadcastShape(const std::vector<AbstractValuePtr>& rOperands) const
+{
+    NdArray<double>::Extents shape;
+    BOOST_FOREACH(const AbstractValuePtr p_operand, rOperands)
+    {
+        if (p_operand->IsDouble())
+        {
+            // Simple values have an empty shape, so broadcast against anything.  Note that IsArray is
+            // true for these too, but they aren't ArrayValue instances so GET_ARRAY mustn't be used.
+            continue;
+        }
+        const NdArray<double>::Extents operand_shape = GET_ARRAY(p_operand).GetShape();
+        if (operand_shape.size() > shape.size())
+        {
+            shape.insert(shape.begin(), operand_shape.size() - shape.size(), 1u);
+        }
+        const unsigned offset = shape.size() - operand_shape.size();
+        for (unsigned i=0; i<operand_shape.size(); ++i)
+        {
+            NdArray<double>::Index& r_extent = shape[offset + i];
+            if (r_extent == 1u)
+            {
+                r_extent = operand_shape[i];
+            }
+            else
+            {
+                PROTO_ASSERT(operand_shape[i] == r_extent || operand_shape[i] == 1u,
+                             "Operands to the " << mName << " operator cannot be broadcast together; shape "
+                             << operand_shape << " is incompatible with " << shape << ".");
+            }
+        }
+    }
+    return shape;
+}
+
+
+NdArray<double> MathmlOperator::BroadcastTo(const NdArray<double>& rArray,
+                                            const NdArray<double>::Extents& rShape) const
+{
+    const NdArray<double>::Extents array_shape = rArray.GetShape();
+    if (array_shape == rShape)
+    {
+        return rArray;
+    }
+    assert(array_shape.size() <= rShape.size());
+    const unsigned offset = rShape.size() - array_shape.size();
+    NdArray<double> result(rShape);
+    NdArray<double>::Indices result_idxs = result.GetIndices();
+    NdArray<double>::Indices array_idxs = rArray.GetIndices();
+    for (NdArray<double>::Iterator it = result.Begin(); it != result.End(); ++it)
+    {
+        for (unsigned i=0; i<array_shape.size(); ++i)
+        {
+            array_idxs[i] = (array_shape[i] == 1u) ? 0u : result_idxs[offset + i];
+        }
+        *it = rArray[array_idxs];
+        result.IncrementIndices(result_idxs);
+    }
+    return result;
+}
@@ -38,8 +38,13 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <string>
 #include <vector>
+#include <algorithm>
+#include <boost/make_shared.hpp>
 
 #include "AbstractExpression.hpp"
+#include "NdArray.hpp"
+#include "ValueTypes.hpp"
+#include "ProtoHelperMacros.hpp"
 
 /**
  * Base class for MathML operators.  May not be needed really?  But perhaps convenient.
@@ -58,7 +63,108 @@ public:
           mName(rName)
     {}
 
+    /** Get the name of this operator. */
+    const std::string& rGetName() const
+    {
+        return mName;
+    }
+
 protected:
+    /**
+     * Check that every operand is numeric, i.e. either a simple value or an array.
+     *
+     * @param rOperands  the evaluated operands
+     * @param rDescription  how to refer to this operator in any error message
+     * @return  whether all the operands are simple values, in which case the scalar
+     *     evaluation code may be used
+     */
+    bool CheckNumericOperands(const std::vector<AbstractValuePtr>& rOperands,
+                              const std::string& rDescription) const;
+
+    /**
+     * Compute the shape of the result of an element-wise operation on the given operands,
+     * using NumPy-style broadcasting rules.  Shapes are aligned at their trailing dimensions,
+     * missing leading dimensions are treated as having extent 1, and along each dimension
+     * the extents must either match or be 1.
+     *
+     * @param rOperands  the evaluated operands; these must all be simple values or arrays
+     */
+    NdArray<double>::Extents GetBroadcastShape(const std::vector<AbstractValuePtr>& rOperands) const;
+
+    /**
+     * Expand an array to the given (compatible) broadcast shape.  If the array already has
+     * this shape it is returned as-is, without copying.
+     *
+     * @param rArray  the array to expand
+     * @param rShape  the shape to expand to, as computed by GetBroadcastShape
+     */
+    NdArray<double> BroadcastTo(const NdArray<double>& rArray,
+                                const NdArray<double>::Extents& rShape) const;
+
+    /**
+     * Apply a unary operation to each element of an array operand.
+     *
+     * @param pOperand  the operand, which must be a simple value or an array
+     * @param op  the operation, mapping a double to a double
+     * @return  a new array of the same shape as the operand
+     */
+    template<typename OP>
+    AbstractValuePtr ElementwiseUnary(const AbstractValuePtr pOperand, OP op) const
+    {
+        const NdArray<double> operand = GET_ARRAY(pOperand);
+        NdArray<double> result(operand.GetShape());
+        std::transform(operand.Begin(), operand.End(), result.Begin(), op);
+        return boost::make_shared<ArrayValue>(result);
+    }
+
+    /**
+     * Apply a binary operation element-wise to a sequence of operands, with broadcasting.
+     * When there are more than two operands the operation is applied left-to-right, so that
+     * the result is op(op(a, b), c) etc.  Simple value operands are applied directly rather
+     * than being expanded into arrays.
+     *
+     * @param rOperands  the operands, which must all be simple values or arrays
+     * @param op  the operation, mapping two doubles to a double (or bool)
+     * @return  a new array of the broadcast shape of the operands
+     */
+    template<typename OP>
+    AbstractValuePtr ElementwiseBinary(const std::vector<AbstractValuePtr>& rOperands, OP op) const
+    {
+        const NdArray<double>::Extents shape = GetBroadcastShape(rOperands);
+        NdArray<double> result(shape);
+        for (unsigned i=0; i<rOperands.size(); ++i)
+        {
+            if (rOperands[i]->IsDouble())
+            {
+                const double value = GET_SIMPLE_VALUE(rOperands[i]);
+                if (i == 0u)
+                {
+                    std::fill(result.Begin(), result.End(), value);
+                }
+                else
+                {
+                    for (NdArray<double>::Iterator it = result.Begin(); it != result.End(); ++it)
+                    {
+                        *it = op(*it, value);
+                    }
+                }
+            }
+            else
+            {
+                const NdArray<double> operand = BroadcastTo(GET_ARRAY(rOperands[i]), shape);
+                if (i == 0u)
+                {
+                    std::copy(operand.Begin(), operand.End(), result.Begin());
+                }
+                else
+                {
+                    std::transform(result.Begin(), result.End(), operand.Begin(), result.Begin(), op);
+                }
+            }
+        }
+        return boost::make_shared<ArrayValue>(result);
+    }
+
     /** The name of this operator. */
     std::string mName;
 };
@@ -35,6 +35,7 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "MathmlPlus.hpp"
 
+#include <functional>
 #include <boost/make_shared.hpp>
 #include "BacktraceException.hpp"
 #include "ValueTypes.hpp"
@@ -48,13 +49,16 @@ MathmlPlus::MathmlPlus(const std::vector<AbstractExpressionPtr>& rOperands)
 
 AbstractValuePtr MathmlPlus::operator()(const Environment& rEnv) const
 {
-    double result = 0.0;
     std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);
+    if (!CheckNumericOperands(operands, "Plus"))
+    {
+        return TraceResult(ElementwiseBinary(operands, std::plus<double>()));
+    }
+    double result = 0.0;
     for (std::vector<AbstractValuePtr>::const_iterator it = operands.begin();
          it != operands.end();
          ++it)
     {
-        PROTO_ASSERT((*it)->IsDouble(), "Plus operator requires its operands to be simple values.");
         result += GET_SIMPLE_VALUE(*it);
     }
     return TraceResult(boost::make_shared<SimpleValue>(result));
@@ -35,6 +35,7 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "MathmlRelations.hpp"
 
+#include <functional>
 #include <boost/make_shared.hpp>
 #include "BacktraceException.hpp"
 #include "ValueTypes.hpp"
@@ -49,8 +50,10 @@ MathmlEq::MathmlEq(const std::vector<AbstractExpressionPtr>& rOperands)
 AbstractValuePtr MathmlEq::operator()(const Environment& rEnv) const
 {
     std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);
-    PROTO_ASSERT(operands[0]->IsDouble(), "Equality operator requires its operands to be simple values.");
-    PROTO_ASSERT(operands[1]->IsDouble(), "Equality operator requires its operands to be simple values.");
+    if (!CheckNumericOperands(operands, "Equality"))
+    {
+        return TraceResult(ElementwiseBinary(operands, std::equal_to<double>()));
+    }
     bool result = GET_SIMPLE_VALUE(operands[0]) == GET_SIMPLE_VALUE(operands[1]);
     return TraceResult(boost::make_shared<SimpleValue>(result));
 }
@@ -65,8 +68,10 @@ MathmlNeq::MathmlNeq(const std::vector<AbstractExpressionPtr>& rOperands)
 AbstractValuePtr MathmlNeq::operator()(const Environment& rEnv) const
 {
     std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);
-    PROTO_ASSERT(operands[0]->IsDouble(), "Not-equal operator requires its operands to be simple values.");
-    PROTO_ASSERT(operands[1]->IsDouble(), "Not-equal operator requires its operands to be simple values.");
+    if (!CheckNumericOperands(operands, "Not-equal"))
+    {
+        return TraceResult(ElementwiseBinary(operands, std::not_equal_to<double>()));
+    }
     bool result = GET_SIMPLE_VALUE(operands[0]) != GET_SIMPLE_VALUE(operands[1]);
     return TraceResult(boost::make_shared<SimpleValue>(result));
 }
@@ -81,8 +86,10 @@ MathmlLt::MathmlLt(const std::vector<AbstractExpressionPtr>& rOperands)
 AbstractValuePtr MathmlLt::operator()(const Environment& rEnv) const
 {
     std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);
-    PROTO_ASSERT(operands[0]->IsDouble(), "Less-than operator requires its operands to be simple values.");
-    PROTO_ASSERT(operands[1]->IsDouble(), "Less-than operator requires its operands to be simple values.");
+    if (!CheckNumericOperands(operands, "Less-than"))
+    {
+        return TraceResult(ElementwiseBinary(operands, std::less<double>()));
+    }
     bool result = GET_SIMPLE_VALUE(operands[0]) < GET_SIMPLE_VALUE(operands[1]);
     return TraceResult(boost::make_shared<SimpleValue>(result));
 }
@@ -97,8 +104,10 @@ MathmlGt::MathmlGt(const std::vector<AbstractExpressionPtr>& rOperands)
 AbstractValuePtr MathmlGt::operator()(const Environment& rEnv) const
 {
     std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);
-    PROTO_ASSERT(operands[0]->IsDouble(), "Greater-than operator requires its operands to be simple values.");
-    PROTO_ASSERT(operands[1]->IsDouble(), "Greater-than operator requires its operands to be simple values.");
+    if (!CheckNumericOperands(operands, "Greater-than"))
+    {
+        return TraceResult(ElementwiseBinary(operands, std::greater<double>()));
+    }
     bool result = GET_SIMPLE_VALUE(operands[0]) > GET_SIMPLE_VALUE(operands[1]);
     return TraceResult(boost::make_shared<SimpleValue>(result));
 }
@@ -113,8 +122,10 @@ MathmlLeq::MathmlLeq(const std::vector<AbstractExpressionPtr>& rOperands)
 AbstractValuePtr MathmlLeq::operator()(const Environment& rEnv) const
 {
     std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);
-    PROTO_ASSERT(operands[0]->IsDouble(), "Less-than-or-equals operator requires its operands to be simple values.");
-    PROTO_ASSERT(operands[1]->IsDouble(), "Less-than-or-equals operator requires its operands to be simple values.");
+    if (!CheckNumericOperands(operands, "Less-than-or-equals"))
+    {
+        return TraceResult(ElementwiseBinary(operands, std::less_equal<double>()));
+    }
     bool result = GET_SIMPLE_VALUE(operands[0]) <= GET_SIMPLE_VALUE(operands[1]);
     return TraceResult(boost::make_shared<SimpleValue>(result));
 }
@@ -129,8 +140,10 @@ MathmlGeq::MathmlGeq(const std::vector<AbstractExpressionPtr>& rOperands)
 AbstractValuePtr MathmlGeq::operator()(const Environment& rEnv) const
 {
     std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);
-    PROTO_ASSERT(operands[0]->IsDouble(), "Greater-than-or-equals operator requires its operands to be simple values.");
-    PROTO_ASSERT(operands[1]->IsDouble(), "Greater-than-or-equals operator requires its operands to be simple values.");
+    if (!CheckNumericOperands(operands, "Greater-than-or-equals"))
+    {
+        return TraceResult(ElementwiseBinary(operands, std::greater_equal<double>()));
+    }
     bool result = GET_SIMPLE_VALUE(operands[0]) >= GET_SIMPLE_VALUE(operands[1]);
     return TraceResult(boost::make_shared<SimpleValue>(result));
 }
@@ -35,6 +35,7 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "MathmlTimes.hpp"
 
+#include <functional>
 #include <boost/make_shared.hpp>
 #include "BacktraceException.hpp"
 #include "ValueTypes.hpp"
@@ -48,13 +49,16 @@ MathmlTimes::MathmlTimes(const std::vector<AbstractExpressionPtr>& rOperands)
 
 AbstractValuePtr MathmlTimes::operator()(const Environment& rEnv) const
 {
-    double result = 1.0;
     std::vector<AbstractValuePtr> operands = EvaluateChildren(rEnv);
+    if (!CheckNumericOperands(operands, "Times"))
+    {
+        return TraceResult(ElementwiseBinary(operands, std::multiplies<double>()));
+    }
+    double result = 1.0;
     for (std::vector<AbstractValuePtr>::const_iterator it = operands.begin();
          it != operands.end();
          ++it)
     {
-        PROTO_ASSERT((*it)->IsDouble(), "Times operator requires its operands to be simple values.");
         result *= GET_SIMPLE_VALUE(*it);
     }
     return TraceResult(boost::make_shared<SimpleValue>(result));
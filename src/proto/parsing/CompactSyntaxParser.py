@@ -85,6 +85,7 @@ else:
     import fc.simulations.modifiers as Modifiers
     import fc.simulations.ranges as Ranges
     import fc.simulations.simulations as Simulations
+    from fc.utility.error_handling import ProtocolError
     from fc.utility.locatable import Locatable
 
     OPERATORS = {'+': E.Plus, '-': E.Minus, '*': E.Times, '/': E.Divide, '^': E.Power,
@@ -214,6 +215,11 @@ class Actions(object):
         def _xml(self):
             """Subclasses must implement this method to generate their specific XML."""
             raise NotImplementedError
+        
+        def Unsupported(self, construct):
+            """Report that the Python implementation can't run the given construct, saying where it was used."""
+            raise ProtocolError(construct, "can only be run by the C++ implementation, not in Python; used at",
+                                self.source_location)
     
     class BaseGroupAction(BaseAction):
         """Base class for parse actions associated with a Group.
@@ -908,25 +914,73 @@ class Actions(object):
         def _expr(self):
             return self.GetChildrenExpr()
     
+    class Event(BaseGroupAction):
+        """Parse action for an event to be located during a timecourse simulation."""
+        def _xml(self):
+            name, rate, variable, threshold, direction = self.tokens
+            attrs = {'name': str(name)}
+            if len(rate) > 0:
+                attrs['rateOfChange'] = 'true'
+            if len(direction) > 0:
+                attrs['direction'] = direction[0]
+            return P.event(P.name(variable), P.threshold(threshold.xml()), **attrs)
+    
+    class Events(BaseGroupAction):
+        """Parse action for the events collection of a timecourse simulation."""
+        def _xml(self):
+            return P.events(*self.GetChildrenXml())
+        
+        def _expr(self):
+            self.Unsupported("Locating events")
+    
+    class SolverSetting(BaseGroupAction):
+        """Parse action for a single named setting of a solver, steady state simulation or parareal options."""
+        def _xml(self):
+            return P.setting(self.tokens[1].xml(), name=str(self.tokens[0]))
+    
+    class Solver(BaseGroupAction):
+        """Parse action for the solver settings of a timecourse or nested simulation."""
+        def _xml(self):
+            return P.solver(*self.GetChildrenXml())
+        
+        def _expr(self):
+            self.Unsupported("Per-simulation solver settings")
+    
+    class Parareal(BaseGroupAction):
+        """Parse action for the options for solving a timecourse simulation in parallel in time."""
+        def _xml(self):
+            return P.parareal(*self.GetChildrenXml())
+    
     class TimecourseSimulation(BaseGroupAction):
         def _xml(self):
             args = self.GetChildrenXml()
-            if len(args) == 1:
+            if len(args) == 1 or isinstance(self.tokens[1], (Actions.Events, Actions.Parareal, Actions.Solver)):
                 # Add an empty modifiers element
-                args.append(self.Delegate('Modifiers', [[]]).xml())
+                args.insert(1, self.Delegate('Modifiers', [[]]).xml())
             return P.timecourseSimulation(*args)
         
         def _expr(self):
-            args = self.GetChildrenExpr()
+            # Solving in parallel in time doesn't change the results, so Python just ignores it
+            args = [token.expr() for token in self.tokens if not isinstance(token, Actions.Parareal)]
             return Simulations.Timecourse(*args)
         
     class NestedSimulation(BaseGroupAction):
+        def _SplitTokens(self):
+            """Separate the range & modifiers, the nested simulation, any reductions, and any solver settings."""
+            tokens = list(self.tokens)
+            reductions = solver = None
+            if isinstance(tokens[-1], Actions.Solver):
+                solver = tokens.pop()
+            if isinstance(tokens[-1], Actions.Reductions):
+                reductions = tokens.pop()
+            return tokens[0:-1], tokens[-1][0], reductions, solver
+        
         def _xml(self):
-            args = map(lambda t: t.xml(), self.tokens[0:-1])
+            loop_tokens, nested, reductions, solver = self._SplitTokens()
+            args = map(lambda t: t.xml(), loop_tokens)
             if len(args) == 1:
                 # Add an empty modifiers element
                 args.append(self.Delegate('Modifiers', [[]]).xml())
-            nested = self.tokens[-1][0]
             if isinstance(nested, (Actions.Simulation, Actions.NestedProtocol)):
                 # Inline definition
                 args.append(nested.xml())
@@ -934,19 +988,35 @@ class Actions(object):
                 # Reference to named task
                 nested = P.subTask(task=str(nested))
                 args.append(self.AddLoc(nested))
+            if reductions is not None:
+                args.append(reductions.xml())
+            if solver is not None:
+                args.append(solver.xml())
             return P.nestedSimulation(*args)
         
         def _expr(self):
-            args = map(lambda t: t.expr(), self.tokens[0:-1])
+            loop_tokens, nested, reductions, solver = self._SplitTokens()
+            if reductions is not None:
+                reductions.expr()
+            if solver is not None:
+                solver.expr()
+            args = map(lambda t: t.expr(), loop_tokens)
             if len(args) == 1:
                 # Add an empty modifiers element
                 args.append(self.Delegate('Modifiers', [[]]).expr())
-            nested = self.tokens[-1][0]
             if isinstance(nested, (Actions.Simulation, Actions.NestedProtocol)):
                 # Inline definition
                 args.append(nested.expr())
             return Simulations.Nested(args[2], args[0], args[1])
     
+    class Reductions(BaseGroupAction):
+        """Parse action for the per-iteration reductions of a nested simulation."""
+        def _xml(self):
+            return P.reduce(self.tokens[0].xml())
+        
+        def _expr(self):
+            self.Unsupported("Reducing nested simulation results")
+    
     class OneStepSimulation(BaseGroupAction):
         def _xml(self):
             attrs = {}
@@ -957,6 +1027,27 @@ class Actions(object):
                 args.append(self.tokens['modifiers'][0].xml())
             return P.oneStep(*args, **attrs)
     
+    class SteadyStateSimulation(BaseGroupAction):
+        """Parse action for a simulation pacing the model to a periodic steady state."""
+        def _xml(self):
+            args = []
+            settings = []
+            solver = None
+            for token in self.tokens:
+                if isinstance(token, Actions.Modifiers):
+                    args.append(token.xml())
+                elif isinstance(token, Actions.Solver):
+                    solver = token.xml()
+                else:
+                    settings.append(token.xml())
+            args.extend(settings)
+            if solver is not None:
+                args.append(solver)
+            return P.steadyStateSimulation(*args)
+        
+        def _expr(self):
+            self.Unsupported("Steady state simulations")
+    
     class NestedProtocol(BaseGroupAction):
         def __init__(self, s, loc, tokens):
             self.trace = (tokens[0][-1] == '?')
@@ -1051,6 +1142,14 @@ class Actions(object):
     
     class Import(BaseGroupAction):
         """Parse action for protocol imports."""
+        def __init__(self, s, loc, tokens):
+            super(Actions.Import, self).__init__(s, loc, tokens)
+            # A prefix may also be called 'trusted', so check for the keyword by name
+            self._trusted = 'trusted' in self.tokens
+            if self._trusted:
+                # This library is trusted to be used correctly
+                self.tokens = self.tokens[1:]
+
         def _xml(self):
             assert len(self.tokens) >= 2
             attrs = {'source': self.tokens[1]}
@@ -1058,6 +1157,8 @@ class Actions(object):
                 attrs['prefix'] = self.tokens[0]
             else:
                 attrs['mergeDefinitions'] = 'true'
+            if self._trusted:
+                attrs['trusted'] = 'true'
             children = []
             if len(self.tokens) == 3:
                 for set_input in self.tokens[2].tokens:
@@ -1571,7 +1672,9 @@ class CompactSyntaxParser(object):
     inputs = (MakeKw('inputs') - obrace - simpleAssignList + cbrace).setName('Inputs').setParseAction(Actions.Inputs)
 
     # Import statements
-    importStmt = p.Group(MakeKw('import') - Optional(ncIdent + eq, default='') + quotedUri +
+    # The trusted keyword can't be followed by '=', so it may also be used as a prefix
+    importStmt = p.Group(MakeKw('import') - Optional(MakeKw('trusted', suppress=False)('trusted') + ~eq) +
+                         Optional(ncIdent + eq, default='') + quotedUri +
                          Optional(obrace - simpleAssignList + embedded_cbrace)).setName('Import').setParseAction(Actions.Import)
     imports = OptionalDelimitedList(importStmt, nl).setName('Imports')
     
@@ -1664,15 +1767,35 @@ class CompactSyntaxParser(object):
     nestedProtocol = p.Group(MakeKw('protocol') - quotedUri + obrace +
                              simpleAssignList + Optional(nl) + OptionalDelimitedList(_selectOutput, nl) +
                              cbrace + Optional('?')).setName('NestedProtocol').setParseAction(Actions.NestedProtocol)
-    timecourseSim = p.Group(MakeKw('timecourse') - obrace - range + Optional(nl + modifiers) + cbrace
+    eventDefn = p.Group(ncIdent + eq - p.Group(Optional(MakeKw('rate', False) + MakeKw('of')))
+                        + ident + MakeKw('crosses') + expr
+                        + p.Group(Optional(MakeKw('rising', False) | MakeKw('falling', False)))
+                        ).setName('Event').setParseAction(Actions.Event)
+    events = p.Group(MakeKw('events') + obrace - OptionalDelimitedList(eventDefn, nl) + cbrace
+                     ).setName('Events').setParseAction(Actions.Events)
+    solverSetting = p.Group(ncIdent + eq - expr).setName('SolverSetting').setParseAction(Actions.SolverSetting)
+    solver = p.Group(MakeKw('solver') + obrace - OptionalDelimitedList(solverSetting, nl) + cbrace
+                     ).setName('Solver').setParseAction(Actions.Solver)
+    parareal = p.Group(MakeKw('parareal') + obrace - OptionalDelimitedList(solverSetting, nl) + cbrace
+                       ).setName('Parareal').setParseAction(Actions.Parareal)
+    timecourseSim = p.Group(MakeKw('timecourse') - obrace - range + Optional(nl + modifiers)
+                            + Optional(nl + events) + Optional(nl + parareal) + Optional(nl + solver) + cbrace
                             ).setName('TimecourseSim').setParseAction(Actions.TimecourseSimulation)
+    reductions = p.Group(MakeKw('reduce') - obrace - stmtList + cbrace
+                         ).setName('Reductions').setParseAction(Actions.Reductions)
     nestedSim = p.Group(MakeKw('nested') - obrace - range + nl + Optional(modifiers)
                         + p.Group(MakeKw('nests') + (simulation | nestedProtocol | ident))
+                        + Optional(Optional(nl) + reductions)
+                        + Optional(Optional(nl) + solver)
                         + cbrace).setName('NestedSim').setParseAction(Actions.NestedSimulation)
     oneStepSim = p.Group(MakeKw('oneStep') - Optional(p.originalTextFor(expr))("step")
                          + Optional(obrace - modifiers + cbrace)("modifiers")).setParseAction(Actions.OneStepSimulation)
+    steadyStateSim = p.Group(MakeKw('steadyState') - obrace - p.delimitedList(solverSetting, nl)
+                             + Optional(nl + modifiers) + Optional(nl + solver) + cbrace
+                             ).setName('SteadyStateSim').setParseAction(Actions.SteadyStateSimulation)
     simulation << p.Group(MakeKw('simulation') - Optional(ncIdent + eq, default='')
-                          + (timecourseSim | nestedSim | oneStepSim) - Optional('?' + nl)).setParseAction(Actions.Simulation)
+                          + (timecourseSim | nestedSim | oneStepSim | steadyStateSim) - Optional('?' + nl)
+                          ).setParseAction(Actions.Simulation)
 
     tasks = p.Group(MakeKw('tasks') + obrace - p.ZeroOrMore(simulation) + cbrace).setName('Tasks').setParseAction(Actions.Tasks)
 
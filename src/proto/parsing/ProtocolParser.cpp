@@ -53,6 +53,7 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "TimecourseSimulation.hpp"
 #include "CombinedSimulation.hpp"
 #include "OneStepSimulation.hpp"
+#include "SteadyStateSimulation.hpp"
 #include "NestedProtocol.hpp"
 #include "AbstractModifier.hpp"
 #include "ModelResetModifier.hpp"
@@ -185,6 +186,17 @@ public:
             input_values[input_name] = p_input_value;
         }
         SetContext(pImportElt);
+        // Libraries marked as trusted to be used correctly don't check their assertions
+        bool trusted = false;
+        if (pImportElt->hasAttribute(X("trusted")))
+        {
+            std::string trusted_attr = X2C(pImportElt->getAttribute(X("trusted")));
+            trusted = (trusted_attr == "true" || trusted_attr == "1");
+            if (trusted)
+            {
+                p_imported_proto->SetTrustedLibrary();
+            }
+        }
         // Merge or store protocol
         if (pImportElt->hasAttribute(X("prefix")))
         {
@@ -224,7 +236,7 @@ public:
             {
                 mpCurrentProtocolObject->AddImport(import.first, import.second, GetLocationInfo());
             }
-            mpCurrentProtocolObject->AddLibrary(p_imported_proto->rGetLibraryStatements());
+            mpCurrentProtocolObject->AddImportedLibrary(p_imported_proto->rGetLibraryStatements(), trusted);
             mpCurrentProtocolObject->AddSimulations(p_imported_proto->rGetSimulations());
             mpCurrentProtocolObject->AddPostProcessing(p_imported_proto->rGetPostProcessing());
             mpCurrentProtocolObject->AddOutputSpecs(p_imported_proto->rGetOutputSpecifications());
@@ -786,7 +798,68 @@ public:
     }
 
     /**
-     * Parse a timecourseSimulation element.
+     * Parse an event element, and add the event to the simulation that locates it.
+     *
+     * @param pEventElt  the element
+     * @param rSimulation  the simulation
+     */
+    void ParseEvent(DOMElement* pEventElt, TimecourseSimulation& rSimulation)
+    {
+        SetContext(pEventElt);
+        PROTO_ASSERT(pEventElt->hasAttribute(X("name")), "An event must be given a name.");
+        const std::string name = X2C(pEventElt->getAttribute(X("name")));
+        int direction = 0;
+        if (pEventElt->hasAttribute(X("direction")))
+        {
+            const std::string direction_name = X2C(pEventElt->getAttribute(X("direction")));
+            if (direction_name == "rising")
+            {
+                direction = 1;
+            }
+            else if (direction_name == "falling")
+            {
+                direction = -1;
+            }
+            else
+            {
+                PROTO_ASSERT(direction_name == "either",
+                             "The direction of an event must be 'rising', 'falling' or 'either'; not "
+                             << direction_name << ".");
+            }
+        }
+        bool rate_of_change = false;
+        if (pEventElt->hasAttribute(X("rateOfChange")))
+        {
+            const std::string rate_attr = X2C(pEventElt->getAttribute(X("rateOfChange")));
+            rate_of_change = (rate_attr == "true" || rate_attr == "1");
+        }
+        std::vector<DOMElement*> children = XmlTools::GetChildElements(pEventElt);
+        PROTO_ASSERT(children.size() == 2u, "An event requires 2 child elements.");
+        const std::string variable = X2C(children[0]->getTextContent());
+        AbstractExpressionPtr p_threshold = ParseNumberOrExpression(children[1]);
+        rSimulation.AddEvent(name, variable, rate_of_change, p_threshold, direction);
+    }
+
+    /**
+     * Parse a solver element, giving the solver settings to use while a simulation runs.
+     *
+     * @param pSolverElt  the element
+     * @param rSimulation  the simulation
+     */
+    void ParseSolverSettings(DOMElement* pSolverElt, AbstractSimulation& rSimulation)
+    {
+        BOOST_FOREACH(DOMElement* p_setting_elt, XmlTools::GetChildElements(pSolverElt))
+        {
+            SetContext(p_setting_elt);
+            PROTO_ASSERT(p_setting_elt->hasAttribute(X("name")), "A solver setting must be given a name.");
+            const std::string name = X2C(p_setting_elt->getAttribute(X("name")));
+            rSimulation.SetSolverSetting(name, ParseNumberOrExpression(p_setting_elt));
+        }
+    }
+
+    /**
+     * Parse a timecourseSimulation element, including any events to locate, options for solving it
+     * in parallel in time, and solver settings.
      *
      * @param pDefnElt  the element
      * @param pStepper  the parsed simulation stepper
@@ -798,11 +871,39 @@ public:
     {
         SetContext(pDefnElt);
         boost::shared_ptr<AbstractSystemWithOutputs> p_no_model; ///\todo specify model in XML?
-        return boost::make_shared<TimecourseSimulation>(p_no_model, pStepper, pModifiers);
+        boost::shared_ptr<TimecourseSimulation> p_sim = boost::make_shared<TimecourseSimulation>(p_no_model, pStepper, pModifiers);
+        std::vector<DOMElement*> children = XmlTools::GetChildElements(pDefnElt);
+        if (X2C(children.back()->getLocalName()) == "solver")
+        {
+            ParseSolverSettings(children.back(), *p_sim);
+            children.pop_back();
+        }
+        if (children.size() > 2u && X2C(children.back()->getLocalName()) == "parareal")
+        {
+            BOOST_FOREACH(DOMElement* p_setting_elt, XmlTools::GetChildElements(children.back()))
+            {
+                SetContext(p_setting_elt);
+                PROTO_ASSERT(p_setting_elt->hasAttribute(X("name")), "A parareal setting must be given a name.");
+                const std::string name = X2C(p_setting_elt->getAttribute(X("name")));
+                p_sim->SetPararealSetting(name, ParseNumberOrExpression(p_setting_elt));
+            }
+            children.pop_back();
+        }
+        if (children.size() > 2u)
+        {
+            PROTO_ASSERT(children.size() == 3u && X2C(children[2]->getLocalName()) == "events",
+                         "A timecourseSimulation may only contain a stepper, modifiers, events, parareal options and solver settings.");
+            BOOST_FOREACH(DOMElement* p_event_elt, XmlTools::GetChildElements(children[2]))
+            {
+                ParseEvent(p_event_elt, *p_sim);
+            }
+        }
+        return p_sim;
     }
 
     /**
-     * Parse a nestedSimulation element.
+     * Parse a nestedSimulation element, including any reductions of each iteration's results and
+     * solver settings.
      *
      * @param pDefnElt  the element
      * @param pStepper  the parsed simulation stepper
@@ -814,9 +915,28 @@ public:
     {
         SetContext(pDefnElt);
         std::vector<DOMElement*> children = XmlTools::GetChildElements(pDefnElt);
-        PROTO_ASSERT(children.size() == 3, "A nestedSimulation must contain a (single) nested simulation definition.");
-        boost::shared_ptr<AbstractSimulation> p_nested_sim = ParseSimulationDefinition(children.back());
-        return boost::make_shared<NestedSimulation>(p_nested_sim, pStepper, pModifiers);
+        DOMElement* p_solver_elt = NULL;
+        if (X2C(children.back()->getLocalName()) == "solver")
+        {
+            p_solver_elt = children.back();
+            children.pop_back();
+        }
+        const bool has_reductions = !children.empty() && X2C(children.back()->getLocalName()) == "reduce";
+        PROTO_ASSERT(children.size() == 3u + has_reductions,
+                     "A nestedSimulation must contain a (single) nested simulation definition.");
+        boost::shared_ptr<AbstractSimulation> p_nested_sim = ParseSimulationDefinition(children[2]);
+        boost::shared_ptr<NestedSimulation> p_sim = boost::make_shared<NestedSimulation>(p_nested_sim, pStepper, pModifiers);
+        if (has_reductions)
+        {
+            std::vector<DOMElement*> lists = XmlTools::GetChildElements(children.back());
+            PROTO_ASSERT(lists.size() == 1u, "A reduce element must contain a single statement list.");
+            p_sim->SetReductions(ParseStatementList(lists.front()));
+        }
+        if (p_solver_elt)
+        {
+            ParseSolverSettings(p_solver_elt, *p_sim);
+        }
+        return p_sim;
     }
 
     /**
@@ -841,6 +961,39 @@ public:
         return boost::make_shared<OneStepSimulation>(step, p_modifiers);
     }
 
+    /**
+     * Parse a steadyStateSimulation element.
+     *
+     * @param pDefnElt  the element
+     * @return  the corresponding simulation object
+     */
+    AbstractSimulationPtr ParseSteadyStateSimulation(DOMElement* pDefnElt)
+    {
+        SetContext(pDefnElt);
+        std::vector<DOMElement*> children = XmlTools::GetChildElements(pDefnElt);
+        boost::shared_ptr<ModifierCollection> p_modifiers;
+        if (!children.empty() && X2C(children.front()->getLocalName()) == "modifiers")
+        {
+            p_modifiers = ParseModifiers(children.front());
+            children.erase(children.begin());
+        }
+        boost::shared_ptr<SteadyStateSimulation> p_sim = boost::make_shared<SteadyStateSimulation>(p_modifiers);
+        if (!children.empty() && X2C(children.back()->getLocalName()) == "solver")
+        {
+            ParseSolverSettings(children.back(), *p_sim);
+            children.pop_back();
+        }
+        BOOST_FOREACH(DOMElement* p_setting_elt, children)
+        {
+            SetContext(p_setting_elt);
+            PROTO_ASSERT(X2C(p_setting_elt->getLocalName()) == "setting" && p_setting_elt->hasAttribute(X("name")),
+                         "A steadyStateSimulation may only contain modifiers, named settings and solver settings.");
+            const std::string name = X2C(p_setting_elt->getAttribute(X("name")));
+            p_sim->SetSetting(name, ParseNumberOrExpression(p_setting_elt));
+        }
+        return p_sim;
+    }
+
     /**
      * Parse a combinedSimulation element.
      *
@@ -904,6 +1057,10 @@ public:
         {
             p_sim = ParseOneStepSimulation(pDefnElt);
         }
+        else if (sim_type == "steadyStateSimulation")
+        {
+            p_sim = ParseSteadyStateSimulation(pDefnElt);
+        }
         else
         {
             std::vector<DOMElement*> children = XmlTools::GetChildElements(pDefnElt);
@@ -53,3 +53,8 @@ AbstractValuePtr AssertStatement::operator()(Environment& rEnv) const
     PROTO_ASSERT(GET_SIMPLE_VALUE(p_assertion_value), "Assertion failed: result is zero.");
     return boost::make_shared<NullValue>();
 }
+
+AbstractExpressionPtr& AssertStatement::rGetAssertion()
+{
+    return mpAssertion;
+}
@@ -60,6 +60,11 @@ public:
      */
     AbstractValuePtr operator()(Environment& rEnv) const;
 
+    /**
+     * Get the expression being asserted, for rewriting by optimisation passes.
+     */
+    AbstractExpressionPtr& rGetAssertion();
+
 private:
     /** The expression which should evaluate to non-zero. */
     AbstractExpressionPtr mpAssertion;
@@ -40,6 +40,7 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "BacktraceException.hpp"
 
 #include "DebugProto.hpp"
+#include "ThreadPool.hpp"
 
 AssignmentStatement::AssignmentStatement(const std::string& rNameToAssign,
                                          const AbstractExpressionPtr pRhs,
@@ -88,6 +89,7 @@ AbstractValuePtr AssignmentStatement::operator()(Environment& rEnv) const
             rEnv.DefineName(mNamesToAssign.front(), p_rhs_value, GetLocationInfo());
             if (GetTrace())
             {
+                ThreadPool::CheckThreadSafe();
                 TRACE_PROTO("Assign " << mNamesToAssign.front() << " <- " << p_rhs_value
                             << " at " << GetLocationInfo() << std::endl);
             }
@@ -100,3 +102,13 @@ const std::vector<std::string>& AssignmentStatement::rGetNamesToAssign() const
 {
     return mNamesToAssign;
 }
+
+AbstractExpressionPtr& AssignmentStatement::rGetRhs()
+{
+    return mpRhs;
+}
+
+bool AssignmentStatement::IsOptional() const
+{
+    return mOptional;
+}
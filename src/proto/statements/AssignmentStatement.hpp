@@ -84,6 +84,16 @@ public:
      */
     const std::vector<std::string>& rGetNamesToAssign() const;
 
+    /**
+     * Get the expression giving the value(s) to assign, for rewriting by optimisation passes.
+     */
+    AbstractExpressionPtr& rGetRhs();
+
+    /**
+     * Get whether this assignment is optional, i.e. errors evaluating the RHS are ignored.
+     */
+    bool IsOptional() const;
+
 private:
     /** The name(s) to assign. */
     std::vector<std::string> mNamesToAssign;
@@ -71,3 +71,8 @@ AbstractValuePtr ReturnStatement::operator()(Environment& rEnv) const
     }
     return p_result;
 }
+
+std::vector<AbstractExpressionPtr>& ReturnStatement::rGetExpressions()
+{
+    return mExpressions;
+}
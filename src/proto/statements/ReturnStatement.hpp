@@ -70,6 +70,11 @@ public:
      */
     AbstractValuePtr operator()(Environment& rEnv) const;
 
+    /**
+     * Get the expression(s) giving the return value(s), for rewriting by optimisation passes.
+     */
+    std::vector<AbstractExpressionPtr>& rGetExpressions();
+
 private:
     /** The expression(s) to evaluate to yield the return value(s). */
     std::vector<AbstractExpressionPtr> mExpressions;
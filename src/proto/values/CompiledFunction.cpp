@@ -0,0 +1,92 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "CompiledFunction.hpp"
+
+#include <cassert>
+#include <boost/make_shared.hpp>
+
+#include "ValueTypes.hpp"
+#include "ProtoHelperMacros.hpp"
+
+const unsigned CompiledFunction::MAX_PARAMETERS;
+
+CompiledFunction::CompiledFunction(FunctionPointer pFunction,
+                                   unsigned numParameters,
+                                   const boost::shared_ptr<void> pLibrary)
+    : mpFunction(pFunction),
+      mNumParameters(numParameters),
+      mpLibrary(pLibrary)
+{
+    assert(mpFunction);
+    assert(mNumParameters <= MAX_PARAMETERS);
+}
+
+bool CompiledFunction::CanEvaluate(const std::vector<AbstractValuePtr>& rParameters) const
+{
+    if (rParameters.size() != mNumParameters)
+    {
+        return false;
+    }
+    for (unsigned i=0; i<mNumParameters; ++i)
+    {
+        if (!rParameters[i] || !rParameters[i]->IsDouble())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+AbstractValuePtr CompiledFunction::operator()(const std::vector<AbstractValuePtr>& rParameters) const
+{
+    assert(CanEvaluate(rParameters));
+    double args[MAX_PARAMETERS];
+    for (unsigned i=0; i<mNumParameters; ++i)
+    {
+        args[i] = GET_SIMPLE_VALUE(rParameters[i]);
+    }
+    return boost::make_shared<SimpleValue>((*mpFunction)(args));
+}
+
+double CompiledFunction::operator()(const double* pArgs) const
+{
+    return (*mpFunction)(pArgs);
+}
+
+unsigned CompiledFunction::GetNumParameters() const
+{
+    return mNumParameters;
+}
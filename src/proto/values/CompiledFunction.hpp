@@ -0,0 +1,107 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef COMPILEDFUNCTION_HPP_
+#define COMPILEDFUNCTION_HPP_
+
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
+#include "AbstractValue.hpp"
+
+/**
+ * A native version of a protocol function, generated and loaded by ProtocolCompiler.  It only
+ * handles calls where every argument is a simple value; other calls must use the interpreter.
+ */
+class CompiledFunction
+{
+public:
+    /** The signature of generated functions: they take an array of arguments and return a number. */
+    typedef double (*FunctionPointer)(const double*);
+
+    /** The most parameters a compiled function may have. */
+    static const unsigned MAX_PARAMETERS = 16u;
+
+    /**
+     * Wrap a function loaded from a shared library.
+     *
+     * @param pFunction  the native function
+     * @param numParameters  how many arguments it takes
+     * @param pLibrary  handle for the library containing the function, which is kept open while we exist
+     */
+    CompiledFunction(FunctionPointer pFunction,
+                     unsigned numParameters,
+                     const boost::shared_ptr<void> pLibrary);
+
+    /**
+     * Whether the native function can evaluate a call with the given (complete) arguments.
+     *
+     * @param rParameters  the actual parameters, with any defaults filled in
+     */
+    bool CanEvaluate(const std::vector<AbstractValuePtr>& rParameters) const;
+
+    /**
+     * Evaluate a call.  CanEvaluate must be true for the arguments.
+     *
+     * @param rParameters  the actual parameters, with any defaults filled in
+     */
+    AbstractValuePtr operator()(const std::vector<AbstractValuePtr>& rParameters) const;
+
+    /**
+     * Evaluate a call with numeric arguments, avoiding the creation of values.
+     *
+     * @param pArgs  the arguments, one per parameter
+     */
+    double operator()(const double* pArgs) const;
+
+    /** Get how many arguments the function takes. */
+    unsigned GetNumParameters() const;
+
+private:
+    /** The native function. */
+    FunctionPointer mpFunction;
+
+    /** How many arguments it takes. */
+    unsigned mNumParameters;
+
+    /** The library containing the function. */
+    boost::shared_ptr<void> mpLibrary;
+};
+
+/** Type of a pointer to a compiled function. */
+typedef boost::shared_ptr<const CompiledFunction> CompiledFunctionPtr;
+
+#endif /* COMPILEDFUNCTION_HPP_ */
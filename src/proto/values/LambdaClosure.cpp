@@ -43,11 +43,14 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 LambdaClosure::LambdaClosure(EnvironmentCPtr pDefiningEnv,
                              const std::vector<std::string>& rFormalParameters,
                              const std::vector<AbstractStatementPtr>& rBody,
-                             const std::vector<AbstractValuePtr>& rDefaultParameters)
+                             const std::vector<AbstractValuePtr>& rDefaultParameters,
+                             const HoistedDefinitions& rHoistedDefinitions)
     : mpDefiningEnv(pDefiningEnv),
       mFormalParameters(rFormalParameters),
       mBody(rBody),
-      mDefaultParameters(rDefaultParameters)
+      mDefaultParameters(rDefaultParameters),
+      mHoistedDefinitions(rHoistedDefinitions),
+      mHoistedValuesEvaluated(false)
 {
     // This should be checked by the defining LambdaExpression
     assert(mDefaultParameters.empty() || mDefaultParameters.size() == mFormalParameters.size());
@@ -76,11 +79,46 @@ AbstractValuePtr LambdaClosure::operator()(const Environment& rCallersEnv,
             }
         }
     }
+    // Native code is faster than even a cache lookup
+    if (mpCompiledFunction && mpCompiledFunction->CanEvaluate(params))
+    {
+        return (*mpCompiledFunction)(params);
+    }
+    // Check for a cached result
+    std::string memo_key;
+    if (mpMemoCache)
+    {
+        AbstractValuePtr p_cached = mpMemoCache->Lookup(params, memo_key);
+        if (p_cached)
+        {
+            return p_cached;
+        }
+    }
     // Create local environment and execute function body
-    EnvironmentPtr p_local_env(new Environment(mpDefiningEnv.lock()->GetAsDelegatee()));
+    EnvironmentCPtr p_defining_env = mpDefiningEnv.lock();
+    EnvironmentPtr p_local_env(new Environment(p_defining_env->GetAsDelegatee()));
     p_local_env->DefineNames(mFormalParameters, params, GetLocationInfo());
+    if (!mHoistedDefinitions.empty())
+    {
+        // Loop-invariant parts of the body only depend on the defining environment, so are computed once
+        std::vector<AbstractValuePtr> hoisted_values;
+        {
+            boost::recursive_mutex::scoped_lock lock(mHoistedValuesMutex);
+            if (!mHoistedValuesEvaluated)
+            {
+                mHoistedValues = HoistedExpression::EvaluateDefinitions(mHoistedDefinitions, *p_defining_env);
+                mHoistedValuesEvaluated = true;
+            }
+            hoisted_values = mHoistedValues;
+        }
+        HoistedExpression::DefineValues(mHoistedDefinitions, hoisted_values, *p_local_env, GetLocationInfo());
+    }
     AbstractValuePtr p_result;
     PROPAGATE_BACKTRACE_ENV(p_result = p_local_env->ExecuteStatements(mBody, true /* says return is allowed */), *p_local_env);
+    if (mpMemoCache)
+    {
+        mpMemoCache->Store(memo_key, params, p_result);
+    }
     return p_result;
 }
 
@@ -88,3 +126,33 @@ bool LambdaClosure::IsLambda() const
 {
     return true;
 }
+
+void LambdaClosure::EnableMemoisation(const MemoCache::StatisticsPtr pStatistics)
+{
+    mpMemoCache.reset(new MemoCache(pStatistics));
+}
+
+void LambdaClosure::SetCompiledFunction(const CompiledFunctionPtr pFunction)
+{
+    mpCompiledFunction = pFunction;
+}
+
+const std::vector<std::string>& LambdaClosure::rGetFormalParameters() const
+{
+    return mFormalParameters;
+}
+
+const std::vector<AbstractStatementPtr>& LambdaClosure::rGetBody() const
+{
+    return mBody;
+}
+
+const std::vector<AbstractValuePtr>& LambdaClosure::rGetDefaultParameters() const
+{
+    return mDefaultParameters;
+}
+
+EnvironmentCPtr LambdaClosure::GetDefiningEnvironment() const
+{
+    return mpDefiningEnv.lock();
+}
@@ -39,12 +39,16 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <string>
 #include <vector>
 #include <boost/weak_ptr.hpp>
+#include <boost/thread/recursive_mutex.hpp>
 
 #include "AbstractValue.hpp"
 #include "LocatableConstruct.hpp"
 
 #include "AbstractStatement.hpp"
+#include "CompiledFunction.hpp"
 #include "Environment.hpp"
+#include "HoistedExpression.hpp"
+#include "MemoCache.hpp"
 
 /**
  * A function definition storable in an Environment.
@@ -59,11 +63,13 @@ public:
      * @param rFormalParameters  the names of the function's parameters
      * @param rBody  the body of the function - the statements to execute when the function is called
      * @param rDefaultParameters  default values for parameters, if any are defined
+     * @param rHoistedDefinitions  loop-invariant expressions hoisted out of the body, if any
      */
     LambdaClosure(EnvironmentCPtr pDefiningEnv,
                   const std::vector<std::string>& rFormalParameters,
                   const std::vector<AbstractStatementPtr>& rBody,
-                  const std::vector<AbstractValuePtr>& rDefaultParameters);
+                  const std::vector<AbstractValuePtr>& rDefaultParameters,
+                  const HoistedDefinitions& rHoistedDefinitions=HoistedDefinitions());
 
     /**
      * Call the function with the given parameter values in the given environment.
@@ -77,6 +83,32 @@ public:
     /** Used for testing that this is a LambdaClosure. */
     bool IsLambda() const;
 
+    /**
+     * Cache the results of calls to this function.  Should only be used if the function is pure.
+     *
+     * @param pStatistics  settings and counters shared by all caches
+     */
+    void EnableMemoisation(const MemoCache::StatisticsPtr pStatistics);
+
+    /**
+     * Use a native version of this function for calls where every argument is a simple value.
+     *
+     * @param pFunction  the native function
+     */
+    void SetCompiledFunction(const CompiledFunctionPtr pFunction);
+
+    /** Get the names of the function's parameters. */
+    const std::vector<std::string>& rGetFormalParameters() const;
+
+    /** Get the body of the function. */
+    const std::vector<AbstractStatementPtr>& rGetBody() const;
+
+    /** Get the default values for parameters, which is empty if none are defined. */
+    const std::vector<AbstractValuePtr>& rGetDefaultParameters() const;
+
+    /** Get the environment in which this lambda was defined, or an empty pointer if it no longer exists. */
+    EnvironmentCPtr GetDefiningEnvironment() const;
+
 private:
     /** The environment in which this lambda was defined. */
     boost::weak_ptr<const Environment> mpDefiningEnv;
@@ -89,6 +121,27 @@ private:
 
     /** Default values for parameters, if any are defined. */
     std::vector<AbstractValuePtr> mDefaultParameters;
+
+    /** Loop-invariant expressions hoisted out of the body, evaluated on the first call. */
+    HoistedDefinitions mHoistedDefinitions;
+
+    /** The values of #mHoistedDefinitions, once evaluated. */
+    mutable std::vector<AbstractValuePtr> mHoistedValues;
+
+    /** Whether #mHoistedValues has been filled in yet. */
+    mutable bool mHoistedValuesEvaluated;
+
+    /**
+     * Protects the hoisted values, since the function may be called from parallel loops.
+     * Evaluating them may call this function again, hence the mutex is recursive.
+     */
+    mutable boost::recursive_mutex mHoistedValuesMutex;
+
+    /** Cache of call results, if memoisation is enabled. */
+    boost::shared_ptr<MemoCache> mpMemoCache;
+
+    /** Native version of this function, if one has been compiled. */
+    CompiledFunctionPtr mpCompiledFunction;
 };
 
 
@@ -0,0 +1,199 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "MemoCache.hpp"
+
+#include <cassert>
+#include <boost/foreach.hpp>
+
+#include "ValueTypes.hpp"
+
+/** Arrays with at most this many elements are keyed by value rather than identity. */
+const unsigned MAX_ELEMENTS_KEYED_BY_VALUE = 16u;
+
+/**
+ * Append the raw bytes of a plain object to a key.
+ *
+ * @param rData  the object
+ * @param rKey  the key to add to
+ */
+template<typename DATA>
+static void AppendBytes(const DATA& rData, std::string& rKey)
+{
+    rKey.append(reinterpret_cast<const char*>(&rData), sizeof(DATA));
+}
+
+MemoCache::Statistics::Statistics(unsigned maxEntries)
+    : maxEntries(maxEntries),
+      generation(0u),
+      numHits(0u),
+      numMisses(0u)
+{}
+
+MemoCache::MemoCache(const StatisticsPtr pStatistics)
+    : mpStatistics(pStatistics),
+      mGeneration(pStatistics->generation)
+{}
+
+AbstractValuePtr MemoCache::Lookup(const std::vector<AbstractValuePtr>& rArgs, std::string& rKey)
+{
+    rKey.clear();
+    BOOST_FOREACH(const AbstractValuePtr p_arg, rArgs)
+    {
+        AppendKey(p_arg, rKey);
+    }
+    boost::mutex::scoped_lock lock(mMutex);
+    CheckGeneration();
+    AbstractValuePtr p_result;
+    std::map<std::string, std::list<Entry>::iterator>::iterator it = mIndex.find(rKey);
+    if (it != mIndex.end())
+    {
+        // Move the entry to the front of the recently used list
+        mEntries.splice(mEntries.begin(), mEntries, it->second);
+        p_result = it->second->pResult;
+    }
+    boost::mutex::scoped_lock stats_lock(mpStatistics->mutex);
+    if (p_result)
+    {
+        mpStatistics->numHits++;
+    }
+    else
+    {
+        mpStatistics->numMisses++;
+    }
+    return p_result;
+}
+
+void MemoCache::Store(const std::string& rKey, const std::vector<AbstractValuePtr>& rArgs, const AbstractValuePtr pResult)
+{
+    boost::mutex::scoped_lock lock(mMutex);
+    CheckGeneration();
+    if (mpStatistics->maxEntries == 0u || mIndex.find(rKey) != mIndex.end())
+    {
+        return;
+    }
+    while (mEntries.size() >= mpStatistics->maxEntries)
+    {
+        mIndex.erase(mEntries.back().key);
+        mEntries.pop_back();
+    }
+    Entry entry;
+    entry.key = rKey;
+    entry.args = rArgs;
+    entry.pResult = pResult;
+    mEntries.push_front(entry);
+    mIndex[rKey] = mEntries.begin();
+}
+
+unsigned MemoCache::GetNumEntries()
+{
+    boost::mutex::scoped_lock lock(mMutex);
+    CheckGeneration();
+    return mEntries.size();
+}
+
+void MemoCache::AppendKey(const AbstractValuePtr pValue, std::string& rKey)
+{
+    if (!pValue)
+    {
+        rKey += 'u';
+    }
+    else if (SimpleValue* p_simple = dynamic_cast<SimpleValue*>(pValue.get()))
+    {
+        rKey += 'd';
+        AppendBytes(p_simple->GetValue(), rKey);
+    }
+    else if (ArrayValue* p_array = dynamic_cast<ArrayValue*>(pValue.get()))
+    {
+        const NdArray<double> array = p_array->GetArray();
+        if (array.GetNumElements() <= MAX_ELEMENTS_KEYED_BY_VALUE)
+        {
+            rKey += 'a';
+            AppendBytes(array.GetNumDimensions(), rKey);
+            BOOST_FOREACH(NdArray<double>::Index extent, array.GetShape())
+            {
+                AppendBytes(extent, rKey);
+            }
+            for (NdArray<double>::ConstIterator it=array.Begin(); it != array.End(); ++it)
+            {
+                AppendBytes(*it, rKey);
+            }
+        }
+        else
+        {
+            rKey += 'A';
+            AppendBytes(pValue.get(), rKey);
+        }
+    }
+    else if (StringValue* p_string = dynamic_cast<StringValue*>(pValue.get()))
+    {
+        const std::string str = p_string->GetString();
+        rKey += 's';
+        AppendBytes(str.size(), rKey);
+        rKey += str;
+    }
+    else if (TupleValue* p_tuple = dynamic_cast<TupleValue*>(pValue.get()))
+    {
+        rKey += 't';
+        AppendBytes(p_tuple->GetNumItems(), rKey);
+        for (unsigned i=0; i<p_tuple->GetNumItems(); ++i)
+        {
+            AppendKey(p_tuple->GetItem(i), rKey);
+        }
+    }
+    else if (pValue->IsNull())
+    {
+        rKey += 'n';
+    }
+    else if (pValue->IsDefault())
+    {
+        rKey += '_';
+    }
+    else
+    {
+        rKey += 'i';
+        AppendBytes(pValue.get(), rKey);
+    }
+}
+
+void MemoCache::CheckGeneration()
+{
+    if (mGeneration != mpStatistics->generation)
+    {
+        mEntries.clear();
+        mIndex.clear();
+        mGeneration = mpStatistics->generation;
+    }
+}
@@ -0,0 +1,161 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef MEMOCACHE_HPP_
+#define MEMOCACHE_HPP_
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "AbstractValue.hpp"
+
+/**
+ * A bounded cache of the results of calls to a single pure function, used by LambdaClosure when
+ * memoisation has been enabled (see Protocol::SetMemoisation).  The least recently used result is
+ * discarded when the cache is full.
+ *
+ * Calls are keyed on their argument values.  Scalars, strings and small arrays are compared by value;
+ * larger arrays, and functions, are compared by identity, which is cheap and catches the common case
+ * of library helpers being passed the same array repeatedly.  Cached entries keep their arguments
+ * alive, so an identity can't be reused by a different value while it is in the cache.
+ *
+ * Caches may be used from parallel loops (see ThreadPool), so access is serialised.
+ */
+class MemoCache
+{
+public:
+    /**
+     * Settings and counters shared by all the caches created for a protocol.
+     */
+    struct Statistics
+    {
+        /**
+         * Create a fresh set of statistics.
+         *
+         * @param maxEntries  the maximum number of results each cache may hold
+         */
+        Statistics(unsigned maxEntries);
+
+        /** The maximum number of results each cache may hold. */
+        unsigned maxEntries;
+
+        /** Incremented to invalidate all existing cache entries, e.g. when model results change. */
+        unsigned generation;
+
+        /** Number of calls answered from a cache. */
+        unsigned numHits;
+
+        /** Number of calls that had to be evaluated. */
+        unsigned numMisses;
+
+        /** Protects the counters. */
+        boost::mutex mutex;
+    };
+
+    /** Type of a pointer to cache statistics. */
+    typedef boost::shared_ptr<Statistics> StatisticsPtr;
+
+    /**
+     * Create an empty cache.
+     *
+     * @param pStatistics  shared settings and counters
+     */
+    MemoCache(const StatisticsPtr pStatistics);
+
+    /**
+     * Look up the result of a call.  Updates the hit/miss counters.
+     *
+     * @param rArgs  the actual parameters of the call
+     * @param rKey  will be set to the key for these arguments, for passing to Store on a miss
+     * @return  the cached result, or an empty pointer if there is none
+     */
+    AbstractValuePtr Lookup(const std::vector<AbstractValuePtr>& rArgs, std::string& rKey);
+
+    /**
+     * Record the result of a call, evicting the least recently used entry if the cache is full.
+     *
+     * @param rKey  the key computed by Lookup
+     * @param rArgs  the actual parameters of the call
+     * @param pResult  the result
+     */
+    void Store(const std::string& rKey, const std::vector<AbstractValuePtr>& rArgs, const AbstractValuePtr pResult);
+
+    /** Get the number of results currently cached. */
+    unsigned GetNumEntries();
+
+private:
+    /** A cached call result. */
+    struct Entry
+    {
+        /** The key for the call. */
+        std::string key;
+        /** The arguments, kept alive so that identity-based keys remain valid. */
+        std::vector<AbstractValuePtr> args;
+        /** The result of the call. */
+        AbstractValuePtr pResult;
+    };
+
+    /**
+     * Append the key for a value to a string.
+     *
+     * @param pValue  the value
+     * @param rKey  the key to add to
+     */
+    static void AppendKey(const AbstractValuePtr pValue, std::string& rKey);
+
+    /** Drop all entries if the shared generation counter has moved on. */
+    void CheckGeneration();
+
+    /** The cached results, most recently used first. */
+    std::list<Entry> mEntries;
+
+    /** Index into #mEntries by key. */
+    std::map<std::string, std::list<Entry>::iterator> mIndex;
+
+    /** Shared settings and counters. */
+    StatisticsPtr mpStatistics;
+
+    /** The generation our entries belong to. */
+    unsigned mGeneration;
+
+    /** Protects the cache contents. */
+    boost::mutex mMutex;
+};
+
+#endif /* MEMOCACHE_HPP_ */
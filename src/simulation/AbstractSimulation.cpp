@@ -54,6 +54,7 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "NameLookup.hpp"
 #include "TupleExpression.hpp"
 #include "VectorStreaming.hpp"
+#include "ThreadPool.hpp"
 
 
 AbstractSimulation::AbstractSimulation(boost::shared_ptr<AbstractSystemWithOutputs> pModel,
@@ -66,8 +67,11 @@ AbstractSimulation::AbstractSimulation(boost::shared_ptr<AbstractSystemWithOutpu
       mpSteppers(pSteppers),
       mpEnvironment(new Environment),
       mParalleliseLoops(false),
+      mBalanceLoad(false),
+      mNativeLoops(false),
       mZeroInitialiseArrays(false),
-      mpResultsEnvironment(new Environment)
+      mpResultsEnvironment(new Environment),
+      mRestrictOutputs(false)
 {
     if (!mpSteppers)
     {
@@ -199,38 +203,40 @@ FileFinder AbstractSimulation::GetOutputFolder() const
 //
 
 /**
- * Broadcast a vector of varying length 'objects' from the master to all processes.
+ * Broadcast a vector of varying length 'objects' from one process to all the others.
  *
- * @param rResult  the result vector.  On input this must be filled in with the data to broadcast for the master process;
+ * @param rResult  the result vector.  On input this must be filled in with the data to broadcast for the root process;
  *     it will be filled in by this method for other processes.
  * @param numItems  how many objects are being communicated
  * @param mpiType  the underlying MPI type that each object is a vector of
  *     The template parameter RAW_TYPE is the C++ type corresponding to mpiType.
+ * @param root  the rank of the process broadcasting
  */
 template<typename TYPE, typename RAW_TYPE>
-void BroadcastVector(std::vector<TYPE>& rResult, unsigned numItems, MPI_Datatype mpiType)
+void BroadcastVector(std::vector<TYPE>& rResult, unsigned numItems, MPI_Datatype mpiType, int root)
 {
+    const bool am_root = ((int)PetscTools::GetMyRank() == root);
     assert(rResult.size() == numItems || rResult.size() == 0u);
     rResult.resize(numItems);
     // First, broadcast how long each object is, in terms of number of data items
     std::vector<unsigned> lengths(numItems);
-    if (PetscTools::AmMaster())
+    if (am_root)
     {
         for (unsigned i=0; i<numItems; ++i)
         {
             lengths[i] = rResult[i].size();
         }
     }
-    MPI_Bcast(&lengths[0], numItems, MPI_UNSIGNED, 0, PetscTools::GetWorld());
+    MPI_Bcast(&lengths[0], numItems, MPI_UNSIGNED, root, PetscTools::GetWorld());
     // Now broadcast the objects themselves
     for (unsigned i=0; i<numItems; ++i)
     {
         boost::scoped_array<RAW_TYPE> p_item(new RAW_TYPE[lengths[i]]); // MPI working memory
-        if (PetscTools::AmMaster())
+        if (am_root)
         {
             std::copy(rResult[i].begin(), rResult[i].end(), p_item.get());
         }
-        MPI_Bcast(p_item.get(), lengths[i], mpiType, 0, PetscTools::GetWorld());
+        MPI_Bcast(p_item.get(), lengths[i], mpiType, root, PetscTools::GetWorld());
         // Copy the item into the result vector
         rResult[i].resize(lengths[i]);
         std::copy(p_item.get(), p_item.get() + lengths[i], rResult[i].begin());
@@ -238,29 +244,105 @@ void BroadcastVector(std::vector<TYPE>& rResult, unsigned numItems, MPI_Datatype
 }
 
 
+/**
+ * Replicate one distributed results array so each process has the full data.
+ *
+ * If the owner of each iteration is known, the array is split into as many equal slices as there are
+ * iterations, and each process sends just the slices it owns to the others, so the data sent in total
+ * is the size of the array.  Otherwise each process must have zeros where it has no results, and the
+ * arrays of all processes are summed.
+ *
+ * @param rArray  the results array
+ * @param rOwners  the rank holding each slice of the array, or -1 if none does; empty if not known
+ */
+void ReplicateArray(NdArray<double>& rArray, const std::vector<int>& rOwners)
+{
+    const unsigned num_elements = rArray.GetNumElements();
+    double* p_data = &(*rArray.Begin());
+    int mpi_ret;
+    if (rOwners.empty())
+    {
+        boost::scoped_array<double> p_result(new double[num_elements]);
+        mpi_ret = MPI_Allreduce(p_data, p_result.get(), num_elements, MPI_DOUBLE, MPI_SUM, PetscTools::GetWorld());
+        memcpy(p_data, p_result.get(), num_elements * sizeof(double));
+    }
+    else
+    {
+        assert(num_elements % rOwners.size() == 0u);
+        const unsigned slice_size = num_elements / rOwners.size();
+        const unsigned my_rank = PetscTools::GetMyRank();
+        // Work out where each process's slices go in the gathered data; they are sent in order
+        std::vector<int> counts(PetscTools::GetNumProcs(), 0);
+        BOOST_FOREACH(int owner, rOwners)
+        {
+            if (owner >= 0)
+            {
+                counts[owner] += slice_size;
+            }
+        }
+        std::vector<int> offsets(counts.size(), 0);
+        for (unsigned rank=1; rank<counts.size(); ++rank)
+        {
+            offsets[rank] = offsets[rank-1] + counts[rank-1];
+        }
+        boost::scoped_array<double> p_ours(new double[counts[my_rank]]);
+        boost::scoped_array<double> p_gathered(new double[offsets.back() + counts.back()]);
+        double* p_next = p_ours.get();
+        for (unsigned i=0; i<rOwners.size(); ++i)
+        {
+            if (rOwners[i] == (int)my_rank)
+            {
+                p_next = std::copy(p_data + i*slice_size, p_data + (i+1)*slice_size, p_next);
+            }
+        }
+        mpi_ret = MPI_Allgatherv(p_ours.get(), counts[my_rank], MPI_DOUBLE,
+                                 p_gathered.get(), &counts[0], &offsets[0], MPI_DOUBLE, PetscTools::GetWorld());
+        // Put every slice in its place, taking those of each process in turn
+        for (unsigned i=0; i<rOwners.size(); ++i)
+        {
+            const int owner = rOwners[i];
+            if (owner >= 0)
+            {
+                const double* p_slice = p_gathered.get() + offsets[owner];
+                std::copy(p_slice, p_slice + slice_size, p_data + i*slice_size);
+                offsets[owner] += slice_size;
+            }
+        }
+    }
+    assert(mpi_ret == MPI_SUCCESS);
+    UNUSED_OPT(mpi_ret);
+}
+
+
 /**
  * Replicate distributed results arrays so each process has the full data.
  *
  * @param pResults  the results environment
+ * @param rOwners  the rank holding the results of each iteration of the loops that were shared out, or -1 if
+ *     none does; empty if not known (see AbstractSimulation::GetResultsOwners)
  * @param rLoc  the location information of the caller, for use if an error occurs
  */
-void ReplicateResults(EnvironmentPtr pResults, const std::string& rLoc)
+void ReplicateResults(EnvironmentPtr pResults, const std::vector<int>& rOwners, const std::string& rLoc)
 {
-    // Check whether all processes have some partial results; if not, the master must broadcast the names, units & shapes.
-    // (Note that the master is guaranteed to have a full set of metadata, since it always runs the first iteration.)
+    // Check whether all processes have some partial results; if not, a process that does must broadcast the
+    // names, units & shapes.  Note that when iterations are handed out by the master, it has no results itself.
     {
         unsigned num_local_results = pResults->GetNumberOfDefinitions();
         unsigned max_local_results = 0u;
         int mpi_ret = MPI_Allreduce(&num_local_results, &max_local_results, 1u, MPI_UNSIGNED, MPI_MAX, PetscTools::GetWorld());
         assert(mpi_ret == MPI_SUCCESS);
-        UNUSED_OPT(mpi_ret);
         if (PetscTools::ReplicateBool(num_local_results < max_local_results))
         {
+            // Find the first process with a full set of metadata
+            int candidate = (num_local_results == max_local_results) ? (int)PetscTools::GetMyRank() : (int)PetscTools::GetNumProcs();
+            int root = 0;
+            mpi_ret = MPI_Allreduce(&candidate, &root, 1u, MPI_INT, MPI_MIN, PetscTools::GetWorld());
+            assert(mpi_ret == MPI_SUCCESS);
             // Broadcast result metadata: result names, units & shapes
             std::vector<std::string> names;
             std::vector<std::string> units;
             std::vector<NdArray<double>::Extents> shapes;
-            if (PetscTools::AmMaster())
+            if ((int)PetscTools::GetMyRank() == root)
             {
                 names = pResults->GetDefinedNames();
                 BOOST_FOREACH(const std::string& r_name, names)
@@ -271,9 +353,9 @@ void ReplicateResults(EnvironmentPtr pResults, const std::string& rLoc)
                     shapes.push_back(GET_ARRAY(p_result).GetShape());
                 }
             }
-            BroadcastVector<std::string, unsigned char>(names, max_local_results, MPI_UNSIGNED_CHAR);
-            BroadcastVector<std::string, unsigned char>(units, max_local_results, MPI_UNSIGNED_CHAR);
-            BroadcastVector<NdArray<double>::Extents, NdArray<double>::Index>(shapes, max_local_results, MPI_UNSIGNED);
+            BroadcastVector<std::string, unsigned char>(names, max_local_results, MPI_UNSIGNED_CHAR, root);
+            BroadcastVector<std::string, unsigned char>(units, max_local_results, MPI_UNSIGNED_CHAR, root);
+            BroadcastVector<NdArray<double>::Extents, NdArray<double>::Index>(shapes, max_local_results, MPI_UNSIGNED, root);
             // Now create zero-filled arrays for any results the local process doesn't have
             std::vector<std::string> our_names = pResults->GetDefinedNames();
             for (unsigned i=0; i<max_local_results; ++i)
@@ -288,6 +370,7 @@ void ReplicateResults(EnvironmentPtr pResults, const std::string& rLoc)
                 }
             }
         }
+        UNUSED_OPT(mpi_ret);
     }
     // Replicate all results defined in this environment
     BOOST_FOREACH(const std::string& r_output_name, pResults->GetDefinedNames())
@@ -295,20 +378,16 @@ void ReplicateResults(EnvironmentPtr pResults, const std::string& rLoc)
         AbstractValuePtr p_output = pResults->Lookup(r_output_name, rLoc);
         PROTO_ASSERT2(p_output->IsArray(), "Model produced non-array output " << r_output_name << ".", rLoc);
         NdArray<double> array = GET_ARRAY(p_output);
-        double* p_data = &(*array.Begin());
-        boost::scoped_array<double> p_result(new double[array.GetNumElements()]);
-        int mpi_ret = MPI_Allreduce(p_data, p_result.get(), array.GetNumElements(), MPI_DOUBLE, MPI_SUM, PetscTools::GetWorld());
-        assert(mpi_ret == MPI_SUCCESS);
-        UNUSED_OPT(mpi_ret);
-        memcpy(p_data, p_result.get(), array.GetNumElements() * sizeof(double));
+        ReplicateArray(array, rOwners);
     }
     // Check for any results sub-environments, and replicate them too, recursively.
+    // Their arrays are indexed by the same loops, so are sliced up in the same way.
     BOOST_FOREACH(const std::string& r_sub_prefix, pResults->rGetSubEnvironmentNames())
     {
         EnvironmentPtr p_sub_results
             = boost::const_pointer_cast<Environment>(pResults->GetDelegateeEnvironment(r_sub_prefix));
         assert(p_sub_results);
-        ReplicateResults(p_sub_results, rLoc);
+        ReplicateResults(p_sub_results, rOwners, rLoc);
     }
 }
 
@@ -349,6 +428,86 @@ private:
 };
 
 
+/**
+ * A little helper class that optionally restricts the outputs a model provides, and
+ * ensures that the previous restriction is restored at the end of the scope.
+ */
+class RequireOutputsHere
+{
+public:
+    /**
+     * Create a restriction scope.
+     * @param pModel  the model
+     * @param pNames  the names of the outputs to provide, or NULL to leave the model unchanged
+     */
+    RequireOutputsHere(boost::shared_ptr<AbstractSystemWithOutputs> pModel,
+                       const std::set<std::string>* pNames)
+        : mpModel(pNames ? pModel : boost::shared_ptr<AbstractSystemWithOutputs>())
+    {
+        if (mpModel)
+        {
+            mOldRequired = mpModel->rGetRequiredOutputs();
+            mpModel->SetRequiredOutputs(*pNames);
+        }
+    }
+    /**
+     * Restore the previous restriction, iff we changed it.
+     */
+    ~RequireOutputsHere()
+    {
+        if (mpModel)
+        {
+            mpModel->SetRequiredOutputs(mOldRequired);
+        }
+    }
+private:
+    /** The model we restricted, if any. */
+    boost::shared_ptr<AbstractSystemWithOutputs> mpModel;
+    /** The model's previous restriction. */
+    std::vector<bool> mOldRequired;
+};
+
+
+/**
+ * A little helper class that optionally changes the model's solver settings, and
+ * ensures that the previous settings are restored at the end of the scope.
+ */
+class UseSolverSettingsHere
+{
+public:
+    /**
+     * Create a solver settings scope.
+     * @param pModel  the model
+     * @param rSettings  the settings to change; if none are set the model is left unchanged
+     */
+    UseSolverSettingsHere(boost::shared_ptr<AbstractSystemWithOutputs> pModel,
+                          const AbstractSystemWithOutputs::SolverSettings& rSettings)
+        : mpModel(rSettings.IsAnySet() ? pModel : boost::shared_ptr<AbstractSystemWithOutputs>())
+    {
+        if (mpModel)
+        {
+            mOldSettings = mpModel->GetSolverSettings();
+            mpModel->SetSolverSettings(rSettings);
+        }
+    }
+    /**
+     * Restore the previous settings, iff we changed them.
+     */
+    ~UseSolverSettingsHere()
+    {
+        if (mpModel)
+        {
+            mpModel->SetSolverSettings(mOldSettings);
+        }
+    }
+private:
+    /** The model whose settings we changed, if any. */
+    boost::shared_ptr<AbstractSystemWithOutputs> mpModel;
+    /** The model's previous settings. */
+    AbstractSystemWithOutputs::SolverSettings mOldSettings;
+};
+
+
 EnvironmentPtr AbstractSimulation::Run()
 {
     EnvironmentPtr p_results;
@@ -363,17 +522,22 @@ EnvironmentPtr AbstractSimulation::Run()
     // For normal models run independently on all processes, to avoid breaking save/reset state and set-variable dependencies.
     bool run_sim = !mParalleliseLoops;
     bool replicate_results = false;
+    bool can_parallelise = false;
     if (mParalleliseLoops)
     {
         ZeroInitialiseResults();
         // Note that CanParallelise() can have side effects, so must come first and happen once.
-        bool can_parallelise = CanParallelise();
+        can_parallelise = CanParallelise();
         run_sim = can_parallelise || PetscTools::AmMaster() || !mpModel->HasImplicitReset();
         replicate_results = can_parallelise || mpModel->HasImplicitReset();
     }
     try
     {
         IsolateHere isolater(mParalleliseLoops);
+        RequireOutputsHere restricter(mpModel, mRestrictOutputs ? &mRequiredOutputs : NULL);
+        AbstractSystemWithOutputs::SolverSettings solver_settings;
+        GetSolverSettings(solver_settings);
+        UseSolverSettingsHere solver_setter(mpModel, solver_settings);
         if (run_sim)
         {
             Run(p_results);
@@ -381,14 +545,19 @@ EnvironmentPtr AbstractSimulation::Run()
     }
     catch (const Exception& rE)
     {
+        AbandonParallelIterations();
         PetscTools::ReplicateException(true);
         // Shrink results to largest possible regular arrays with valid data.
         // For the first stepper that has been stepped, we take all the results from previous steps of that stepper.
         if (store_results)
         {
-            std::vector<NdArray<double>::Index> base_shape(mpSteppers->size());
+            // Only the loops indexing our results matter; as we're at the top level, these start with ours
+            unsigned first_loop, end_loop;
+            GetResultsLoops(first_loop, end_loop);
+            assert(first_loop == 0u);
+            std::vector<NdArray<double>::Index> base_shape(end_loop);
             bool found_progress = false;
-            for (unsigned i=0; i<mpSteppers->size(); i++)
+            for (unsigned i=0; i<end_loop; i++)
             {
                 AbstractStepperPtr p_stepper = (*mpSteppers)[i];
                 unsigned n = p_stepper->GetCurrentOutputNumber();
@@ -434,7 +603,13 @@ EnvironmentPtr AbstractSimulation::Run()
         // Replicate the results so each process has a full set
         if (p_results && replicate_results)
         {
-            ReplicateResults(p_results, GetLocationInfo());
+            // Only the master has results, unless we shared the work out
+            std::vector<int> owners(1u, 0);
+            if (can_parallelise)
+            {
+                GetResultsOwners(owners);
+            }
+            ReplicateResults(p_results, owners, GetLocationInfo());
         }
     }
     return mpResultsEnvironment;
@@ -483,7 +658,9 @@ void AbstractSimulation::AddIterationOutputs(EnvironmentPtr pResults,
 {
     if (pResults)
     {
-        const unsigned num_local_dims = rGetSteppers().size();
+        unsigned first_loop, end_loop;
+        GetResultsLoops(first_loop, end_loop);
+        const unsigned num_local_dims = end_loop - first_loop;
         if (pResults == pIterationOutputs)
         {
             // Special case for CombinedSimulation at the top level;
@@ -492,6 +669,11 @@ void AbstractSimulation::AddIterationOutputs(EnvironmentPtr pResults,
             return;
         }
         bool first_run = (pResults->GetNumberOfDefinitions() == 0u);
+        if (first_run)
+        {
+            // Threads may only fill in results arrays that already exist
+            ThreadPool::CheckThreadSafe();
+        }
 
         BOOST_FOREACH(const std::string& r_output_name, pIterationOutputs->GetDefinedNames())
         {
@@ -508,6 +690,7 @@ void AbstractSimulation::AddIterationOutputs(EnvironmentPtr pResults,
                 {
                     if (pResults->HasName(r_output_name, GetLocationInfo()))
                     {
+                        ThreadPool::CheckThreadSafe();
                         std::map<std::string, AbstractValuePtr> other_results;
                         BOOST_FOREACH(const std::string& r_name, pResults->GetDefinedNames())
                         {
@@ -539,7 +722,7 @@ void AbstractSimulation::AddIterationOutputs(EnvironmentPtr pResults,
                 NdArray<double>::Extents shape(num_local_dims + output_shape.size());
                 for (unsigned i=0; i<num_local_dims; i++)
                 {
-                    shape[i] = rGetSteppers()[i]->GetNumberOfOutputPoints();
+                    shape[i] = rGetSteppers()[first_loop + i]->GetNumberOfOutputPoints();
                 }
                 std::copy(output_shape.begin(), output_shape.end(), shape.begin() + num_local_dims);
                 NdArray<double> result(shape);
@@ -577,7 +760,7 @@ void AbstractSimulation::AddIterationOutputs(EnvironmentPtr pResults,
             NdArray<double>::Indices idxs = result_array.GetIndices();
             for (unsigned i=0; i<num_local_dims; i++)
             {
-                idxs[i] = rGetSteppers()[i]->GetCurrentOutputNumber();
+                idxs[i] = rGetSteppers()[first_loop + i]->GetCurrentOutputNumber();
             }
             NdArray<double>::Iterator result_it(idxs, result_array);
             std::copy(output_array.Begin(), output_array.End(), result_it);
@@ -591,6 +774,7 @@ void AbstractSimulation::AddIterationOutputs(EnvironmentPtr pResults,
             if (!p_sub_results)
             {
                 // Set up a new delegatee in the overall results for these sub-results
+                ThreadPool::CheckThreadSafe();
                 p_sub_results.reset(new Environment);
                 pResults->SetDelegateeEnvironment(p_sub_results, r_sub_prefix);
             }
@@ -602,6 +786,80 @@ void AbstractSimulation::AddIterationOutputs(EnvironmentPtr pResults,
 }
 
 
+bool AbstractSimulation::StartDirectRecording(EnvironmentPtr pResults)
+{
+    assert(pResults);
+    mDirectOutputs.clear();
+    const std::vector<std::string>& r_output_names = mpModel->rGetOutputNames();
+    unsigned num_required = 0u;
+    for (unsigned i=0; i<r_output_names.size(); i++)
+    {
+        num_required += mpModel->IsOutputRequired(i);
+    }
+    if (!mpStepper->IsEndFixed() || mpStepper != rGetSteppers().back()
+        || !pResults->rGetSubEnvironmentNames().empty()
+        || pResults->GetNumberOfDefinitions() != num_required
+        || !mpModel->GetOutputValues(mOutputValues))
+    {
+        return false;
+    }
+
+    // Find where the first iteration of this loop goes in each results array
+    unsigned first_loop, end_loop;
+    GetResultsLoops(first_loop, end_loop);
+    const unsigned num_local_dims = end_loop - first_loop;
+    unsigned num_values = 0u;
+    for (unsigned output_index=0; output_index<r_output_names.size(); output_index++)
+    {
+        if (!mpModel->IsOutputRequired(output_index))
+        {
+            continue;
+        }
+        const std::string& r_name = r_output_names[output_index];
+        if (!pResults->HasName(r_name, GetLocationInfo()))
+        {
+            mDirectOutputs.clear();
+            return false;
+        }
+        NdArray<double> array = GET_ARRAY(pResults->Lookup(r_name, GetLocationInfo()));
+        NdArray<double>::Indices idxs = array.GetIndices();
+        for (unsigned i=0; i<num_local_dims-1; i++)
+        {
+            idxs[i] = rGetSteppers()[first_loop + i]->GetCurrentOutputNumber();
+        }
+        NdArray<double>::Iterator first_it(idxs, array);
+        const NdArray<double>::Extents shape = array.GetShape();
+        unsigned output_size = 1u;
+        for (unsigned i=num_local_dims; i<shape.size(); i++)
+        {
+            output_size *= shape[i];
+        }
+        mDirectOutputs.push_back(std::make_pair(&(*first_it), output_size));
+        num_values += output_size;
+    }
+    if (num_values != mOutputValues.size())
+    {
+        mDirectOutputs.clear();
+        return false;
+    }
+    return true;
+}
+
+
+void AbstractSimulation::RecordOutputsDirectly()
+{
+    mpModel->GetOutputValues(mOutputValues);
+    const unsigned iteration = mpStepper->GetCurrentOutputNumber();
+    std::vector<double>::const_iterator value_it = mOutputValues.begin();
+    for (unsigned i=0; i<mDirectOutputs.size(); i++)
+    {
+        const unsigned output_size = mDirectOutputs[i].second;
+        std::copy(value_it, value_it + output_size, mDirectOutputs[i].first + iteration * output_size);
+        value_it += output_size;
+    }
+}
+
+
 void AbstractSimulation::ResizeOutputs()
 {
     assert(!GetOutputsPrefix().empty());
@@ -655,9 +913,131 @@ void AbstractSimulation::CreateResultViews()
 }
 
 
-void AbstractSimulation::SetParalleliseLoops(bool paralleliseLoops)
+void AbstractSimulation::SetParalleliseLoops(bool paralleliseLoops, bool balanceLoad)
 {
     mParalleliseLoops = paralleliseLoops;
+    mBalanceLoad = balanceLoad;
+}
+
+
+void AbstractSimulation::SetNativeLoops(bool nativeLoops)
+{
+    mNativeLoops = nativeLoops;
+}
+
+
+void AbstractSimulation::SetRequiredOutputs(const std::set<std::string>& rNames)
+{
+    mRestrictOutputs = true;
+    mRequiredOutputs = rNames;
+}
+
+
+void AbstractSimulation::SetAllOutputsRequired()
+{
+    mRestrictOutputs = false;
+    mRequiredOutputs.clear();
+}
+
+
+void AbstractSimulation::GetResultsLoops(unsigned& rFirst, unsigned& rEnd) const
+{
+    const std::vector<AbstractStepperPtr>& r_steppers = *mpSteppers;
+    rFirst = 0u;
+    rEnd = r_steppers.size();
+    for (unsigned i=0; i<r_steppers.size(); i++)
+    {
+        if (r_steppers[i] == mpReducingLoop)
+        {
+            rFirst = i + 1u;
+        }
+        if (r_steppers[i] == mpInnermostResultsLoop)
+        {
+            rEnd = i + 1u;
+        }
+    }
+}
+
+
+void AbstractSimulation::SetReducingLoop(AbstractStepperPtr pStepper)
+{
+    mpReducingLoop = pStepper;
+}
+
+
+void AbstractSimulation::SetSolverSetting(const std::string& rName, AbstractExpressionPtr pValue)
+{
+    PROTO_ASSERT(rName == "relTol" || rName == "absTol" || rName == "maxStep" || rName == "maxSteps"
+                 || rName == "analyticJacobian" || rName == "krylovLinearSolver",
+                 "Unknown solver setting " << rName << "; must be one of relTol, absTol, maxStep, maxSteps,"
+                 " analyticJacobian or krylovLinearSolver.");
+    mSolverSettings[rName] = pValue;
+}
+
+
+bool AbstractSimulation::HasSolverSetting(const std::string& rName) const
+{
+    return mSolverSettings.find(rName) != mSolverSettings.end();
+}
+
+
+void AbstractSimulation::GetSolverSettings(AbstractSystemWithOutputs::SolverSettings& rSettings)
+{
+    typedef std::pair<std::string, AbstractExpressionPtr> StringExprPair;
+    BOOST_FOREACH(const StringExprPair& r_setting, mSolverSettings)
+    {
+        AbstractValuePtr p_value = (*r_setting.second)(*mpEnvironment);
+        PROTO_ASSERT(p_value->IsDouble(), "The solver setting " << r_setting.first << " must be a real number.");
+        const double value = GET_SIMPLE_VALUE(p_value);
+        if (r_setting.first == "analyticJacobian" || r_setting.first == "krylovLinearSolver")
+        {
+            PROTO_ASSERT(value == 0.0 || value == 1.0,
+                         "The solver setting " << r_setting.first << " must be 0 or 1, not " << value << ".");
+        }
+        else
+        {
+            PROTO_ASSERT(value > 0.0, "The solver setting " << r_setting.first << " must be positive, not " << value << ".");
+        }
+        if (r_setting.first == "relTol")
+        {
+            rSettings.relTol = value;
+        }
+        else if (r_setting.first == "absTol")
+        {
+            rSettings.absTol = value;
+        }
+        else if (r_setting.first == "maxStep")
+        {
+            rSettings.maxStep = value;
+        }
+        else if (r_setting.first == "maxSteps")
+        {
+            rSettings.maxSteps = value;
+        }
+        else if (r_setting.first == "analyticJacobian")
+        {
+            rSettings.analyticJacobian = value;
+        }
+        else
+        {
+            rSettings.krylovLinearSolver = value;
+        }
+    }
+}
+
+
+void AbstractSimulation::CollectExpressions(std::vector<AbstractExpressionPtr>& rExpressions) const
+{
+    if (mpStepper)
+    {
+        mpStepper->CollectExpressions(rExpressions);
+    }
+    mpModifiers->CollectExpressions(rExpressions);
+    typedef std::pair<std::string, AbstractExpressionPtr> StringExprPair;
+    BOOST_FOREACH(const StringExprPair& r_setting, mSolverSettings)
+    {
+        rExpressions.push_back(r_setting.second);
+    }
 }
 
 
@@ -667,6 +1047,17 @@ bool AbstractSimulation::CanParallelise()
 }
 
 
+void AbstractSimulation::AbandonParallelIterations()
+{
+}
+
+
+void AbstractSimulation::GetResultsOwners(std::vector<int>& rOwners)
+{
+    rOwners.clear();
+}
+
+
 void AbstractSimulation::ZeroInitialiseResults()
 {
     mZeroInitialiseArrays = true;
@@ -677,3 +1068,34 @@ void AbstractSimulation::SetIndent(std::string indent)
 {
     mIndent = indent;
 }
+
+
+void AbstractSimulation::SetNumThreads(unsigned numThreads)
+{
+}
+
+
+void AbstractSimulation::SetEnsembleSize(unsigned ensembleSize)
+{
+}
+
+
+AbstractSimulationPtr AbstractSimulation::Clone() const
+{
+    return AbstractSimulationPtr();
+}
+
+
+void AbstractSimulation::CopySettingsTo(AbstractSimulation& rCopy) const
+{
+    rCopy.SetLocationInfo(GetLocationInfo());
+    rCopy.mNativeLoops = mNativeLoops;
+    rCopy.mZeroInitialiseArrays = mZeroInitialiseArrays;
+    rCopy.mIndent = mIndent;
+    rCopy.mpReducingLoop = mpReducingLoop;
+    rCopy.mOutputsPrefix = mOutputsPrefix;
+    rCopy.mModelOutputShapes = mModelOutputShapes;
+    rCopy.mRestrictOutputs = mRestrictOutputs;
+    rCopy.mRequiredOutputs = mRequiredOutputs;
+    rCopy.mSolverSettings = mSolverSettings;
+}
@@ -39,6 +39,7 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
 #include <boost/shared_ptr.hpp>
 #include <boost/utility.hpp>
 
@@ -169,12 +170,77 @@ public:
      * Set whether to use automatic parallelisation of nested loops.
      *
      * @param paralleliseLoops  whether to parallelise loops whenever safe
+     * @param balanceLoad  whether to hand out the iterations of parallelised loops to processes as
+     *     they become free, rather than in a fixed pattern (see NestedSimulation::CanParallelise)
      */
-    void SetParalleliseLoops(bool paralleliseLoops);
+    void SetParalleliseLoops(bool paralleliseLoops, bool balanceLoad=false);
 
     /**
-     * Ensure that all results arrays are initialised with zeros so that they can easily be replicated
-     * by doing a global sum.
+     * Set whether to use specialised simulation loops where possible.  These avoid the per-step
+     * overheads of the general loop, in particular by writing model outputs straight into the
+     * results arrays rather than collecting them in an Environment at each step.  Results are
+     * identical either way.
+     *
+     * @param nativeLoops  whether to use the specialised loops when the simulation allows
+     */
+    virtual void SetNativeLoops(bool nativeLoops);
+
+    /**
+     * Record only the named model outputs in this simulation's results, so the model need not
+     * compute the others (see AbstractSystemWithOutputs::SetRequiredOutputs).  The restriction is
+     * applied to the model only while this simulation runs.
+     *
+     * @param rNames  the names of the model outputs needed from this simulation
+     */
+    void SetRequiredOutputs(const std::set<std::string>& rNames);
+
+    /**
+     * Record all model outputs in this simulation's results, as is the default.
+     */
+    void SetAllOutputsRequired();
+
+    /**
+     * Set a solver setting to use while this simulation runs, overriding that of the model and of
+     * any simulation enclosing this one (see AbstractSystemWithOutputs::SetSolverSettings).  The
+     * value is evaluated in this simulation's environment when it starts to run, and the model's
+     * previous setting is restored afterwards.
+     *
+     * @param rName  the setting: one of relTol, absTol, maxStep, maxSteps, analyticJacobian or krylovLinearSolver
+     * @param pValue  expression giving the setting's value, which must be positive, or 0 or 1 for the
+     *     last two, which choose how the solver's linear systems are formed and solved
+     */
+    void SetSolverSetting(const std::string& rName, AbstractExpressionPtr pValue);
+
+    /**
+     * @return  whether this simulation, or any simulation within it, has been given the named solver setting
+     *
+     * @param rName  the setting
+     */
+    virtual bool HasSolverSetting(const std::string& rName) const;
+
+    /**
+     * Get the protocol language expressions evaluated by this simulation's stepper and modifiers,
+     * and by any simulations within it, so callers can determine which names it may reference.
+     *
+     * @param rExpressions  the expressions will be appended to this vector
+     */
+    virtual void CollectExpressions(std::vector<AbstractExpressionPtr>& rExpressions) const;
+
+    /**
+     * Get the range of loops, within rGetSteppers, whose iterations index the leading dimensions of
+     * the results this simulation records.  This is all of them, unless a NestedSimulation reduces
+     * the results of each iteration of its loop (see NestedSimulation::SetReductions), in which case
+     * simulations within it exclude that loop and those enclosing it, while it excludes the loops
+     * within it.
+     *
+     * @param rFirst  set to the index of the outermost loop indexing our results
+     * @param rEnd  set to one past the index of the innermost loop indexing our results
+     */
+    void GetResultsLoops(unsigned& rFirst, unsigned& rEnd) const;
+
+    /**
+     * Ensure that all results arrays are initialised with zeros, so that they can still be replicated
+     * by doing a global sum if it isn't known which process holds each part (see GetResultsOwners).
      */
     virtual void ZeroInitialiseResults();
 
@@ -184,6 +250,35 @@ public:
      */
     virtual void SetIndent(std::string indent);
 
+    /**
+     * Set how many threads may share the iterations of a nested simulation loop, where these are
+     * provably independent (see NestedSimulation::SetNumThreads).  The default implementation does
+     * nothing, since only nested simulations have such loops.
+     *
+     * @param numThreads  the number of threads; 0 or 1 means run sequentially
+     */
+    virtual void SetNumThreads(unsigned numThreads);
+
+    /**
+     * Set how many iterations of a nested simulation loop may be run together in lock-step, where
+     * these are provably independent (see NestedSimulation::SetEnsembleSize).  The default
+     * implementation does nothing, since only nested simulations have such loops.
+     *
+     * @param ensembleSize  the number of iterations to run together; 0 or 1 means run each in turn
+     */
+    virtual void SetEnsembleSize(unsigned ensembleSize);
+
+    /**
+     * Create a copy of this simulation, and of any simulation nested within it, so that some iterations
+     * of an enclosing loop can be run alongside others.  The copy has its own steppers and environments,
+     * but shares our modifiers and expressions, which don't change as they are used.  It must be given
+     * its own model with SetModel, and its environment has no default delegatee.
+     * The default implementation returns an empty pointer.
+     *
+     * @return  the copy, or an empty pointer if this simulation can't be copied
+     */
+    virtual AbstractSimulationPtr Clone() const;
+
 protected:
     /**
      * Run a simulation, filling in the results if requested.
@@ -227,6 +322,24 @@ protected:
     void AddIterationOutputs(EnvironmentPtr pResults, EnvironmentCPtr pIterationOutputs,
                              std::string outputNamePrefix="");
 
+    /**
+     * Try to set up direct recording of model outputs by RecordOutputsDirectly, as an alternative to
+     * calling AddIterationOutputs at each step of this simulation's loop.  This is only possible if
+     * this is the innermost loop, its results arrays have been created by a previous call to
+     * AddIterationOutputs, and the model supports AbstractSystemWithOutputs::GetOutputValues.
+     * The set up lasts until the loop is next reset.
+     *
+     * @param pResults  the environment in which to record the whole simulation's results
+     * @return  whether direct recording may be used
+     */
+    bool StartDirectRecording(EnvironmentPtr pResults);
+
+    /**
+     * Record the model outputs for the current iteration of this simulation's loop straight into
+     * the results arrays.  StartDirectRecording must have succeeded since the loop was reset.
+     */
+    void RecordOutputsDirectly();
+
     /**
      * If this simulation is controlled by a while loop, then we might need to resize the
      * output arrays whenever they exceed the current allocation, and shrink them to the
@@ -253,6 +366,49 @@ protected:
      */
     virtual bool CanParallelise();
 
+    /**
+     * Called on a process that is abandoning this simulation because of an error, so that it stops
+     * taking part in handing out the iterations of a parallelised loop, if it was.  Does nothing unless
+     * overridden in a subclass.
+     */
+    virtual void AbandonParallelIterations();
+
+    /**
+     * Once this simulation has run in parallel, find which process holds the results of each iteration
+     * of the loops it shared out, so that only those are sent to the others.  Must be called on all
+     * processes.  Leaves the owners empty unless overridden in a subclass, meaning that they are not known
+     * and so the results of all processes must be summed.
+     *
+     * @param rOwners  filled in with the rank holding each iteration's results, numbered as in
+     *     NestedSimulation::CanParallelise, or -1 if no process ran it
+     */
+    virtual void GetResultsOwners(std::vector<int>& rOwners);
+
+    /**
+     * Evaluate the solver settings given for this simulation, and any simulation nested within it,
+     * overriding those already set.
+     *
+     * @param rSettings  the settings to fill in
+     */
+    virtual void GetSolverSettings(AbstractSystemWithOutputs::SolverSettings& rSettings);
+
+    /**
+     * Note that an enclosing NestedSimulation reduces the results of each iteration of its loop, so
+     * that loop and those enclosing it do not index the results we record.
+     *
+     * @param pStepper  the stepper for the reducing simulation's loop
+     */
+    virtual void SetReducingLoop(AbstractStepperPtr pStepper);
+
+    /**
+     * For use by Clone: give a copy of this simulation the settings all kinds of simulation have, and
+     * the shapes of the model outputs recorded so far.  Loop parallelisation is not copied, since copies
+     * are only run within a loop that is already parallelised.
+     *
+     * @param rCopy  the copy
+     */
+    void CopySettingsTo(AbstractSimulation& rCopy) const;
+
     /**
      * The model the protocol is being run on.
      */
@@ -287,12 +443,24 @@ protected:
     /** Whether to use automatic parallelisation of nested loops. */
     bool mParalleliseLoops;
 
+    /** Whether parallelised loops hand out iterations to processes as they become free. */
+    bool mBalanceLoad;
+
+    /** Whether to use specialised simulation loops where possible. */
+    bool mNativeLoops;
+
     /** Whether to fill result arrays with zero when they're created. */
     bool mZeroInitialiseArrays;
 
     /** The indentation string to use for status/error lines written to cout/cerr. */
     std::string mIndent;
 
+    /** The loop of the innermost enclosing simulation that reduces each iteration's results, if any. */
+    AbstractStepperPtr mpReducingLoop;
+
+    /** If set, the innermost loop indexing our results, when we reduce the results of the loops within it. */
+    AbstractStepperPtr mpInnermostResultsLoop;
+
 private:
     /** The namespace prefix to use for outputs from this simulation. */
     std::string mOutputsPrefix;
@@ -303,6 +471,24 @@ private:
     /** The shapes of the model outputs on the first iteration. */
     std::map<std::string, NdArray<double>::Extents> mModelOutputShapes;
 
+    /** Whether to record only the model outputs named in #mRequiredOutputs. */
+    bool mRestrictOutputs;
+
+    /** The model outputs to record, if #mRestrictOutputs is set. */
+    std::set<std::string> mRequiredOutputs;
+
+    /** Expressions giving the solver settings to use while this simulation runs, by setting name. */
+    std::map<std::string, AbstractExpressionPtr> mSolverSettings;
+
+    /** Working memory for the model output values when recording directly. */
+    std::vector<double> mOutputValues;
+
+    /**
+     * When recording directly, where in the results arrays the outputs for the first iteration of this
+     * loop go, and how many values each output has.  Outputs are in the order given by the model.
+     */
+    std::vector<std::pair<double*, unsigned> > mDirectOutputs;
+
     /** Allow NestedSimulation to call Run(EnvironmentPtr) */
     friend class NestedSimulation;
 };
@@ -115,3 +115,34 @@ void CombinedSimulation::ZeroInitialiseResults()
         p_child_sim->ZeroInitialiseResults();
     }
 }
+
+
+void CombinedSimulation::SetNativeLoops(bool nativeLoops)
+{
+    AbstractSimulation::SetNativeLoops(nativeLoops);
+    BOOST_FOREACH(AbstractSimulationPtr p_child_sim, mChildSims)
+    {
+        p_child_sim->SetNativeLoops(nativeLoops);
+    }
+}
+
+
+void CombinedSimulation::CollectExpressions(std::vector<AbstractExpressionPtr>& rExpressions) const
+{
+    AbstractSimulation::CollectExpressions(rExpressions);
+    BOOST_FOREACH(AbstractSimulationPtr p_child_sim, mChildSims)
+    {
+        p_child_sim->CollectExpressions(rExpressions);
+    }
+}
+
+
+bool CombinedSimulation::HasSolverSetting(const std::string& rName) const
+{
+    bool has_setting = AbstractSimulation::HasSolverSetting(rName);
+    BOOST_FOREACH(AbstractSimulationPtr p_child_sim, mChildSims)
+    {
+        has_setting = has_setting || p_child_sim->HasSolverSetting(rName);
+    }
+    return has_setting;
+}
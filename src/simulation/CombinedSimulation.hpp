@@ -85,6 +85,28 @@ public:
      */
     virtual void ZeroInitialiseResults();
 
+    /**
+     * Set whether to use specialised simulation loops where possible, for this simulation and
+     * its children.
+     *
+     * @param nativeLoops  whether to use the specialised loops when the simulation allows
+     */
+    void SetNativeLoops(bool nativeLoops);
+
+    /**
+     * Get the protocol language expressions evaluated by this simulation and its children.
+     *
+     * @param rExpressions  the expressions will be appended to this vector
+     */
+    void CollectExpressions(std::vector<AbstractExpressionPtr>& rExpressions) const;
+
+    /**
+     * @return  whether this simulation or any of its children has been given the named solver setting
+     *
+     * @param rName  the setting
+     */
+    bool HasSolverSetting(const std::string& rName) const;
+
 protected:
     /**
      * Run a simulation, filling in the results if requested.
@@ -60,6 +60,30 @@ void NestedProtocol::SetModel(boost::shared_ptr<AbstractSystemWithOutputs> pMode
 }
 
 
+void NestedProtocol::SetNativeLoops(bool nativeLoops)
+{
+    AbstractSimulation::SetNativeLoops(nativeLoops);
+    mpProtocol->SetNativeSimulationLoops(nativeLoops);
+}
+
+
+void NestedProtocol::CollectExpressions(std::vector<AbstractExpressionPtr>& rExpressions) const
+{
+    AbstractSimulation::CollectExpressions(rExpressions);
+    typedef std::pair<const std::string, AbstractExpressionPtr> StringExprPair;
+    BOOST_FOREACH(const StringExprPair& r_input, mInputSpecifications)
+    {
+        rExpressions.push_back(r_input.second);
+    }
+}
+
+
+bool NestedProtocol::HasSolverSetting(const std::string& rName) const
+{
+    return AbstractSimulation::HasSolverSetting(rName) || mpProtocol->HasSolverSetting(rName);
+}
+
+
 void NestedProtocol::Run(EnvironmentPtr pResults)
 {
     mpProtocol->SetIndent(mIndent);
@@ -74,6 +74,28 @@ public:
      */
     void SetModel(boost::shared_ptr<AbstractSystemWithOutputs> pModel);
 
+    /**
+     * Set whether to use specialised simulation loops where possible, for this simulation and
+     * the simulations within the nested protocol.
+     *
+     * @param nativeLoops  whether to use the specialised loops when the simulation allows
+     */
+    void SetNativeLoops(bool nativeLoops);
+
+    /**
+     * Get the protocol language expressions evaluated by this simulation, including those setting the nested protocol's inputs.
+     *
+     * @param rExpressions  the expressions will be appended to this vector
+     */
+    void CollectExpressions(std::vector<AbstractExpressionPtr>& rExpressions) const;
+
+    /**
+     * @return  whether this simulation or any simulation in the nested protocol has been given the named solver setting
+     *
+     * @param rName  the setting
+     */
+    bool HasSolverSetting(const std::string& rName) const;
+
 protected:
     /**
      * Run a simulation, filling in the results if requested.
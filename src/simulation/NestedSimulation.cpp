@@ -35,20 +35,165 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "NestedSimulation.hpp"
 
+#include <algorithm>
+#include <cassert>
 #include <boost/foreach.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/thread/mutex.hpp>
 #include <iostream>
 #include <sstream>
 #include "PetscTools.hpp"
 #include "NullDeleter.hpp"
 #include "BacktraceException.hpp"
 #include "ProtoHelperMacros.hpp"
+#include "ThreadPool.hpp"
+#include "TimecourseSimulation.hpp"
+
+/** MPI tag for messages asking the master for an iteration to run. */
+const int ITERATION_REQUEST_TAG = 2341;
+
+/** MPI tag for the master's replies, giving an iteration to run. */
+const int ITERATION_REPLY_TAG = 2342;
+
+/** Sent in place of the last iteration run, to tell the master not to hand out any more. */
+const double STOP_REQUEST = -2.0;
+
+/**
+ * Orders iterations by their cost, most costly first, except that those whose cost isn't known
+ * yet (a negative value) come before all others.
+ */
+class CostlierIteration
+{
+public:
+    /**
+     * Constructor.
+     * @param rCosts  the cost of each iteration
+     */
+    CostlierIteration(const std::vector<double>& rCosts)
+        : mrCosts(rCosts)
+    {}
+
+    /**
+     * @return  whether iteration a should be handed out before iteration b.
+     * @param a  an iteration
+     * @param b  another iteration
+     */
+    bool operator()(unsigned a, unsigned b) const
+    {
+        if (mrCosts[a] < 0.0 || mrCosts[b] < 0.0)
+        {
+            return mrCosts[a] < 0.0 && mrCosts[b] >= 0.0;
+        }
+        return mrCosts[a] > mrCosts[b];
+    }
+
+private:
+    /** The cost of each iteration. */
+    const std::vector<double>& mrCosts;
+};
+
+/**
+ * Runs iterations of a nested simulation's loop on the ThreadPool.  Each thread takes a copy of the
+ * simulation for the iterations it runs from a shared collection, and returns it when done, so no two
+ * threads use the same copy at once.
+ */
+class NestedIterationsLoop : public AbstractParallelLoop
+{
+public:
+    /**
+     * Constructor.
+     *
+     * @param rCopies  a copy of the simulation for each thread
+     * @param rIterations  the iterations of its loop to run
+     * @param pResults  the environment in which to record the simulation's results
+     */
+    NestedIterationsLoop(const std::vector<boost::shared_ptr<NestedSimulation> >& rCopies,
+                         const std::vector<unsigned>& rIterations,
+                         EnvironmentPtr pResults)
+        : mFreeCopies(rCopies),
+          mrIterations(rIterations),
+          mpResults(pResults)
+    {}
+
+    /**
+     * Run some of the iterations on one of the copies.
+     *
+     * @param start  the first iteration to run
+     * @param end  one past the last iteration to run
+     */
+    void RunIterations(unsigned start, unsigned end)
+    {
+        boost::shared_ptr<NestedSimulation> p_copy = TakeCopy();
+        try
+        {
+            AbstractStepperPtr p_stepper = p_copy->mpStepper;
+            for (unsigned i=start; i<end; ++i)
+            {
+                if (p_stepper->GetCurrentOutputNumber() > mrIterations[i])
+                {
+                    p_stepper->Reset();
+                }
+                while (p_stepper->GetCurrentOutputNumber() < mrIterations[i])
+                {
+                    p_stepper->Step();
+                }
+                p_copy->RunIteration(mpResults, mpResults);
+            }
+        }
+        catch (...)
+        {
+            ReturnCopy(p_copy);
+            throw;
+        }
+        ReturnCopy(p_copy);
+    }
+
+private:
+    /** @return  a copy of the simulation that no other thread is using. */
+    boost::shared_ptr<NestedSimulation> TakeCopy()
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        assert(!mFreeCopies.empty());
+        boost::shared_ptr<NestedSimulation> p_copy = mFreeCopies.back();
+        mFreeCopies.pop_back();
+        return p_copy;
+    }
+
+    /**
+     * Make a copy of the simulation available to other threads again.
+     *
+     * @param pCopy  the copy
+     */
+    void ReturnCopy(boost::shared_ptr<NestedSimulation> pCopy)
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        mFreeCopies.push_back(pCopy);
+    }
+
+    /** The copies of the simulation not currently in use. */
+    std::vector<boost::shared_ptr<NestedSimulation> > mFreeCopies;
+    /** Protects #mFreeCopies. */
+    boost::mutex mMutex;
+    /** The iterations to run. */
+    const std::vector<unsigned>& mrIterations;
+    /** The environment in which to record the simulation's results. */
+    EnvironmentPtr mpResults;
+};
+
 
 NestedSimulation::NestedSimulation(AbstractSimulationPtr pNestedSimulation,
                                    AbstractStepperPtr pStepper,
                                    boost::shared_ptr<ModifierCollection> pModifiers)
     : AbstractSimulation(pNestedSimulation->GetModel(), pStepper, pModifiers, pNestedSimulation->GetSteppers()),
-      mpNestedSimulation(pNestedSimulation)
+      mpNestedSimulation(pNestedSimulation),
+      mDynamicIterations(false),
+      mNextTask(-1),
+      mLastTask(-1),
+      mLastTaskTime(0.0),
+      mTasksDone(false),
+      mNumWorkersLeft(0u),
+      mNumThreads(1u),
+      mEnsembleSize(1u)
 {
     mpNestedSimulation->rGetEnvironment().SetDelegateeEnvironment(mpEnvironment->GetAsDelegatee());
 }
@@ -56,40 +201,536 @@ NestedSimulation::NestedSimulation(AbstractSimulationPtr pNestedSimulation,
 
 void NestedSimulation::Run(EnvironmentPtr pResults)
 {
+    // If we reduce each iteration's results, the nested simulation records into scratch arrays that are reused
+    EnvironmentPtr p_nested_results = pResults;
+    if (pResults && !mReductions.empty())
+    {
+        p_nested_results.reset(new Environment(mpEnvironment->GetAsDelegatee()));
+    }
+    if (mDynamicIterations)
+    {
+        RunDynamicIterations(pResults, p_nested_results);
+        LoopEndHook();
+        return;
+    }
+    bool first_iteration = true;
+    std::set<unsigned> iterations_run_already;
     for (mpStepper->Reset(); !mpStepper->AtEnd(); mpStepper->Step())
     {
-        if (!mParallelMultipliers.empty())
+        const unsigned iteration = mpStepper->GetCurrentOutputNumber();
+        if (!IsMyIteration(iteration))
+        {
+            continue; // Someone else will do it
+        }
+        if (iterations_run_already.find(iteration) != iterations_run_already.end())
+        {
+            continue; // Already done
+        }
+        RunIteration(pResults, p_nested_results);
+        if (first_iteration && mNumThreads > 1u)
+        {
+            // The results arrays now exist, so threads can fill in the rest
+            RunIterationsOnThreads(pResults, iterations_run_already);
+        }
+        else if (first_iteration && mEnsembleSize > 1u)
+        {
+            // Likewise for ensembles
+            RunIterationsInLockStep(pResults, iterations_run_already);
+        }
+        first_iteration = false;
+    }
+    LoopEndHook();
+}
+
+
+bool NestedSimulation::IsMyIteration(unsigned outputNumber)
+{
+    return mParallelMultipliers.empty()
+           || GetIterationCount(outputNumber) % PetscTools::GetNumProcs() == PetscTools::GetMyRank();
+}
+
+
+unsigned NestedSimulation::GetIterationCount(unsigned outputNumber)
+{
+    // Our loop is the innermost one counted
+    assert(rGetSteppers()[mParallelMultipliers.size()-1] == mpStepper);
+    unsigned iteration_count = mParallelMultipliers.back() * outputNumber;
+    for (unsigned i=0; i<mParallelMultipliers.size()-1; ++i)
+    {
+        iteration_count += mParallelMultipliers[i] * rGetSteppers()[i]->GetCurrentOutputNumber();
+    }
+    return iteration_count;
+}
+
+
+void NestedSimulation::RunDynamicIterations(EnvironmentPtr pResults, EnvironmentPtr pNestedResults)
+{
+    const unsigned num_points = mpStepper->GetNumberOfOutputPoints();
+    const unsigned this_run = GetIterationCount(0u) / num_points;
+    if (this_run == 0u)
+    {
+        mIterationOwners.assign(mParallelMultipliers.front() * rGetSteppers().front()->GetNumberOfOutputPoints(), -1);
+    }
+    // Process isolation makes PetscTools::AmMaster true everywhere, so check the rank directly
+    if (PetscTools::GetMyRank() == 0u)
+    {
+        if (this_run == 0u)
         {
-            // Figure out if we should do this iteration
-            unsigned iteration_count = 0u;
-            for (unsigned i=0; i<mParallelMultipliers.size(); ++i)
+            HandOutIterations();
+        }
+        return;
+    }
+    // If an iteration fails, AbandonParallelIterations lets the master know
+    while (!mTasksDone)
+    {
+        if (mNextTask < 0)
+        {
+            RequestIteration();
+            if (mTasksDone)
             {
-                iteration_count += mParallelMultipliers[i] * rGetSteppers()[i]->GetCurrentOutputNumber();
+                break;
             }
-            if (iteration_count % PetscTools::GetNumProcs() != PetscTools::GetMyRank())
+        }
+        if ((unsigned)mNextTask / num_points > this_run)
+        {
+            break; // Keep it until its run starts
+        }
+        assert((unsigned)mNextTask / num_points == this_run);
+        const unsigned iteration = mNextTask % num_points;
+        if (mpStepper->GetCurrentOutputNumber() > iteration)
+        {
+            mpStepper->Reset();
+        }
+        while (mpStepper->GetCurrentOutputNumber() < iteration)
+        {
+            mpStepper->Step();
+        }
+        const double start_time = MPI_Wtime();
+        RunIteration(pResults, pNestedResults);
+        mLastTaskTime = MPI_Wtime() - start_time;
+        mIterationOwners[mNextTask] = PetscTools::GetMyRank();
+        mLastTask = mNextTask;
+        mNextTask = -1;
+    }
+}
+
+
+void NestedSimulation::HandOutIterations(bool abandon)
+{
+    const unsigned num_points = mpStepper->GetNumberOfOutputPoints();
+    const unsigned num_runs = mParallelMultipliers.front() * rGetSteppers().front()->GetNumberOfOutputPoints() / num_points;
+    if (mIterationCosts.size() != num_points)
+    {
+        mIterationCosts.assign(num_points, -1.0);
+    }
+    unsigned num_runs_started = 0u;
+    std::vector<unsigned> order; // The order in which to hand out the latest run's iterations
+    unsigned next = 0u;
+    while (mNumWorkersLeft > 0u)
+    {
+        double request[2];
+        MPI_Status status;
+        MPI_Recv(request, 2, MPI_DOUBLE, MPI_ANY_SOURCE, ITERATION_REQUEST_TAG, PETSC_COMM_WORLD, &status);
+        if (request[0] >= 0.0)
+        {
+            mIterationCosts[(unsigned)request[0] % num_points] = request[1];
+        }
+        if (next == order.size() && num_runs_started < num_runs && !abandon)
+        {
+            // Order the next run's iterations using the costs known so far
+            order.resize(num_points);
+            for (unsigned i=0; i<num_points; ++i)
             {
-                continue; // Someone else will do it
+                order[i] = i;
             }
+            std::stable_sort(order.begin(), order.end(), CostlierIteration(mIterationCosts));
+            next = 0u;
+            ++num_runs_started;
+        }
+        int task = -1;
+        if (request[0] != STOP_REQUEST && next < order.size())
+        {
+            task = (num_runs_started - 1u) * num_points + order[next++];
+        }
+        else
+        {
+            --mNumWorkersLeft;
         }
+        MPI_Send(&task, 1, MPI_INT, status.MPI_SOURCE, ITERATION_REPLY_TAG, PETSC_COMM_WORLD);
+    }
+}
+
+
+void NestedSimulation::RequestIteration(bool stop)
+{
+    if (!mTasksDone)
+    {
+        double request[2] = {stop ? STOP_REQUEST : (double)mLastTask, mLastTaskTime};
+        MPI_Send(request, 2, MPI_DOUBLE, 0, ITERATION_REQUEST_TAG, PETSC_COMM_WORLD);
+        MPI_Status status;
+        MPI_Recv(&mNextTask, 1, MPI_INT, 0, ITERATION_REPLY_TAG, PETSC_COMM_WORLD, &status);
+        mTasksDone = (mNextTask < 0);
+        mLastTask = -1;
+    }
+}
+
+
+void NestedSimulation::AbandonParallelIterations()
+{
+    boost::shared_ptr<NestedSimulation> p_sim(this, NullDeleter());
+    while (p_sim)
+    {
+        if (p_sim->mDynamicIterations)
+        {
+            if (PetscTools::GetMyRank() == 0u)
+            {
+                // Other processes may be waiting for iterations we would have handed out
+                p_sim->HandOutIterations(true);
+            }
+            else
+            {
+                p_sim->RequestIteration(true);
+            }
+        }
+        p_sim = boost::dynamic_pointer_cast<NestedSimulation>(p_sim->mpNestedSimulation);
+    }
+}
+
+
+void NestedSimulation::GetResultsOwners(std::vector<int>& rOwners)
+{
+    rOwners.clear();
+    boost::shared_ptr<NestedSimulation> p_sim(this, NullDeleter());
+    while (p_sim && p_sim->mParallelMultipliers.empty())
+    {
+        if (!p_sim->mReductions.empty())
+        {
+            return; // Processes' results are combined above the shared loop
+        }
+        p_sim = boost::dynamic_pointer_cast<NestedSimulation>(p_sim->mpNestedSimulation);
+    }
+    assert(p_sim);
+    const unsigned num_iterations = p_sim->mParallelMultipliers.front() * rGetSteppers().front()->GetNumberOfOutputPoints();
+    if (p_sim->mDynamicIterations)
+    {
+        // Only the process that ran each iteration knows about it
+        assert(p_sim->mIterationOwners.size() == num_iterations);
+        rOwners.resize(num_iterations);
+        int mpi_ret = MPI_Allreduce(&p_sim->mIterationOwners[0], &rOwners[0], num_iterations, MPI_INT, MPI_MAX, PETSC_COMM_WORLD);
+        assert(mpi_ret == MPI_SUCCESS);
+        UNUSED_OPT(mpi_ret);
+    }
+    else
+    {
+        // Iterations are shared out in a fixed pattern, as in IsMyIteration
+        rOwners.resize(num_iterations);
+        for (unsigned i=0; i<num_iterations; ++i)
+        {
+            rOwners[i] = i % PetscTools::GetNumProcs();
+        }
+    }
+}
+
+
+void NestedSimulation::RunIteration(EnvironmentPtr pResults, EnvironmentPtr pNestedResults)
+{
+    {
+        // Other threads may be writing their status lines too
+        boost::mutex::scoped_lock chaste_lock(ThreadPool::rGetChasteMutex());
         std::cout << mIndent << "Nested simulation " << mpStepper->GetIndexName() << " step "
                   << mpStepper->GetCurrentOutputNumber() << " (value " << mpStepper->GetCurrentOutputPoint()
                   << ") on process " << PetscTools::GetMyRank() << "..." << std::endl;
-        if (GetTrace() && mpOutputHandler)
+    }
+    if (GetTrace() && mpOutputHandler)
+    {
+        // Creating the folder may involve all processes
+        ThreadPool::CheckThreadSafe();
+        // Set a run-specific subfolder for the nested simulation to save debug results in
+        std::stringstream run_dir;
+        run_dir << "run_" << mpStepper->GetCurrentOutputNumber();
+        boost::shared_ptr<OutputFileHandler> p_this_run = boost::make_shared<OutputFileHandler>(mpOutputHandler->FindFile(run_dir.str()), false);
+        mpNestedSimulation->SetOutputFolder(p_this_run);
+        // Get it to trace too, for saner semantics
+        mpNestedSimulation->SetTrace();
+    }
+    LoopBodyStartHook();
+    // Run the nested simulation, which will add any outputs produced
+    mpNestedSimulation->Run(pNestedResults);
+    if (pNestedResults != pResults)
+    {
+        ReduceIterationResults(pResults, pNestedResults);
+    }
+    LoopBodyEndHook();
+}
+
+
+void NestedSimulation::RunIterationsOnThreads(EnvironmentPtr pResults, std::set<unsigned>& rIterationsRun)
+{
+    if (!mReductions.empty() || !mpStepper->IsEndFixed() || ThreadPool::InParallelRegion()
+        || (GetTrace() && mpOutputHandler) || SavesModelStates())
+    {
+        return;
+    }
+    // The last iteration is left to run as usual, so the model ends in the same state
+    std::vector<unsigned> iterations;
+    for (unsigned i=mpStepper->GetCurrentOutputNumber()+1; i<mpStepper->GetNumberOfOutputPoints(); ++i)
+    {
+        if (IsMyIteration(i))
         {
-            // Set a run-specific subfolder for the nested simulation to save debug results in
-            std::stringstream run_dir;
-            run_dir << "run_" << mpStepper->GetCurrentOutputNumber();
-            boost::shared_ptr<OutputFileHandler> p_this_run = boost::make_shared<OutputFileHandler>(mpOutputHandler->FindFile(run_dir.str()), false);
-            mpNestedSimulation->SetOutputFolder(p_this_run);
-            // Get it to trace too, for saner semantics
-            mpNestedSimulation->SetTrace();
+            iterations.push_back(i);
         }
-        LoopBodyStartHook();
-        // Run the nested simulation, which will add any outputs produced
-        mpNestedSimulation->Run(pResults);
-        LoopBodyEndHook();
     }
-    LoopEndHook();
+    if (iterations.size() < 3u)
+    {
+        return;
+    }
+    iterations.pop_back();
+    const unsigned num_threads = std::min(mNumThreads, (unsigned)iterations.size());
+    std::vector<boost::shared_ptr<NestedSimulation> > copies;
+    try
+    {
+        for (unsigned i=0; i<num_threads; ++i)
+        {
+            boost::shared_ptr<NestedSimulation> p_copy = CopyForIterations();
+            if (!p_copy)
+            {
+                return;
+            }
+            copies.push_back(p_copy);
+        }
+    }
+    catch (const Exception&)
+    {
+        return; // The model can't be copied
+    }
+    NestedIterationsLoop loop(copies, iterations, pResults);
+    UseThreadsHere use_threads(num_threads);
+    if (ThreadPool::Instance()->Run(loop, iterations.size()))
+    {
+        rIterationsRun.insert(iterations.begin(), iterations.end());
+    }
+}
+
+
+void NestedSimulation::RunIterationsInLockStep(EnvironmentPtr pResults, std::set<unsigned>& rIterationsRun)
+{
+    boost::shared_ptr<TimecourseSimulation> p_timecourse = boost::dynamic_pointer_cast<TimecourseSimulation>(mpNestedSimulation);
+    if (!p_timecourse || !p_timecourse->CanRunInLockStep() || !mReductions.empty() || !mpStepper->IsEndFixed()
+        || (GetTrace() && mpOutputHandler) || SavesModelStates())
+    {
+        return;
+    }
+    // The last iteration is left to run as usual, so the model ends in the same state
+    std::vector<unsigned> iterations;
+    for (unsigned i=mpStepper->GetCurrentOutputNumber()+1; i<mpStepper->GetNumberOfOutputPoints(); ++i)
+    {
+        if (IsMyIteration(i))
+        {
+            iterations.push_back(i);
+        }
+    }
+    if (iterations.size() < 3u)
+    {
+        return;
+    }
+    iterations.pop_back();
+    const unsigned ensemble_size = std::min(mEnsembleSize, (unsigned)iterations.size());
+    std::vector<boost::shared_ptr<NestedSimulation> > copies;
+    try
+    {
+        for (unsigned i=0; i<ensemble_size; ++i)
+        {
+            boost::shared_ptr<NestedSimulation> p_copy = CopyForIterations();
+            if (!p_copy)
+            {
+                return;
+            }
+            copies.push_back(p_copy);
+        }
+    }
+    catch (const Exception&)
+    {
+        return; // The model can't be copied
+    }
+
+    for (unsigned start=0; start<iterations.size(); start += ensemble_size)
+    {
+        const unsigned batch_size = std::min(ensemble_size, (unsigned)iterations.size() - start);
+        std::cout << mIndent << "Nested simulation " << mpStepper->GetIndexName() << " steps "
+                  << iterations[start] << "-" << iterations[start + batch_size - 1]
+                  << " in lock-step on process " << PetscTools::GetMyRank() << "..." << std::endl;
+        std::vector<boost::shared_ptr<TimecourseSimulation> > instances(batch_size);
+        try
+        {
+            for (unsigned i=0; i<batch_size; ++i)
+            {
+                NestedSimulation& r_copy = *copies[i];
+                AbstractStepperPtr p_stepper = r_copy.mpStepper;
+                if (p_stepper->GetCurrentOutputNumber() > iterations[start + i])
+                {
+                    p_stepper->Reset();
+                }
+                while (p_stepper->GetCurrentOutputNumber() < iterations[start + i])
+                {
+                    p_stepper->Step();
+                }
+                r_copy.LoopBodyStartHook();
+                instances[i] = boost::static_pointer_cast<TimecourseSimulation>(r_copy.mpNestedSimulation);
+            }
+            TimecourseSimulation::RunInLockStep(instances, pResults);
+            for (unsigned i=0; i<batch_size; ++i)
+            {
+                copies[i]->LoopBodyEndHook();
+            }
+        }
+        catch (const Exception&)
+        {
+            return; // This batch and the rest are run as usual, which reports the error properly
+        }
+        rIterationsRun.insert(iterations.begin() + start, iterations.begin() + start + batch_size);
+    }
+}
+
+
+boost::shared_ptr<NestedSimulation> NestedSimulation::CopyForIterations()
+{
+    boost::shared_ptr<NestedSimulation> p_copy = boost::dynamic_pointer_cast<NestedSimulation>(Clone());
+    if (p_copy)
+    {
+        // Our copy's loops are indexed within those enclosing ours, which don't change while it runs
+        std::vector<AbstractStepperPtr>& r_steppers = rGetSteppers();
+        std::vector<AbstractStepperPtr>::iterator it = std::find(r_steppers.begin(), r_steppers.end(), mpStepper);
+        p_copy->rGetSteppers().insert(p_copy->rGetSteppers().begin(), r_steppers.begin(), it);
+        p_copy->rGetEnvironment().SetDelegateeEnvironment(mpEnvironment->GetDelegateeEnvironment());
+        p_copy->SetModel(mpModel->Clone());
+        p_copy->mpStepper->Reset();
+    }
+    return p_copy;
+}
+
+
+bool NestedSimulation::SavesModelStates() const
+{
+    // Copies may reset their models to states saved outside our loop, but not save any themselves
+    const AbstractSimulation* p_sim = this;
+    while (p_sim)
+    {
+        boost::shared_ptr<ModifierCollection> p_modifiers = p_sim->mpModifiers;
+        for (unsigned i=0; i<p_modifiers->GetNumModifiers(); ++i)
+        {
+            AbstractSimulationModifierPtr p_modifier = (*p_modifiers)[i];
+            if (!p_modifier->IsReset() && !p_modifier->GetStateName().empty())
+            {
+                return true;
+            }
+        }
+        const NestedSimulation* p_nested = dynamic_cast<const NestedSimulation*>(p_sim);
+        p_sim = p_nested ? p_nested->mpNestedSimulation.get() : NULL;
+    }
+    return false;
+}
+
+
+void NestedSimulation::SetNumThreads(unsigned numThreads)
+{
+    // Only the loop whose iterations are independent is shared among threads
+    boost::shared_ptr<NestedSimulation> p_sim(this, NullDeleter());
+    while (p_sim)
+    {
+        p_sim->mNumThreads = 1u;
+        p_sim = boost::dynamic_pointer_cast<NestedSimulation>(p_sim->mpNestedSimulation);
+    }
+    unsigned level = 0u;
+    p_sim = FindIndependentIterations(level);
+    if (p_sim)
+    {
+        p_sim->mNumThreads = numThreads;
+    }
+}
+
+
+void NestedSimulation::SetEnsembleSize(unsigned ensembleSize)
+{
+    // Only the loop whose iterations are independent is run as an ensemble
+    boost::shared_ptr<NestedSimulation> p_sim(this, NullDeleter());
+    while (p_sim)
+    {
+        p_sim->mEnsembleSize = 1u;
+        p_sim = boost::dynamic_pointer_cast<NestedSimulation>(p_sim->mpNestedSimulation);
+    }
+    unsigned level = 0u;
+    p_sim = FindIndependentIterations(level);
+    if (p_sim)
+    {
+        p_sim->mEnsembleSize = ensembleSize;
+    }
+}
+
+
+AbstractSimulationPtr NestedSimulation::Clone() const
+{
+    boost::shared_ptr<NestedSimulation> p_copy;
+    if (mReductions.empty())
+    {
+        AbstractStepperPtr p_stepper = mpStepper->Clone();
+        AbstractSimulationPtr p_nested = mpNestedSimulation->Clone();
+        if (p_stepper && p_nested)
+        {
+            p_copy.reset(new NestedSimulation(p_nested, p_stepper, mpModifiers));
+            CopySettingsTo(*p_copy);
+        }
+    }
+    return p_copy;
+}
+
+
+void NestedSimulation::ReduceIterationResults(EnvironmentPtr pResults, EnvironmentPtr pIterationResults)
+{
+    EnvironmentPtr p_reduce_env(new Environment(pIterationResults->GetAsDelegatee()));
+    p_reduce_env->ExecuteStatements(mReductions);
+    // Only numbers and arrays can be recorded; anything else (e.g. a helper function) is left out
+    EnvironmentPtr p_reduced(new Environment);
+    BOOST_FOREACH(const std::string& r_name, p_reduce_env->GetDefinedNames())
+    {
+        AbstractValuePtr p_value = p_reduce_env->Lookup(r_name, GetLocationInfo());
+        if (p_value->IsArray())
+        {
+            p_reduced->DefineName(r_name, p_value, GetLocationInfo());
+        }
+    }
+    AddIterationOutputs(pResults, p_reduced);
+}
+
+
+void NestedSimulation::SetReductions(const std::vector<AbstractStatementPtr>& rReductions)
+{
+    mReductions = rReductions;
+    if (mReductions.empty())
+    {
+        mpInnermostResultsLoop.reset();
+        mpNestedSimulation->SetReducingLoop(mpReducingLoop);
+    }
+    else
+    {
+        mpInnermostResultsLoop = mpStepper;
+        mpNestedSimulation->SetReducingLoop(mpStepper);
+    }
+}
+
+
+const std::vector<AbstractStatementPtr>& NestedSimulation::rGetReductions() const
+{
+    return mReductions;
+}
+
+
+void NestedSimulation::SetReducingLoop(AbstractStepperPtr pStepper)
+{
+    AbstractSimulation::SetReducingLoop(pStepper);
+    if (mReductions.empty())
+    {
+        mpNestedSimulation->SetReducingLoop(pStepper);
+    }
 }
 
 
@@ -120,22 +761,10 @@ bool NestedSimulation::CanParallelise()
     boost::shared_ptr<NestedSimulation> p_parallel_sim;
     if (mParalleliseLoops && mpStepper->IsEndFixed() && mpStepper == rGetSteppers().front())
     {
-        unsigned num_levels = 0u;
-        unsigned parallised_level = 0u;
-        std::set<std::string> state_names;
-        boost::shared_ptr<NestedSimulation> p_sim(this, NullDeleter());
         // Determine the nesting level at which we'll split processing across processes.
         // We split at the innermost allowable level, leading to the smallest possible chunks of work for load balancing.
-        while (p_sim)
-        {
-            ++num_levels;
-            if (p_sim->CanParalleliseHere(state_names))
-            {
-                p_parallel_sim = p_sim;
-                parallised_level = num_levels;
-            }
-            p_sim = boost::dynamic_pointer_cast<NestedSimulation>(p_sim->mpNestedSimulation);
-        }
+        unsigned parallised_level = 0u;
+        p_parallel_sim = FindIndependentIterations(parallised_level);
         if (p_parallel_sim)
         {
             // Tell the level which can parallelise how to compute which process does what
@@ -144,13 +773,34 @@ bool NestedSimulation::CanParallelise()
             {
                 loop_index_multipliers[i-1] = loop_index_multipliers[i] * rGetSteppers()[i]->GetNumberOfOutputPoints();
             }
-            p_parallel_sim->SetParallelMultipliers(loop_index_multipliers);
+            // Handing out iterations dynamically only pays if there are at least 2 processes besides the master
+            p_parallel_sim->SetParallelMultipliers(loop_index_multipliers, mBalanceLoad && PetscTools::GetNumProcs() > 2u);
         }
     }
     return (bool)p_parallel_sim;
 }
 
 
+boost::shared_ptr<NestedSimulation> NestedSimulation::FindIndependentIterations(unsigned& rLevel)
+{
+    boost::shared_ptr<NestedSimulation> p_independent_sim;
+    unsigned num_levels = 0u;
+    std::set<std::string> state_names;
+    boost::shared_ptr<NestedSimulation> p_sim(this, NullDeleter());
+    while (p_sim)
+    {
+        ++num_levels;
+        if (p_sim->CanParalleliseHere(state_names))
+        {
+            p_independent_sim = p_sim;
+            rLevel = num_levels;
+        }
+        p_sim = boost::dynamic_pointer_cast<NestedSimulation>(p_sim->mpNestedSimulation);
+    }
+    return p_independent_sim;
+}
+
+
 bool NestedSimulation::CanParalleliseHere(std::set<std::string>& rStatesSaved) const
 {
     bool has_reset = mpModel->HasImplicitReset();
@@ -209,9 +859,14 @@ bool NestedSimulation::CanParalleliseHere(std::set<std::string>& rStatesSaved) c
 }
 
 
-void NestedSimulation::SetParallelMultipliers(const std::vector<unsigned>& rMultipliers)
+void NestedSimulation::SetParallelMultipliers(const std::vector<unsigned>& rMultipliers, bool dynamicIterations)
 {
     mParallelMultipliers = rMultipliers;
+    mDynamicIterations = dynamicIterations;
+    mNextTask = -1;
+    mLastTask = -1;
+    mTasksDone = false;
+    mNumWorkersLeft = PetscTools::GetNumProcs() - 1u;
 }
 
 
@@ -222,6 +877,33 @@ void NestedSimulation::ZeroInitialiseResults()
 }
 
 
+void NestedSimulation::SetNativeLoops(bool nativeLoops)
+{
+    AbstractSimulation::SetNativeLoops(nativeLoops);
+    mpNestedSimulation->SetNativeLoops(nativeLoops);
+}
+
+
+void NestedSimulation::CollectExpressions(std::vector<AbstractExpressionPtr>& rExpressions) const
+{
+    AbstractSimulation::CollectExpressions(rExpressions);
+    mpNestedSimulation->CollectExpressions(rExpressions);
+}
+
+
+bool NestedSimulation::HasSolverSetting(const std::string& rName) const
+{
+    return AbstractSimulation::HasSolverSetting(rName) || mpNestedSimulation->HasSolverSetting(rName);
+}
+
+
+void NestedSimulation::GetSolverSettings(AbstractSystemWithOutputs::SolverSettings& rSettings)
+{
+    AbstractSimulation::GetSolverSettings(rSettings);
+    mpNestedSimulation->GetSolverSettings(rSettings);
+}
+
+
 void NestedSimulation::SetIndent(std::string indent)
 {
     AbstractSimulation::SetIndent(indent);
@@ -37,11 +37,17 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define NESTEDSIMULATION_HPP_
 
 #include <set>
+#include <vector>
 #include "AbstractSimulation.hpp"
+#include "AbstractStatement.hpp"
 
 /**
  * A nested simulation that contains another simulation.  Each time round this
  * simulation's loop, we run the contained simulation.
+ *
+ * Where the iterations of a loop are provably independent, they may be shared among processes
+ * (see CanParallelise) and among threads (see SetNumThreads), or run together as an ensemble
+ * (see SetEnsembleSize).
  */
 class NestedSimulation : public AbstractSimulation
 {
@@ -90,6 +96,93 @@ public:
      */
     virtual void SetIndent(std::string indent);
 
+    /**
+     * Set whether to use specialised simulation loops where possible, for this simulation and
+     * the one it nests.
+     *
+     * @param nativeLoops  whether to use the specialised loops when the simulation allows
+     */
+    void SetNativeLoops(bool nativeLoops);
+
+    /**
+     * Get the protocol language expressions evaluated by this simulation and the one it nests.
+     *
+     * @param rExpressions  the expressions will be appended to this vector
+     */
+    void CollectExpressions(std::vector<AbstractExpressionPtr>& rExpressions) const;
+
+    /**
+     * @return  whether this simulation or the one it nests has been given the named solver setting
+     *
+     * @param rName  the setting
+     */
+    bool HasSolverSetting(const std::string& rName) const;
+
+    /**
+     * Reduce the results of each iteration of the nested simulation as soon as it finishes, and record
+     * only the reduced results, so memory use is independent of the nested simulation's extent.  The
+     * statements are run in an environment where that iteration's results are available by their
+     * unprefixed names, along with everything visible to this simulation's loop.  Each name they assign
+     * to a number or array becomes one of this simulation's results, with a dimension added for this
+     * loop and any enclosing it.
+     *
+     * @param rReductions  the statements to run for each iteration
+     */
+    void SetReductions(const std::vector<AbstractStatementPtr>& rReductions);
+
+    /** @return the statements reducing the results of each iteration, if any. */
+    const std::vector<AbstractStatementPtr>& rGetReductions() const;
+
+    /**
+     * Find the innermost simulation, among this one and those nested within it, whose iterations are
+     * provably independent of each other (see CanParalleliseHere).  Such iterations may be run in any
+     * order, or simultaneously, without affecting the results.
+     *
+     * @param rLevel  set to the nesting level of the simulation found, counting this one as level 1
+     * @return  the simulation found, or an empty pointer if there is none
+     */
+    boost::shared_ptr<NestedSimulation> FindIndependentIterations(unsigned& rLevel);
+
+    /**
+     * Share the iterations of the loop found by FindIndependentIterations among the given number of
+     * threads.  Each thread runs its iterations on its own copy of the model and of the simulations within
+     * that loop (see Clone), filling in its own parts of the results arrays.  The first iteration is run
+     * as usual, since it creates the results arrays, as is the last, so that the model is left in the same
+     * state as it would be otherwise.  Iterations are run in turn as usual if any simulation within the
+     * loop saves model states or reduces its results, if the model or a stepper can't be copied, or if
+     * any iteration fails, in which case errors are reported exactly as they would be without threads.
+     *
+     * @param numThreads  the number of threads; 0 or 1 means run sequentially
+     */
+    void SetNumThreads(unsigned numThreads);
+
+    /**
+     * Run the iterations of the loop found by FindIndependentIterations in batches of the given size,
+     * provided the simulation it nests is a timecourse.  Each batch is an ensemble of copies of the
+     * model and of the simulations within that loop (see Clone), stepped through the timecourse in
+     * lock-step, so that each output point fills in one row of the results for every iteration in
+     * the batch (see TimecourseSimulation::RunInLockStep).  As with threads, which take precedence if
+     * also requested, the first and last iterations are run as usual, and iterations are run in turn
+     * as usual if this isn't possible or a batch fails.
+     *
+     * @param ensembleSize  the number of iterations to run together; 0 or 1 means run each in turn
+     */
+    void SetEnsembleSize(unsigned ensembleSize);
+
+    /**
+     * Create a copy of this simulation and the one nested within it, provided we don't reduce the
+     * results of each iteration, and our stepper and nested simulation can be copied.
+     *
+     * @return  the copy, or an empty pointer if it can't be made
+     */
+    AbstractSimulationPtr Clone() const;
+
+    /** @return the simulation nested inside this one. */
+    boost::shared_ptr<AbstractSimulation> GetNestedSimulation() const
+    {
+        return mpNestedSimulation;
+    }
+
 protected:
     /**
      * Run a simulation, filling in the results.
@@ -99,17 +192,140 @@ protected:
     void Run(EnvironmentPtr pResults);
 
     /**
+     * Evaluate the solver settings given for this simulation and then those for the nested simulation,
+     * which override ours since it is where the model is actually solved.  Since the nested simulation
+     * is run many times, its settings are evaluated just once, when this simulation starts to run.
+     *
+     * @param rSettings  the settings to fill in
+     */
+    void GetSolverSettings(AbstractSystemWithOutputs::SolverSettings& rSettings);
+
+    /**
+     * Determine whether this simulation is capable of running on more than one process, and if so set
+     * up the simulation found by FindIndependentIterations to share out its iterations.  The iterations
+     * of the loops down to and including that simulation's are numbered in order, and by default each
+     * process performs those whose number modulo the number of processes is its rank.  If load balancing
+     * was requested (see SetParalleliseLoops) and there are at least 3 processes, the master process
+     * instead hands out iterations to the others as they become free, so that iterations varying widely
+     * in cost don't leave processes idle (see RunDynamicIterations).  The results are the same either way.
+     *
      * @return  whether this simulation is capable of running on more than one process.
      */
     virtual bool CanParallelise();
 
+    /**
+     * Stop taking part in handing out the iterations of the loop found by FindIndependentIterations,
+     * if we were, because this process is abandoning the simulation.
+     */
+    void AbandonParallelIterations();
+
+    /**
+     * Find which process ran each iteration of the loops shared out by CanParallelise, and so holds its
+     * results.  The owners can't be given if a loop enclosing the shared loop reduces its results, since
+     * then the results of different processes are combined.
+     *
+     * @param rOwners  filled in with the rank that ran each iteration, or -1 if none did; empty if not known
+     */
+    void GetResultsOwners(std::vector<int>& rOwners);
+
+    /**
+     * Note that an enclosing simulation reduces the results of each iteration of its loop.  This is
+     * passed on to our nested simulation, unless we reduce its results ourselves.
+     *
+     * @param pStepper  the stepper for the reducing simulation's loop
+     */
+    void SetReducingLoop(AbstractStepperPtr pStepper);
+
 private:
     /** The simulation nested inside this one. */
     boost::shared_ptr<AbstractSimulation> mpNestedSimulation;
 
+    /** Statements reducing the results of each iteration of the nested simulation, if any. */
+    std::vector<AbstractStatementPtr> mReductions;
+
+    /**
+     * Run the reductions on the results of the current iteration, and record what they compute.
+     *
+     * @param pResults  the environment in which to record this simulation's results
+     * @param pIterationResults  the nested simulation's results for this iteration
+     */
+    void ReduceIterationResults(EnvironmentPtr pResults, EnvironmentPtr pIterationResults);
+
     /** What to multiply loop indices by to obtain an overall iteration count. */
     std::vector<unsigned> mParallelMultipliers;
 
+    /** Whether the master process hands out the iterations of this simulation's loop to the others. */
+    bool mDynamicIterations;
+
+    /**
+     * The time the last run of each iteration of this simulation's loop took, or a negative number if
+     * not yet known.  Only used on the master process when it hands out iterations, to give out the most
+     * costly first.  Kept from one run of the simulation to the next.
+     */
+    std::vector<double> mIterationCosts;
+
+    /** On other processes, the overall number of the next iteration to run, or -1 if none is to hand. */
+    int mNextTask;
+
+    /** On other processes, the overall number of the last iteration run, or -1 if none has been. */
+    int mLastTask;
+
+    /** On other processes, how long the last iteration run took. */
+    double mLastTaskTime;
+
+    /** On other processes, whether the master has no more iterations to hand out to us. */
+    bool mTasksDone;
+
+    /** On the master, the number of other processes not yet told there are no more iterations to run. */
+    unsigned mNumWorkersLeft;
+
+    /**
+     * Which process ran each iteration handed out by the master, by overall number, or -1 if it is not
+     * known locally.  Each process fills in just its own iterations; GetResultsOwners combines them.
+     */
+    std::vector<int> mIterationOwners;
+
+    /**
+     * Get the overall number of an iteration of this simulation's loop, given the current iterations of
+     * the loops enclosing it.
+     *
+     * @param outputNumber  the iteration of our loop
+     */
+    unsigned GetIterationCount(unsigned outputNumber);
+
+    /**
+     * Run the iterations of this simulation's loop for the current iterations of the loops enclosing it,
+     * as handed out by the master process.  All processes run the enclosing loops in full, so each run of
+     * our loop is numbered in turn.  When the first starts, the master hands out every iteration of every
+     * run (see HandOutIterations), and doesn't run any itself.  Other processes ask the master for an
+     * iteration to run whenever they become free, and run it if it belongs to the current run of our loop;
+     * if it belongs to a later run, they keep it until that run starts.
+     *
+     * @param pResults  the environment in which to record this simulation's results
+     * @param pNestedResults  the environment in which the nested simulation records its results
+     */
+    void RunDynamicIterations(EnvironmentPtr pResults, EnvironmentPtr pNestedResults);
+
+    /**
+     * On the master process, hand out all the iterations of all runs of this simulation's loop to the
+     * other processes, as they ask for them.  The iterations of each run are handed out together, the
+     * most costly (as recorded in #mIterationCosts) first, since starting long iterations early leaves
+     * the short ones to fill the gaps at the end.  Iterations whose cost isn't known yet come first.
+     *
+     * If the master is abandoning the simulation, it instead answers every outstanding request by saying
+     * there is nothing more to run, so no other process is left waiting for a reply.
+     *
+     * @param abandon  whether to hand out no more iterations
+     */
+    void HandOutIterations(bool abandon=false);
+
+    /**
+     * On other processes, tell the master how long the last iteration took, and ask for another.
+     *
+     * @param stop  whether to tell the master not to hand out any more iterations to this process
+     */
+    void RequestIteration(bool stop=false);
+
     /**
      * Determine whether the iterations of this simulation are provably independent, and so can be
      * farmed out to separate processes.  We do this by analysing the modifiers on this simulation
@@ -131,10 +347,68 @@ private:
     /**
      * Set that this simulation can be parallelised, and what to multiply each loop index by to obtain
      * an overall iteration count, and hence determine if the current process should perform this iteration.
+     * Since this is done before each run of the outermost simulation, it also starts handing out
+     * iterations afresh, so the master and the other processes agree on who is still taking part even
+     * if one of them fails before the first run of our loop.
      *
      * @param rMultipliers  the multipliers
+     * @param dynamicIterations  whether the master process hands out iterations to the others
+     */
+    void SetParallelMultipliers(const std::vector<unsigned>& rMultipliers, bool dynamicIterations=false);
+
+    /**
+     * Determine whether the current process should perform an iteration of this simulation's loop,
+     * given the current iterations of the loops enclosing it.
+     *
+     * @param outputNumber  the iteration of our loop
      */
-    void SetParallelMultipliers(const std::vector<unsigned>& rMultipliers);
+    bool IsMyIteration(unsigned outputNumber);
+
+    /**
+     * Run the current iteration of this simulation's loop.
+     *
+     * @param pResults  the environment in which to record this simulation's results
+     * @param pNestedResults  the environment in which the nested simulation records its results
+     */
+    void RunIteration(EnvironmentPtr pResults, EnvironmentPtr pNestedResults);
+
+    /** How many threads may share the iterations of this simulation's loop. */
+    unsigned mNumThreads;
+
+    /**
+     * Run those iterations of this simulation's loop after the current one, except the last, that this
+     * process should perform, shared among #mNumThreads threads, if this is possible.
+     *
+     * @param pResults  the environment in which to record this simulation's results
+     * @param rIterationsRun  filled in with the iterations run, if any
+     */
+    void RunIterationsOnThreads(EnvironmentPtr pResults, std::set<unsigned>& rIterationsRun);
+
+    /** How many iterations of this simulation's loop may be run together in lock-step. */
+    unsigned mEnsembleSize;
+
+    /**
+     * Run those iterations of this simulation's loop after the current one, except the last, that this
+     * process should perform, in lock-step batches of #mEnsembleSize, if this is possible.
+     *
+     * @param pResults  the environment in which to record this simulation's results
+     * @param rIterationsRun  filled in with the iterations run, if any
+     */
+    void RunIterationsInLockStep(EnvironmentPtr pResults, std::set<unsigned>& rIterationsRun);
+
+    /**
+     * Create a copy of this simulation that can run iterations of our loop alongside ours, either on
+     * another thread or in lock-step, with its own copy of the model, and sharing the loops enclosing ours.
+     *
+     * @return  the copy, or an empty pointer if it can't be made
+     */
+    boost::shared_ptr<NestedSimulation> CopyForIterations();
+
+    /** @return  whether this simulation, or any within it, saves model states. */
+    bool SavesModelStates() const;
+
+    /** Allow the loop run by threads to run iterations of copies of this simulation. */
+    friend class NestedIterationsLoop;
 };
 
 #endif /*NESTEDSIMULATION_HPP_*/
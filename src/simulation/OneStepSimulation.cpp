@@ -51,6 +51,14 @@ OneStepSimulation::OneStepSimulation(double step, boost::shared_ptr<ModifierColl
 }
 
 
+AbstractSimulationPtr OneStepSimulation::Clone() const
+{
+    boost::shared_ptr<OneStepSimulation> p_copy(new OneStepSimulation(mStep, mpModifiers));
+    CopySettingsTo(*p_copy);
+    return p_copy;
+}
+
+
 void OneStepSimulation::Run(EnvironmentPtr pResults)
 {
     (*mpModifiers)(mpModel, mpStepper);
@@ -54,6 +54,9 @@ public:
     OneStepSimulation(double step=DOUBLE_UNSET,
                       boost::shared_ptr<ModifierCollection> pModifiers=boost::shared_ptr<ModifierCollection>());
 
+    /** @return  a copy of this simulation. */
+    AbstractSimulationPtr Clone() const;
+
 protected:
     /**
      * Run a simulation, filling in the results if requested.
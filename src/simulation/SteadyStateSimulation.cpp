@@ -0,0 +1,409 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "SteadyStateSimulation.hpp"
+
+#include <cmath>
+#include <deque>
+#include <boost/foreach.hpp>
+#include <boost/make_shared.hpp>
+
+#include "VectorStepper.hpp"
+#include "BacktraceException.hpp"
+#include "ValueTypes.hpp"
+#include "ProtoHelperMacros.hpp"
+
+/**
+ * Anderson extrapolation for a fixed point iteration x -> g(x).  Given the latest iterate x and its
+ * image g(x), and the history of previous ones, it proposes the next iterate as the combination of
+ * recent images whose residuals g(x)-x best cancel in a least squares sense.
+ *
+ * State variables differ in magnitude by orders of magnitude, so each is weighted by the reciprocal
+ * of its size at the first iterate, to stop the least squares fit seeing only the largest ones.
+ */
+class AndersonExtrapolator
+{
+public:
+    /**
+     * Create an extrapolator.
+     * @param depth  how many previous iterates it may combine; 0 disables extrapolation
+     */
+    AndersonExtrapolator(unsigned depth)
+        : mDepth(depth)
+    {}
+
+    /** Forget the history, e.g. because extrapolation has stopped helping. */
+    void Reset()
+    {
+        mResiduals.clear();
+        mImages.clear();
+    }
+
+    /**
+     * Propose the next iterate.
+     *
+     * @param rX  the latest iterate
+     * @param rG  its image under the map
+     * @param rNext  filled in with the proposal, if there is one
+     * @return  whether a proposal was made; if not, the next iterate should just be rG
+     */
+    bool Extrapolate(const std::vector<double>& rX, const std::vector<double>& rG, std::vector<double>& rNext)
+    {
+        if (mDepth == 0u)
+        {
+            return false;
+        }
+        const unsigned size = rX.size();
+        if (mWeights.empty())
+        {
+            mWeights.resize(size);
+            for (unsigned i=0; i<size; ++i)
+            {
+                mWeights[i] = 1.0 / std::max(std::fabs(rG[i]), 1e-6);
+            }
+        }
+        std::vector<double> residual(size);
+        for (unsigned i=0; i<size; ++i)
+        {
+            residual[i] = (rG[i] - rX[i]) * mWeights[i];
+        }
+        mResiduals.push_back(residual);
+        mImages.push_back(rG);
+        if (mResiduals.size() > mDepth + 1u)
+        {
+            mResiduals.pop_front();
+            mImages.pop_front();
+        }
+        const unsigned num_cols = mResiduals.size() - 1u;
+        if (num_cols == 0u)
+        {
+            return false;
+        }
+
+        // Differences between successive residuals form the columns of the least squares matrix
+        std::vector<std::vector<double> > diffs(num_cols, std::vector<double>(size));
+        for (unsigned j=0; j<num_cols; ++j)
+        {
+            for (unsigned i=0; i<size; ++i)
+            {
+                diffs[j][i] = mResiduals[j+1][i] - mResiduals[j][i];
+            }
+        }
+        // Solve the (slightly regularised) normal equations for the coefficients
+        std::vector<std::vector<double> > matrix(num_cols, std::vector<double>(num_cols + 1u, 0.0));
+        double trace = 0.0;
+        for (unsigned j=0; j<num_cols; ++j)
+        {
+            for (unsigned k=0; k<num_cols; ++k)
+            {
+                matrix[j][k] = Dot(diffs[j], diffs[k]);
+            }
+            matrix[j][num_cols] = Dot(diffs[j], residual);
+            trace += matrix[j][j];
+        }
+        if (!(trace > 0.0))
+        {
+            Reset();
+            return false;
+        }
+        for (unsigned j=0; j<num_cols; ++j)
+        {
+            matrix[j][j] += 1e-10 * trace;
+        }
+        std::vector<double> coeffs(num_cols);
+        if (!SolveInPlace(matrix, coeffs))
+        {
+            Reset();
+            return false;
+        }
+
+        // The proposal is the latest image less the same combination of image differences
+        rNext = rG;
+        for (unsigned j=0; j<num_cols; ++j)
+        {
+            for (unsigned i=0; i<size; ++i)
+            {
+                rNext[i] -= coeffs[j] * (mImages[j+1][i] - mImages[j][i]);
+            }
+        }
+        // Don't let extrapolation change the sign of any variable, since e.g. concentrations and
+        // gating variables have no meaning when negative
+        for (unsigned i=0; i<size; ++i)
+        {
+            if (rNext[i] * rG[i] < 0.0 || !std::isfinite(rNext[i]))
+            {
+                rNext[i] = rG[i];
+            }
+        }
+        return true;
+    }
+
+private:
+    /** How many previous iterates may be combined. */
+    unsigned mDepth;
+
+    /** The weight applied to each component of the residuals. */
+    std::vector<double> mWeights;
+
+    /** The weighted residuals of recent iterates, oldest first. */
+    std::deque<std::vector<double> > mResiduals;
+
+    /** The images of recent iterates, oldest first. */
+    std::deque<std::vector<double> > mImages;
+
+    /**
+     * @return  the dot product of two vectors.
+     * @param rA  the first vector
+     * @param rB  the second vector
+     */
+    static double Dot(const std::vector<double>& rA, const std::vector<double>& rB)
+    {
+        double result = 0.0;
+        for (unsigned i=0; i<rA.size(); ++i)
+        {
+            result += rA[i] * rB[i];
+        }
+        return result;
+    }
+
+    /**
+     * Solve a small linear system by Gaussian elimination with partial pivoting.
+     *
+     * @param rMatrix  the augmented matrix, with the right-hand side as its last column; overwritten
+     * @param rSolution  filled in with the solution
+     * @return  false if the matrix is singular
+     */
+    static bool SolveInPlace(std::vector<std::vector<double> >& rMatrix, std::vector<double>& rSolution)
+    {
+        const unsigned n = rSolution.size();
+        for (unsigned col=0; col<n; ++col)
+        {
+            unsigned pivot = col;
+            for (unsigned row=col+1; row<n; ++row)
+            {
+                if (std::fabs(rMatrix[row][col]) > std::fabs(rMatrix[pivot][col]))
+                {
+                    pivot = row;
+                }
+            }
+            if (rMatrix[pivot][col] == 0.0)
+            {
+                return false;
+            }
+            std::swap(rMatrix[col], rMatrix[pivot]);
+            for (unsigned row=col+1; row<n; ++row)
+            {
+                const double factor = rMatrix[row][col] / rMatrix[col][col];
+                for (unsigned k=col; k<=n; ++k)
+                {
+                    rMatrix[row][k] -= factor * rMatrix[col][k];
+                }
+            }
+        }
+        for (unsigned row=n; row-- > 0u; )
+        {
+            double value = rMatrix[row][n];
+            for (unsigned k=row+1; k<n; ++k)
+            {
+                value -= rMatrix[row][k] * rSolution[k];
+            }
+            rSolution[row] = value / rMatrix[row][row];
+        }
+        return true;
+    }
+};
+
+
+SteadyStateSimulation::SteadyStateSimulation(boost::shared_ptr<ModifierCollection> pModifiers)
+    : AbstractSimulation(boost::shared_ptr<AbstractSystemWithOutputs>(), AbstractStepperPtr(), pModifiers)
+{
+    // Create a fake stepper that's at the start, for use by the modifiers
+    std::vector<double> zero(1u, 0.0);
+    mpStepper.reset(new VectorStepper("fake", "fake", zero));
+    mpStepper->SetEnvironment(mpEnvironment);
+}
+
+
+void SteadyStateSimulation::SetSetting(const std::string& rName, AbstractExpressionPtr pValue)
+{
+    PROTO_ASSERT(rName == "period" || rName == "maxBeats" || rName == "tolerance" || rName == "start"
+                 || rName == "acceleration",
+                 "Unknown steady state setting " << rName
+                 << "; must be one of period, maxBeats, tolerance, start or acceleration.");
+    mSettings[rName] = pValue;
+}
+
+
+void SteadyStateSimulation::CollectExpressions(std::vector<AbstractExpressionPtr>& rExpressions) const
+{
+    AbstractSimulation::CollectExpressions(rExpressions);
+    typedef std::pair<std::string, AbstractExpressionPtr> StringExprPair;
+    BOOST_FOREACH(const StringExprPair& r_setting, mSettings)
+    {
+        rExpressions.push_back(r_setting.second);
+    }
+}
+
+
+AbstractSimulationPtr SteadyStateSimulation::Clone() const
+{
+    boost::shared_ptr<SteadyStateSimulation> p_copy(new SteadyStateSimulation(mpModifiers));
+    CopySettingsTo(*p_copy);
+    p_copy->mSettings = mSettings;
+    return p_copy;
+}
+
+
+double SteadyStateSimulation::EvaluateSetting(const std::string& rName, double defaultValue)
+{
+    std::map<std::string, AbstractExpressionPtr>::const_iterator it = mSettings.find(rName);
+    if (it == mSettings.end())
+    {
+        PROTO_ASSERT(defaultValue != DOUBLE_UNSET, "A steadyState simulation must specify its " << rName << ".");
+        return defaultValue;
+    }
+    AbstractValuePtr p_value = (*it->second)(*mpEnvironment);
+    PROTO_ASSERT(p_value->IsDouble(), "The steady state setting " << rName << " must be a real number.");
+    return GET_SIMPLE_VALUE(p_value);
+}
+
+
+void SteadyStateSimulation::GetModelState(std::vector<double>& rState)
+{
+    PROTO_ASSERT(mpModel->GetStateValues(rState), "A steadyState simulation can only be run on an ODE model.");
+}
+
+
+void SteadyStateSimulation::SetModelState(const std::vector<double>& rState)
+{
+    PROTO_ASSERT(mpModel->SetStateValues(rState), "A steadyState simulation can only be run on an ODE model.");
+}
+
+
+void SteadyStateSimulation::Run(EnvironmentPtr pResults)
+{
+    (*mpModifiers)(mpModel, mpStepper);
+
+    const double start = EvaluateSetting("start", mpModel->GetFreeVariable());
+    const double period = EvaluateSetting("period");
+    const double max_beats = EvaluateSetting("maxBeats");
+    const double tolerance = EvaluateSetting("tolerance");
+    const double depth = EvaluateSetting("acceleration", 0.0);
+    PROTO_ASSERT(period > 0.0, "The period of a steadyState simulation must be positive, not " << period << ".");
+    PROTO_ASSERT(max_beats >= 1.0 && max_beats == std::floor(max_beats),
+                 "The maximum number of beats for a steadyState simulation must be a positive integer, not " << max_beats << ".");
+    PROTO_ASSERT(tolerance >= 0.0, "The tolerance of a steadyState simulation must not be negative.");
+    PROTO_ASSERT(depth >= 0.0 && depth == std::floor(depth),
+                 "The acceleration of a steadyState simulation must be a non-negative integer, not " << depth << ".");
+
+    std::vector<double> state;
+    GetModelState(state);
+    const unsigned num_state_vars = state.size();
+    std::vector<double> final_states;
+    std::vector<double> norms;
+    std::vector<double> end_state, next_state;
+    AndersonExtrapolator extrapolator((unsigned)depth);
+    bool extrapolated = false;
+    while (norms.size() < max_beats)
+    {
+        mpModel->SetFreeVariable(start);
+        try
+        {
+            mpModel->SolveModel(start + period);
+        }
+        catch (const Exception&)
+        {
+            if (!extrapolated)
+            {
+                throw;
+            }
+            // The extrapolated state wasn't viable, so carry on from where the last beat ended
+            extrapolator.Reset();
+            extrapolated = false;
+            state = end_state;
+            SetModelState(state);
+            continue;
+        }
+        GetModelState(end_state);
+        double norm = 0.0;
+        for (unsigned i=0; i<num_state_vars; ++i)
+        {
+            norm += std::fabs(end_state[i] - state[i]);
+        }
+        if (!norms.empty() && norm > norms.back())
+        {
+            // Extrapolation has stopped helping; start again from this beat
+            extrapolator.Reset();
+        }
+        final_states.insert(final_states.end(), end_state.begin(), end_state.end());
+        norms.push_back(norm);
+        if (norm <= tolerance)
+        {
+            break;
+        }
+        extrapolated = extrapolator.Extrapolate(state, end_state, next_state);
+        if (extrapolated)
+        {
+            state = next_state;
+            SetModelState(state);
+        }
+        else
+        {
+            state = end_state;
+        }
+    }
+
+    if (pResults)
+    {
+        const unsigned num_beats = norms.size();
+        EnvironmentPtr p_outputs(new Environment);
+        NdArray<double>::Extents shape(2u);
+        shape[0] = num_beats;
+        shape[1] = num_state_vars;
+        NdArray<double> final_states_array(shape);
+        std::copy(final_states.begin(), final_states.end(), final_states_array.Begin());
+        p_outputs->DefineName("final_state_variables", boost::make_shared<ArrayValue>(final_states_array),
+                              GetLocationInfo());
+        NdArray<double> norms_array(NdArray<double>::Extents(1u, num_beats));
+        std::copy(norms.begin(), norms.end(), norms_array.Begin());
+        p_outputs->DefineName("norm_of_differences", boost::make_shared<ArrayValue>(norms_array), GetLocationInfo());
+        AbstractValuePtr p_num_paces = boost::make_shared<SimpleValue>(num_beats);
+        p_num_paces->SetUnits("dimensionless");
+        p_outputs->DefineName("num_paces", p_num_paces, GetLocationInfo());
+        AddIterationOutputs(pResults, p_outputs);
+    }
+
+    mpModifiers->ApplyAtEnd(mpModel, mpStepper);
+}
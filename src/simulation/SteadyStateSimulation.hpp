@@ -0,0 +1,137 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef STEADYSTATESIMULATION_HPP_
+#define STEADYSTATESIMULATION_HPP_
+
+#include <string>
+#include <vector>
+#include <map>
+#include "AbstractSimulation.hpp"
+#include "AbstractExpression.hpp"
+
+/**
+ * Pace the model to a periodic steady state, by repeatedly applying the map that takes its state
+ * at the start of a beat to its state one period later, until the change over a beat is small.
+ *
+ * This does natively what a protocol would otherwise do by nesting a single-pace protocol in a
+ * while loop, without running a whole nested protocol for each beat.  The results match those of
+ * SinglePace.txt as used by SteadyStateRunner.txt:
+ *  - final_state_variables  the state at the end of each beat
+ *  - norm_of_differences  the L1 norm of the change in state over each beat
+ *  - num_paces  the number of beats simulated
+ *
+ * Optionally, the iteration can be accelerated by Anderson extrapolation on the beat-to-beat map:
+ * rather than starting each beat from where the last one ended, it starts from the combination of
+ * recent beats that best cancels their changes.  With a history of 1 this is Aitken's (secant)
+ * extrapolation applied to the whole state.  Extrapolated states are not trajectories of the model,
+ * so the convergence test is always on the change over a simulated beat.
+ *
+ * Modifiers are applied once, at the start and end of the simulation.
+ */
+class SteadyStateSimulation : public AbstractSimulation
+{
+public:
+    /**
+     * Create a new simulation instance.  Its settings must be supplied with SetSetting.
+     *
+     * @param pModifiers  optional collection of modifiers
+     */
+    SteadyStateSimulation(boost::shared_ptr<ModifierCollection> pModifiers=boost::shared_ptr<ModifierCollection>());
+
+    /**
+     * Set how the simulation paces the model.  Each value is evaluated in this simulation's environment
+     * when it starts to run.
+     *
+     * @param rName  the setting, one of:
+     *  - period  the length of a beat, i.e. the stimulus period times the number of paces per beat (required)
+     *  - maxBeats  the largest number of beats to simulate before giving up (required)
+     *  - tolerance  steady state is reached when the L1 norm of the change in state over a beat is
+     *    no larger than this (required)
+     *  - start  the value of the free variable at the start of each beat; defaults to its value
+     *    when the simulation starts
+     *  - acceleration  how many previous beats Anderson extrapolation may combine; defaults to 0,
+     *    i.e. plain pacing
+     * @param pValue  expression giving the setting's value
+     */
+    void SetSetting(const std::string& rName, AbstractExpressionPtr pValue);
+
+    /**
+     * Add the expressions evaluated by this simulation, including its settings, to the given vector.
+     *
+     * @param rExpressions  the vector to add to
+     */
+    void CollectExpressions(std::vector<AbstractExpressionPtr>& rExpressions) const;
+
+    /** @return  a copy of this simulation, with the same settings. */
+    AbstractSimulationPtr Clone() const;
+
+protected:
+    /**
+     * Run a simulation, filling in the results if requested.
+     *
+     * @param pResults  an Environment to be filled in with results, or an empty pointer
+     */
+    void Run(EnvironmentPtr pResults);
+
+private:
+    /** Expressions for this simulation's settings, by name. */
+    std::map<std::string, AbstractExpressionPtr> mSettings;
+
+    /**
+     * Evaluate one of our settings.
+     *
+     * @param rName  the setting's name
+     * @param defaultValue  the value to use if the setting wasn't given; if DOUBLE_UNSET the setting is required
+     * @return  its value
+     */
+    double EvaluateSetting(const std::string& rName, double defaultValue=DOUBLE_UNSET);
+
+    /**
+     * Get the model's state variables.
+     *
+     * @param rState  filled in with their values
+     */
+    void GetModelState(std::vector<double>& rState);
+
+    /**
+     * Set the model's state variables.
+     *
+     * @param rState  their new values
+     */
+    void SetModelState(const std::vector<double>& rState);
+};
+
+#endif // STEADYSTATESIMULATION_HPP_
@@ -35,16 +35,411 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "TimecourseSimulation.hpp"
 
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <boost/foreach.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "BacktraceException.hpp"
+#include "ValueTypes.hpp"
+#include "ProtoHelperMacros.hpp"
+#include "ThreadPool.hpp"
+
+/**
+ * A helper class that makes a model locate events for the duration of a scope, and
+ * stops it doing so at the end of the scope (i.e. when the object is destroyed).
+ */
+class LocateEventsHere
+{
+public:
+    /**
+     * Start locating events.
+     * @param pModel  the model
+     * @param rEvents  the events to locate; if empty, nothing is done
+     */
+    LocateEventsHere(boost::shared_ptr<AbstractSystemWithOutputs> pModel,
+                     const std::vector<AbstractSystemWithOutputs::EventInfo>& rEvents)
+        : mpModel(pModel),
+          mActive(!rEvents.empty())
+    {
+        if (mActive)
+        {
+            mpModel->SetEvents(rEvents);
+        }
+    }
+    /**
+     * Stop locating events, iff we started.
+     */
+    ~LocateEventsHere()
+    {
+        if (mActive)
+        {
+            mpModel->SetEvents(std::vector<AbstractSystemWithOutputs::EventInfo>());
+        }
+    }
+private:
+    /** The model. */
+    boost::shared_ptr<AbstractSystemWithOutputs> mpModel;
+    /** Whether we set events on the model. */
+    bool mActive;
+};
+
+
+/**
+ * The accurate (fine) sweep of the Parareal algorithm: solves each time slice from its current start
+ * state on its own copy of the model, so the slices can be solved concurrently.  The model outputs at
+ * the output points within each slice are recorded as it goes.
+ */
+class PararealFineSweep : public AbstractParallelLoop
+{
+public:
+    /**
+     * Set up the sweep.
+     *
+     * @param rModels  a copy of the model for each slice
+     * @param rSliceTimes  the start of each slice, followed by the end of the last
+     * @param rOutputPoints  the output points of the whole simulation
+     * @param rFirstPoints  the index of the first output point in each slice, followed by the number of points
+     * @param recordOutputs  whether to record the model outputs
+     */
+    PararealFineSweep(const std::vector<boost::shared_ptr<AbstractSystemWithOutputs> >& rModels,
+                      const std::vector<double>& rSliceTimes,
+                      const std::vector<double>& rOutputPoints,
+                      const std::vector<unsigned>& rFirstPoints,
+                      bool recordOutputs)
+        : mrModels(rModels),
+          mrSliceTimes(rSliceTimes),
+          mrOutputPoints(rOutputPoints),
+          mrFirstPoints(rFirstPoints),
+          mRecordOutputs(recordOutputs),
+          mStarts(rModels.size()),
+          mEnds(rModels.size()),
+          mOutputs(rOutputPoints.size()),
+          mFirstSlice(0u)
+    {}
+
+    /**
+     * Solve the slices from the given one onwards; the loop's iterations are numbered from there.
+     * @param firstSlice  the first slice whose start state may have changed
+     */
+    void SetFirstSlice(unsigned firstSlice)
+    {
+        mFirstSlice = firstSlice;
+    }
+
+    /**
+     * Solve a range of slices.
+     * @param start  the first iteration to run
+     * @param end  one past the last iteration to run
+     */
+    void RunIterations(unsigned start, unsigned end)
+    {
+        for (unsigned slice=mFirstSlice+start; slice<mFirstSlice+end; ++slice)
+        {
+            AbstractSystemWithOutputs& r_model = *mrModels[slice];
+            r_model.SetStateValues(mStarts[slice]);
+            r_model.SetFreeVariable(mrSliceTimes[slice]);
+            for (unsigned i=mrFirstPoints[slice]; i<mrFirstPoints[slice+1]; ++i)
+            {
+                if (mrOutputPoints[i] > r_model.GetFreeVariable())
+                {
+                    r_model.SolveModel(mrOutputPoints[i]);
+                }
+                if (mRecordOutputs)
+                {
+                    mOutputs[i] = r_model.GetOutputs();
+                }
+            }
+            if (mrSliceTimes[slice+1] > r_model.GetFreeVariable())
+            {
+                r_model.SolveModel(mrSliceTimes[slice+1]);
+            }
+            r_model.GetStateValues(mEnds[slice]);
+        }
+    }
+
+    /** @return  the state at the start of each slice, to be filled in by the caller. */
+    std::vector<std::vector<double> >& rGetStarts()
+    {
+        return mStarts;
+    }
+
+    /** @return  the state at the end of each slice, as last solved. */
+    const std::vector<std::vector<double> >& rGetEnds() const
+    {
+        return mEnds;
+    }
+
+    /** @return  the model outputs at each output point, as last solved. */
+    const std::vector<EnvironmentCPtr>& rGetOutputs() const
+    {
+        return mOutputs;
+    }
+
+private:
+    /** A copy of the model for each slice. */
+    const std::vector<boost::shared_ptr<AbstractSystemWithOutputs> >& mrModels;
+    /** The start of each slice, followed by the end of the last. */
+    const std::vector<double>& mrSliceTimes;
+    /** The output points of the whole simulation. */
+    const std::vector<double>& mrOutputPoints;
+    /** The index of the first output point in each slice, followed by the number of points. */
+    const std::vector<unsigned>& mrFirstPoints;
+    /** Whether to record the model outputs. */
+    bool mRecordOutputs;
+    /** The state at the start of each slice. */
+    std::vector<std::vector<double> > mStarts;
+    /** The state at the end of each slice. */
+    std::vector<std::vector<double> > mEnds;
+    /** The model outputs at each output point. */
+    std::vector<EnvironmentCPtr> mOutputs;
+    /** The first slice to solve. */
+    unsigned mFirstSlice;
+};
+
+
+/**
+ * Solve a model from one point to another, starting from the given state.
+ *
+ * @param rModel  the model
+ * @param startPoint  the initial value of the free variable
+ * @param rStart  the initial state
+ * @param endPoint  the final value of the free variable
+ * @param rEnd  filled in with the final state
+ */
+static void Propagate(AbstractSystemWithOutputs& rModel, double startPoint, const std::vector<double>& rStart,
+                      double endPoint, std::vector<double>& rEnd)
+{
+    rModel.SetStateValues(rStart);
+    rModel.SetFreeVariable(startPoint);
+    rModel.SolveModel(endPoint);
+    rModel.GetStateValues(rEnd);
+}
+
+
+/**
+ * @return  the largest change between two states, relative to the size of each state variable.
+ *
+ * @param rOld  the old state
+ * @param rNew  the new state
+ */
+static double RelativeChange(const std::vector<double>& rOld, const std::vector<double>& rNew)
+{
+    double change = 0.0;
+    for (unsigned i=0; i<rNew.size(); ++i)
+    {
+        change = std::max(change, std::fabs(rNew[i] - rOld[i]) / std::max(std::fabs(rNew[i]), 1e-6));
+    }
+    return change;
+}
+
+
 TimecourseSimulation::TimecourseSimulation(boost::shared_ptr<AbstractSystemWithOutputs> pModel,
                                            boost::shared_ptr<AbstractStepper> pStepper,
                                            boost::shared_ptr<ModifierCollection> pModifiers)
-    : AbstractSimulation(pModel, pStepper, pModifiers)
+    : AbstractSimulation(pModel, pStepper, pModifiers),
+      mNumPararealSweeps(0u)
 {
 }
 
 
+void TimecourseSimulation::AddEvent(const std::string& rName, const std::string& rVariable, bool rateOfChange,
+                                    AbstractExpressionPtr pThreshold, int direction)
+{
+    PROTO_ASSERT(direction >= -1 && direction <= 1, "Invalid direction " << direction << " for event " << rName << ".");
+    AbstractSystemWithOutputs::EventInfo event;
+    event.variable = rVariable;
+    event.rateOfChange = rateOfChange;
+    event.threshold = 0.0;
+    event.direction = direction;
+    mEventNames.push_back(rName);
+    mEvents.push_back(event);
+    mEventThresholds.push_back(pThreshold);
+}
+
+
+const std::vector<std::string>& TimecourseSimulation::rGetEventNames() const
+{
+    return mEventNames;
+}
+
+
+void TimecourseSimulation::CollectExpressions(std::vector<AbstractExpressionPtr>& rExpressions) const
+{
+    AbstractSimulation::CollectExpressions(rExpressions);
+    rExpressions.insert(rExpressions.end(), mEventThresholds.begin(), mEventThresholds.end());
+    typedef std::pair<std::string, AbstractExpressionPtr> StringExprPair;
+    BOOST_FOREACH(const StringExprPair& r_setting, mPararealSettings)
+    {
+        rExpressions.push_back(r_setting.second);
+    }
+}
+
+
+void TimecourseSimulation::SetPararealSetting(const std::string& rName, AbstractExpressionPtr pValue)
+{
+    PROTO_ASSERT(rName == "slices" || rName == "tolerance" || rName == "coarseRelTol" || rName == "coarseAbsTol"
+                 || rName == "coarseMaxStep",
+                 "Unknown parareal setting " << rName
+                 << "; must be one of slices, tolerance, coarseRelTol, coarseAbsTol or coarseMaxStep.");
+    mPararealSettings[rName] = pValue;
+}
+
+
+unsigned TimecourseSimulation::GetNumPararealSweeps() const
+{
+    return mNumPararealSweeps;
+}
+
+
+AbstractSimulationPtr TimecourseSimulation::Clone() const
+{
+    boost::shared_ptr<TimecourseSimulation> p_copy;
+    AbstractStepperPtr p_stepper = mpStepper->Clone();
+    if (p_stepper)
+    {
+        p_copy.reset(new TimecourseSimulation(mpModel, p_stepper, mpModifiers));
+        CopySettingsTo(*p_copy);
+        p_copy->mPararealSettings = mPararealSettings;
+        p_copy->mEventNames = mEventNames;
+        p_copy->mEvents = mEvents;
+        p_copy->mEventThresholds = mEventThresholds;
+    }
+    return p_copy;
+}
+
+
+bool TimecourseSimulation::CanRunInLockStep() const
+{
+    return mpStepper->IsEndFixed() && mEvents.empty() && mPararealSettings.empty();
+}
+
+
+void TimecourseSimulation::RunInLockStep(const std::vector<boost::shared_ptr<TimecourseSimulation> >& rInstances,
+                                         EnvironmentPtr pResults)
+{
+    // As in RunNative, once the results arrays exist outputs can be recorded straight into them
+    std::vector<bool> record_directly(rInstances.size(), false);
+    for (unsigned i=0; i<rInstances.size(); ++i)
+    {
+        TimecourseSimulation& r_instance = *rInstances[i];
+        assert(r_instance.CanRunInLockStep());
+        r_instance.mpStepper->Reset();
+        record_directly[i] = r_instance.mNativeLoops && pResults && pResults->GetNumberOfDefinitions() > 0u
+                             && r_instance.StartDirectRecording(pResults);
+    }
+    // The instances' loops are copies, so they all reach the end together
+    AbstractStepperPtr p_stepper = rInstances.front()->mpStepper;
+    while (!p_stepper->AtEnd())
+    {
+        for (unsigned i=0; i<rInstances.size(); ++i)
+        {
+            TimecourseSimulation& r_instance = *rInstances[i];
+            r_instance.LoopBodyStartHook();
+            r_instance.mpModel->SetFreeVariable(r_instance.mpStepper->GetCurrentOutputPoint());
+            if (record_directly[i])
+            {
+                r_instance.RecordOutputsDirectly();
+            }
+            else
+            {
+                r_instance.AddIterationOutputs(pResults, r_instance.mpModel->GetOutputs());
+            }
+            r_instance.LoopBodyEndHook();
+        }
+        // Simulate every instance until the next output point, if there is one
+        for (unsigned i=0; i<rInstances.size(); ++i)
+        {
+            TimecourseSimulation& r_instance = *rInstances[i];
+            const double next_time = r_instance.mpStepper->Step();
+            if (!r_instance.mpStepper->AtEnd())
+            {
+                r_instance.mpModel->SolveModel(next_time);
+            }
+        }
+    }
+    BOOST_FOREACH(boost::shared_ptr<TimecourseSimulation> p_instance, rInstances)
+    {
+        p_instance->LoopEndHook();
+    }
+}
+
+
+double TimecourseSimulation::EvaluatePararealSetting(const std::string& rName, double defaultValue)
+{
+    std::map<std::string, AbstractExpressionPtr>::const_iterator it = mPararealSettings.find(rName);
+    if (it == mPararealSettings.end())
+    {
+        return defaultValue;
+    }
+    AbstractValuePtr p_value = (*it->second)(*mpEnvironment);
+    PROTO_ASSERT(p_value->IsDouble(), "The parareal setting " << rName << " must be a real number.");
+    const double value = GET_SIMPLE_VALUE(p_value);
+    PROTO_ASSERT(value > 0.0, "The parareal setting " << rName << " must be positive, not " << value << ".");
+    return value;
+}
+
+
+std::vector<AbstractSystemWithOutputs::EventInfo> TimecourseSimulation::GetEventsToLocate()
+{
+    std::vector<AbstractSystemWithOutputs::EventInfo> events(mEvents);
+    const std::map<std::string, EnvironmentPtr>& r_model_envs = mpModel->rGetEnvironmentMap();
+    for (unsigned i=0; i<events.size(); ++i)
+    {
+        AbstractValuePtr p_threshold = (*mEventThresholds[i])(*mpEnvironment);
+        PROTO_ASSERT(p_threshold->IsDouble(),
+                     "The threshold for event " << mEventNames[i] << " must be a real number.");
+        events[i].threshold = GET_SIMPLE_VALUE(p_threshold);
+        // The model knows its variables by their local names
+        std::string& r_variable = events[i].variable;
+        const size_t colon = r_variable.find(':');
+        PROTO_ASSERT(colon != std::string::npos && r_model_envs.find(r_variable.substr(0, colon)) != r_model_envs.end(),
+                     "Event " << mEventNames[i] << " must monitor a model variable, not " << r_variable << ".");
+        r_variable = r_variable.substr(colon + 1);
+    }
+    return events;
+}
+
+
+EnvironmentCPtr TimecourseSimulation::GetOutputsWithEvents()
+{
+    EnvironmentCPtr p_model_outputs = mpModel->GetOutputs();
+    if (mEvents.empty())
+    {
+        return p_model_outputs;
+    }
+    EnvironmentPtr p_outputs(new Environment);
+    p_outputs->Merge(*p_model_outputs, GetLocationInfo());
+    // At the first output point no time has passed, so no events can have occurred
+    const std::vector<double>& r_times = mpModel->rGetEventTimes();
+    const bool at_start = (mpStepper->GetCurrentOutputNumber() == 0u);
+    for (unsigned i=0; i<mEventNames.size(); ++i)
+    {
+        const double time = at_start ? std::numeric_limits<double>::quiet_NaN() : r_times[i];
+        AbstractValuePtr p_time = boost::make_shared<SimpleValue>(time);
+        p_time->SetUnits(mpStepper->GetUnits());
+        p_outputs->DefineName(mEventNames[i], p_time, GetLocationInfo());
+    }
+    return p_outputs;
+}
+
+
 void TimecourseSimulation::Run(EnvironmentPtr pResults)
 {
+    if (!mPararealSettings.empty() && mpStepper->IsEndFixed() && mEvents.empty() && RunParareal(pResults))
+    {
+        LoopEndHook();
+        return;
+    }
+    if (mNativeLoops && mpStepper->IsEndFixed() && mEvents.empty())
+    {
+        RunNative(pResults);
+        return;
+    }
+    LocateEventsHere locate_events(mpModel, GetEventsToLocate());
     // Loop over time
     mpStepper->Reset();
     while (!mpStepper->AtEnd())
@@ -52,7 +447,7 @@ void TimecourseSimulation::Run(EnvironmentPtr pResults)
         LoopBodyStartHook();
         mpModel->SetFreeVariable(mpStepper->GetCurrentOutputPoint());
         // Compute outputs here, so we get the initial state
-        AddIterationOutputs(pResults, mpModel->GetOutputs());
+        AddIterationOutputs(pResults, GetOutputsWithEvents());
         LoopBodyEndHook();
         // Simulate until the next output point, if there is one
         const double next_time = mpStepper->Step();
@@ -63,3 +458,210 @@ void TimecourseSimulation::Run(EnvironmentPtr pResults)
     }
     LoopEndHook();
 }
+
+
+void TimecourseSimulation::RunNative(EnvironmentPtr pResults)
+{
+    // With a fixed end point the loop hooks only need to apply modifiers, and once the results
+    // arrays exist we can record outputs straight into them.
+    const bool have_modifiers = (mpModifiers->GetNumModifiers() > 0u);
+    mpStepper->Reset();
+    bool record_directly = pResults && pResults->GetNumberOfDefinitions() > 0u && StartDirectRecording(pResults);
+    bool try_direct = !record_directly;
+    while (!mpStepper->AtEnd())
+    {
+        if (have_modifiers)
+        {
+            (*mpModifiers)(mpModel, mpStepper);
+        }
+        mpModel->SetFreeVariable(mpStepper->GetCurrentOutputPoint());
+        if (record_directly)
+        {
+            RecordOutputsDirectly();
+        }
+        else if (pResults)
+        {
+            AddIterationOutputs(pResults, mpModel->GetOutputs());
+            if (try_direct)
+            {
+                record_directly = StartDirectRecording(pResults);
+                try_direct = false;
+            }
+        }
+        // Simulate until the next output point, if there is one
+        const double next_time = mpStepper->Step();
+        if (!mpStepper->AtEnd())
+        {
+            mpModel->SolveModel(next_time);
+        }
+    }
+    LoopEndHook();
+}
+
+
+bool TimecourseSimulation::RunParareal(EnvironmentPtr pResults)
+{
+    mNumPararealSweeps = 0u;
+    const double num_slices = EvaluatePararealSetting("slices", 1.0);
+    PROTO_ASSERT(num_slices == std::floor(num_slices),
+                 "The number of parareal slices must be a positive integer, not " << num_slices << ".");
+    const double tolerance = EvaluatePararealSetting("tolerance", 1e-6);
+    if (num_slices < 2.0 || ThreadPool::InParallelRegion())
+    {
+        return false;
+    }
+    // Modifiers applied during the loop would need the slices to be solved in order
+    for (unsigned i=0; i<mpModifiers->GetNumModifiers(); ++i)
+    {
+        if ((*mpModifiers)[i]->GetWhenApplied() == AbstractSimulationModifier::EVERY_LOOP)
+        {
+            return false;
+        }
+    }
+    std::vector<double> points;
+    for (mpStepper->Reset(); !mpStepper->AtEnd(); mpStepper->Step())
+    {
+        points.push_back(mpStepper->GetCurrentOutputPoint());
+        if (points.size() > 1u && points.back() <= points[points.size() - 2])
+        {
+            return false;
+        }
+    }
+    if (points.size() < 2u)
+    {
+        return false;
+    }
+
+    // From here on we run the simulation, solving in order if Parareal fails for any reason
+    mpStepper->Reset();
+    (*mpModifiers)(mpModel, mpStepper);
+    mpModel->SetFreeVariable(points.front());
+    const unsigned num_slices_int = static_cast<unsigned>(num_slices);
+    std::vector<double> slice_times(num_slices_int + 1u);
+    std::vector<unsigned> first_points(num_slices_int + 1u, 0u);
+    for (unsigned slice=1; slice<=num_slices_int; ++slice)
+    {
+        slice_times[slice] = points.front() + (points.back() - points.front()) * slice / num_slices_int;
+        first_points[slice] = std::upper_bound(points.begin(), points.end(), slice_times[slice]) - points.begin();
+    }
+    slice_times.front() = points.front();
+    slice_times.back() = points.back();
+    first_points.back() = points.size();
+
+    bool solved = false;
+    std::vector<boost::shared_ptr<AbstractSystemWithOutputs> > fine_models;
+    PararealFineSweep sweep(fine_models, slice_times, points, first_points, bool(pResults));
+    try
+    {
+        std::vector<std::vector<double> >& r_starts = sweep.rGetStarts();
+        if (mpModel->GetStateValues(r_starts.front()))
+        {
+            fine_models.resize(num_slices_int);
+            for (unsigned slice=0; slice<num_slices_int; ++slice)
+            {
+                fine_models[slice] = mpModel->Clone();
+            }
+            // The coarse solver is a copy of the model with looser settings
+            boost::shared_ptr<AbstractSystemWithOutputs> p_coarse_model = mpModel->Clone();
+            AbstractSystemWithOutputs::SolverSettings coarse_settings;
+            const AbstractSystemWithOutputs::SolverSettings fine_settings = mpModel->GetSolverSettings();
+            if (fine_settings.relTol != DOUBLE_UNSET)
+            {
+                coarse_settings.relTol = 1e-4;
+                coarse_settings.absTol = 1e-6;
+            }
+            else if (fine_settings.maxStep != DOUBLE_UNSET)
+            {
+                coarse_settings.maxStep = 10.0 * fine_settings.maxStep;
+            }
+            coarse_settings.relTol = EvaluatePararealSetting("coarseRelTol", coarse_settings.relTol);
+            coarse_settings.absTol = EvaluatePararealSetting("coarseAbsTol", coarse_settings.absTol);
+            coarse_settings.maxStep = EvaluatePararealSetting("coarseMaxStep", coarse_settings.maxStep);
+            p_coarse_model->SetSolverSettings(coarse_settings);
+
+            // Predict the start of each slice with the coarse solver
+            std::vector<std::vector<double> > coarse_ends(num_slices_int);
+            for (unsigned slice=0; slice<num_slices_int; ++slice)
+            {
+                Propagate(*p_coarse_model, slice_times[slice], r_starts[slice], slice_times[slice+1], coarse_ends[slice]);
+                if (slice + 1u < num_slices_int)
+                {
+                    r_starts[slice+1] = coarse_ends[slice];
+                }
+            }
+
+            UseThreadsHere use_threads(std::min(num_slices_int, std::max(1u, boost::thread::hardware_concurrency())));
+            // Slices before the first are exact, since their start states can no longer change
+            unsigned first_slice = 0u;
+            solved = true;
+            while (solved)
+            {
+                sweep.SetFirstSlice(first_slice);
+                solved = ThreadPool::Instance()->Run(sweep, num_slices_int - first_slice);
+                if (solved)
+                {
+                    ++mNumPararealSweeps;
+                    // Correct the later start states, carrying the corrections forward with the coarse solver
+                    const std::vector<std::vector<double> >& r_ends = sweep.rGetEnds();
+                    std::vector<double> next_start = r_ends[first_slice];
+                    std::vector<double> coarse_end;
+                    double max_change = 0.0;
+                    for (unsigned slice=first_slice+1; slice<num_slices_int; ++slice)
+                    {
+                        max_change = std::max(max_change, RelativeChange(r_starts[slice], next_start));
+                        r_starts[slice] = next_start;
+                        Propagate(*p_coarse_model, slice_times[slice], r_starts[slice], slice_times[slice+1], coarse_end);
+                        for (unsigned i=0; i<next_start.size(); ++i)
+                        {
+                            next_start[i] = coarse_end[i] + r_ends[slice][i] - coarse_ends[slice][i];
+                        }
+                        coarse_ends[slice] = coarse_end;
+                    }
+                    ++first_slice;
+                    if (max_change <= tolerance)
+                    {
+                        // The slices were solved from start states this close to the corrected ones
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    catch (const Exception&)
+    {
+        // E.g. the model can't be cloned, or the coarse solver failed
+        solved = false;
+    }
+
+    mpStepper->Reset();
+    if (solved)
+    {
+        for (unsigned i=0; i<points.size(); ++i)
+        {
+            if (pResults)
+            {
+                AddIterationOutputs(pResults, sweep.rGetOutputs()[i]);
+            }
+            mpStepper->Step();
+        }
+        mpModel->SetStateValues(sweep.rGetEnds().back());
+        mpModel->SetFreeVariable(points.back());
+    }
+    else
+    {
+        // Solve in order on the model itself, which reports any errors properly;
+        // modifiers have already been applied
+        mNumPararealSweeps = 0u;
+        while (!mpStepper->AtEnd())
+        {
+            mpModel->SetFreeVariable(mpStepper->GetCurrentOutputPoint());
+            AddIterationOutputs(pResults, mpModel->GetOutputs());
+            const double next_time = mpStepper->Step();
+            if (!mpStepper->AtEnd())
+            {
+                mpModel->SolveModel(next_time);
+            }
+        }
+    }
+    return true;
+}
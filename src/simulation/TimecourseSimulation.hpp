@@ -36,10 +36,22 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef TIMECOURSESIMULATION_HPP_
 #define TIMECOURSESIMULATION_HPP_
 
+#include <string>
+#include <vector>
+#include <map>
 #include "AbstractSimulation.hpp"
+#include "AbstractExpression.hpp"
 
 /**
  * Simulate the cell against time.
+ *
+ * Long simulations may optionally be solved in parallel in time, using the Parareal algorithm (see
+ * SetPararealSetting).  The time span is split into slices, each solved accurately on its own copy of
+ * the model and its own thread, starting from states predicted by a cheap coarse solve through the
+ * slices in turn.  The start states are then corrected, using the difference between the accurate and
+ * coarse solutions of each slice, and the slices solved again, until the start states stop changing.
+ * Each iteration makes at least one more slice exact, so at worst this costs as much as solving in
+ * order, but typically only a few iterations are needed.
  */
 class TimecourseSimulation : public AbstractSimulation
 {
@@ -56,6 +68,83 @@ public:
                          boost::shared_ptr<AbstractStepper> pStepper,
                          boost::shared_ptr<ModifierCollection> pModifiers=boost::shared_ptr<ModifierCollection>());
 
+    /**
+     * Add an event for the model's solver to locate while this simulation runs.  The event occurs when a
+     * model variable, or its rate of change, crosses a threshold.  An extra result with the given name
+     * records, at each output point, the time at which the event first occurred since the previous output
+     * point, or NaN if it didn't.  So only coarse output sampling is needed to obtain exact event times.
+     *
+     * @param rName  the name of the result recording event times
+     * @param rVariable  the model variable to monitor, as a prefixed name, e.g. oxmeta:membrane_voltage
+     * @param rateOfChange  whether to monitor the time derivative of the variable instead
+     * @param pThreshold  computes the threshold, which is evaluated each time the simulation is run
+     * @param direction  which crossings count: 1 for rising only, -1 for falling only, or 0 for either
+     */
+    void AddEvent(const std::string& rName, const std::string& rVariable, bool rateOfChange,
+                  AbstractExpressionPtr pThreshold, int direction);
+
+    /** @return the names of the results recording event times, if any. */
+    const std::vector<std::string>& rGetEventNames() const;
+
+    /**
+     * Add the expressions evaluated by this simulation, including event thresholds, to the given vector.
+     *
+     * @param rExpressions  the vector to add to
+     */
+    void CollectExpressions(std::vector<AbstractExpressionPtr>& rExpressions) const;
+
+    /**
+     * Set an option for solving this simulation in parallel in time.  Each value is evaluated in this
+     * simulation's environment when it starts to run.  Parareal is only used if the simulation has a
+     * fixed end point, locates no events, and has no modifiers applied every time round its loop, and
+     * the model can be cloned; otherwise the simulation is solved in order as usual.
+     *
+     * @param rName  the option, one of:
+     *  - slices  how many slices to split the time span into, each solved on its own thread; 1 (the
+     *    default) disables Parareal
+     *  - tolerance  the iteration stops when no slice's start state changes by more than this, relative
+     *    to the size of each state variable; defaults to 1e-6
+     *  - coarseRelTol, coarseAbsTol  the tolerances for the coarse solver, if the model is solved with
+     *    CVODE; default to 1e-4 and 1e-6
+     *  - coarseMaxStep  the maximum step for the coarse solver, or its step size for fixed step methods;
+     *    defaults to that of the model for CVODE, and 10 times it for fixed step methods
+     * @param pValue  expression giving the option's value
+     */
+    void SetPararealSetting(const std::string& rName, AbstractExpressionPtr pValue);
+
+    /**
+     * @return  how many times Parareal solved the slices accurately the last time this simulation was run,
+     * or 0 if it was solved in order.
+     */
+    unsigned GetNumPararealSweeps() const;
+
+    /**
+     * Create a copy of this simulation, with its events and Parareal settings, provided our stepper
+     * can be copied.
+     *
+     * @return  the copy, or an empty pointer if it can't be made
+     */
+    AbstractSimulationPtr Clone() const;
+
+    /**
+     * @return  whether copies of this simulation can be run in lock-step (see RunInLockStep): its loop
+     * must have a fixed end point, and it mustn't locate events or be solved with Parareal.
+     */
+    bool CanRunInLockStep() const;
+
+    /**
+     * Run copies of a simulation (see Clone) as an ensemble, each on its own copy of the model, filling
+     * in the same results as running each in turn would.  The copies step through their loops together:
+     * at each output point every copy records its model outputs, filling in one row of the results each,
+     * and then every model is solved up to the next point.  The loops enclosing each copy must already
+     * be at the iteration whose results it is to fill in.
+     *
+     * @param rInstances  the copies to run; each must satisfy CanRunInLockStep
+     * @param pResults  an Environment to be filled in with results, or an empty pointer
+     */
+    static void RunInLockStep(const std::vector<boost::shared_ptr<TimecourseSimulation> >& rInstances,
+                              EnvironmentPtr pResults);
+
 protected:
     /**
      * Run a simulation, filling in the results.
@@ -63,6 +152,61 @@ protected:
      * @param pResults  an Environment to be filled in with results
      */
     void Run(EnvironmentPtr pResults);
+
+private:
+    /**
+     * The specialised version of Run used if SetNativeLoops has been called and our stepper has a
+     * fixed end point.  This behaves identically, but avoids interpreter overheads at each step.
+     *
+     * @param pResults  an Environment to be filled in with results, or an empty pointer
+     */
+    void RunNative(EnvironmentPtr pResults);
+
+    /**
+     * The version of Run used if Parareal has been requested.  Returns false, having done nothing,
+     * if Parareal can't be used for this simulation; otherwise it fills in the results just as Run
+     * does, except for calling LoopEndHook.
+     *
+     * @param pResults  an Environment to be filled in with results, or an empty pointer
+     * @return  whether the simulation was run
+     */
+    bool RunParareal(EnvironmentPtr pResults);
+
+    /** Expressions for the options controlling Parareal, by name. */
+    std::map<std::string, AbstractExpressionPtr> mPararealSettings;
+
+    /** How many fine sweeps Parareal took the last time we were run. */
+    unsigned mNumPararealSweeps;
+
+    /**
+     * Evaluate one of the options controlling Parareal.
+     *
+     * @param rName  the option's name
+     * @param defaultValue  the value to use if the option wasn't given
+     * @return  its value
+     */
+    double EvaluatePararealSetting(const std::string& rName, double defaultValue);
+
+    /** The names of the results recording event times. */
+    std::vector<std::string> mEventNames;
+
+    /** The events to locate; thresholds are filled in each time we run. */
+    std::vector<AbstractSystemWithOutputs::EventInfo> mEvents;
+
+    /** Expressions computing the threshold for each event. */
+    std::vector<AbstractExpressionPtr> mEventThresholds;
+
+    /**
+     * @return  our events in the form the model needs: with thresholds evaluated in the current
+     * simulation environment, and variable names without their prefix.
+     */
+    std::vector<AbstractSystemWithOutputs::EventInfo> GetEventsToLocate();
+
+    /**
+     * Get the model outputs at the current output point, along with the times of any events since
+     * the previous one.
+     */
+    EnvironmentCPtr GetOutputsWithEvents();
 };
 
 #endif /*TIMECOURSESIMULATION_HPP_*/
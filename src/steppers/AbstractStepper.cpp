@@ -86,6 +86,18 @@ Environment& AbstractStepper::rGetEnvironment() const
 }
 
 
+void AbstractStepper::CollectExpressions(std::vector<AbstractExpressionPtr>& rExpressions) const
+{
+    rExpressions.insert(rExpressions.end(), mExpressions.begin(), mExpressions.end());
+}
+
+
+AbstractStepperPtr AbstractStepper::Clone() const
+{
+    return AbstractStepperPtr();
+}
+
+
 std::vector<double> AbstractStepper::EvaluateParameters(bool allowArray)
 {
     EXCEPT_IF_NOT(mpEnvironment);
@@ -138,6 +138,25 @@ public:
     /** Get the environment in which this stepper's value is bound. */
     Environment& rGetEnvironment() const;
 
+    /**
+     * Get the protocol language expressions this stepper evaluates, so callers can determine
+     * which names it may reference.  The default implementation gives #mExpressions.
+     *
+     * @param rExpressions  the expressions will be appended to this vector
+     */
+    virtual void CollectExpressions(std::vector<AbstractExpressionPtr>& rExpressions) const;
+
+    /**
+     * Create a stepper with the same output points as this one, so that a copy of the loop it controls
+     * can be run alongside it (see AbstractSimulation::Clone).  This stepper must have been initialised,
+     * since the copy's points are fixed values.  The copy has no environment and is at its start.  The
+     * default implementation returns an empty pointer, for steppers whose points are only computed as
+     * they step.
+     *
+     * @return  the copy, or an empty pointer if this stepper can't be copied
+     */
+    virtual AbstractStepperPtr Clone() const;
+
 protected:
     /** The name of our index variable */
     std::string mIndexName;
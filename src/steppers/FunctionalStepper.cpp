@@ -88,3 +88,10 @@ double FunctionalStepper::Step()
     SetCurrentOutputPoint(GET_SIMPLE_VALUE(p_value));
     return GetCurrentOutputPoint();
 }
+
+
+void FunctionalStepper::CollectExpressions(std::vector<AbstractExpressionPtr>& rExpressions) const
+{
+    AbstractStepper::CollectExpressions(rExpressions);
+    rExpressions.push_back(mpExpr);
+}
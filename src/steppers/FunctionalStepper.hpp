@@ -92,6 +92,13 @@ public:
      */
     double Step();
 
+    /**
+     * Get the protocol language expressions this stepper evaluates, i.e. its expression giving each value.
+     *
+     * @param rExpressions  the expressions will be appended to this vector
+     */
+    void CollectExpressions(std::vector<AbstractExpressionPtr>& rExpressions) const;
+
 private:
     /** The function giving this stepper's value at each step. */
     AbstractExpressionPtr mpExpr;
@@ -117,3 +117,28 @@ void MultipleStepper::SetEnvironment(EnvironmentPtr pEnv)
         p_stepper->SetEnvironment(pEnv);
     }
 }
+
+
+void MultipleStepper::CollectExpressions(std::vector<AbstractExpressionPtr>& rExpressions) const
+{
+    BOOST_FOREACH(AbstractStepperPtr p_stepper, mSteppers)
+    {
+        p_stepper->CollectExpressions(rExpressions);
+    }
+}
+
+
+AbstractStepperPtr MultipleStepper::Clone() const
+{
+    std::vector<AbstractStepperPtr> copies;
+    BOOST_FOREACH(AbstractStepperPtr p_stepper, mSteppers)
+    {
+        AbstractStepperPtr p_copy = p_stepper->Clone();
+        if (!p_copy)
+        {
+            return AbstractStepperPtr();
+        }
+        copies.push_back(p_copy);
+    }
+    return AbstractStepperPtr(new MultipleStepper(copies));
+}
@@ -104,6 +104,20 @@ public:
      */
     void SetEnvironment(EnvironmentPtr pEnv);
 
+    /**
+     * Get the protocol language expressions evaluated by any of our steppers.
+     *
+     * @param rExpressions  the expressions will be appended to this vector
+     */
+    void CollectExpressions(std::vector<AbstractExpressionPtr>& rExpressions) const;
+
+    /**
+     * Create a copy of this collection, copying each of our steppers.
+     *
+     * @return  the copy, or an empty pointer if any of our steppers can't be copied
+     */
+    AbstractStepperPtr Clone() const;
+
 private:
     /** The ranges in this collection. */
     std::vector<AbstractStepperPtr> mSteppers;
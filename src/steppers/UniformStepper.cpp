@@ -131,6 +131,12 @@ double UniformStepper::Step()
 }
 
 
+AbstractStepperPtr UniformStepper::Clone() const
+{
+    return AbstractStepperPtr(new UniformStepper(mIndexName, mIndexUnits, mStartPoint, mEndPoint, mInterval));
+}
+
+
 double UniformStepper::GetStartPoint() const
 {
     return mStartPoint;
@@ -113,6 +113,11 @@ public:
      */
     double Step();
 
+    /**
+     * Create a uniform stepper over the same range as this one.
+     */
+    AbstractStepperPtr Clone() const;
+
     /** Get method for #mStartPoint */
     double GetStartPoint() const;
 
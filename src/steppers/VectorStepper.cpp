@@ -94,3 +94,10 @@ double VectorStepper::Step()
     SetCurrentOutputPoint(mCurrentStep < mValues.size() ? mValues[mCurrentStep] : DOUBLE_UNSET);
     return GetCurrentOutputPoint();
 }
+
+
+AbstractStepperPtr VectorStepper::Clone() const
+{
+    PROTO_ASSERT(!mValues.empty(), "Un-initialised stepper!");
+    return AbstractStepperPtr(new VectorStepper(mIndexName, mIndexUnits, mValues));
+}
@@ -102,6 +102,11 @@ public:
      */
     double Step();
 
+    /**
+     * Create a stepper over the same values as this one.
+     */
+    AbstractStepperPtr Clone() const;
+
 private:
     /** The values to iterate over. */
     std::vector<double> mValues;
@@ -103,3 +103,10 @@ double WhileStepper::Step()
 
     return GetCurrentOutputPoint();
 }
+
+
+void WhileStepper::CollectExpressions(std::vector<AbstractExpressionPtr>& rExpressions) const
+{
+    AbstractStepper::CollectExpressions(rExpressions);
+    rExpressions.push_back(mpCondition);
+}
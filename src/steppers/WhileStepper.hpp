@@ -92,6 +92,13 @@ public:
      */
     double Step();
 
+    /**
+     * Get the protocol language expressions this stepper evaluates, i.e. its loop condition.
+     *
+     * @param rExpressions  the expressions will be appended to this vector
+     */
+    void CollectExpressions(std::vector<AbstractExpressionPtr>& rExpressions) const;
+
 private:
     /** The current estimate of the number of output points. */
     unsigned mNumberOfOutputPoints;
@@ -40,6 +40,7 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "VectorStreaming.hpp"
 #include "ProtoHelperMacros.hpp"
+#include "ThreadPool.hpp"
 
 
 out_stream DebugProto::mpTraceFile;
@@ -70,7 +71,8 @@ void DebugProto::StopTracing()
 
 bool DebugProto::IsTracing()
 {
-    return mpTraceFile.get();
+    // Trace output from parallel loops would be garbled; failures within them are re-run sequentially anyway
+    return mpTraceFile.get() && !ThreadPool::InParallelRegion();
 }
 
 
@@ -78,7 +80,15 @@ void DebugProto::TraceEnv(const Environment& rEnv)
 {
     BOOST_FOREACH(const std::string& r_name, rEnv.GetDefinedNames())
     {
-        TRACE_PROTO("  " << r_name << " = " << rEnv.Lookup(r_name, "DebugProto::TraceEnv") << std::endl);
+        if (rEnv.IsDefinitionPending(r_name))
+        {
+            // Tracing shouldn't trigger computations
+            TRACE_PROTO("  " << r_name << " = <not yet computed>" << std::endl);
+        }
+        else
+        {
+            TRACE_PROTO("  " << r_name << " = " << rEnv.Lookup(r_name, "DebugProto::TraceEnv") << std::endl);
+        }
     }
 }
 
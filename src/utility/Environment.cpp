@@ -140,6 +140,7 @@ EnvironmentCPtr FindDelegatee(const Environment& rEnv, std::string& rName, const
 void Environment::Clear()
 {
     mBindings.clear();
+    mLazyDefinitions.clear();
     BOOST_FOREACH(const std::string& r_prefix, rGetSubEnvironmentNames())
     {
         EnvironmentPtr p_sub_env
@@ -152,7 +153,7 @@ void Environment::Clear()
 bool Environment::HasName(const std::string& rName, const std::string& rCallerLocation) const
 {
     bool found = false;
-    if (mBindings.find(rName) != mBindings.end())
+    if (mBindings.find(rName) != mBindings.end() || mLazyDefinitions.find(rName) != mLazyDefinitions.end())
     {
         found = true;
     }
@@ -173,10 +174,15 @@ AbstractValuePtr Environment::Lookup(const std::string& rName, const std::string
 {
     AbstractValuePtr p_result;
     std::map<std::string, AbstractValuePtr>::const_iterator it = mBindings.find(rName);
+    LazyDefinitionMap::const_iterator lazy_it;
     if (it != mBindings.end())
     {
         p_result = it->second;
     }
+    else if ((lazy_it = mLazyDefinitions.find(rName)) != mLazyDefinitions.end())
+    {
+        p_result = ForceDefinition(rName, *lazy_it->second);
+    }
     else if (!mpDelegateeEnvs.empty())
     {
         std::string name = rName;
@@ -203,7 +209,7 @@ void Environment::DefineName(const std::string& rName, const AbstractValuePtr pV
                          rCallerLocation);
     }
     std::map<std::string, AbstractValuePtr>::const_iterator it = mBindings.find(rName);
-    if (it != mBindings.end())
+    if (it != mBindings.end() || mLazyDefinitions.find(rName) != mLazyDefinitions.end())
     {
         PROTO_EXCEPTION2("Name " << rName << " is already defined and may not be re-bound.", rCallerLocation);
     }
@@ -211,6 +217,60 @@ void Environment::DefineName(const std::string& rName, const AbstractValuePtr pV
 }
 
 
+void Environment::DefineLazily(const std::string& rName, const AbstractStatementPtr pStatement,
+                               const std::string& rCallerLocation)
+{
+    if (mBindings.find(rName) != mBindings.end() || mLazyDefinitions.find(rName) != mLazyDefinitions.end())
+    {
+        PROTO_EXCEPTION2("Name " << rName << " is already defined and may not be re-bound.", rCallerLocation);
+    }
+    boost::shared_ptr<LazyDefinition> p_defn(new LazyDefinition);
+    p_defn->pStatement = pStatement;
+    p_defn->computed = false;
+    p_defn->inProgress = false;
+    mLazyDefinitions[rName] = p_defn;
+}
+
+
+bool Environment::IsDefinitionPending(const std::string& rName) const
+{
+    LazyDefinitionMap::const_iterator it = mLazyDefinitions.find(rName);
+    if (it == mLazyDefinitions.end())
+    {
+        return false;
+    }
+    boost::recursive_mutex::scoped_lock lock(it->second->mutex);
+    return !it->second->computed;
+}
+
+
+AbstractValuePtr Environment::ForceDefinition(const std::string& rName, LazyDefinition& rDefinition) const
+{
+    boost::recursive_mutex::scoped_lock lock(rDefinition.mutex);
+    if (!rDefinition.computed)
+    {
+        const std::string& r_loc = rDefinition.pStatement->GetLocationInfo();
+        PROTO_ASSERT2(!rDefinition.inProgress, "Name " << rName << " is used in its own definition.", r_loc);
+        rDefinition.inProgress = true;
+        try
+        {
+            // Other threads may be reading our bindings, so define the name in a new environment
+            EnvironmentPtr p_defining_env(new Environment(GetAsDelegatee()));
+            p_defining_env->ExecuteStatement(rDefinition.pStatement);
+            rDefinition.pValue = p_defining_env->Lookup(rName, r_loc);
+        }
+        catch (...)
+        {
+            rDefinition.inProgress = false;
+            throw;
+        }
+        rDefinition.inProgress = false;
+        rDefinition.computed = true;
+    }
+    return rDefinition.pValue;
+}
+
+
 void Environment::DefineNames(const std::vector<std::string>& rNames,
                               const std::vector<AbstractValuePtr>& rValues,
                               const std::string& rCallerLocation)
@@ -287,19 +347,24 @@ void Environment::RemoveDefinition(const std::string& rName, const std::string&
 
 unsigned Environment::GetNumberOfDefinitions() const
 {
-    return mBindings.size();
+    return mBindings.size() + mLazyDefinitions.size();
 }
 
 
 std::vector<std::string> Environment::GetDefinedNames() const
 {
     std::vector<std::string> names;
-    names.reserve(mBindings.size());
+    names.reserve(mBindings.size() + mLazyDefinitions.size());
     for (std::map<std::string, AbstractValuePtr>::const_iterator it = mBindings.begin();
          it != mBindings.end(); ++it)
     {
         names.push_back(it->first);
     }
+    for (LazyDefinitionMap::const_iterator it = mLazyDefinitions.begin();
+         it != mLazyDefinitions.end(); ++it)
+    {
+        names.push_back(it->first);
+    }
     return names;
 }
 
@@ -41,6 +41,7 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <map>
 #include <boost/utility.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/recursive_mutex.hpp>
 #include <boost/enable_shared_from_this.hpp>
 
 #include "AbstractStatement.hpp"
@@ -152,6 +153,27 @@ public:
     virtual void DefineName(const std::string& rName, const AbstractValuePtr pValue,
                             const std::string& rCallerLocation);
 
+    /**
+     * Define a name whose value is computed on demand, by executing the given statement (which
+     * should assign to just this name) the first time the name is looked up.  The statement is
+     * executed in a fresh environment delegating to this one, so may refer to any of our names.
+     * This is thread safe, so that lookups may happen from parallel post-processing loops.
+     *
+     * @param rName  the name
+     * @param pStatement  the statement that will define it
+     * @param rCallerLocation  location information to use in error backtrace if name is already defined
+     */
+    void DefineLazily(const std::string& rName, const AbstractStatementPtr pStatement,
+                      const std::string& rCallerLocation);
+
+    /**
+     * Test whether a name in this environment was defined with DefineLazily and has not yet been
+     * looked up, so that looking it up would execute its definition.
+     *
+     * @param rName  the name to check
+     */
+    bool IsDefinitionPending(const std::string& rName) const;
+
     /**
      * Add a set of name-value mappings to the environment.
      * This is used to define function arguments in the local environment, for instance.
@@ -226,6 +248,38 @@ protected:
     std::map<std::string, AbstractValuePtr> mBindings;
 
 private:
+    /** A name defined with DefineLazily. */
+    struct LazyDefinition
+    {
+        /** The statement defining the name. */
+        AbstractStatementPtr pStatement;
+        /** The value, once computed. */
+        AbstractValuePtr pValue;
+        /** Whether the value has been computed. */
+        bool computed;
+        /** Whether the value is being computed, to detect circular definitions. */
+        bool inProgress;
+        /**
+         * Guards the fields above.  This is per definition, since computing one may use parallel
+         * loops whose threads need another, and recursive so circular definitions can be reported.
+         */
+        mutable boost::recursive_mutex mutex;
+    };
+
+    /**
+     * Get the value of a lazily defined name, computing it if this is the first lookup.
+     *
+     * @param rName  the name
+     * @param rDefinition  its definition
+     */
+    AbstractValuePtr ForceDefinition(const std::string& rName, LazyDefinition& rDefinition) const;
+
+    /** Type of a map from names to lazy definitions. */
+    typedef std::map<std::string, boost::shared_ptr<LazyDefinition> > LazyDefinitionMap;
+
+    /** Names defined with DefineLazily.  This map is not changed once definitions are looked up. */
+    LazyDefinitionMap mLazyDefinitions;
+
     /**
      * Environments to delegate to if we are asked to look up a name that isn't defined here.
      */
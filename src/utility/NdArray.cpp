@@ -322,6 +322,28 @@ NdArray<DATA> NdArray<DATA>::Copy() const
 }
 
 
+template<typename DATA>
+bool NdArray<DATA>::IsAliased() const
+{
+    return !mpInternalData.unique();
+}
+
+
+template<typename DATA>
+typename NdArray<DATA>::Indices NdArray<DATA>::GetIndices(Index offset, const Extents& rExtents) const
+{
+    // Last dimension varies fastest
+    const unsigned num_dims = rExtents.size();
+    Indices indices(num_dims, 0u);
+    for (unsigned dim = num_dims; dim-- != 0 && offset != 0; )
+    {
+        indices[dim] = offset % rExtents[dim];
+        offset /= rExtents[dim];
+    }
+    return indices;
+}
+
+
 template<typename DATA>
 void NdArray<DATA>::IncrementIndices(Indices& rIndices, const Extents& rExtents) const
 {
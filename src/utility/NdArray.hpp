@@ -154,6 +154,16 @@ public:
      */
     Indices GetIndices() const;
 
+    /**
+     * Get an Indices object referencing the element at the given position in iteration order,
+     * i.e. where IncrementIndices would reach after being called offset times.  This allows
+     * iteration over an array to be split into independent chunks.
+     *
+     * @param offset  the position of the element
+     * @param rExtents  the shape of the array to index
+     */
+    Indices GetIndices(Index offset, const Extents& rExtents) const;
+
     /**
      * Increment an Indices object to reference the next element of an array with the given shape.
      * It will wrap around to the beginning once it reaches the end of the array.
@@ -431,6 +441,12 @@ public:
      */
     NdArray<DATA> Copy() const;
 
+    /**
+     * Test whether any other array object, whether a copy or a view, refers to our data.
+     * If not, the data may safely be modified in place.
+     */
+    bool IsAliased() const;
+
 private:
     /**
      * The type of array internal data.  We don't contain these directly, but via a shared pointer,
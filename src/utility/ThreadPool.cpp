@@ -0,0 +1,237 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+
+#include "PetscTools.hpp"
+
+/** How many chunks to aim for per thread, so faster threads can pick up the slack. */
+const unsigned CHUNKS_PER_THREAD = 4u;
+
+boost::thread_specific_ptr<bool> ThreadPool::mpInParallelRegion;
+
+ThreadPool* ThreadPool::Instance()
+{
+    static ThreadPool pool;
+    return &pool;
+}
+
+ThreadPool::ThreadPool()
+    : mMinIterations(1000u),
+      mLoopNumber(0u),
+      mStopping(false),
+      mNumActiveWorkers(0u),
+      mpLoop(NULL),
+      mNumIterations(0u),
+      mChunkSize(1u),
+      mNextIteration(0u),
+      mFailed(false)
+{}
+
+ThreadPool::~ThreadPool()
+{
+    StopWorkers();
+}
+
+void ThreadPool::SetNumThreads(unsigned numThreads)
+{
+    boost::mutex::scoped_lock run_lock(mRunMutex);
+    StopWorkers();
+    if (numThreads > 1u)
+    {
+        // Chaste's singletons are created on first use, which isn't thread safe, so do that now
+        rGetChasteMutex();
+        Warnings::Instance();
+        PetscTools::GetMyRank();
+    }
+    for (unsigned i=1; i<numThreads; ++i)
+    {
+        mWorkers.push_back(boost::make_shared<boost::thread>(boost::bind(&ThreadPool::WorkerMain, this, mLoopNumber)));
+    }
+}
+
+unsigned ThreadPool::GetNumThreads() const
+{
+    return mWorkers.size() + 1u;
+}
+
+void ThreadPool::SetMinimumIterations(unsigned minIterations)
+{
+    mMinIterations = minIterations;
+}
+
+unsigned ThreadPool::GetMinimumIterations() const
+{
+    return mMinIterations;
+}
+
+bool ThreadPool::ShouldParallelise(unsigned numIterations) const
+{
+    return !mWorkers.empty() && numIterations >= mMinIterations && numIterations > 1u && !InParallelRegion();
+}
+
+bool ThreadPool::Run(AbstractParallelLoop& rLoop, unsigned numIterations)
+{
+    boost::mutex::scoped_lock run_lock(mRunMutex);
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        mpLoop = &rLoop;
+        mNumIterations = numIterations;
+        mChunkSize = std::max(1u, numIterations / (CHUNKS_PER_THREAD * GetNumThreads()));
+        mNextIteration = 0u;
+        mFailed = false;
+        mNumActiveWorkers = mWorkers.size();
+        mLoopNumber++;
+    }
+    mWorkReady.notify_all();
+    SetInParallelRegion(true);
+    RunChunks();
+    SetInParallelRegion(false);
+    boost::mutex::scoped_lock lock(mMutex);
+    while (mNumActiveWorkers > 0u)
+    {
+        mWorkDone.wait(lock);
+    }
+    mpLoop = NULL;
+    return !mFailed;
+}
+
+void ThreadPool::RunLoop(AbstractParallelLoop& rLoop, unsigned numIterations)
+{
+    ThreadPool* p_pool = Instance();
+    if (!p_pool->ShouldParallelise(numIterations) || !p_pool->Run(rLoop, numIterations))
+    {
+        rLoop.RunIterations(0u, numIterations);
+    }
+}
+
+bool ThreadPool::InParallelRegion()
+{
+    return mpInParallelRegion.get() != NULL;
+}
+
+void ThreadPool::SetInParallelRegion(bool inRegion)
+{
+    mpInParallelRegion.reset(inRegion ? new bool(true) : NULL);
+}
+
+void ThreadPool::CheckThreadSafe()
+{
+    if (InParallelRegion())
+    {
+        throw NotThreadSafe();
+    }
+}
+
+boost::mutex& ThreadPool::rGetChasteMutex()
+{
+    static boost::mutex mutex;
+    return mutex;
+}
+
+void ThreadPool::WorkerMain(unsigned lastLoopNumber)
+{
+    SetInParallelRegion(true);
+    unsigned last_loop_number = lastLoopNumber;
+    while (true)
+    {
+        {
+            boost::mutex::scoped_lock lock(mMutex);
+            while (!mStopping && mLoopNumber == last_loop_number)
+            {
+                mWorkReady.wait(lock);
+            }
+            if (mStopping)
+            {
+                break;
+            }
+            last_loop_number = mLoopNumber;
+        }
+        RunChunks();
+        {
+            boost::mutex::scoped_lock lock(mMutex);
+            mNumActiveWorkers--;
+        }
+        mWorkDone.notify_one();
+    }
+}
+
+void ThreadPool::RunChunks()
+{
+    while (true)
+    {
+        unsigned start, end;
+        {
+            // Chunks are large enough that claiming them under the lock costs little
+            boost::mutex::scoped_lock lock(mMutex);
+            if (mFailed || mNextIteration >= mNumIterations)
+            {
+                break;
+            }
+            start = mNextIteration;
+            end = std::min(start + mChunkSize, mNumIterations);
+            mNextIteration = end;
+        }
+        try
+        {
+            mpLoop->RunIterations(start, end);
+        }
+        catch (...)
+        {
+            // The caller will re-run the loop sequentially to report any error properly
+            boost::mutex::scoped_lock lock(mMutex);
+            mFailed = true;
+        }
+    }
+}
+
+void ThreadPool::StopWorkers()
+{
+    {
+        boost::mutex::scoped_lock lock(mMutex);
+        mStopping = true;
+    }
+    mWorkReady.notify_all();
+    for (unsigned i=0; i<mWorkers.size(); ++i)
+    {
+        mWorkers[i]->join();
+    }
+    mWorkers.clear();
+    mStopping = false;
+}
@@ -0,0 +1,272 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef THREADPOOL_HPP_
+#define THREADPOOL_HPP_
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/utility.hpp>
+
+#include "Warnings.hpp"
+
+/**
+ * Base class for loops that ThreadPool can run in parallel.  The loop iterations are split into
+ * contiguous chunks which may be run concurrently, so iterations must be independent, and write
+ * their results to disjoint locations.
+ */
+class AbstractParallelLoop
+{
+public:
+    /**
+     * Run a contiguous range of the loop's iterations.
+     *
+     * @param start  the first iteration to run
+     * @param end  one past the last iteration to run
+     */
+    virtual void RunIterations(unsigned start, unsigned end) = 0;
+
+    /** Virtual destructor since we have virtual methods. */
+    virtual ~AbstractParallelLoop()
+    {}
+};
+
+/**
+ * A pool of worker threads used to parallelise the protocol language's loop constructs (map, fold,
+ * and array comprehensions) over large arrays.  The calling thread takes part in running each loop.
+ *
+ * Parallelisation is off until SetNumThreads is called; Protocol enables it just for post-processing
+ * (see Protocol::SetNumPostProcessingThreads), when no model state is being changed.  Only loops with at
+ * least GetMinimumIterations() iterations are run in parallel, and nested loops always run sequentially.
+ *
+ * Evaluating protocol language expressions is thread safe provided they do not have side effects.
+ * Operations that do (tracing, loading files) call CheckThreadSafe, which aborts the parallel run if
+ * called within one.  Run then returns false, as it does if any iteration throws an exception, and
+ * callers must re-run the loop sequentially.  This ensures any errors are reported exactly as they
+ * would have been without parallelisation.
+ *
+ * Chaste's singletons, such as Warnings and PetscTools, aren't thread safe either.  Code that may run in
+ * a parallel loop must hold rGetChasteMutex() while using them, e.g. by warning with THREAD_SAFE_WARNING.
+ * Creating an OutputFileHandler may involve all processes, so must be preceded by CheckThreadSafe.
+ */
+class ThreadPool : private boost::noncopyable
+{
+public:
+    /** The type thrown by CheckThreadSafe.  Deliberately not an Exception, so it isn't caught by the interpreter. */
+    class NotThreadSafe
+    {};
+
+    /** Get the single instance of the pool. */
+    static ThreadPool* Instance();
+
+    /**
+     * Set how many threads (including the calling thread) should run parallel loops.
+     * A value of 0 or 1 disables parallelisation.  Must not be called while running a loop.
+     *
+     * @param numThreads  the number of threads
+     */
+    void SetNumThreads(unsigned numThreads);
+
+    /** Get how many threads are used to run parallel loops. */
+    unsigned GetNumThreads() const;
+
+    /**
+     * Set the minimum number of iterations for a loop to be worth running in parallel.
+     *
+     * @param minIterations  the threshold
+     */
+    void SetMinimumIterations(unsigned minIterations);
+
+    /** Get the minimum number of iterations for a loop to be worth running in parallel. */
+    unsigned GetMinimumIterations() const;
+
+    /**
+     * Whether a loop with the given number of iterations should be run in parallel.
+     *
+     * @param numIterations  the number of iterations
+     */
+    bool ShouldParallelise(unsigned numIterations) const;
+
+    /**
+     * Run a loop in parallel, returning once all iterations are complete.
+     *
+     * @param rLoop  the loop
+     * @param numIterations  the number of iterations
+     * @return  true if all iterations succeeded; false if the loop must be re-run sequentially
+     */
+    bool Run(AbstractParallelLoop& rLoop, unsigned numIterations);
+
+    /**
+     * Run all the iterations of a loop, in parallel if worthwhile, otherwise (or if running in
+     * parallel fails) sequentially in the calling thread.
+     *
+     * @param rLoop  the loop
+     * @param numIterations  the number of iterations
+     */
+    static void RunLoop(AbstractParallelLoop& rLoop, unsigned numIterations);
+
+    /** Whether the calling thread is currently running part of a parallel loop. */
+    static bool InParallelRegion();
+
+    /**
+     * Abort the current parallel loop, if any, since the calling code isn't thread safe.
+     * Does nothing outside a parallel loop.
+     */
+    static void CheckThreadSafe();
+
+    /** Get the mutex guarding use of Chaste's singletons from parallel loops. */
+    static boost::mutex& rGetChasteMutex();
+
+    /** Stops the worker threads. */
+    ~ThreadPool();
+
+private:
+    /** Private constructor for singleton; no threads are started. */
+    ThreadPool();
+
+    /**
+     * The main function of worker threads.
+     *
+     * @param lastLoopNumber  the value of #mLoopNumber when the thread was created
+     */
+    void WorkerMain(unsigned lastLoopNumber);
+
+    /** Run chunks of the current loop until none remain. */
+    void RunChunks();
+
+    /**
+     * Record whether the calling thread is running part of a parallel loop.
+     *
+     * @param inRegion  whether it is
+     */
+    static void SetInParallelRegion(bool inRegion);
+
+    /** Stop and join all worker threads. */
+    void StopWorkers();
+
+    /** The worker threads. */
+    std::vector<boost::shared_ptr<boost::thread> > mWorkers;
+
+    /** Minimum number of iterations for a loop to be worth running in parallel. */
+    unsigned mMinIterations;
+
+    /** Serialises calls to Run from different threads. */
+    boost::mutex mRunMutex;
+
+    /** Protects the loop details below. */
+    boost::mutex mMutex;
+
+    /** Signalled when a new loop is available, or the workers should stop. */
+    boost::condition_variable mWorkReady;
+
+    /** Signalled when a worker finishes its part of a loop. */
+    boost::condition_variable mWorkDone;
+
+    /** Incremented for each loop run, so workers can tell there is new work. */
+    unsigned mLoopNumber;
+
+    /** Whether the workers should stop. */
+    bool mStopping;
+
+    /** The number of workers still running chunks of the current loop. */
+    unsigned mNumActiveWorkers;
+
+    /** The loop being run. */
+    AbstractParallelLoop* mpLoop;
+
+    /** The number of iterations in the current loop. */
+    unsigned mNumIterations;
+
+    /** The number of iterations in each chunk of the current loop. */
+    unsigned mChunkSize;
+
+    /** The first iteration not yet claimed by a thread. */
+    unsigned mNextIteration;
+
+    /** Whether any iteration of the current loop has failed. */
+    bool mFailed;
+
+    /** Non-NULL in threads running part of a parallel loop. */
+    static boost::thread_specific_ptr<bool> mpInParallelRegion;
+};
+
+/**
+ * A helper class that sets how many threads the ThreadPool uses for the duration of a scope,
+ * and restores the previous number at the end of the scope.
+ */
+class UseThreadsHere
+{
+public:
+    /**
+     * Change the number of threads.
+     * @param numThreads  how many threads to use, including the calling thread
+     */
+    UseThreadsHere(unsigned numThreads)
+        : mOldNumThreads(ThreadPool::Instance()->GetNumThreads())
+    {
+        if (numThreads != mOldNumThreads)
+        {
+            ThreadPool::Instance()->SetNumThreads(numThreads);
+        }
+    }
+    /**
+     * Restore the previous number of threads, if we changed it.
+     */
+    ~UseThreadsHere()
+    {
+        if (ThreadPool::Instance()->GetNumThreads() != mOldNumThreads)
+        {
+            ThreadPool::Instance()->SetNumThreads(mOldNumThreads);
+        }
+    }
+private:
+    /** How many threads the pool used before. */
+    unsigned mOldNumThreads;
+};
+
+/**
+ * Like WARNING, but safe to use within parallel loops.
+ *
+ * @param message  the warning message
+ */
+#define THREAD_SAFE_WARNING(message)                                                \
+    {                                                                               \
+        boost::mutex::scoped_lock chaste_lock(ThreadPool::rGetChasteMutex());       \
+        WARNING(message);                                                           \
+    }
+
+#endif /* THREADPOOL_HPP_ */
@@ -36,10 +36,14 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef TESTADVANCEDMODELINTERFACE_HPP_
 #define TESTADVANCEDMODELINTERFACE_HPP_
 
+#include <sstream>
 #include <string>
+#include <vector>
 #include <cxxtest/TestSuite.h>
+#include <boost/foreach.hpp>
 
 #include "ProtocolRunner.hpp"
+#include "ProtoHelperMacros.hpp"
 
 #include "FileFinder.hpp"
 
@@ -58,6 +62,117 @@ public:
         FileFinder success_file(dirname + "/success", RelativeTo::ChasteTestOutput);
         TS_ASSERT(success_file.Exists());
     }
+
+    void TestRecordingOnlyRequiredOutputs() throw (Exception)
+    {
+        std::string dirname = "TestAdvancedModelInterface_TestRecordingOnlyRequiredOutputs";
+        ProtocolFileFinder proto_file("projects/FunctionalCuration/test/protocols/test_required_outputs.txt", RelativeTo::ChasteSourceRoot);
+        FileFinder cellml_file("projects/FunctionalCuration/test/data/simple_ode.cellml", RelativeTo::ChasteSourceRoot);
+
+        // With lazy evaluation only the voltage is recorded, since the statement using parameter_b is skipped
+        {
+            ProtocolRunner runner(cellml_file, proto_file, dirname);
+            runner.GetProtocol()->SetLazyEvaluation();
+            runner.GetProtocol()->SetOutputPruning();
+            runner.RunProtocol();
+            FileFinder success_file(dirname + "/success", RelativeTo::ChasteTestOutput);
+            TS_ASSERT(success_file.Exists());
+            const Environment& r_results = runner.GetProtocol()->rGetOutputsCollection("sim");
+            TS_ASSERT(r_results.HasName("membrane_voltage", "test"));
+            TS_ASSERT(!r_results.HasName("parameter_a", "test"));
+            TS_ASSERT(!r_results.HasName("parameter_b", "test"));
+            NdArray<double> voltage = GET_ARRAY(r_results.Lookup("membrane_voltage", "test"));
+            TS_ASSERT_EQUALS(voltage.GetNumElements(), 6u);
+            NdArray<double>::Indices last = voltage.GetIndices();
+            last[0] = 5u;
+            TS_ASSERT_DELTA(voltage[last], 5.0, 1e-6);
+        }
+
+        // Without lazy evaluation every post-processing statement runs, so parameter_b is needed too
+        {
+            ProtocolRunner runner(cellml_file, proto_file, dirname);
+            runner.GetProtocol()->SetOutputPruning();
+            runner.RunProtocol();
+            const Environment& r_results = runner.GetProtocol()->rGetOutputsCollection("sim");
+            TS_ASSERT(r_results.HasName("membrane_voltage", "test"));
+            TS_ASSERT(!r_results.HasName("parameter_a", "test"));
+            TS_ASSERT(r_results.HasName("parameter_b", "test"));
+        }
+
+        // By default every output is recorded, even with lazy evaluation
+        {
+            ProtocolRunner runner(cellml_file, proto_file, dirname);
+            runner.GetProtocol()->SetLazyEvaluation();
+            runner.RunProtocol();
+            const Environment& r_results = runner.GetProtocol()->rGetOutputsCollection("sim");
+            TS_ASSERT(r_results.HasName("membrane_voltage", "test"));
+            TS_ASSERT(r_results.HasName("parameter_a", "test"));
+            TS_ASSERT(r_results.HasName("parameter_b", "test"));
+        }
+    }
+
+    void TestDirectRecordingMatchesGenericRecording() throw (Exception)
+    {
+        ProtocolFileFinder proto_file("projects/FunctionalCuration/test/protocols/test_direct_recording.txt", RelativeTo::ChasteSourceRoot);
+        FileFinder cellml_file("projects/FunctionalCuration/test/data/simple_ode.cellml", RelativeTo::ChasteSourceRoot);
+        std::vector<std::string> prefixes;
+        prefixes.push_back("tc");
+        prefixes.push_back("nested");
+
+        // The generic path, recording every output, gives the expected results
+        ProtocolRunner generic_runner(cellml_file, proto_file, "TestAdvancedModelInterface_TestDirectRecording_Generic");
+        generic_runner.RunProtocol();
+        FileFinder generic_success("TestAdvancedModelInterface_TestDirectRecording_Generic/success", RelativeTo::ChasteTestOutput);
+        TS_ASSERT(generic_success.Exists());
+
+        // Native loops record straight into the results arrays, for both a timecourse and a nested simulation,
+        // and pruning changes which outputs they have to record
+        for (unsigned native_loops=0; native_loops<2u; ++native_loops)
+        {
+            for (unsigned prune=0; prune<2u; ++prune)
+            {
+                if (!native_loops && !prune)
+                {
+                    continue;
+                }
+                std::stringstream dirname;
+                dirname << "TestAdvancedModelInterface_TestDirectRecording_" << (native_loops ? "Native" : "Generic")
+                        << (prune ? "_Pruned" : "");
+                ProtocolRunner runner(cellml_file, proto_file, dirname.str());
+                runner.GetProtocol()->SetNativeSimulationLoops(native_loops);
+                runner.GetProtocol()->SetOutputPruning(prune);
+                runner.RunProtocol();
+                FileFinder success_file(dirname.str() + "/success", RelativeTo::ChasteTestOutput);
+                TS_ASSERT(success_file.Exists());
+
+                BOOST_FOREACH(const std::string& r_prefix, prefixes)
+                {
+                    const Environment& r_expected = generic_runner.GetProtocol()->rGetOutputsCollection(r_prefix);
+                    const Environment& r_results = runner.GetProtocol()->rGetOutputsCollection(r_prefix);
+                    BOOST_FOREACH(const std::string& r_name, r_expected.GetDefinedNames())
+                    {
+                        // Only the nested simulation has outputs that aren't referred to
+                        const bool pruned = prune && r_prefix == "nested" && r_name != "membrane_voltage";
+                        TS_ASSERT_EQUALS(r_results.HasName(r_name, "test"), !pruned);
+                        if (pruned || !r_results.HasName(r_name, "test"))
+                        {
+                            continue;
+                        }
+                        NdArray<double> expected = GET_ARRAY(r_expected.Lookup(r_name, "test"));
+                        NdArray<double> actual = GET_ARRAY(r_results.Lookup(r_name, "test"));
+                        TS_ASSERT(actual.GetShape() == expected.GetShape());
+                        if (actual.GetShape() == expected.GetShape())
+                        {
+                            for (NdArray<double>::ConstIterator it=actual.Begin(), exp_it=expected.Begin(); it != actual.End(); ++it, ++exp_it)
+                            {
+                                TS_ASSERT_DELTA(*it, *exp_it, 1e-12);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
 };
 
 #endif // TESTADVANCEDMODELINTERFACE_HPP_
@@ -0,0 +1,171 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+#ifndef TESTANALYTICJACOBIAN_HPP_
+#define TESTANALYTICJACOBIAN_HPP_
+
+#include <cxxtest/TestSuite.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "ProtocolRunner.hpp"
+#include "ProtoHelperMacros.hpp"
+
+#include "AbstractCvodeCell.hpp"
+#include "FileFinder.hpp"
+
+#include "FakePetscSetup.hpp"
+
+class TestAnalyticJacobian : public CxxTest::TestSuite
+{
+    /**
+     * Pace the model for a few beats.
+     *
+     * @param rDirname  the output folder
+     * @param analyticJacobian  whether to have CVODE use an analytic Jacobian
+     * @param linearSolver  how CVODE should solve its linear systems
+     * @return  the membrane voltage trace
+     */
+    NdArray<double> RunPacing(const std::string& rDirname, bool analyticJacobian,
+                              ProtocolRunner::LinearSolver linearSolver=ProtocolRunner::DENSE)
+    {
+        FileFinder cellml_file("projects/FunctionalCuration/cellml/luo_rudy_1991.cellml", RelativeTo::ChasteSourceRoot);
+        ProtocolFileFinder proto_file("projects/FunctionalCuration/test/protocols/test_stimulus_stops.txt", RelativeTo::ChasteSourceRoot);
+        ProtocolRunner runner(cellml_file, proto_file, rDirname, false, analyticJacobian, ProtocolRunner::CVODE,
+                              boost::shared_ptr<ModelCache>(), linearSolver);
+
+        // Make sure we're testing what we think we are
+        AbstractCvodeCell* p_cell = dynamic_cast<AbstractCvodeCell*>(runner.GetProtocol()->GetModel().get());
+        TS_ASSERT(p_cell);
+        if (p_cell)
+        {
+            TS_ASSERT_EQUALS(p_cell->HasAnalyticJacobian() && p_cell->GetUseAnalyticJacobian(), analyticJacobian);
+        }
+        AbstractSystemWithOutputs::SolverSettings settings = runner.GetProtocol()->GetModel()->GetSolverSettings();
+        TS_ASSERT_EQUALS(settings.krylovLinearSolver, linearSolver == ProtocolRunner::KRYLOV ? 1.0 : 0.0);
+
+        // The analytic Jacobian's speedup is only measured if there is one
+        if (analyticJacobian)
+        {
+            TS_ASSERT_LESS_THAN(0.0, runner.GetAnalyticJacobianSpeedup());
+        }
+        else
+        {
+            TS_ASSERT_EQUALS(runner.GetAnalyticJacobianSpeedup(), DOUBLE_UNSET);
+        }
+
+        runner.RunProtocol();
+        FileFinder success_file(rDirname + "/success", RelativeTo::ChasteTestOutput);
+        TS_ASSERT(success_file.Exists());
+        return GET_ARRAY(runner.GetProtocol()->rGetOutputsCollection().Lookup("V"));
+    }
+
+    /**
+     * Check that two ways of solving the model give the same trace.  The Jacobian and linear solver
+     * only affect how CVODE takes its steps, not the answer, to within its tolerances.
+     *
+     * @param rExpected  the trace from one
+     * @param rActual  the trace from the other
+     */
+    void CompareTraces(const NdArray<double>& rExpected, const NdArray<double>& rActual)
+    {
+        TS_ASSERT(rExpected.GetShape() == rActual.GetShape());
+        NdArray<double>::ConstIterator actual_it = rActual.Begin();
+        for (NdArray<double>::ConstIterator it=rExpected.Begin(); it != rExpected.End(); ++it, ++actual_it)
+        {
+            TS_ASSERT_DELTA(*it, *actual_it, 0.5); // mV
+        }
+    }
+
+public:
+    void TestAnalyticMatchesNumericalJacobian() throw (Exception)
+    {
+        NdArray<double> numerical = RunPacing("TestAnalyticJacobian_Numerical", false);
+        NdArray<double> analytic = RunPacing("TestAnalyticJacobian_Analytic", true);
+        CompareTraces(numerical, analytic);
+    }
+
+    void TestKrylovMatchesDenseLinearSolver() throw (Exception)
+    {
+        NdArray<double> dense = RunPacing("TestAnalyticJacobian_Dense", false);
+        NdArray<double> krylov = RunPacing("TestAnalyticJacobian_Krylov", false, ProtocolRunner::KRYLOV);
+        CompareTraces(dense, krylov);
+    }
+
+    void TestProtocolChoosesJacobian() throw (Exception)
+    {
+        std::string dirname = "TestAnalyticJacobian_Protocol";
+        FileFinder cellml_file("projects/FunctionalCuration/cellml/luo_rudy_1991.cellml", RelativeTo::ChasteSourceRoot);
+        ProtocolFileFinder proto_file("projects/FunctionalCuration/test/protocols/test_jacobian_settings.txt", RelativeTo::ChasteSourceRoot);
+        ProtocolRunner runner(cellml_file, proto_file, dirname);
+
+        // An analytic Jacobian is generated for the simulation that asks for it, but isn't used by default
+        AbstractCvodeCell* p_cell = dynamic_cast<AbstractCvodeCell*>(runner.GetProtocol()->GetModel().get());
+        TS_ASSERT(p_cell);
+        if (p_cell)
+        {
+            TS_ASSERT(p_cell->HasAnalyticJacobian());
+            TS_ASSERT(!p_cell->GetUseAnalyticJacobian());
+        }
+
+        // How much it speeds up evaluating the Jacobian is measured and reported, as is the Jacobian's sparsity
+        TS_ASSERT_LESS_THAN(0.0, runner.GetAnalyticJacobianSpeedup());
+        std::ifstream model_info(FileFinder(dirname + "/model_info.txt", RelativeTo::ChasteTestOutput).GetAbsolutePath().c_str());
+        std::stringstream model_info_contents;
+        model_info_contents << model_info.rdbuf();
+        TS_ASSERT_DIFFERS(model_info_contents.str().find("Jacobian: numerical\n"), std::string::npos);
+        TS_ASSERT_DIFFERS(model_info_contents.str().find("Jacobian non-zeros: "), std::string::npos);
+        TS_ASSERT_DIFFERS(model_info_contents.str().find("Analytic Jacobian speedup: "), std::string::npos);
+        TS_ASSERT_DIFFERS(model_info_contents.str().find("Linear solver: dense\n"), std::string::npos);
+
+        runner.RunProtocol();
+        FileFinder success_file(dirname + "/success", RelativeTo::ChasteTestOutput);
+        TS_ASSERT(success_file.Exists());
+        if (p_cell)
+        {
+            TS_ASSERT(!p_cell->GetUseAnalyticJacobian());
+        }
+        const Environment& r_outputs = runner.GetProtocol()->rGetOutputsCollection();
+        NdArray<double> numerical = GET_ARRAY(r_outputs.Lookup("V_numerical"));
+        CompareTraces(numerical, GET_ARRAY(r_outputs.Lookup("V_analytic")));
+        CompareTraces(numerical, GET_ARRAY(r_outputs.Lookup("V_krylov")));
+        CompareTraces(numerical, GET_ARRAY(r_outputs.Lookup("V_after")));
+    }
+};
+
+#endif // TESTANALYTICJACOBIAN_HPP_
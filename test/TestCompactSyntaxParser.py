@@ -286,6 +286,16 @@ class TestCompactSyntaxParser(unittest.TestCase):
                           [['l1', 'file1'], ['', 'file2']])
         self.assertParses(csp.imports, '', [])
         self.failIfParses(csp.imports, 'import "file"\n')
+        self.assertParses(csp.importStmt, 'import trusted std = "BasicLibrary.xml"',
+                          [['trusted', 'std', 'BasicLibrary.xml']],
+                          ('import', {'source': 'BasicLibrary.xml', 'prefix': 'std', 'trusted': 'true'}))
+        self.assertParses(csp.importStmt, 'import trusted "file"', [['trusted', '', 'file']],
+                          ('import', {'source': 'file', 'mergeDefinitions': 'true', 'trusted': 'true'}))
+        # 'trusted' may also be used as a prefix
+        self.assertParses(csp.importStmt, 'import trusted = "lib.txt"', [['trusted', 'lib.txt']],
+                          ('import', {'source': 'lib.txt', 'prefix': 'trusted'}))
+        self.assertParses(csp.importStmt, 'import trusted trusted="lib.txt"', [['trusted', 'trusted', 'lib.txt']],
+                          ('import', {'source': 'lib.txt', 'prefix': 'trusted', 'trusted': 'true'}))
 
     def TestParsingImportsWithSetInput(self):
         self.assertParses(csp.importStmt, """import "S1S2.txt" {
@@ -471,6 +481,56 @@ modifiers { at end save as prelim }
                           ('timecourseSimulation', {'prefix': 'sim'}, [('whileStepper', {'name': 'time', 'units': 'U'},
                                                                         [('condition', [('apply', ['lt', 'ci:time', 'cn:100'])])]),
                                                                        ('modifiers', [('saveState', ['when:AT_END', 'name:prelim'])])]))
+        self.assertParses(csp.simulation, """simulation sim = timecourse {
+range time units ms uniform 1:1000
+events {
+    up = oxmeta:membrane_voltage crosses 0 rising
+    dvdt = rate of oxmeta:membrane_voltage crosses 10
+}
+}""",
+                          [['sim', [['time', 'ms', ['1', '1000']],
+                                    [['up', [], 'oxmeta:membrane_voltage', '0', ['rising']],
+                                     ['dvdt', ['rate'], 'oxmeta:membrane_voltage', '10', []]]]]],
+                          ('timecourseSimulation', {'prefix': 'sim'},
+                           [('uniformStepper', {'name': 'time', 'units': 'ms'},
+                             [('start', ['cn:1']), ('stop', ['cn:1000']), ('step', ['cn:1'])]),
+                            'modifiers',
+                            ('events', [('event', {'name': 'up', 'direction': 'rising'},
+                                         ['name:oxmeta:membrane_voltage', ('threshold', ['cn:0'])]),
+                                        ('event', {'name': 'dvdt', 'rateOfChange': 'true'},
+                                         ['name:oxmeta:membrane_voltage', ('threshold', ['cn:10'])])])]))
+        self.assertParses(csp.simulation, """simulation sim = timecourse {
+range time units ms uniform 1:1000
+solver {
+    relTol = 0.001
+    maxStep = 1
+}
+}""",
+                          [['sim', [['time', 'ms', ['1', '1000']],
+                                    [['relTol', '0.001'], ['maxStep', '1']]]]],
+                          ('timecourseSimulation', {'prefix': 'sim'},
+                           [('uniformStepper', {'name': 'time', 'units': 'ms'},
+                             [('start', ['cn:1']), ('stop', ['cn:1000']), ('step', ['cn:1'])]),
+                            'modifiers',
+                            ('solver', [('setting', {'name': 'relTol'}, ['cn:0.001']),
+                                        ('setting', {'name': 'maxStep'}, ['cn:1'])])]))
+        self.assertParses(csp.simulation, """simulation sim = timecourse {
+range time units ms vector [0, 1000000]
+parareal {
+    slices = 32
+    coarseRelTol = 1e-3
+}
+solver { relTol = 1e-7 }
+}""",
+                          [['sim', [['time', 'ms', ['0', '1000000']],
+                                    [['slices', '32'], ['coarseRelTol', '1e-3']],
+                                    [['relTol', '1e-7']]]]],
+                          ('timecourseSimulation', {'prefix': 'sim'},
+                           [('vectorStepper', {'name': 'time', 'units': 'ms'}, [('apply', ['csymbol-newArray', 'cn:0', 'cn:1000000'])]),
+                            'modifiers',
+                            ('parareal', [('setting', {'name': 'slices'}, ['cn:32']),
+                                          ('setting', {'name': 'coarseRelTol'}, ['cn:1e-3'])]),
+                            ('solver', [('setting', {'name': 'relTol'}, ['cn:1e-7'])])]))
         self.failIfParses(csp.simulation, 'simulation sim = timecourse {}')
     
     def TestParsingOneStepSimulations(self):
@@ -483,6 +543,36 @@ modifiers { at end save as prelim }
                           [['', [[['start', ['a', '1']]]]]],
                           ('oneStep', {}, [('modifiers', [('setVariable', ['when:AT_START_ONLY', 'name:a', ('value', ['cn:1'])])])]))
     
+    def TestParsingSteadyStateSimulations(self):
+        self.assertParses(csp.simulation, """simulation ss = steadyState {
+period = 1000
+maxBeats = max_paces
+tolerance = 1e-6
+}""",
+                          [['ss', [['period', '1000'], ['maxBeats', 'max_paces'], ['tolerance', '1e-6']]]],
+                          ('steadyStateSimulation', {'prefix': 'ss'},
+                           [('setting', {'name': 'period'}, ['cn:1000']),
+                            ('setting', {'name': 'maxBeats'}, ['ci:max_paces']),
+                            ('setting', {'name': 'tolerance'}, ['cn:1e-6'])]))
+        self.assertParses(csp.simulation, """simulation ss = steadyState {
+period = 500
+maxBeats = 100
+tolerance = 1e-6
+acceleration = 5
+modifiers { at start set a = 1 }
+solver { relTol = 1e-4 }
+}""",
+                          [['ss', [['period', '500'], ['maxBeats', '100'], ['tolerance', '1e-6'], ['acceleration', '5'],
+                                   [['start', ['a', '1']]], [['relTol', '1e-4']]]]],
+                          ('steadyStateSimulation', {'prefix': 'ss'},
+                           [('modifiers', [('setVariable', ['when:AT_START_ONLY', 'name:a', ('value', ['cn:1'])])]),
+                            ('setting', {'name': 'period'}, ['cn:500']),
+                            ('setting', {'name': 'maxBeats'}, ['cn:100']),
+                            ('setting', {'name': 'tolerance'}, ['cn:1e-6']),
+                            ('setting', {'name': 'acceleration'}, ['cn:5']),
+                            ('solver', [('setting', {'name': 'relTol'}, ['cn:1e-4'])])]))
+        self.failIfParses(csp.simulation, 'simulation ss = steadyState {}')
+    
     def TestParsingNestedSimulations(self):
         self.assertParses(csp.simulation,
                           'simulation rpt = nested { range run units U while not rpt:result\n nests sim }',
@@ -508,6 +598,15 @@ nests simulation timecourse { range t units u uniform 1:100 } }""",
                             'modifiers',
                             ('timecourseSimulation', {},
                              [('uniformStepper', [('start', ['cn:1']), ('stop', ['cn:100']), ('step', ['cn:1'])]), 'modifiers'])]))
+        self.assertParses(csp.simulation, """simulation nested { range R units U uniform 1:2
+nests sim
+reduce { peak = sim:V } }""",
+                          [['', [['R', 'U', ['1', '2']], ['sim'], [[[['peak'], ['sim:V']]]]]]],
+                          ('nestedSimulation', {},
+                           [('uniformStepper', [('start', ['cn:1']), ('stop', ['cn:2']), ('step', ['cn:1'])]),
+                            'modifiers', ('subTask', {'task': 'sim'}),
+                            ('reduce', [('apply', ['csymbol-statementList',
+                                                   ('apply', ['eq', 'ci:peak', 'ci:sim:V'])])])]))
         self.failIfParses(csp.simulation, 'simulation rpt = nested { range run units U while 1 }')
     
     def TestParsingNestedProtocol(self):
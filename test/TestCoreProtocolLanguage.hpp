@@ -42,9 +42,15 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <boost/make_shared.hpp> // Requires Boost 1.39 (available in Lucid and newer)
 
 #include "ProtocolLanguage.hpp"
+#include "ProtocolOptimiser.hpp"
+#include "ProtocolCompiler.hpp"
+#include "ShapeInference.hpp"
+#include "ThreadPool.hpp"
 
 #include "OutputFileHandler.hpp"
 #include "FileFinder.hpp"
+#include "ModelCache.hpp"
+#include "Warnings.hpp"
 #include "DebugProto.hpp"
 
 #include "FakePetscSetup.hpp"
@@ -58,6 +64,103 @@ class TestCoreProtocolLanguage : public CxxTest::TestSuite
         return static_cast<ArrayValue*>(wrapped_array.get())->GetArray();
     }
 
+    /**
+     * Build a program with opportunities for each kind of optimisation, assuming an input 'n' is defined.
+     */
+    std::vector<AbstractStatementPtr> MakeOptimisableProgram()
+    {
+        std::vector<AbstractStatementPtr> program;
+        // k = n * 2  --> constant 8
+        {
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(LOOKUP("n"))(CONST(2));
+            DEFINE(times, boost::make_shared<MathmlTimes>(args));
+            program.push_back(ASSIGN_STMT("k", times)); LOC(program.back());
+        }
+        // scale = lambda p, a: map(lambda x: x * (1 - p/100), a)  --> (1 - p/100) computed once per call of scale
+        {
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(LOOKUP("p"))(CONST(100));
+            DEFINE(divide, boost::make_shared<MathmlDivide>(args));
+            args = EXPR_LIST(CONST(1))(divide);
+            DEFINE(minus, boost::make_shared<MathmlMinus>(args));
+            args = EXPR_LIST(LOOKUP("x"))(minus);
+            DEFINE(times, boost::make_shared<MathmlTimes>(args));
+            std::vector<std::string> inner_fps = {"x"};
+            DEFINE(inner, boost::make_shared<LambdaExpression>(inner_fps, times));
+            args = EXPR_LIST(inner)(LOOKUP("a"));
+            DEFINE(map, boost::make_shared<Map>(args));
+            std::vector<std::string> outer_fps = {"p", "a"};
+            DEFINE(outer, boost::make_shared<LambdaExpression>(outer_fps, map));
+            program.push_back(ASSIGN_STMT("scale", outer)); LOC(program.back());
+        }
+        // v = scale(k, [k + n, n])  --> {11.04, 3.68}
+        {
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(LOOKUP("k"))(LOOKUP("n"));
+            DEFINE(plus, boost::make_shared<MathmlPlus>(args));
+            args = EXPR_LIST(plus)(LOOKUP("n"));
+            DEFINE(array, boost::make_shared<ArrayCreate>(args));
+            args = EXPR_LIST(LOOKUP("k"))(array);
+            DEFINE(call, boost::make_shared<FunctionCall>("scale", args));
+            program.push_back(ASSIGN_STMT("v", call)); LOC(program.back());
+        }
+        // r = (v + 1) * (v + 1) + (v + 1)  --> (v + 1) computed once
+        {
+            std::vector<AbstractExpressionPtr> operands;
+            for (unsigned i=0; i<3; ++i)
+            {
+                std::vector<AbstractExpressionPtr> args = EXPR_LIST(LOOKUP("v"))(CONST(1));
+                operands.push_back(boost::make_shared<MathmlPlus>(args)); LOC(operands.back());
+            }
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(operands[0])(operands[1]);
+            DEFINE(times, boost::make_shared<MathmlTimes>(args));
+            args = EXPR_LIST(times)(operands[2]);
+            DEFINE(plus, boost::make_shared<MathmlPlus>(args));
+            program.push_back(ASSIGN_STMT("r", plus)); LOC(program.back());
+        }
+        // c = { i * (v - n) for #0#i=0:3 }  --> (v - n) computed once
+        {
+            DEFINE_TUPLE(i_range, EXPR_LIST(CONST(0))(CONST(0))(CONST(1))(CONST(3))(VALUE(StringValue, "i")));
+            std::vector<AbstractExpressionPtr> comp_args = {i_range};
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(LOOKUP("v"))(LOOKUP("n"));
+            DEFINE(minus, boost::make_shared<MathmlMinus>(args));
+            args = EXPR_LIST(LOOKUP("i"))(minus);
+            DEFINE(times, boost::make_shared<MathmlTimes>(args));
+            DEFINE(array_exp, boost::make_shared<ArrayCreate>(times, comp_args));
+            program.push_back(ASSIGN_STMT("c", array_exp)); LOC(program.back());
+        }
+        return program;
+    }
+
+    /**
+     * Run the program created by MakeOptimisableProgram and check the results.
+     *
+     * @param pInputs  the environment defining the input 'n'
+     * @param rProgram  the program
+     */
+    void RunOptimisableProgram(EnvironmentPtr pInputs, const std::vector<AbstractStatementPtr>& rProgram)
+    {
+        EnvironmentPtr p_env(new Environment(pInputs->GetAsDelegatee()));
+        p_env->ExecuteStatements(rProgram);
+        TS_ASSERT_EQUALS(GET_SIMPLE_VALUE(p_env->Lookup("k")), 8.0);
+        const double v[] = {12 * 0.92, 4 * 0.92};
+        NdArray<double> r = LookupArray(*p_env, "r");
+        NdArray<double> c = LookupArray(*p_env, "c");
+        TS_ASSERT_EQUALS(r.GetNumElements(), 2u);
+        TS_ASSERT_EQUALS(c.GetNumElements(), 6u);
+        NdArray<double>::Iterator r_it = r.Begin();
+        NdArray<double>::Iterator c_it = c.Begin();
+        for (unsigned j=0; j<2u; ++j)
+        {
+            TS_ASSERT_DELTA(*r_it++, (v[j]+1)*(v[j]+1) + (v[j]+1), 1e-12);
+        }
+        for (unsigned i=0; i<3u; ++i)
+        {
+            for (unsigned j=0; j<2u; ++j)
+            {
+                TS_ASSERT_DELTA(*c_it++, i * (v[j] - 4), 1e-12);
+            }
+        }
+    }
+
 public:
     void TestBasics() throw (Exception)
     {
@@ -640,6 +743,128 @@ public:
                 TS_ASSERT_EQUALS(*it++, values[i]);
             }
         }
+
+        // Index values kept beyond one sub-array (here by a memoised function) mustn't change
+        // id = lambda x: x;  ids = { id(i) for #0#i=0:5 }  --> id(1) is still 1
+        {
+            std::vector<std::string> fps = {"x"};
+            DEFINE(lambda, boost::make_shared<LambdaExpression>(fps, LOOKUP("x")));
+            p_env->DefineName("id", (*lambda)(*p_env), "test");
+            MemoCache::StatisticsPtr p_stats(new MemoCache::Statistics(10u));
+            static_cast<LambdaClosure*>(p_env->Lookup("id").get())->EnableMemoisation(p_stats);
+            DEFINE_TUPLE(i_range, EXPR_LIST(CONST(0))(CONST(0))(CONST(1))(CONST(5))(VALUE(StringValue, "i")));
+            std::vector<AbstractExpressionPtr> comp_args = {i_range};
+            std::vector<AbstractExpressionPtr> args = {LOOKUP("i")};
+            DEFINE(call, boost::make_shared<FunctionCall>("id", args));
+            DEFINE(array_exp, boost::make_shared<ArrayCreate>(call, comp_args));
+            NdArray<double> array = GET_ARRAY((*array_exp)(*p_env));
+            NdArray<double>::Iterator it = array.Begin();
+            for (NdArray<double>::Index i=0; i<5u; ++i)
+            {
+                TS_ASSERT_EQUALS(*it++, i);
+            }
+            args = {CONST(1)};
+            DEFINE(call1, boost::make_shared<FunctionCall>("id", args));
+            TS_ASSERT_EQUALS(GET_SIMPLE_VALUE((*call1)(*p_env)), 1.0);
+            TS_ASSERT_EQUALS(p_stats->numHits, 1u);
+        }
+    }
+
+    void TestArrayArithmetic() throw (Exception)
+    {
+        EnvironmentPtr p_env(new Environment);
+        Environment& env = *p_env; // Save typing!
+
+        // row = [1, 2, 3]; block = [row, row]; column = [[10], [20]]
+        {
+            std::vector<AbstractExpressionPtr> elements = EXPR_LIST(CONST(1))(CONST(2))(CONST(3));
+            DEFINE(row, boost::make_shared<ArrayCreate>(elements));
+            env.ExecuteStatement(ASSIGN_STMT("row", row));
+            elements = EXPR_LIST(LOOKUP("row"))(LOOKUP("row"))EXPR_LIST_END;
+            DEFINE(block, boost::make_shared<ArrayCreate>(elements));
+            env.ExecuteStatement(ASSIGN_STMT("block", block));
+            elements = EXPR_LIST(CONST(10))EXPR_LIST_END;
+            DEFINE(col0, boost::make_shared<ArrayCreate>(elements));
+            elements = EXPR_LIST(CONST(20))EXPR_LIST_END;
+            DEFINE(col1, boost::make_shared<ArrayCreate>(elements));
+            elements = EXPR_LIST(col0)(col1)EXPR_LIST_END;
+            DEFINE(column, boost::make_shared<ArrayCreate>(elements));
+            env.ExecuteStatement(ASSIGN_STMT("column", column));
+        }
+
+        // Scalar operands still give simple values
+        {
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(CONST(2))(CONST(3));
+            DEFINE(times, boost::make_shared<MathmlTimes>(args));
+            AbstractValuePtr p_result = (*times)(env);
+            TS_ASSERT(p_result->IsDouble());
+            TS_ASSERT_EQUALS(GET_SIMPLE_VALUE(p_result), 6.0);
+        }
+
+        // block + column + 1  --> [[12, 13, 14], [22, 23, 24]]
+        {
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(LOOKUP("block"))(LOOKUP("column"))(CONST(1));
+            DEFINE(plus, boost::make_shared<MathmlPlus>(args));
+            AbstractValuePtr p_result = (*plus)(env);
+            TS_ASSERT(p_result->IsArray());
+            NdArray<double> array = GET_ARRAY(p_result);
+            TS_ASSERT_EQUALS(array.GetNumDimensions(), 2u);
+            TS_ASSERT_EQUALS(array.GetShape()[0], 2u);
+            TS_ASSERT_EQUALS(array.GetShape()[1], 3u);
+            NdArray<double>::Iterator it = array.Begin();
+            double values[] = {12, 13, 14, 22, 23, 24};
+            for (NdArray<double>::Index i=0; i<6u; ++i)
+            {
+                TS_ASSERT_EQUALS(*it++, values[i]);
+            }
+        }
+
+        // 5 - row  --> [4, 3, 2]; -row --> [-1, -2, -3]
+        {
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(CONST(5))(LOOKUP("row"));
+            DEFINE(minus, boost::make_shared<MathmlMinus>(args));
+            NdArray<double> array = GET_ARRAY((*minus)(env));
+            TS_ASSERT_EQUALS(array.GetNumElements(), 3u);
+            NdArray<double>::Iterator it = array.Begin();
+            for (NdArray<double>::Index i=0; i<3u; ++i)
+            {
+                TS_ASSERT_EQUALS(*it++, 4.0 - i);
+            }
+
+            args = EXPR_LIST(LOOKUP("row"))EXPR_LIST_END;
+            DEFINE(uminus, boost::make_shared<MathmlMinus>(args));
+            args = EXPR_LIST(uminus)EXPR_LIST_END;
+            DEFINE(abs, boost::make_shared<MathmlAbs>(args));
+            array = GET_ARRAY((*uminus)(env));
+            NdArray<double> abs_array = GET_ARRAY((*abs)(env));
+            it = array.Begin();
+            NdArray<double>::Iterator abs_it = abs_array.Begin();
+            for (NdArray<double>::Index i=0; i<3u; ++i)
+            {
+                TS_ASSERT_EQUALS(*it++, -(i + 1.0));
+                TS_ASSERT_EQUALS(*abs_it++, i + 1.0);
+            }
+        }
+
+        // row <= 2  --> [1, 1, 0]
+        {
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(LOOKUP("row"))(CONST(2));
+            DEFINE(leq, boost::make_shared<MathmlLeq>(args));
+            NdArray<double> array = GET_ARRAY((*leq)(env));
+            NdArray<double>::Iterator it = array.Begin();
+            TS_ASSERT_EQUALS(*it++, 1.0);
+            TS_ASSERT_EQUALS(*it++, 1.0);
+            TS_ASSERT_EQUALS(*it++, 0.0);
+        }
+
+        // Incompatible shapes: row / column[0]
+        {
+            std::vector<AbstractExpressionPtr> elements = EXPR_LIST(CONST(1))(CONST(2));
+            DEFINE(pair, boost::make_shared<ArrayCreate>(elements));
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(LOOKUP("row"))(pair);
+            DEFINE(divide, boost::make_shared<MathmlDivide>(args));
+            TS_ASSERT_THROWS_CONTAINS((*divide)(env), "cannot be broadcast together; shape {2} is incompatible with {3}");
+        }
     }
 
     void TestMultipleReturns() throw (Exception)
@@ -671,6 +896,652 @@ public:
         TS_ASSERT_EQUALS(GET_SIMPLE_VALUE(env.Lookup("one")), 1.0);
         TS_ASSERT_EQUALS(GET_SIMPLE_VALUE(env.Lookup("two")), 2.0);
     }
+
+    void TestOptimiser() throw (Exception)
+    {
+        EnvironmentPtr p_inputs(new Environment(true));
+        p_inputs->DefineName("n", CV(4), "input");
+        std::vector<AbstractStatementPtr> program = MakeOptimisableProgram();
+        const std::vector<AbstractStatementPtr> original_program = program;
+        RunOptimisableProgram(p_inputs, program);
+
+        ProtocolOptimiser optimiser;
+        optimiser.Optimise(program, *p_inputs, true);
+        // n (x3), k (x2), n*2, k+n, [k+n, n], and the range tuple are folded
+        TS_ASSERT_EQUALS(optimiser.GetNumberFolded(), 10u);
+        TS_ASSERT_EQUALS(optimiser.GetNumberEliminated(), 2u);
+        TS_ASSERT_EQUALS(optimiser.GetNumberHoisted(), 2u);
+        TS_ASSERT_EQUALS(program.size(), original_program.size() + 1u);
+        AssignmentStatement* p_assign = static_cast<AssignmentStatement*>(program.front().get());
+        TS_ASSERT(dynamic_cast<ValueExpression*>(p_assign->rGetRhs().get()));
+        RunOptimisableProgram(p_inputs, program);
+
+        // Undoing the changes restores the original program
+        optimiser.Restore();
+        TS_ASSERT_EQUALS(optimiser.GetNumberFolded(), 0u);
+        TS_ASSERT(program == original_program);
+        TS_ASSERT(dynamic_cast<MathmlTimes*>(p_assign->rGetRhs().get()));
+        RunOptimisableProgram(p_inputs, program);
+
+        // Without knowing the input value, there is less to fold
+        EnvironmentPtr p_empty(new Environment);
+        optimiser.Optimise(program, *p_empty, true);
+        TS_ASSERT_EQUALS(optimiser.GetNumberFolded(), 1u); // Just the range tuple
+        TS_ASSERT_EQUALS(optimiser.GetNumberEliminated(), 2u);
+        TS_ASSERT_EQUALS(optimiser.GetNumberHoisted(), 2u);
+        RunOptimisableProgram(p_inputs, program);
+        optimiser.Restore();
+    }
+
+    void TestMemoisation() throw (Exception)
+    {
+        EnvironmentPtr p_inputs(new Environment(true));
+        p_inputs->DefineName("n", CV(4), "input");
+        std::vector<AbstractStatementPtr> program = MakeOptimisableProgram();
+        // w = scale(k, [k + n, n])  --> same arguments as for v, so the cached result is used
+        {
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(LOOKUP("k"))(LOOKUP("n"));
+            DEFINE(plus, boost::make_shared<MathmlPlus>(args));
+            args = EXPR_LIST(plus)(LOOKUP("n"));
+            DEFINE(array, boost::make_shared<ArrayCreate>(args));
+            args = EXPR_LIST(LOOKUP("k"))(array);
+            DEFINE(call, boost::make_shared<FunctionCall>("scale", args));
+            program.push_back(ASSIGN_STMT("w", call)); LOC(program.back());
+        }
+        // f = lambda x: x + sim:y  --> reads model results, so isn't memoised
+        {
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(LOOKUP("x"))(LOOKUP("sim:y"));
+            DEFINE(plus, boost::make_shared<MathmlPlus>(args));
+            std::vector<std::string> fps = {"x"};
+            DEFINE(lambda, boost::make_shared<LambdaExpression>(fps, plus));
+            program.push_back(ASSIGN_STMT("f", lambda)); LOC(program.back());
+        }
+
+        MemoCache::StatisticsPtr p_stats(new MemoCache::Statistics(2u));
+        ProtocolOptimiser optimiser;
+        optimiser.EnableMemoisation(program, p_stats);
+        TS_ASSERT_EQUALS(optimiser.GetNumberMemoised(), 1u);
+        RunOptimisableProgram(p_inputs, program);
+        TS_ASSERT_EQUALS(p_stats->numHits, 1u);
+        TS_ASSERT_EQUALS(p_stats->numMisses, 1u);
+        optimiser.Restore();
+        RunOptimisableProgram(p_inputs, program);
+        TS_ASSERT_EQUALS(p_stats->numMisses, 1u);
+
+        // Test the cache itself: small arrays are keyed by value, large ones by identity
+        NdArray<double>::Extents shape = boost::assign::list_of(100);
+        NdArray<double> large(shape);
+        AbstractValuePtr p_large = boost::make_shared<ArrayValue>(large);
+        AbstractValuePtr p_large_copy = boost::make_shared<ArrayValue>(large);
+        shape[0] = 2;
+        NdArray<double> small(shape);
+        small[std::vector<NdArray<double>::Index>(1, 0u)] = 1.0;
+        small[std::vector<NdArray<double>::Index>(1, 1u)] = 2.0;
+        AbstractValuePtr p_small = boost::make_shared<ArrayValue>(small);
+        AbstractValuePtr p_small_copy = boost::make_shared<ArrayValue>(small.Copy());
+        std::vector<AbstractValuePtr> large_args = boost::assign::list_of(p_large)(CV(1));
+        std::vector<AbstractValuePtr> small_args = boost::assign::list_of(p_small)(CV(1));
+        std::vector<AbstractValuePtr> scalar_args(1, CV(3));
+
+        MemoCache cache(p_stats);
+        std::string key;
+        TS_ASSERT(!cache.Lookup(large_args, key));
+        cache.Store(key, large_args, CV(10));
+        TS_ASSERT(!cache.Lookup(small_args, key));
+        cache.Store(key, small_args, CV(20));
+        TS_ASSERT_EQUALS(cache.GetNumEntries(), 2u);
+        TS_ASSERT_EQUALS(p_stats->numMisses, 3u);
+        TS_ASSERT_EQUALS(GET_SIMPLE_VALUE(cache.Lookup(large_args, key)), 10.0);
+        small_args[0] = p_small_copy;
+        TS_ASSERT_EQUALS(GET_SIMPLE_VALUE(cache.Lookup(small_args, key)), 20.0);
+        large_args[0] = p_large_copy;
+        TS_ASSERT(!cache.Lookup(large_args, key));
+        large_args[1] = CV(2);
+        TS_ASSERT(!cache.Lookup(large_args, key));
+        TS_ASSERT_EQUALS(p_stats->numHits, 3u);
+        TS_ASSERT_EQUALS(p_stats->numMisses, 5u);
+
+        // The least recently used entry is evicted when full
+        TS_ASSERT(!cache.Lookup(scalar_args, key));
+        cache.Store(key, scalar_args, CV(30));
+        TS_ASSERT_EQUALS(cache.GetNumEntries(), 2u);
+        large_args = boost::assign::list_of(p_large)(CV(1));
+        TS_ASSERT(!cache.Lookup(large_args, key));
+        TS_ASSERT(cache.Lookup(small_args, key));
+        TS_ASSERT(cache.Lookup(scalar_args, key));
+
+        // Moving to a new generation empties the cache
+        p_stats->generation++;
+        TS_ASSERT(!cache.Lookup(scalar_args, key));
+        TS_ASSERT_EQUALS(cache.GetNumEntries(), 0u);
+    }
+
+    void TestTrustedLibraryAssertions() throw (Exception)
+    {
+        std::vector<AbstractStatementPtr> library;
+        // ShapeEq = lambda a1, a2: 0  --> deliberately wrong, so we can tell if it gets called
+        {
+            std::vector<std::string> fps = {"a1", "a2"};
+            DEFINE(lambda, boost::make_shared<LambdaExpression>(fps, CONST(0)));
+            library.push_back(ASSIGN_STMT("ShapeEq", lambda)); LOC(library.back());
+        }
+        // def f(a, b) { assert ShapeEq(a, b); assert ArrayEq([2], b.SHAPE); assert 0; return a }
+        LambdaExpression* p_f;
+        {
+            std::vector<AbstractStatementPtr> body;
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(LOOKUP("a"))(LOOKUP("b"));
+            DEFINE(shape_eq, boost::make_shared<FunctionCall>("ShapeEq", args));
+            body.push_back(ASSERT_STMT(shape_eq)); LOC(body.back());
+            args = EXPR_LIST(CONST(2));
+            DEFINE(shape, boost::make_shared<ArrayCreate>(args));
+            DEFINE(b_shape, boost::make_shared<Accessor>(LOOKUP("b"), Accessor::SHAPE));
+            args = EXPR_LIST(shape)(b_shape);
+            DEFINE(array_eq, boost::make_shared<FunctionCall>("ArrayEq", args));
+            body.push_back(ASSERT_STMT(array_eq)); LOC(body.back());
+            body.push_back(ASSERT_STMT(CONST(0))); LOC(body.back());
+            body.push_back(RETURN_STMT(LOOKUP("a"))); LOC(body.back());
+            std::vector<std::string> fps = {"a", "b"};
+            DEFINE(lambda, boost::make_shared<LambdaExpression>(fps, body));
+            p_f = static_cast<LambdaExpression*>(lambda.get());
+            library.push_back(ASSIGN_STMT("f", lambda)); LOC(library.back());
+        }
+        library.push_back(ASSERT_STMT(CONST(0))); LOC(library.back());
+        const std::vector<AbstractStatementPtr> original_library = library;
+
+        // Calls f([1, 2], [3, 4]) or f([1, 2], [3])
+        std::vector<AbstractExpressionPtr> args = EXPR_LIST(CONST(1))(CONST(2));
+        DEFINE(a, boost::make_shared<ArrayCreate>(args));
+        args = EXPR_LIST(CONST(3))(CONST(4));
+        DEFINE(b_ok, boost::make_shared<ArrayCreate>(args));
+        args = EXPR_LIST(CONST(3));
+        DEFINE(b_bad, boost::make_shared<ArrayCreate>(args));
+        args = EXPR_LIST(a)(b_ok);
+        DEFINE(call_ok, boost::make_shared<FunctionCall>("f", args));
+        args = EXPR_LIST(a)(b_bad);
+        DEFINE(call_bad, boost::make_shared<FunctionCall>("f", args));
+
+        {
+            EnvironmentPtr p_env(new Environment);
+            TS_ASSERT_THROWS_CONTAINS(p_env->ExecuteStatements(library), "Assertion failed");
+            TS_ASSERT_THROWS_CONTAINS((*call_ok)(*p_env), "Assertion failed");
+        }
+
+        // Trusting the library removes the assertions, except for the shape comparisons
+        ProtocolOptimiser optimiser;
+        optimiser.ElideAssertions(library, 0u, library.size());
+        TS_ASSERT_EQUALS(optimiser.GetNumberAssertionsElided(), 4u);
+        TS_ASSERT_EQUALS(library.size(), 2u);
+        TS_ASSERT_EQUALS(p_f->rGetBody().size(), 3u);
+        {
+            EnvironmentPtr p_env(new Environment);
+            TS_ASSERT_THROWS_NOTHING(p_env->ExecuteStatements(library));
+            AbstractValuePtr p_result = (*call_ok)(*p_env);
+            TS_ASSERT(p_result->IsArray());
+            TS_ASSERT_EQUALS(GET_ARRAY(p_result).GetNumElements(), 2u);
+            TS_ASSERT_THROWS_CONTAINS((*call_bad)(*p_env), "Assertion failed");
+        }
+
+        // Undoing the changes restores the original library
+        optimiser.Restore();
+        TS_ASSERT_EQUALS(optimiser.GetNumberAssertionsElided(), 0u);
+        TS_ASSERT(library == original_library);
+        TS_ASSERT_EQUALS(p_f->rGetBody().size(), 4u);
+
+        // Only the given range of statements is trusted
+        optimiser.ElideAssertions(library, 2u, 3u);
+        TS_ASSERT_EQUALS(optimiser.GetNumberAssertionsElided(), 1u);
+        TS_ASSERT_EQUALS(p_f->rGetBody().size(), 4u);
+        {
+            EnvironmentPtr p_env(new Environment);
+            TS_ASSERT_THROWS_NOTHING(p_env->ExecuteStatements(library));
+            TS_ASSERT_THROWS_CONTAINS((*call_ok)(*p_env), "Assertion failed");
+        }
+        optimiser.Restore();
+    }
+
+    void TestLazyEvaluation() throw (Exception)
+    {
+        // Lazy definitions are computed when first looked up
+        EnvironmentPtr p_env(new Environment);
+        p_env->DefineLazily("bad", ASSIGN_STMT("bad", LOOKUP("missing")), "test");
+        {
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(LOOKUP("y"))(CONST(1));
+            DEFINE(plus, boost::make_shared<MathmlPlus>(args));
+            p_env->DefineLazily("z", ASSIGN_STMT("z", plus), "test");
+        }
+        p_env->DefineLazily("y", ASSIGN_STMT("y", CONST(2)), "test");
+        p_env->DefineLazily("c1", ASSIGN_STMT("c1", LOOKUP("c2")), "test");
+        p_env->DefineLazily("c2", ASSIGN_STMT("c2", LOOKUP("c1")), "test");
+        TS_ASSERT_EQUALS(p_env->GetNumberOfDefinitions(), 5u);
+        TS_ASSERT(p_env->HasName("z"));
+        TS_ASSERT(p_env->IsDefinitionPending("y"));
+        TS_ASSERT(p_env->IsDefinitionPending("z"));
+        TS_ASSERT_EQUALS(GET_SIMPLE_VALUE(p_env->Lookup("z")), 3.0);
+        TS_ASSERT(!p_env->IsDefinitionPending("y"));
+        TS_ASSERT(!p_env->IsDefinitionPending("z"));
+        TS_ASSERT_THROWS_CONTAINS(p_env->DefineName("y", CV(1), "test"), "Name y is already defined");
+        // Errors are only reported if the name is used, and each time it is used
+        TS_ASSERT(p_env->IsDefinitionPending("bad"));
+        TS_ASSERT_THROWS_CONTAINS(p_env->Lookup("bad"), "Name missing is not defined");
+        TS_ASSERT_THROWS_CONTAINS(p_env->Lookup("bad"), "Name missing is not defined");
+        TS_ASSERT_THROWS_CONTAINS(p_env->Lookup("c1"), "Name c1 is used in its own definition.");
+
+        // Post-processing statements are only kept if needed for the required names
+        std::vector<AbstractStatementPtr> program;
+        program.push_back(ASSIGN_STMT("a", CONST(1))); LOC(program.back());
+        program.push_back(ASSIGN_STMT("unused", LOOKUP("missing"))); LOC(program.back());
+        {
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(LOOKUP("a"))(CONST(1));
+            DEFINE(plus, boost::make_shared<MathmlPlus>(args));
+            program.push_back(ASSIGN_STMT("b", plus)); LOC(program.back());
+        }
+        program.push_back(ASSIGN_STMT("c", LOOKUP("a"))); LOC(program.back());
+        program.push_back(ASSERT_STMT(LOOKUP("c"))); LOC(program.back());
+        const std::vector<AbstractStatementPtr> original_program = program;
+        ProtocolOptimiser optimiser;
+        optimiser.RemoveUnusedStatements(program, boost::assign::list_of("b"));
+        TS_ASSERT_EQUALS(optimiser.GetNumberRemoved(), 1u);
+        TS_ASSERT_EQUALS(program.size(), 4u);
+        {
+            EnvironmentPtr p_pp_env(new Environment);
+            TS_ASSERT_THROWS_NOTHING(p_pp_env->ExecuteStatements(program));
+            TS_ASSERT_EQUALS(GET_SIMPLE_VALUE(p_pp_env->Lookup("b")), 2.0);
+        }
+        optimiser.Restore();
+        TS_ASSERT(program == original_program);
+        TS_ASSERT_EQUALS(optimiser.GetNumberRemoved(), 0u);
+        optimiser.RemoveUnusedStatements(program, std::set<std::string>());
+        TS_ASSERT_EQUALS(optimiser.GetNumberRemoved(), 2u); // Just a and c are needed, for the assertion
+        optimiser.Restore();
+
+        // Simulations only record the model outputs that are referenced, including within functions
+        std::vector<AbstractStatementPtr> uses;
+        {
+            std::vector<std::string> fps = boost::assign::list_of("t");
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(LOOKUP("t"))(LOOKUP("sim:V"));
+            DEFINE(plus, boost::make_shared<MathmlPlus>(args));
+            DEFINE(f, boost::make_shared<LambdaExpression>(fps, plus));
+            uses.push_back(ASSIGN_STMT("f", f)); LOC(uses.back());
+        }
+        uses.push_back(ASSIGN_STMT("d", LOOKUP("sim:time"))); LOC(uses.back());
+        std::set<std::string> referenced;
+        ProtocolOptimiser::CollectReferencedNames(uses, referenced);
+        TS_ASSERT_EQUALS(referenced.size(), 2u);
+        TS_ASSERT_EQUALS(referenced.count("sim:V"), 1u);
+        TS_ASSERT_EQUALS(referenced.count("sim:time"), 1u);
+        std::vector<AbstractExpressionPtr> conditions = EXPR_LIST(LOOKUP("sim:Cai"));
+        ProtocolOptimiser::CollectReferencedNames(conditions, referenced);
+        TS_ASSERT_EQUALS(referenced.count("sim:Cai"), 1u);
+    }
+
+    void TestThreadParallelLoops() throw (Exception)
+    {
+        ThreadPool* p_pool = ThreadPool::Instance();
+        TS_ASSERT_EQUALS(p_pool->GetNumThreads(), 1u);
+        TS_ASSERT(!p_pool->ShouldParallelise(100000u));
+        p_pool->SetNumThreads(4u);
+        p_pool->SetMinimumIterations(10u);
+        TS_ASSERT_EQUALS(p_pool->GetNumThreads(), 4u);
+        TS_ASSERT(p_pool->ShouldParallelise(10u));
+        TS_ASSERT(!p_pool->ShouldParallelise(9u));
+
+        EnvironmentPtr p_env(new Environment);
+        std::vector<AbstractStatementPtr> program;
+        // grid = { i * 100 + j for #0#i=0:50, #1#j=0:100 }
+        {
+            DEFINE_TUPLE(i_range, EXPR_LIST(CONST(0))(CONST(0))(CONST(1))(CONST(50))(VALUE(StringValue, "i")));
+            DEFINE_TUPLE(j_range, EXPR_LIST(CONST(1))(CONST(0))(CONST(1))(CONST(100))(VALUE(StringValue, "j")));
+            std::vector<AbstractExpressionPtr> comp_args = {i_range, j_range};
+            std::vector<AbstractExpressionPtr> args = {LOOKUP("i"), CONST(100)};
+            DEFINE(times, boost::make_shared<MathmlTimes>(args));
+            args = {times, LOOKUP("j")};
+            DEFINE(plus, boost::make_shared<MathmlPlus>(args));
+            DEFINE(array_exp, boost::make_shared<ArrayCreate>(plus, comp_args));
+            program.push_back(ASSIGN_STMT("grid", array_exp)); LOC(program.back());
+        }
+        // doubled = map(lambda x: x * 2, grid)
+        {
+            std::vector<AbstractExpressionPtr> args = {LOOKUP("x"), CONST(2)};
+            DEFINE(times, boost::make_shared<MathmlTimes>(args));
+            std::vector<std::string> fps = {"x"};
+            DEFINE(lambda, boost::make_shared<LambdaExpression>(fps, times));
+            args = EXPR_LIST(lambda)(LOOKUP("grid"));
+            DEFINE(map, boost::make_shared<Map>(args));
+            program.push_back(ASSIGN_STMT("doubled", map)); LOC(program.back());
+        }
+        // sums = fold(@2:+, grid, 0, 1)
+        {
+            DEFINE(plus, LambdaExpression::WrapMathml<MathmlPlus>(2));
+            DEFINE(fold, boost::make_shared<Fold>(plus, LOOKUP("grid"), CONST(0), CONST(1)));
+            program.push_back(ASSIGN_STMT("sums", fold)); LOC(program.back());
+        }
+        p_env->ExecuteStatements(program);
+        NdArray<double> grid = LookupArray(*p_env, "grid");
+        NdArray<double> doubled = LookupArray(*p_env, "doubled");
+        NdArray<double> sums = LookupArray(*p_env, "sums");
+        TS_ASSERT_EQUALS(grid.GetNumElements(), 5000u);
+        TS_ASSERT_EQUALS(sums.GetNumElements(), 50u);
+        NdArray<double>::Iterator it = grid.Begin();
+        NdArray<double>::Iterator doubled_it = doubled.Begin();
+        for (unsigned i=0; i<5000u; ++i)
+        {
+            TS_ASSERT_EQUALS(*it++, i);
+            TS_ASSERT_EQUALS(*doubled_it++, 2.0 * i);
+        }
+        it = sums.Begin();
+        for (unsigned i=0; i<50u; ++i)
+        {
+            TS_ASSERT_EQUALS(*it++, 10000.0 * i + 4950.0);
+        }
+
+        // Errors are reported as if the loop was sequential
+        {
+            // map(lambda x: if x == 3000 then [x, x] else x, grid)
+            std::vector<AbstractExpressionPtr> args = {LOOKUP("x"), CONST(3000)};
+            DEFINE(test, boost::make_shared<MathmlEq>(args));
+            args = {LOOKUP("x"), LOOKUP("x")};
+            DEFINE(pair, boost::make_shared<ArrayCreate>(args));
+            DEFINE(if_expr, boost::make_shared<If>(test, pair, LOOKUP("x")));
+            std::vector<std::string> fps = {"x"};
+            DEFINE(lambda, boost::make_shared<LambdaExpression>(fps, if_expr));
+            args = EXPR_LIST(lambda)(LOOKUP("grid"));
+            DEFINE(map, boost::make_shared<Map>(args));
+            TS_ASSERT_THROWS_CONTAINS((*map)(*p_env), "The function passed to map must only return simple values.");
+        }
+
+        // Side effects such as tracing force sequential evaluation
+        {
+            std::vector<AbstractExpressionPtr> args = {LOOKUP("i"), CONST(1)};
+            DEFINE(plus, boost::make_shared<MathmlPlus>(args));
+            plus->SetTrace();
+            DEFINE_TUPLE(i_range, EXPR_LIST(CONST(0))(CONST(0))(CONST(1))(CONST(20))(VALUE(StringValue, "i")));
+            std::vector<AbstractExpressionPtr> comp_args = {i_range};
+            DEFINE(array_exp, boost::make_shared<ArrayCreate>(plus, comp_args));
+            AbstractValuePtr p_array = (*array_exp)(*p_env);
+            NdArray<double> array = GET_ARRAY(p_array);
+            it = array.Begin();
+            for (unsigned i=0; i<20u; ++i)
+            {
+                TS_ASSERT_EQUALS(*it++, i + 1.0);
+            }
+        }
+
+        p_pool->SetNumThreads(1u);
+        TS_ASSERT(!p_pool->ShouldParallelise(100000u));
+        TS_ASSERT(!ThreadPool::InParallelRegion());
+    }
+
+    void TestCompiledFunctions() throw (Exception)
+    {
+        std::vector<AbstractStatementPtr> program;
+        // sq = lambda x: x * x
+        {
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(LOOKUP("x"))(LOOKUP("x"));
+            DEFINE(times, boost::make_shared<MathmlTimes>(args));
+            std::vector<std::string> fps = {"x"};
+            DEFINE(lambda, boost::make_shared<LambdaExpression>(fps, times));
+            program.push_back(ASSIGN_STMT("sq", lambda)); LOC(program.back());
+        }
+        // hyp = lambda a, b=3: { h2 = sq(a) + sq(b); return root(h2) }
+        {
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(LOOKUP("a"));
+            DEFINE(sq_a, boost::make_shared<FunctionCall>("sq", args));
+            args = EXPR_LIST(LOOKUP("b"));
+            DEFINE(sq_b, boost::make_shared<FunctionCall>("sq", args));
+            args = EXPR_LIST(sq_a)(sq_b);
+            DEFINE(plus, boost::make_shared<MathmlPlus>(args));
+            args = EXPR_LIST(LOOKUP("h2"));
+            DEFINE(root, boost::make_shared<MathmlRoot>(args));
+            std::vector<AbstractStatementPtr> body = {ASSIGN_STMT("h2", plus), RETURN_STMT(root)};
+            std::vector<std::string> fps = {"a", "b"};
+            std::vector<AbstractValuePtr> defaults = {boost::make_shared<DefaultParameter>(), CV(3)};
+            DEFINE(lambda, boost::make_shared<LambdaExpression>(fps, body, defaults));
+            program.push_back(ASSIGN_STMT("hyp", lambda)); LOC(program.back());
+        }
+        // fact = lambda n: if n <= 1 then 1 else n * fact(n - 1)
+        {
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(LOOKUP("n"))(CONST(1));
+            DEFINE(test, boost::make_shared<MathmlLeq>(args));
+            DEFINE(minus, boost::make_shared<MathmlMinus>(args));
+            args = EXPR_LIST(minus);
+            DEFINE(call, boost::make_shared<FunctionCall>("fact", args));
+            args = EXPR_LIST(LOOKUP("n"))(call);
+            DEFINE(times, boost::make_shared<MathmlTimes>(args));
+            DEFINE(if_expr, boost::make_shared<If>(test, CONST(1), times));
+            std::vector<std::string> fps = {"n"};
+            DEFINE(lambda, boost::make_shared<LambdaExpression>(fps, if_expr));
+            program.push_back(ASSIGN_STMT("fact", lambda)); LOC(program.back());
+        }
+        // pair = lambda x: [x, sq(x)]  --> creates an array, so is interpreted
+        {
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(LOOKUP("x"));
+            DEFINE(call, boost::make_shared<FunctionCall>("sq", args));
+            args = EXPR_LIST(LOOKUP("x"))(call);
+            DEFINE(array, boost::make_shared<ArrayCreate>(args));
+            std::vector<std::string> fps = {"x"};
+            DEFINE(lambda, boost::make_shared<LambdaExpression>(fps, array));
+            program.push_back(ASSIGN_STMT("pair", lambda)); LOC(program.back());
+        }
+        // wrap = lambda x: pair(x)  --> calls an interpreted function, so is interpreted
+        {
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(LOOKUP("x"));
+            DEFINE(call, boost::make_shared<FunctionCall>("pair", args));
+            DEFINE(lambda, boost::make_shared<LambdaExpression>(std::vector<std::string>(1, "x"), call));
+            program.push_back(ASSIGN_STMT("wrap", lambda)); LOC(program.back());
+        }
+        // squares = map(lambda x: sq(x) + 1, [1, 2, 3])  --> the anonymous function is translated
+        {
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(LOOKUP("x"));
+            DEFINE(call, boost::make_shared<FunctionCall>("sq", args));
+            args = EXPR_LIST(call)(CONST(1));
+            DEFINE(plus, boost::make_shared<MathmlPlus>(args));
+            DEFINE(lambda, boost::make_shared<LambdaExpression>(std::vector<std::string>(1, "x"), plus));
+            args = EXPR_LIST(CONST(1))(CONST(2))(CONST(3));
+            DEFINE(array, boost::make_shared<ArrayCreate>(args));
+            args = EXPR_LIST(lambda)(array);
+            DEFINE(map, boost::make_shared<Map>(args));
+            program.push_back(ASSIGN_STMT("squares", map)); LOC(program.back());
+        }
+        // apply = lambda sq, a: map(lambda x: sq(x), a)  --> sq is a parameter here, so neither is translated
+        {
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(LOOKUP("x"));
+            DEFINE(call, boost::make_shared<FunctionCall>("sq", args));
+            DEFINE(inner, boost::make_shared<LambdaExpression>(std::vector<std::string>(1, "x"), call));
+            args = EXPR_LIST(inner)(LOOKUP("a"));
+            DEFINE(map, boost::make_shared<Map>(args));
+            std::vector<std::string> fps = {"sq", "a"};
+            DEFINE(lambda, boost::make_shared<LambdaExpression>(fps, map));
+            program.push_back(ASSIGN_STMT("apply", lambda)); LOC(program.back());
+        }
+        // grid = { i * 3 + fact(j) for #0#i=1:3, #1#j=0:3 }  --> the generator is translated
+        {
+            DEFINE_TUPLE(i_range, EXPR_LIST(CONST(0))(CONST(1))(CONST(1))(CONST(3))(VALUE(StringValue, "i")));
+            DEFINE_TUPLE(j_range, EXPR_LIST(CONST(1))(CONST(0))(CONST(1))(CONST(3))(VALUE(StringValue, "j")));
+            std::vector<AbstractExpressionPtr> comp_args = {i_range, j_range};
+            std::vector<AbstractExpressionPtr> args = {LOOKUP("i"), CONST(3)};
+            DEFINE(times, boost::make_shared<MathmlTimes>(args));
+            args = EXPR_LIST(LOOKUP("j"));
+            DEFINE(call, boost::make_shared<FunctionCall>("fact", args));
+            args = {times, call};
+            DEFINE(plus, boost::make_shared<MathmlPlus>(args));
+            DEFINE(array, boost::make_shared<ArrayCreate>(plus, comp_args));
+            program.push_back(ASSIGN_STMT("grid", array)); LOC(program.back());
+        }
+
+        std::vector<AbstractExpression*> functions;
+        std::string code = ProtocolCompiler::GenerateCode(program, functions);
+        TS_ASSERT_EQUALS(functions.size(), 5u);
+        TS_ASSERT_DIFFERS(code.find("fc_function_4"), std::string::npos);
+        TS_ASSERT_EQUALS(code.find("fc_function_5"), std::string::npos);
+        TS_ASSERT_DIFFERS(code.find("// anonymous function"), std::string::npos);
+        TS_ASSERT_DIFFERS(code.find("// array comprehension"), std::string::npos);
+
+        OutputFileHandler handler("TestCoreProtocolLanguage_Compiler");
+        ModelCache cache(handler.FindFile("cache"));
+        ProtocolCompiler compiler;
+        compiler.Compile(program, cache, "TestCompiledFunctions");
+        TS_ASSERT_EQUALS(compiler.GetNumberCompiled(), 5u);
+        TS_ASSERT(!compiler.GetUsedCachedLibrary());
+        // The cache holds a single entry with the library and its code; the work folder has gone
+        std::vector<FileFinder> entries = handler.FindFile("cache").FindMatches("*");
+        TS_ASSERT_EQUALS(entries.size(), 1u);
+        TS_ASSERT(FileFinder("protocol.so", entries.front()).Exists());
+        TS_ASSERT(FileFinder("protocol.cpp", entries.front()).Exists());
+
+        EnvironmentPtr p_env(new Environment);
+        p_env->ExecuteStatements(program);
+        std::vector<AbstractExpressionPtr> args = EXPR_LIST(CONST(4));
+        TS_ASSERT_EQUALS(GET_SIMPLE_VALUE((*boost::make_shared<FunctionCall>("hyp", args))(*p_env)), 5.0);
+        args = EXPR_LIST(CONST(5));
+        TS_ASSERT_EQUALS(GET_SIMPLE_VALUE((*boost::make_shared<FunctionCall>("fact", args))(*p_env)), 120.0);
+        // Array arguments are handled by the interpreter
+        args = EXPR_LIST(CONST(3));
+        NdArray<double> pair = GET_ARRAY((*boost::make_shared<FunctionCall>("wrap", args))(*p_env));
+        TS_ASSERT_EQUALS(pair.GetNumElements(), 2u);
+        TS_ASSERT_EQUALS(*(++pair.Begin()), 9.0);
+        args = EXPR_LIST(boost::make_shared<FunctionCall>("wrap", args));
+        NdArray<double> squares = GET_ARRAY((*boost::make_shared<FunctionCall>("sq", args))(*p_env));
+        TS_ASSERT_EQUALS(*squares.Begin(), 9.0);
+        TS_ASSERT_EQUALS(*(++squares.Begin()), 81.0);
+        // Map and comprehensions use the native code for each element
+        NdArray<double> mapped = LookupArray(*p_env, "squares");
+        std::vector<double> mapped_values(mapped.Begin(), mapped.End());
+        std::vector<double> expected = {2, 5, 10};
+        TS_ASSERT_EQUALS(mapped_values, expected);
+        NdArray<double> grid = LookupArray(*p_env, "grid");
+        TS_ASSERT_EQUALS(grid.GetShape()[0], 2u);
+        TS_ASSERT_EQUALS(grid.GetShape()[1], 3u);
+        std::vector<double> grid_values(grid.Begin(), grid.End());
+        expected = {4, 4, 5, 7, 7, 8};
+        TS_ASSERT_EQUALS(grid_values, expected);
+
+        // A second compilation of the same code uses the cached library, even from another cache object
+        ProtocolCompiler compiler2;
+        ModelCache cache2(handler.FindFile("cache"));
+        compiler2.Compile(program, cache2, "TestCompiledFunctions");
+        TS_ASSERT_EQUALS(compiler2.GetNumberCompiled(), 5u);
+        TS_ASSERT(compiler2.GetUsedCachedLibrary());
+        TS_ASSERT_EQUALS(handler.FindFile("cache").FindMatches("*").size(), 1u);
+        compiler2.Restore();
+        compiler.Restore();
+        TS_ASSERT_EQUALS(compiler.GetNumberCompiled(), 0u);
+
+        // If the compiler fails, we get a warning, nothing is cached, and no temporary files are left
+        const char* p_cxx = getenv("CXX");
+        const std::string old_cxx = p_cxx ? p_cxx : "";
+        setenv("CXX", "false", 1);
+        const unsigned num_warnings = Warnings::Instance()->GetNumWarnings();
+        ModelCache failing_cache(handler.FindFile("failing_cache"));
+        ProtocolCompiler compiler3;
+        compiler3.Compile(program, failing_cache, "TestCompiledFunctions");
+        if (p_cxx)
+        {
+            setenv("CXX", old_cxx.c_str(), 1);
+        }
+        else
+        {
+            unsetenv("CXX");
+        }
+        TS_ASSERT_EQUALS(compiler3.GetNumberCompiled(), 0u);
+        TS_ASSERT_EQUALS(handler.FindFile("failing_cache").FindMatches("*").size(), 0u);
+        TS_ASSERT_EQUALS(Warnings::Instance()->GetNumWarnings(), num_warnings + 1u);
+        Warnings::QuietDestroy();
+    }
+
+    void TestShapeInference() throw (Exception)
+    {
+        EnvironmentPtr p_inputs(new Environment(true));
+        p_inputs->DefineName("n", CV(4), "input");
+        std::vector<AbstractStatementPtr> program = MakeOptimisableProgram();
+        // d = sim:y + [1, 2, 3]  --> the simulation result is known to be 1d, so this has shape {3}
+        {
+            std::vector<AbstractExpressionPtr> elements = EXPR_LIST(CONST(1))(CONST(2))(CONST(3));
+            DEFINE(array, boost::make_shared<ArrayCreate>(elements));
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(LOOKUP("sim:y"))(array);
+            DEFINE(plus, boost::make_shared<MathmlPlus>(args));
+            program.push_back(ASSIGN_STMT("d", plus)); LOC(program.back());
+        }
+        // e = if n > sim:y[0] then undefined else 1  --> only a possible error, so not reported
+        {
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(LOOKUP("n"))(LOOKUP("sim:z"));
+            DEFINE(test, boost::make_shared<MathmlGt>(args));
+            DEFINE(if_expr, boost::make_shared<If>(test, LOOKUP("undefined"), CONST(1)));
+            program.push_back(ASSIGN_STMT("e", if_expr)); LOC(program.back());
+        }
+
+        ShapeInference inference;
+        std::map<std::string, NdArray<double>::Extents> results;
+        results["y"] = NdArray<double>::Extents(1, ShapeInference::UNKNOWN_EXTENT);
+        inference.DeclareResults("sim", results);
+        inference.Check(program, *p_inputs);
+        const std::map<std::string, NdArray<double>::Extents>& r_shapes = inference.rGetInferredShapes();
+        TS_ASSERT_EQUALS(r_shapes.size(), 4u); // k, v, r, d
+        TS_ASSERT_EQUALS(r_shapes.at("k").size(), 0u);
+        TS_ASSERT_EQUALS(r_shapes.at("v"), NdArray<double>::Extents(1, 2u));
+        TS_ASSERT_EQUALS(r_shapes.at("r"), NdArray<double>::Extents(1, 2u));
+        TS_ASSERT_EQUALS(r_shapes.at("d"), NdArray<double>::Extents(1, 3u));
+        ShapeInference::Type c_type = inference.GetInferredType("c");
+        TS_ASSERT_EQUALS(c_type.kind, ShapeInference::ARRAY);
+        TS_ASSERT(c_type.rankKnown);
+        TS_ASSERT_EQUALS(c_type.extents.size(), 2u);
+        TS_ASSERT_EQUALS(inference.GetInferredType("scale").kind, ShapeInference::FUNCTION);
+        TS_ASSERT_EQUALS(inference.GetInferredType("e").kind, ShapeInference::UNKNOWN);
+
+        // Functions defined in a library that has already run are followed too
+        EnvironmentPtr p_library(new Environment(p_inputs->GetAsDelegatee()));
+        p_library->ExecuteStatements(MakeOptimisableProgram());
+        // w = scale(1, [k, k, k])
+        std::vector<AbstractStatementPtr> post_proc;
+        {
+            std::vector<AbstractExpressionPtr> elements = EXPR_LIST(LOOKUP("k"))(LOOKUP("k"))(LOOKUP("k"));
+            DEFINE(array, boost::make_shared<ArrayCreate>(elements));
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(CONST(1))(array);
+            DEFINE(call, boost::make_shared<FunctionCall>("scale", args));
+            post_proc.push_back(ASSIGN_STMT("w", call)); LOC(post_proc.back());
+        }
+        inference.Check(post_proc, *p_library);
+        TS_ASSERT_EQUALS(inference.rGetInferredShapes().size(), 1u);
+        TS_ASSERT_EQUALS(inference.rGetInferredShapes().at("w"), NdArray<double>::Extents(1, 3u));
+
+        // Errors that are certain to happen are reported
+        // bad = v + [1, 2, 3]
+        {
+            std::vector<AbstractExpressionPtr> elements = EXPR_LIST(CONST(1))(CONST(2))(CONST(3));
+            DEFINE(array, boost::make_shared<ArrayCreate>(elements));
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(LOOKUP("v"))(array);
+            DEFINE(plus, boost::make_shared<MathmlPlus>(args));
+            std::vector<AbstractStatementPtr> bad_program = {ASSIGN_STMT("bad", plus)};
+            TS_ASSERT_THROWS_CONTAINS(inference.Check(bad_program, *p_library),
+                                      "cannot be broadcast together; shape {3} is incompatible with {2}");
+        }
+        // a, b = k
+        {
+            std::vector<std::string> names = {"a", "b"};
+            std::vector<AbstractStatementPtr> bad_program = {ASSIGN_STMT(names, LOOKUP("k"))};
+            TS_ASSERT_THROWS_CONTAINS(inference.Check(bad_program, *p_library),
+                                      "When assigning multiple names the value to assign must be a tuple.");
+        }
+        // bad = scale(1)
+        {
+            std::vector<AbstractExpressionPtr> args = EXPR_LIST(CONST(1));
+            DEFINE(call, boost::make_shared<FunctionCall>("scale", args));
+            std::vector<AbstractStatementPtr> bad_program = {ASSIGN_STMT("bad", call)};
+            TS_ASSERT_THROWS_CONTAINS(inference.Check(bad_program, *p_library),
+                                      "Function expected 2 parameters, but received 1.");
+        }
+        // bad = undefined
+        {
+            std::vector<AbstractStatementPtr> bad_program = {ASSIGN_STMT("bad", LOOKUP("undefined"))};
+            TS_ASSERT_THROWS_CONTAINS(inference.Check(bad_program, *p_library),
+                                      "Name undefined is not defined in this environment.");
+        }
+        // Unless they are in an optional assignment
+        {
+            DEFINE_STMT(optional, boost::make_shared<AssignmentStatement>("bad", LOOKUP("undefined"), true));
+            std::vector<AbstractStatementPtr> ok_program = {optional};
+            TS_ASSERT_THROWS_NOTHING(inference.Check(ok_program, *p_library));
+        }
+    }
 };
 
 #endif // TESTCOREPROTOCOLLANGUAGE_HPP_
@@ -0,0 +1,122 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+#ifndef TESTENSEMBLELOOPS_HPP_
+#define TESTENSEMBLELOOPS_HPP_
+
+#include <cxxtest/TestSuite.h>
+
+#include <cmath>
+#include <map>
+#include <sstream>
+#include <string>
+#include <boost/foreach.hpp>
+
+#include "ProtocolRunner.hpp"
+#include "ProtoHelperMacros.hpp"
+
+#include "FileFinder.hpp"
+
+#include "FakePetscSetup.hpp"
+
+class TestEnsembleLoops : public CxxTest::TestSuite
+{
+    /**
+     * Run a small IV sweep.
+     *
+     * @param rDirname  the output folder
+     * @param ensembleSize  how many iterations of the sweep to run together
+     * @param nativeLoops  whether to use specialised simulation loops
+     * @return  the protocol outputs, by name
+     */
+    std::map<std::string, NdArray<double> > RunSweep(const std::string& rDirname, unsigned ensembleSize,
+                                                     bool nativeLoops)
+    {
+        FileFinder cellml_file("projects/FunctionalCuration/cellml/luo_rudy_1991.cellml", RelativeTo::ChasteSourceRoot);
+        ProtocolFileFinder proto_file("projects/FunctionalCuration/test/protocols/test_ensemble_iv.txt", RelativeTo::ChasteSourceRoot);
+        ProtocolRunner runner(cellml_file, proto_file, rDirname);
+        runner.GetProtocol()->SetSimulationEnsembleSize(ensembleSize);
+        runner.GetProtocol()->SetNativeSimulationLoops(nativeLoops);
+        runner.RunProtocol();
+        FileFinder success_file(rDirname + "/success", RelativeTo::ChasteTestOutput);
+        TS_ASSERT(success_file.Exists());
+
+        std::map<std::string, NdArray<double> > outputs;
+        const Environment& r_outputs = runner.GetProtocol()->rGetOutputsCollection();
+        BOOST_FOREACH(const std::string& r_name, r_outputs.GetDefinedNames())
+        {
+            outputs[r_name] = GET_ARRAY(r_outputs.Lookup(r_name));
+        }
+        return outputs;
+    }
+
+public:
+    void TestEnsembleMatchesSerial() throw (Exception)
+    {
+        std::map<std::string, NdArray<double> > serial = RunSweep("TestEnsembleLoops_Serial", 1u, false);
+        TS_ASSERT_EQUALS(serial.size(), 3u);
+        TS_ASSERT_EQUALS(serial["INa"].GetShape()[0], 9u);
+
+        // With 9 test potentials, the 7 between the first and last run in batches of 4 and 3, or all together;
+        // the specialised loops record outputs straight into the results arrays
+        const unsigned ensemble_sizes[] = {4u, 4u, 20u};
+        const bool native_loops[] = {false, true, false};
+        for (unsigned run=0; run<3u; ++run)
+        {
+            std::stringstream dirname;
+            dirname << "TestEnsembleLoops_" << ensemble_sizes[run] << (native_loops[run] ? "_Native" : "");
+            std::map<std::string, NdArray<double> > ensemble = RunSweep(dirname.str(), ensemble_sizes[run], native_loops[run]);
+            TS_ASSERT_EQUALS(ensemble.size(), serial.size());
+            typedef std::pair<std::string, NdArray<double> > NameArrayPair;
+            BOOST_FOREACH(const NameArrayPair& r_output, serial)
+            {
+                const NdArray<double>& r_expected = r_output.second;
+                NdArray<double> actual = ensemble[r_output.first];
+                TS_ASSERT(actual.GetShape() == r_expected.GetShape());
+                if (actual.GetShape() == r_expected.GetShape())
+                {
+                    NdArray<double>::ConstIterator exp_it = r_expected.Begin();
+                    for (NdArray<double>::ConstIterator it=actual.Begin(); it != actual.End(); ++it, ++exp_it)
+                    {
+                        TS_ASSERT_DELTA(*it, *exp_it, 1e-6 * (1.0 + fabs(*exp_it)));
+                    }
+                }
+            }
+        }
+    }
+};
+
+#endif // TESTENSEMBLELOOPS_HPP_
@@ -0,0 +1,105 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TESTLOCATINGEVENTS_HPP_
+#define TESTLOCATINGEVENTS_HPP_
+
+#include <cxxtest/TestSuite.h>
+
+#include <cmath>
+#include <string>
+
+#include "ProtocolRunner.hpp"
+#include "ProtoHelperMacros.hpp"
+
+#include "FileFinder.hpp"
+
+#include "FakePetscSetup.hpp"
+
+class TestLocatingEvents : public CxxTest::TestSuite
+{
+    /**
+     * Check when an event was recorded as happening.
+     *
+     * @param rTimes  the event's result, with one entry per output point
+     * @param outputPoint  the output point at which the event should be recorded, or -1 if it shouldn't be
+     * @param time  when the event should have happened
+     */
+    void CheckEventTimes(const NdArray<double>& rTimes, int outputPoint, double time)
+    {
+        TS_ASSERT_EQUALS(rTimes.GetNumDimensions(), 1u);
+        TS_ASSERT_EQUALS(rTimes.GetNumElements(), 6u);
+        int i = 0;
+        for (NdArray<double>::ConstIterator it=rTimes.Begin(); it != rTimes.End(); ++it, ++i)
+        {
+            if (i == outputPoint)
+            {
+                TS_ASSERT_DELTA(*it, time, 1e-5);
+            }
+            else
+            {
+                TS_ASSERT(std::isnan(*it));
+            }
+        }
+    }
+
+public:
+    void TestEventTimes() throw (Exception)
+    {
+        std::string dirname = "TestLocatingEvents";
+        FileFinder cellml_file("projects/FunctionalCuration/cellml/luo_rudy_1991.cellml", RelativeTo::ChasteSourceRoot);
+        ProtocolFileFinder proto_file("projects/FunctionalCuration/test/protocols/test_events.txt", RelativeTo::ChasteSourceRoot);
+        ProtocolRunner runner(cellml_file, proto_file, dirname);
+        runner.RunProtocol();
+        FileFinder success_file(dirname + "/success", RelativeTo::ChasteTestOutput);
+        TS_ASSERT(success_file.Exists());
+
+        // Outputs are only sampled every ms, but the crossings are found between the samples
+        const Environment& r_outputs = runner.GetProtocol()->rGetOutputsCollection();
+        CheckEventTimes(GET_ARRAY(r_outputs.Lookup("up")), 3, 2.5);
+        CheckEventTimes(GET_ARRAY(r_outputs.Lookup("down")), -1, 0.0);
+        CheckEventTimes(GET_ARRAY(r_outputs.Lookup("steep")), 4, 3.2);
+
+        // Locating events doesn't change the solution
+        NdArray<double> voltage = GET_ARRAY(r_outputs.Lookup("V"));
+        double t = 0.0;
+        for (NdArray<double>::ConstIterator it=voltage.Begin(); it != voltage.End(); ++it, t += 1.0)
+        {
+            TS_ASSERT_DELTA(*it, exp(t), 1e-4 * exp(t));
+        }
+    }
+};
+
+#endif // TESTLOCATINGEVENTS_HPP_
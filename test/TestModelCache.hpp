@@ -0,0 +1,97 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TESTMODELCACHE_HPP_
+#define TESTMODELCACHE_HPP_
+
+#include <string>
+#include <boost/make_shared.hpp>
+#include <cxxtest/TestSuite.h>
+
+#include "ProtocolRunner.hpp"
+#include "ModelCache.hpp"
+
+#include "FileFinder.hpp"
+#include "OutputFileHandler.hpp"
+
+#include "PetscSetupAndFinalize.hpp"
+
+class TestModelCache : public CxxTest::TestSuite
+{
+public:
+    void TestReusingBuiltModels() throw (Exception)
+    {
+        std::string dirname = "TestModelCache_TestReusingBuiltModels";
+        OutputFileHandler handler(dirname);
+        boost::shared_ptr<ModelCache> p_cache = boost::make_shared<ModelCache>(handler.FindFile("cache"));
+        ProtocolFileFinder proto_file("projects/FunctionalCuration/test/protocols/test_original_definition.txt", RelativeTo::ChasteSourceRoot);
+        FileFinder cellml_file("projects/FunctionalCuration/test/data/simple_ode.cellml", RelativeTo::ChasteSourceRoot);
+
+        // The first run builds the model and stores it
+        {
+            ProtocolRunner runner(cellml_file, proto_file, dirname + "/first", false, false, ProtocolRunner::CVODE, p_cache);
+            TS_ASSERT(!runner.GetUsedCachedModel());
+            runner.RunProtocol();
+            FileFinder success_file(dirname + "/first/success", RelativeTo::ChasteTestOutput);
+            TS_ASSERT(success_file.Exists());
+        }
+
+        // A second run of the same model and protocol reuses it, giving the same results
+        {
+            ProtocolRunner runner(cellml_file, proto_file, dirname + "/second", false, false, ProtocolRunner::CVODE, p_cache);
+            TS_ASSERT(runner.GetUsedCachedModel());
+            runner.RunProtocol();
+            FileFinder success_file(dirname + "/second/success", RelativeTo::ChasteTestOutput);
+            TS_ASSERT(success_file.Exists());
+            FileFinder library(dirname + "/second/libsimple_ode.so", RelativeTo::ChasteTestOutput);
+            TS_ASSERT(library.Exists());
+        }
+
+        // Other converter options need another build
+        {
+            ProtocolRunner runner(cellml_file, proto_file, dirname + "/jacobian", false, true, ProtocolRunner::CVODE, p_cache);
+            TS_ASSERT(!runner.GetUsedCachedModel());
+        }
+
+        // Evicting everything means the model must be built again
+        TS_ASSERT_EQUALS(p_cache->Prune(0u), 2u);
+        {
+            ProtocolRunner runner(cellml_file, proto_file, dirname + "/third", false, false, ProtocolRunner::CVODE, p_cache);
+            TS_ASSERT(!runner.GetUsedCachedModel());
+        }
+    }
+};
+
+#endif // TESTMODELCACHE_HPP_
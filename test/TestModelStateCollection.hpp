@@ -38,6 +38,9 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <cxxtest/TestSuite.h>
 
+#include <cfloat>
+#include <cmath>
+#include <vector>
 #include <boost/pointer_cast.hpp> // NB: Not available on Boost 1.33.1
 
 #include "ModelStateCollection.hpp"
@@ -46,6 +49,11 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "SimpleStimulus.hpp"
 #include "EulerIvpOdeSolver.hpp"
 
+#include "ProtocolRunner.hpp"
+#include "CvodeEventLocator.hpp"
+#include "FileFinder.hpp"
+#include "VectorHelperFunctions.hpp"
+
 #include "FakePetscSetup.hpp"
 
 class TestModelStateCollection : public CxxTest::TestSuite
@@ -84,6 +92,61 @@ public:
             TS_ASSERT_EQUALS(inits[i], r_state[i]);
         }
     }
+
+    void TestSavingSolverStepSize() throw (Exception)
+    {
+#ifdef CHASTE_CVODE
+        // Warm restarts need a model solved with CVODE and wrapped for protocols
+        FileFinder cellml_file("projects/FunctionalCuration/cellml/luo_rudy_1991.cellml", RelativeTo::ChasteSourceRoot);
+        ProtocolFileFinder proto_file("projects/FunctionalCuration/test/protocols/test_stimulus_stops.txt", RelativeTo::ChasteSourceRoot);
+        ProtocolRunner runner(cellml_file, proto_file, "TestModelStateCollection_WarmRestarts");
+        boost::shared_ptr<AbstractSystemWithOutputs> p_model = runner.GetProtocol()->GetModel();
+        boost::shared_ptr<AbstractParameterisedSystem<N_Vector> > p_system
+                = boost::dynamic_pointer_cast<AbstractParameterisedSystem<N_Vector> >(p_model);
+        TS_ASSERT(p_system);
+        p_model->SetWarmRestarts(true);
+        TS_ASSERT_EQUALS(p_model->GetSolverStepSize(), 0.0);
+
+        // Solve into the plateau, where the solver takes large steps, and save the state there
+        ModelStateCollection collection;
+        p_model->SetFreeVariable(0.0);
+        p_model->SolveModel(200.0);
+        const double step_size = p_model->GetSolverStepSize();
+        TS_ASSERT_LESS_THAN(0.0, step_size);
+        collection.SaveState("plateau", p_system);
+
+        // Carry on, then go back and do it again: the solver resumes with the saved step size
+        p_model->SolveModel(250.0);
+        std::vector<double> carried_on;
+        for (unsigned i=0; i<p_system->GetNumberOfStateVariables(); ++i)
+        {
+            carried_on.push_back(GetVectorComponent(p_system->rGetStateVariables(), i));
+        }
+        collection.SetModelState(p_system, "plateau");
+        TS_ASSERT_EQUALS(p_model->GetSolverStepSize(), step_size);
+        p_model->SetFreeVariable(200.0);
+        p_model->SolveModel(250.0);
+        for (unsigned i=0; i<carried_on.size(); ++i)
+        {
+            const double resumed = GetVectorComponent(p_system->rGetStateVariables(), i);
+            TS_ASSERT_DELTA(resumed, carried_on[i], 1e-4 * fabs(carried_on[i]) + 1e-8);
+        }
+
+        // Starting at the saved step size saves CVODE working up to it from a cautious first step
+        AbstractCvodeSystem* p_cvode_system = dynamic_cast<AbstractCvodeSystem*>(p_model.get());
+        TS_ASSERT(p_cvode_system);
+        std::vector<AbstractSystemWithOutputs::EventInfo> no_events;
+        std::vector<double> event_times;
+        collection.SetModelState(p_system, "plateau");
+        CvodeEventLocator cold(p_cvode_system, no_events);
+        cold.Solve(200.0, 250.0, DBL_MAX, event_times);
+        collection.SetModelState(p_system, "plateau");
+        CvodeEventLocator warm(p_cvode_system, no_events);
+        warm.SetInitialStepSize(step_size);
+        warm.Solve(200.0, 250.0, DBL_MAX, event_times);
+        TS_ASSERT_LESS_THAN(warm.GetNumSteps(), cold.GetNumSteps());
+#endif // CHASTE_CVODE
+    }
 };
 
 #endif // TESTMODELSTATECOLLECTION_HPP_
@@ -0,0 +1,101 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TESTNESTEDREDUCTIONS_HPP_
+#define TESTNESTEDREDUCTIONS_HPP_
+
+#include <cxxtest/TestSuite.h>
+
+#include <string>
+#include <vector>
+#include <boost/foreach.hpp>
+
+#include "ProtocolRunner.hpp"
+#include "ProtoHelperMacros.hpp"
+
+#include "FileFinder.hpp"
+
+#include "FakePetscSetup.hpp"
+
+class TestNestedReductions : public CxxTest::TestSuite
+{
+public:
+    void TestReductionsMatchPostProcessing() throw (Exception)
+    {
+        std::string dirname = "TestNestedReductions";
+        FileFinder cellml_file("projects/FunctionalCuration/cellml/luo_rudy_1991.cellml", RelativeTo::ChasteSourceRoot);
+        ProtocolFileFinder proto_file("projects/FunctionalCuration/test/protocols/test_nested_reductions.txt", RelativeTo::ChasteSourceRoot);
+        ProtocolRunner runner(cellml_file, proto_file, dirname);
+        runner.RunProtocol();
+        FileFinder success_file(dirname + "/success", RelativeTo::ChasteTestOutput);
+        TS_ASSERT(success_file.Exists());
+
+        // The protocol checks the values itself; check here that only the reduced results were kept
+        const Environment& r_reduced = runner.GetProtocol()->rGetOutputsCollection("reduced");
+        TS_ASSERT(!r_reduced.HasName("membrane_voltage", "test"));
+        TS_ASSERT(runner.GetProtocol()->rGetOutputsCollection("full").HasName("membrane_voltage", "test"));
+
+        const Environment& r_outputs = runner.GetProtocol()->rGetOutputsCollection();
+        std::vector<std::string> names;
+        names.push_back("final_V");
+        names.push_back("peak_V");
+        names.push_back("mean_V");
+        BOOST_FOREACH(const std::string& r_name, names)
+        {
+            NdArray<double> expected = GET_ARRAY(r_outputs.Lookup(r_name));
+            NdArray<double> reduced = GET_ARRAY(r_outputs.Lookup("reduced_" + r_name));
+            TS_ASSERT_EQUALS(reduced.GetShape()[0], 5u);
+            TS_ASSERT(reduced.GetShape() == expected.GetShape());
+            if (reduced.GetShape() == expected.GetShape())
+            {
+                for (NdArray<double>::ConstIterator it=reduced.Begin(), exp_it=expected.Begin(); it != reduced.End(); ++it, ++exp_it)
+                {
+                    TS_ASSERT_DELTA(*it, *exp_it, 1e-12);
+                }
+            }
+        }
+
+        // Each iteration starts from iter*iter and rises by 10 over its trace
+        NdArray<double> final_V = GET_ARRAY(r_outputs.Lookup("reduced_final_V"));
+        NdArray<double>::Indices idxs = final_V.GetIndices();
+        for (unsigned i=0; i<5u; ++i)
+        {
+            idxs[0] = i;
+            TS_ASSERT_DELTA(final_V[idxs], i*i + 10.0, 1e-4);
+        }
+    }
+};
+
+#endif // TESTNESTEDREDUCTIONS_HPP_
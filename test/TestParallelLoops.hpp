@@ -38,16 +38,73 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <cxxtest/TestSuite.h>
 
+#include <sstream>
 #include <string>
+#include <vector>
+#include <boost/foreach.hpp>
+#include <boost/make_shared.hpp>
 
 #include "ProtocolRunner.hpp"
 #include "ProtocolFileFinder.hpp"
+#include "ProtoHelperMacros.hpp"
+#include "ThreadPool.hpp"
 
+#include "AbstractCardiacCellInterface.hpp"
 #include "FileFinder.hpp"
+#include "OutputFileHandler.hpp"
 #include "Warnings.hpp"
 
 #include "PetscSetupAndFinalize.hpp"
 
+/**
+ * A parallel loop using Chaste's singletons as nested simulations may: each iteration warns, and finds
+ * a path in an output folder.
+ */
+class SingletonsLoop : public AbstractParallelLoop
+{
+public:
+    /**
+     * Create the loop.
+     *
+     * @param rHandler  the output folder
+     * @param numIterations  the number of iterations
+     */
+    SingletonsLoop(const OutputFileHandler& rHandler, unsigned numIterations)
+        : mrHandler(rHandler),
+          mPaths(numIterations)
+    {}
+
+    /**
+     * Run some iterations.
+     *
+     * @param start  the first iteration
+     * @param end  one past the last iteration
+     */
+    void RunIterations(unsigned start, unsigned end)
+    {
+        for (unsigned i=start; i<end; ++i)
+        {
+            std::stringstream name;
+            name << "run_" << i;
+            mPaths[i] = mrHandler.FindFile(name.str()).GetAbsolutePath();
+            THREAD_SAFE_WARNING("Iteration " << i << " of a parallel loop.");
+        }
+    }
+
+    /** @return  the path found by each iteration */
+    const std::vector<std::string>& rGetPaths() const
+    {
+        return mPaths;
+    }
+
+private:
+    /** The output folder. */
+    const OutputFileHandler& mrHandler;
+
+    /** The path found by each iteration. */
+    std::vector<std::string> mPaths;
+};
+
 class TestParallelLoops : public CxxTest::TestSuite
 {
 public:
@@ -71,6 +128,166 @@ public:
         // Also check that replication works for more processes than iterations, by ensuring no warnings occurred
         TS_ASSERT_EQUALS(Warnings::Instance()->GetNumWarnings(), 0u)
     }
+
+    void TestNativeLoops() throw (Exception)
+    {
+        // This protocol checks its own results for many combinations of nested timecourse simulations
+        std::string dirname = "TestParallelLoops_Native";
+        ProtocolFileFinder proto_file("projects/FunctionalCuration/test/protocols/test_parallel_nested.txt", RelativeTo::ChasteSourceRoot);
+        FileFinder cellml_file("projects/FunctionalCuration/cellml/luo_rudy_1991.cellml", RelativeTo::ChasteSourceRoot);
+        ProtocolRunner runner(cellml_file, proto_file, dirname);
+        runner.GetProtocol()->SetParalleliseLoops();
+        runner.GetProtocol()->SetNativeSimulationLoops();
+        runner.RunProtocol();
+        FileFinder success_file(dirname + "/success", RelativeTo::ChasteTestOutput);
+        TS_ASSERT(success_file.Exists());
+    }
+
+    void TestLoadBalancedLoops() throw (Exception)
+    {
+        // Iterations handed out by the master process must give the same results as the fixed pattern
+        std::string dirname = "TestParallelLoops_Balanced";
+        ProtocolFileFinder proto_file("projects/FunctionalCuration/test/protocols/test_parallel_nested.txt", RelativeTo::ChasteSourceRoot);
+        FileFinder cellml_file("projects/FunctionalCuration/cellml/luo_rudy_1991.cellml", RelativeTo::ChasteSourceRoot);
+        ProtocolRunner runner(cellml_file, proto_file, dirname);
+        runner.GetProtocol()->SetParalleliseLoops(true, true);
+        runner.RunProtocol();
+        FileFinder success_file(dirname + "/success", RelativeTo::ChasteTestOutput);
+        TS_ASSERT(success_file.Exists());
+        TS_ASSERT_EQUALS(Warnings::Instance()->GetNumWarnings(), 0u)
+    }
+
+    void TestThreadedLoops() throw (Exception)
+    {
+        // Independent iterations are shared among threads, each with its own copy of the model,
+        // and the protocol's checks of its own results must still pass
+        std::string dirname = "TestParallelLoops_Threaded";
+        ProtocolFileFinder proto_file("projects/FunctionalCuration/test/protocols/test_parallel_nested.txt", RelativeTo::ChasteSourceRoot);
+        FileFinder cellml_file("projects/FunctionalCuration/cellml/luo_rudy_1991.cellml", RelativeTo::ChasteSourceRoot);
+        ProtocolRunner runner(cellml_file, proto_file, dirname);
+        runner.GetProtocol()->SetParalleliseLoops();
+        runner.GetProtocol()->SetNumSimulationThreads(3u);
+        runner.RunProtocol();
+        FileFinder success_file(dirname + "/success", RelativeTo::ChasteTestOutput);
+        TS_ASSERT(success_file.Exists());
+    }
+
+    void TestThreadsDontShareState() throw (Exception)
+    {
+        std::string dirname = "TestParallelLoops_ThreadSafety";
+        ProtocolFileFinder proto_file("projects/FunctionalCuration/test/protocols/test_parallel_nested.txt", RelativeTo::ChasteSourceRoot);
+        FileFinder cellml_file("projects/FunctionalCuration/cellml/luo_rudy_1991.cellml", RelativeTo::ChasteSourceRoot);
+        ProtocolRunner runner(cellml_file, proto_file, dirname);
+        OutputFileHandler handler(dirname, false);
+
+        // The copies of the model that threads use must share nothing mutable with it
+        boost::shared_ptr<AbstractSystemWithOutputs> p_model = runner.GetProtocol()->GetModel();
+        p_model->SetOutputFolder(boost::make_shared<OutputFileHandler>(handler));
+        boost::shared_ptr<AbstractSystemWithOutputs> p_clone = p_model->Clone();
+        TS_ASSERT_DIFFERS(p_clone, p_model);
+        AbstractCardiacCellInterface* p_cell = dynamic_cast<AbstractCardiacCellInterface*>(p_model.get());
+        AbstractCardiacCellInterface* p_clone_cell = dynamic_cast<AbstractCardiacCellInterface*>(p_clone.get());
+        TS_ASSERT(p_cell && p_clone_cell);
+        if (p_cell && p_clone_cell)
+        {
+            TS_ASSERT(!p_cell->GetSolver() || p_clone_cell->GetSolver() != p_cell->GetSolver());
+            TS_ASSERT(!p_cell->GetStimulusFunction() || p_clone_cell->GetStimulusFunction() != p_cell->GetStimulusFunction());
+        }
+        TS_ASSERT(p_model->GetOutputFolder().IsPathSet());
+        TS_ASSERT(!p_clone->GetOutputFolder().IsPathSet());
+        std::vector<double> state, clone_state;
+        TS_ASSERT(p_model->GetStateValues(state));
+        TS_ASSERT(p_clone->GetStateValues(clone_state));
+        TS_ASSERT(state == clone_state);
+
+        // Chaste's singletons may be used from many threads at once, provided they're guarded
+        const unsigned num_iterations = 2000u;
+        const unsigned num_warnings = Warnings::Instance()->GetNumWarnings();
+        SingletonsLoop loop(handler, num_iterations);
+        {
+            UseThreadsHere use_threads(4u);
+            TS_ASSERT(ThreadPool::Instance()->Run(loop, num_iterations));
+        }
+        TS_ASSERT_EQUALS(Warnings::Instance()->GetNumWarnings(), num_warnings + num_iterations);
+        for (unsigned i=0; i<num_iterations; ++i)
+        {
+            std::stringstream name;
+            name << "run_" << i;
+            TS_ASSERT_EQUALS(loop.rGetPaths()[i], handler.FindFile(name.str()).GetAbsolutePath());
+        }
+        Warnings::QuietDestroy();
+
+        // Threaded nested loops mustn't warn, or create output folders except where traced in order
+        runner.GetProtocol()->SetParalleliseLoops();
+        runner.GetProtocol()->SetNumSimulationThreads(4u);
+        runner.RunProtocol();
+        FileFinder success_file(dirname + "/success", RelativeTo::ChasteTestOutput);
+        TS_ASSERT(success_file.Exists());
+        TS_ASSERT_EQUALS(Warnings::Instance()->GetNumWarnings(), 0u);
+        TS_ASSERT(!FileFinder(dirname + "/simulation_one_level_yes1", RelativeTo::ChasteTestOutput).Exists());
+        TS_ASSERT(FileFinder(dirname + "/simulation_three_level_yes1/run_2/run_0/run_1", RelativeTo::ChasteTestOutput).Exists());
+    }
+
+    void TestGatheredResultsMatchSerial() throw (Exception)
+    {
+        // Each process contributes only the slices it ran, so check these end up in the right places
+        ProtocolFileFinder proto_file("projects/FunctionalCuration/test/protocols/test_parallel_gather.txt", RelativeTo::ChasteSourceRoot);
+        FileFinder cellml_file("projects/FunctionalCuration/cellml/luo_rudy_1991.cellml", RelativeTo::ChasteSourceRoot);
+        std::vector<std::string> output_names;
+        output_names.push_back("sweep_V");
+        output_names.push_back("grid_V");
+
+        ProtocolRunner serial_runner(cellml_file, proto_file, "TestParallelLoops_Gather_Serial");
+        serial_runner.RunProtocol();
+        const Environment& r_serial_outputs = serial_runner.GetProtocol()->rGetOutputsCollection();
+        NdArray<double> sweep = GET_ARRAY(r_serial_outputs.Lookup("sweep_V"));
+        TS_ASSERT_EQUALS(sweep.GetNumElements(), 35u);
+
+        for (unsigned balance_load=0; balance_load<2u; ++balance_load)
+        {
+            std::stringstream dirname;
+            dirname << "TestParallelLoops_Gather_" << (balance_load ? "Balanced" : "Fixed");
+            ProtocolRunner runner(cellml_file, proto_file, dirname.str());
+            runner.GetProtocol()->SetParalleliseLoops(true, balance_load);
+            runner.RunProtocol();
+            const Environment& r_outputs = runner.GetProtocol()->rGetOutputsCollection();
+            BOOST_FOREACH(const std::string& r_name, output_names)
+            {
+                NdArray<double> expected = GET_ARRAY(r_serial_outputs.Lookup(r_name));
+                NdArray<double> actual = GET_ARRAY(r_outputs.Lookup(r_name));
+                TS_ASSERT(actual.GetShape() == expected.GetShape());
+                if (actual.GetShape() == expected.GetShape())
+                {
+                    for (NdArray<double>::ConstIterator it=actual.Begin(), exp_it=expected.Begin(); it != actual.End(); ++it, ++exp_it)
+                    {
+                        TS_ASSERT_DELTA(*it, *exp_it, 1e-12);
+                    }
+                }
+            }
+        }
+    }
+
+    void TestErrorsInParallelLoops() throw (Exception)
+    {
+        // Whether an iteration fails, or every process fails before the shared loop starts, the error must
+        // reach every process without any of them waiting forever for iterations to be handed out
+        ProtocolFileFinder proto_file("projects/FunctionalCuration/test/protocols/test_parallel_errors.txt", RelativeTo::ChasteSourceRoot);
+        FileFinder cellml_file("projects/FunctionalCuration/cellml/luo_rudy_1991.cellml", RelativeTo::ChasteSourceRoot);
+        for (unsigned balance_load=0; balance_load<2u; ++balance_load)
+        {
+            for (unsigned fail_at_start=0; fail_at_start<2u; ++fail_at_start)
+            {
+                std::stringstream dirname;
+                dirname << "TestParallelLoops_Errors_" << balance_load << fail_at_start;
+                ProtocolRunner runner(cellml_file, proto_file, dirname.str());
+                runner.GetProtocol()->SetParalleliseLoops(true, balance_load);
+                runner.GetProtocol()->SetInput("fail_at_start", CONST(fail_at_start));
+                TS_ASSERT_THROWS_ANYTHING(runner.RunProtocol());
+                FileFinder success_file(dirname.str() + "/success", RelativeTo::ChasteTestOutput);
+                TS_ASSERT(!success_file.Exists());
+            }
+        }
+    }
 };
 
 #endif // TESTPARALLELLOOPS_HPP_
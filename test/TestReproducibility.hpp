@@ -151,8 +151,20 @@ public:
         }
         PetscTools::IsolateProcesses(true);
 
-        /* This utility class handles comparing virtual experiment results against stored reference data. */
+        /* This utility class handles comparing virtual experiment results against stored reference data.
+         * The historical data were produced using CVODE; if another solver is chosen we just report how
+         * accurately it reproduces them.
+         */
         HistoricalResultTester result_tester;
+        ProtocolRunner::SolverBackend solver = ProtocolRunner::CVODE;
+        if (CommandLineArguments::Instance()->OptionExists("--solver"))
+        {
+            solver = ProtocolRunner::GetSolverBackend(CommandLineArguments::Instance()->GetStringCorrespondingToOption("--solver"));
+        }
+        if (solver != ProtocolRunner::CVODE)
+        {
+            result_tester.SetReportAccuracyOnly();
+        }
 
         unsigned counter = 0u;
         BOOST_FOREACH(const std::string& r_model_name, models)
@@ -171,7 +183,7 @@ public:
                 {
                     FileFinder cellml_file("projects/FunctionalCuration/cellml/" + r_model_name + ".cellml", RelativeTo::ChasteSourceRoot);
                     ProtocolFileFinder proto_file("projects/FunctionalCuration/protocols/" + r_proto_name + ".txt", RelativeTo::ChasteSourceRoot);
-                    ProtocolRunner runner(cellml_file, proto_file, handler.GetRelativePath());
+                    ProtocolRunner runner(cellml_file, proto_file, handler.GetRelativePath(), false, false, solver);
                     std::vector<std::string> input_names {"max_paces", "max_steady_state_beats"};
                     BOOST_FOREACH(std::string input, input_names)
                     {
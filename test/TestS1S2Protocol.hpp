@@ -36,9 +36,11 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef TESTS1S2PROTOCOL_HPP_
 #define TESTS1S2PROTOCOL_HPP_
 
+#include <cmath>
 #include <string>
 #include <set>
 #include <map>
+#include <vector>
 #include <boost/assign/list_of.hpp>
 #include <boost/foreach.hpp>
 #include <cxxtest/TestSuite.h>
@@ -46,6 +48,7 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "ProtocolRunner.hpp"
 #include "ProtocolLanguage.hpp"
 #include "ProtoHelperMacros.hpp"
+#include "TimecourseSimulation.hpp"
 
 #include "FileFinder.hpp"
 #include "NumericFileComparison.hpp"
@@ -73,6 +76,34 @@ public:
         DoTest(dirname, proto_xml_file, cellml_file, 0.212);
     }
 
+    void TestParallelInTimePrerun() throw(Exception, std::bad_alloc)
+    {
+        std::vector<double> serial_state;
+        NdArray<double> serial_voltage = RunPrerun("TestS1S2ProtocolOutputs_PrerunInOrder", 1u, serial_state);
+        std::vector<double> parareal_state;
+        NdArray<double> parareal_voltage = RunPrerun("TestS1S2ProtocolOutputs_PrerunParareal", 4u, parareal_state);
+
+        // Parareal should converge to the solution found by solving in order.  The protocol gives the (fine)
+        // solver relTol=1e-7 and absTol=1e-9; global errors can be a few orders of magnitude larger.
+        const double rel_tol = 1e-7;
+        const double abs_tol = 1e-9;
+        const double factor = 1000.0;
+        TS_ASSERT(serial_voltage.GetShape() == parareal_voltage.GetShape());
+        TS_ASSERT_EQUALS(serial_voltage.GetNumElements(), 10001u);
+        NdArray<double>::ConstIterator parareal_it = parareal_voltage.Begin();
+        for (NdArray<double>::ConstIterator it = serial_voltage.Begin();
+             it != serial_voltage.End() && parareal_it != parareal_voltage.End();
+             ++it, ++parareal_it)
+        {
+            TS_ASSERT_DELTA(*parareal_it, *it, factor * (rel_tol * fabs(*it) + abs_tol));
+        }
+        TS_ASSERT_EQUALS(serial_state.size(), parareal_state.size());
+        for (unsigned i=0; i<serial_state.size() && i<parareal_state.size(); ++i)
+        {
+            TS_ASSERT_DELTA(parareal_state[i], serial_state[i], factor * (rel_tol * fabs(serial_state[i]) + abs_tol));
+        }
+    }
+
     // This model has time units in seconds, so we're checking that conversion works
     void TestNobleModel() throw(Exception, std::bad_alloc)
     {
@@ -84,6 +115,38 @@ public:
     }
 
 private:
+    /**
+     * Run the S1S2 pre-run on its own.
+     *
+     * @param rDirName  the output folder
+     * @param numSlices  how many slices to solve it in with Parareal; 1 solves it in order
+     * @param rFinalState  filled in with the model's state at the end
+     * @return  the membrane voltage trace
+     */
+    NdArray<double> RunPrerun(const std::string& rDirName, unsigned numSlices, std::vector<double>& rFinalState)
+    {
+        FileFinder cellml_file("projects/FunctionalCuration/cellml/luo_rudy_1991.cellml", RelativeTo::ChasteSourceRoot);
+        ProtocolFileFinder proto_file("projects/FunctionalCuration/test/protocols/test_parareal_prerun.txt", RelativeTo::ChasteSourceRoot);
+        ProtocolRunner runner(cellml_file, proto_file, rDirName, true);
+        runner.GetProtocol()->SetInput("prerun_slices", CONST(numSlices));
+        runner.RunProtocol();
+        FileFinder success_file(rDirName + "/success", RelativeTo::ChasteTestOutput);
+        TS_ASSERT(success_file.Exists());
+
+        // Check Parareal was used when asked for, rather than falling back to solving in order
+        boost::shared_ptr<TimecourseSimulation> p_prerun
+            = boost::dynamic_pointer_cast<TimecourseSimulation>(runner.GetProtocol()->rGetSimulations().front());
+        TS_ASSERT(p_prerun);
+        if (p_prerun)
+        {
+            TS_ASSERT_EQUALS(p_prerun->GetNumPararealSweeps() > 0u, numSlices > 1u);
+            TS_ASSERT_LESS_THAN_EQUALS(p_prerun->GetNumPararealSweeps(), numSlices);
+        }
+
+        TS_ASSERT(runner.GetProtocol()->GetModel()->GetStateValues(rFinalState));
+        return GET_ARRAY(runner.GetProtocol()->rGetOutputsCollection().Lookup("membrane_voltage"));
+    }
+
     void DoTest(const std::string& rDirName, const ProtocolFileFinder& rProtocolFile, const FileFinder& rCellmlFile,
                 double expectedSlope)
     {
@@ -0,0 +1,117 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TESTSOLVERSETTINGS_HPP_
+#define TESTSOLVERSETTINGS_HPP_
+
+#include <cxxtest/TestSuite.h>
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+#include "ProtocolRunner.hpp"
+#include "ProtoHelperMacros.hpp"
+
+#include "FileFinder.hpp"
+
+#include "FakePetscSetup.hpp"
+
+class TestSolverSettings : public CxxTest::TestSuite
+{
+    /**
+     * @return  the largest difference between two traces, relative to the first
+     * @param rTrace  the reference trace
+     * @param rOthers  the traces to compare, one after another, e.g. one per iteration of a loop
+     */
+    double MaxRelativeDifference(const NdArray<double>& rTrace, const NdArray<double>& rOthers)
+    {
+        TS_ASSERT_EQUALS(rOthers.GetNumElements() % rTrace.GetNumElements(), 0u);
+        double max_diff = 0.0;
+        NdArray<double>::ConstIterator it = rTrace.Begin();
+        for (NdArray<double>::ConstIterator other_it=rOthers.Begin(); other_it != rOthers.End(); ++other_it)
+        {
+            max_diff = std::max(max_diff, fabs(*other_it - *it) / fabs(*it));
+            if (++it == rTrace.End())
+            {
+                it = rTrace.Begin();
+            }
+        }
+        return max_diff;
+    }
+
+public:
+    void TestOverridingSolverSettings() throw (Exception)
+    {
+        std::string dirname = "TestSolverSettings";
+        FileFinder cellml_file("projects/FunctionalCuration/cellml/luo_rudy_1991.cellml", RelativeTo::ChasteSourceRoot);
+        ProtocolFileFinder proto_file("projects/FunctionalCuration/test/protocols/test_solver_settings.txt", RelativeTo::ChasteSourceRoot);
+        ProtocolRunner runner(cellml_file, proto_file, dirname);
+        const AbstractSystemWithOutputs::SolverSettings original = runner.GetProtocol()->GetModel()->GetSolverSettings();
+        runner.RunProtocol();
+        FileFinder success_file(dirname + "/success", RelativeTo::ChasteTestOutput);
+        TS_ASSERT(success_file.Exists());
+
+        const Environment& r_outputs = runner.GetProtocol()->rGetOutputsCollection();
+        NdArray<double> tight = GET_ARRAY(r_outputs.Lookup("tight"));
+        NdArray<double> loose = GET_ARRAY(r_outputs.Lookup("loose"));
+        NdArray<double> after = GET_ARRAY(r_outputs.Lookup("after"));
+        NdArray<double> overridden = GET_ARRAY(r_outputs.Lookup("overridden"));
+
+        // The model's own settings solve V = exp(t) accurately
+        double t = 0.0;
+        for (NdArray<double>::ConstIterator it=tight.Begin(); it != tight.End(); ++it, t += 1.0)
+        {
+            TS_ASSERT_DELTA(*it, exp(t), 1e-4 * exp(t));
+        }
+
+        // Loose tolerances were used where asked for, and only there
+        TS_ASSERT_LESS_THAN(1e-3, MaxRelativeDifference(tight, loose));
+        TS_ASSERT_LESS_THAN(MaxRelativeDifference(tight, after), 1e-4);
+
+        // The nested timecourse's own settings override those of the loop around it
+        TS_ASSERT_EQUALS(overridden.GetNumElements(), 2u * tight.GetNumElements());
+        TS_ASSERT_LESS_THAN(MaxRelativeDifference(tight, overridden), 1e-4);
+
+        // The model is left with its original settings
+        const AbstractSystemWithOutputs::SolverSettings final = runner.GetProtocol()->GetModel()->GetSolverSettings();
+        TS_ASSERT_EQUALS(final.relTol, original.relTol);
+        TS_ASSERT_EQUALS(final.absTol, original.absTol);
+        TS_ASSERT_EQUALS(final.maxStep, original.maxStep);
+        TS_ASSERT_EQUALS(final.maxSteps, original.maxSteps);
+    }
+};
+
+#endif // TESTSOLVERSETTINGS_HPP_
@@ -36,6 +36,7 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef TESTSTEADYPACINGPROTOCOL_HPP_
 #define TESTSTEADYPACINGPROTOCOL_HPP_
 
+#include <cmath>
 #include <string>
 #include <cxxtest/TestSuite.h>
 
@@ -63,6 +64,43 @@ public:
         runner.RunProtocol();
     }
 
+    void TestNativeSteadyState() throw (Exception)
+    {
+        FileFinder cellml_file("projects/FunctionalCuration/cellml/luo_rudy_1991.cellml", RelativeTo::ChasteSourceRoot);
+        ProtocolFileFinder nested_proto("projects/FunctionalCuration/protocols/SteadyStateRunner.txt", RelativeTo::ChasteSourceRoot);
+        ProtocolFileFinder native_proto("projects/FunctionalCuration/protocols/SteadyStateRunnerNative.txt", RelativeTo::ChasteSourceRoot);
+
+        ProtocolRunner nested_runner(cellml_file, nested_proto, "TestNativeSteadyState/nested", true);
+        nested_runner.GetProtocol()->SetInput("max_paces", CONST(100));
+        nested_runner.RunProtocol();
+        const Environment& r_nested_outputs = nested_runner.GetProtocol()->rGetOutputsCollection();
+
+        // Pacing natively should give the same results as nesting SinglePace.txt
+        ProtocolRunner native_runner(cellml_file, native_proto, "TestNativeSteadyState/native", true);
+        native_runner.GetProtocol()->SetInput("max_paces", CONST(100));
+        native_runner.RunProtocol();
+        const Environment& r_native_outputs = native_runner.GetProtocol()->rGetOutputsCollection();
+
+        const double num_paces = *GET_ARRAY(r_nested_outputs.Lookup("num_paces")).Begin();
+        TS_ASSERT_EQUALS(*GET_ARRAY(r_native_outputs.Lookup("num_paces")).Begin(), num_paces);
+        NdArray<double> nested_norms = GET_ARRAY(r_nested_outputs.Lookup("norm_of_differences"));
+        NdArray<double> native_norms = GET_ARRAY(r_native_outputs.Lookup("norm_of_differences"));
+        TS_ASSERT_EQUALS(native_norms.GetShape(), nested_norms.GetShape());
+        for (NdArray<double>::Iterator it1=nested_norms.Begin(), it2=native_norms.Begin();
+             it1 != nested_norms.End() && it2 != native_norms.End(); ++it1, ++it2)
+        {
+            TS_ASSERT_DELTA(*it2, *it1, 1e-6 * (1.0 + std::fabs(*it1)));
+        }
+
+        // Extrapolating from previous paces should need no more of them
+        ProtocolRunner accelerated_runner(cellml_file, native_proto, "TestNativeSteadyState/accelerated", true);
+        accelerated_runner.GetProtocol()->SetInput("max_paces", CONST(100));
+        accelerated_runner.GetProtocol()->SetInput("acceleration", CONST(5));
+        accelerated_runner.RunProtocol();
+        const Environment& r_accelerated_outputs = accelerated_runner.GetProtocol()->rGetOutputsCollection();
+        TS_ASSERT_LESS_THAN_EQUALS(*GET_ARRAY(r_accelerated_outputs.Lookup("num_paces")).Begin(), num_paces);
+    }
+
     void TestSteadyPacingProtocolRunning() throw(Exception, std::bad_alloc)
     {
         std::string dirname = "TestSteadyPacingProtocolOutputs";
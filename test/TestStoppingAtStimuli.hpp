@@ -0,0 +1,112 @@
+/*
+
+Copyright (c) 2005-2016, University of Oxford.
+All rights reserved.
+
+University of Oxford means the Chancellor, Masters and Scholars of the
+University of Oxford, having an administrative office at Wellington
+Square, Oxford OX1 2JD, UK.
+
+This file is part of Chaste.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ * Neither the name of the University of Oxford nor the names of its
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+#ifndef TESTSTOPPINGATSTIMULI_HPP_
+#define TESTSTOPPINGATSTIMULI_HPP_
+
+#include <cxxtest/TestSuite.h>
+
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <boost/pointer_cast.hpp>
+
+#include "ProtocolRunner.hpp"
+#include "ProtoHelperMacros.hpp"
+#include "AbstractCardiacCellInterface.hpp"
+
+#include "FileFinder.hpp"
+
+#include "FakePetscSetup.hpp"
+
+class TestStoppingAtStimuli : public CxxTest::TestSuite
+{
+    /**
+     * Pace the model for a few beats.
+     *
+     * @param rDirname  the output folder
+     * @param stopAtStimuli  whether to stop the solver at each stimulus change, or instead cap its step
+     *     size at 0.5ms as we used to
+     * @return  the membrane voltage trace
+     */
+    NdArray<double> RunPacing(const std::string& rDirname, bool stopAtStimuli)
+    {
+        FileFinder cellml_file("projects/FunctionalCuration/cellml/luo_rudy_1991.cellml", RelativeTo::ChasteSourceRoot);
+        ProtocolFileFinder proto_file("projects/FunctionalCuration/test/protocols/test_stimulus_stops.txt", RelativeTo::ChasteSourceRoot);
+        ProtocolRunner runner(cellml_file, proto_file, rDirname);
+
+        boost::shared_ptr<AbstractSystemWithOutputs> p_model = runner.GetProtocol()->GetModel();
+        TS_ASSERT(p_model->CanStopAtStimulusChanges());
+        if (!stopAtStimuli)
+        {
+            p_model->SetStopAtStimulusChanges(false);
+            TS_ASSERT(!p_model->CanStopAtStimulusChanges());
+            boost::shared_ptr<AbstractCardiacCellInterface> p_cell
+                = boost::dynamic_pointer_cast<AbstractCardiacCellInterface>(p_model);
+            TS_ASSERT(p_cell);
+            p_cell->SetTimestep(0.5);
+        }
+
+        runner.RunProtocol();
+        FileFinder success_file(rDirname + "/success", RelativeTo::ChasteTestOutput);
+        TS_ASSERT(success_file.Exists());
+        return GET_ARRAY(runner.GetProtocol()->rGetOutputsCollection().Lookup("V"));
+    }
+
+public:
+    void TestStoppingMatchesCappedStep() throw (Exception)
+    {
+        NdArray<double> stopped = RunPacing("TestStoppingAtStimuli_Stopped", true);
+        NdArray<double> capped = RunPacing("TestStoppingAtStimuli_Capped", false);
+        TS_ASSERT(stopped.GetShape() == capped.GetShape());
+        TS_ASSERT_EQUALS(stopped.GetNumElements(), 1201u);
+
+        // Each of the 3 stimuli should have fired an action potential
+        for (unsigned beat=0; beat<3u; ++beat)
+        {
+            NdArray<double>::Indices peak_time = stopped.GetIndices();
+            peak_time[0] = 10u + 400u*beat + 5u;
+            TS_ASSERT_LESS_THAN(0.0, stopped[peak_time]);
+        }
+
+        NdArray<double>::ConstIterator capped_it = capped.Begin();
+        for (NdArray<double>::ConstIterator it=stopped.Begin(); it != stopped.End(); ++it, ++capped_it)
+        {
+            TS_ASSERT_DELTA(*it, *capped_it, 1.0); // mV
+        }
+    }
+};
+
+#endif // TESTSTOPPINGATSTIMULI_HPP_